@@ -165,6 +165,26 @@ typedef struct GCDetails_ {
   Time cpu_ns;
     // The time elapsed during GC itself
   Time elapsed_ns;
+    // The total size of the nurseries after this GC
+  uint64_t nursery_bytes;
+    // The size of the largest nursery after this GC
+  uint64_t max_nursery_bytes;
+    // The time elapsed in each phase of this GC, on the thread leading it:
+    // marking the roots and the mutable lists
+  Time roots_elapsed_ns;
+    // marking the CAF list
+  Time cafs_elapsed_ns;
+    // scavenging, until all the GC threads ran out of work
+  Time scav_elapsed_ns;
+    // traversing the weak pointer list
+  Time weak_elapsed_ns;
+    // compacting or sweeping the oldest generation
+  Time sweep_elapsed_ns;
+    // freeing from-space and returning memory to the OS
+  Time free_elapsed_ns;
+    // In parallel GC, the total time the GC threads spent scavenging while
+    // waiting for work
+  Time par_idle_elapsed_ns;
 
     //
     // Concurrent garbage collector
@@ -187,6 +207,9 @@ typedef struct GCDetails_ {
 //
 // Stats about the RTS currently, and since the start of execution
 //
+// The number of buckets in RTSStats.run_queue_delay_histogram
+#define RUN_QUEUE_DELAY_BUCKETS 24
+
 typedef struct _RTSStats {
 
   // -----------------------------------
@@ -294,6 +317,15 @@ typedef struct _RTSStats {
     // The maximum time elapsed during the post-mark pause phase of the
     // concurrent nonmoving GC.
   Time nonmoving_gc_max_elapsed_ns;
+
+  // ----------------------------------
+  // Scheduler
+
+    // How long runnable threads waited on a run queue before they ran,
+    // over all capabilities.  Element 0 counts waits of less than 1us,
+    // element i > 0 waits of [2^(i-1), 2^i) us, and the last element
+    // counts all the longer waits too.
+  uint64_t run_queue_delay_histogram[RUN_QUEUE_DELAY_BUCKETS];
 } RTSStats;
 
 void getRTSStats (RTSStats *s);
@@ -74,6 +74,21 @@
  */
 #define MUT_ARR_PTRS_CARD_BITS 7
 
+/* The stable pointer table is a directory of segments, each holding
+ * STABLE_PTR_SEGMENT_SIZE entries.  See Note [Stable pointer table] in
+ * rts/StablePtr.c.
+ */
+#define STABLE_PTR_SEGMENT_BITS 10
+#define STABLE_PTR_SEGMENT_SIZE (1 << STABLE_PTR_SEGMENT_BITS)
+#define STABLE_PTR_SEGMENT_MASK (STABLE_PTR_SEGMENT_SIZE - 1)
+
+/* Likewise for the stable name table.  See Note [Stable name table] in
+ * rts/StableName.c.
+ */
+#define STABLE_NAME_SEGMENT_BITS 10
+#define STABLE_NAME_SEGMENT_SIZE (1 << STABLE_NAME_SEGMENT_BITS)
+#define STABLE_NAME_SEGMENT_MASK (STABLE_NAME_SEGMENT_SIZE - 1)
+
 /* -----------------------------------------------------------------------------
    STG Registers.
 
@@ -315,6 +330,18 @@
  */
 #define TSO_ALLOC_LIMIT 256
 
+/*
+ * Priority classes for the tso->prio field.  Each Capability runs its
+ * interactive threads ahead of its normal ones, and those ahead of its
+ * background ones; see Note [Thread priority classes] in Schedule.c.
+ *
+ * NB. keep these in sync with GHC.Conc.Sync
+ */
+#define TSO_PRIO_INTERACTIVE 0
+#define TSO_PRIO_NORMAL      1
+#define TSO_PRIO_BACKGROUND  2
+#define N_TSO_PRIOS          3
+
 /*
  * The number of times we spin in a spin lock before yielding (see
  * #3758).  To tune this value, use the benchmark in #3758: run the
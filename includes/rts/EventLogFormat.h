@@ -157,12 +157,24 @@
 #define EVENT_TICKY_COUNTER_DEF            210
 #define EVENT_TICKY_COUNTER_SAMPLE         211
 
+#define EVENT_EVENTS_DROPPED               212
+#define EVENT_CONC_MARK_WORKER             213
+#define EVENT_PINNED_FRAGMENTATION         214 /* (heap_capset, pinned_bytes, free_bytes) */
+#define EVENT_GC_PHASES                    215 /* (heap_capset, roots_ns, cafs_ns,
+                                                   scav_ns, weak_ns, sweep_ns,
+                                                   free_ns) */
+#define EVENT_GC_THREAD_TIMES              216 /* (roots_ns, scav_ns, idle_ns,
+                                                   sweep_ns) */
+#define EVENT_THREAD_PRIORITY              217 /* (thread, priority) */
+#define EVENT_THREAD_QUEUE_DELAY           218 /* (thread, priority, delay_ns) */
+#define EVENT_RUN_QUEUE_DELAYS             219 /* (n_buckets, counts...) */
+
 /*
  * The highest event code +1 that ghc itself emits. Note that some event
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        212
+#define NUM_GHC_EVENT_TAGS        220
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
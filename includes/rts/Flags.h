@@ -49,12 +49,15 @@ typedef struct _GC_FLAGS {
     uint32_t     minOldGenSize;      /* in *blocks* */
     uint32_t     heapSizeSuggestion; /* in *blocks* */
     bool heapSizeSuggestionAuto;
+    bool adaptiveNursery;       /* size the nurseries after each minor GC */
+    Time nurseryPauseTarget;    /* units: TIME_RESOLUTION */
     double  oldGenFactor;
     double  pcFreeHeap;
 
     bool         useNonmoving; // default = false
     bool         nonmovingSelectorOpt; // Do selector optimization in the
                                        // non-moving heap, default = false
+    uint32_t     nonmovingMarkThreads; // default = 1
     uint32_t     generations;
     bool squeezeUpdFrames;
 
@@ -63,6 +66,7 @@ typedef struct _GC_FLAGS {
 
     bool sweep;		/* use "mostly mark-sweep" instead of copying
                                  * for the oldest generation */
+    bool lazySweep;             /* sweep after the GC, on demand */
     bool ringBell;
 
     Time    idleGCDelayTime;    /* units: TIME_RESOLUTION */
@@ -73,6 +77,16 @@ typedef struct _GC_FLAGS {
 
     StgWord heapBase;           /* address to ask the OS for memory */
 
+    bool    returnMemoryAsync;  /* return free memory to the OS from a
+                                 * background thread */
+    StgWord returnMemoryRetain; /* units: *blocks*
+                                 * free memory kept after a major GC on top
+                                 * of what the next one is expected to need
+                                 */
+    Time    returnMemoryDecay;  /* units: TIME_RESOLUTION
+                                 * half-life of the memory the background
+                                 * thread has yet to return */
+
     StgWord allocLimitGrace;    /* units: *blocks*
                                  * After an AllocationLimitExceeded
                                  * exception has been raised, how much
@@ -89,6 +103,9 @@ typedef struct _GC_FLAGS {
 
     bool numa;                   /* Use NUMA */
     StgWord numaMask;
+
+    bool hugePages;              /* align and advise the heap for huge pages */
+    bool prefaultNursery;        /* touch the nursery when allocating it */
 } GC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -167,6 +184,12 @@ typedef struct _PROFILING_FLAGS {
 #define TRACE_EVENTLOG  1
 #define TRACE_STDERR    2
 
+/* Event classes that can be sampled, see Note [Eventlog sampling] */
+#define TRACE_SAMPLE_SCHED   0
+#define TRACE_SAMPLE_SPARK   1
+#define TRACE_SAMPLE_GC      2
+#define TRACE_SAMPLE_CLASSES 3
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _TRACE_FLAGS {
     int tracing;
@@ -179,6 +202,13 @@ typedef struct _TRACE_FLAGS {
     bool ticky;          /* trace ticky-ticky samples */
     bool user;           /* trace user events (emitted from Haskell code) */
     char *trace_output;  /* output filename for eventlog */
+    uint32_t async_buffers; /* spare buffers for the asynchronous eventlog
+                               writer, or 0 to write synchronously */
+    bool compress;       /* compress the eventlog file */
+    uint32_t sample_every[TRACE_SAMPLE_CLASSES]; /* post 1 in n events */
+    uint32_t max_rate[TRACE_SAMPLE_CLASSES];     /* max events per second
+                                                    per capability, 0 for
+                                                    no limit */
 } TRACE_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -212,9 +242,13 @@ typedef struct _CONCURRENT_FLAGS {
 /* Which I/O Manager to use in the target program.  */
 typedef enum _IO_MANAGER { IO_MNGR_NATIVE, IO_MNGR_POSIX } IO_MANAGER;
 
+/* How the non-threaded RTS waits for file descriptors (posix/Select.c).  */
+typedef enum _IO_POLLER { IO_POLLER_SELECT, IO_POLLER_EPOLL } IO_POLLER;
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _MISC_FLAGS {
     Time    tickInterval;        /* units: TIME_RESOLUTION */
+    bool tickless;               /* stop the timer while nothing needs it */
     bool install_signal_handlers;
     bool install_seh_handlers;
     bool generate_dump_file;
@@ -232,6 +266,7 @@ typedef struct _MISC_FLAGS {
                                   * for the linker, NULL ==> off */
     IO_MANAGER ioManager;        /* The I/O manager to use.  */
     uint32_t numIoWorkerThreads; /* Number of I/O worker threads to use.  */
+    IO_POLLER ioPoller;          /* How the non-threaded RTS waits for I/O. */
 } MISC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -261,6 +296,9 @@ typedef struct _PAR_FLAGS {
                                   * GC (default: use all nNodes). */
 
   bool           setAffinity;    /* force thread affinity with CPUs */
+  bool           stealThreads;   /* idle capabilities ask for threads */
+  Time           lazyHandoff;    /* how long a safe foreign call may hold
+                                  * on to its capability (0: not at all) */
 } PAR_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -175,6 +175,9 @@ extern void closeCondition        ( Condition* pCond );
 extern bool broadcastCondition    ( Condition* pCond );
 extern bool signalCondition       ( Condition* pCond );
 extern bool waitCondition         ( Condition* pCond, Mutex* pMut );
+// false if the timeout expired before the condition was signalled
+extern bool timedWaitCondition    ( Condition* pCond, Mutex* pMut,
+                                    Time timeout );
 
 //
 // Mutexes
@@ -18,15 +18,19 @@
    -------------------------------------------------------------------------- */
 
 typedef struct {
-    StgPtr  addr;        // Haskell object when entry is in use, next free
-                         // entry (NULL when this is the last free entry)
-                         // otherwise. May be NULL temporarily during GC (when
-                         // pointee dies).
+    StgPtr  addr;        // Haskell object when entry is in use, NULL
+                         // otherwise. May also be NULL when the pointee has
+                         // died but the StableName object is still alive.
 
     StgPtr  old;         // Old Haskell object, used during GC
 
     StgClosure *sn_obj;  // The StableName object, or NULL when the entry is
                          // free
+
+    uint32_t list;       // The list this entry is on, and its index in that
+    uint32_t pos;        // list. See Note [Stable name table] in
+                         // rts/StableName.c.
 } snEntry;
 
-extern DLL_IMPORT_RTS snEntry *stable_name_table;
+// A directory of segments of STABLE_NAME_SEGMENT_SIZE entries each
+extern DLL_IMPORT_RTS snEntry **stable_name_table;
@@ -26,14 +26,17 @@ typedef struct {
                          // otherwise.
 } spEntry;
 
-extern DLL_IMPORT_RTS spEntry *stable_ptr_table;
+// A directory of segments of STABLE_PTR_SEGMENT_SIZE entries each
+extern DLL_IMPORT_RTS spEntry **stable_ptr_table;
 
 EXTERN_INLINE
-StgPtr deRefStablePtr(StgStablePtr sp)
+StgPtr deRefStablePtr(StgStablePtr stable_ptr)
 {
-    // acquire load to ensure that we see the new SPT if it has been recently
-    // enlarged.
-    const spEntry *spt = ACQUIRE_LOAD(&stable_ptr_table);
+    StgWord sp = (StgWord)stable_ptr;
+    // acquire loads to ensure that we see the new directory and segment if
+    // the table has been recently enlarged.
+    spEntry **spt = ACQUIRE_LOAD(&stable_ptr_table);
+    const spEntry *seg = ACQUIRE_LOAD(&spt[sp >> STABLE_PTR_SEGMENT_BITS]);
     // acquire load to ensure that the referenced object is visible.
-    return ACQUIRE_LOAD(&spt[(StgWord)sp].addr);
+    return ACQUIRE_LOAD(&seg[sp & STABLE_PTR_SEGMENT_MASK].addr);
 }
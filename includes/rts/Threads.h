@@ -50,6 +50,8 @@ int     cmp_thread                       (StgPtr tso1, StgPtr tso2);
 long    rts_getThreadId                  (StgPtr tso);
 void    rts_enableThreadAllocationLimit  (StgPtr tso);
 void    rts_disableThreadAllocationLimit (StgPtr tso);
+void    rts_setThreadPriority            (StgPtr tso, int prio);
+int     rts_getThreadPriority            (StgPtr tso);
 
 #if !defined(mingw32_HOST_OS)
 pid_t  forkProcess     (HsStablePtr *entry);
@@ -173,6 +173,9 @@ typedef struct bdescr_ {
  * onto nonmoving_large_objects. The mark phase ignores objects which aren't
  * so-flagged */
 #define BF_NONMOVING_SWEEPING 2048
+/* A block of small pinned objects with a line map (see Note [Pinned block
+ * recycling] in Storage.c) */
+#define BF_LINES     4096
 /* Maximum flag value (do not define anything higher than this!) */
 #define BF_FLAG_MAX  (1 << 15)
 
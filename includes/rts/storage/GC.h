@@ -126,6 +126,9 @@ typedef struct generation_ {
     uint32_t collections;
     uint32_t par_collections;
     uint32_t failed_promotions;         // Currently unused
+    memcount n_pinned_blocks;           // pinned blocks with line maps,
+    memcount n_pinned_free_words;       // and their free lines; see
+                                        // Note [Pinned block recycling]
 
     // ------------------------------------
     // Fields below are used during GC only
@@ -160,6 +160,13 @@ typedef struct StgTSO_ {
      */
     StgInt64  alloc_limit;     /* in bytes */
 
+    /*
+     * When the thread last joined a run queue, for reporting how long
+     * it waited there.  Only kept up to date when we are tracing
+     * scheduler events.
+     */
+    Time      run_queue_time;
+
     /*
      * sum of the sizes of all stack chunks (in words), used to decide
      * whether to throw the StackOverflow exception when the stack
@@ -173,6 +180,15 @@ typedef struct StgTSO_ {
      */
     StgWord32  tot_stack_size;
 
+    /*
+     * The thread's priority class (TSO_PRIO_* in Constants.h), and the
+     * class of the run queue it is on, if any.  A change to prio takes
+     * effect the next time the thread joins a run queue, so run_queue_prio
+     * tells us which queue to take it off.
+     */
+    StgWord16  prio;
+    StgWord16  run_queue_prio;
+
 #if defined(TICKY_TICKY)
     /* TICKY-specific stuff would go here. */
 #endif
@@ -307,9 +323,10 @@ void dirty_STACK (Capability *cap, StgStack *stack);
 
         BlockedOnMsgThrowTo    MessageThrowTo *     TSO->blocked_exception
 
-        BlockedOnRead          NULL                 blocked_queue
-        BlockedOnWrite         NULL                 blocked_queue
-        BlockedOnDelay         NULL                 blocked_queue
+        BlockedOnRead          the fd               fd_waiters (blocked_queue
+        BlockedOnWrite         the fd               on Windows)
+        BlockedOnDelay         the target time      sleeping_heap (blocked_queue
+                                                    on Windows)
 
       tso->link == END_TSO_QUEUE, if the thread is currently running.
 
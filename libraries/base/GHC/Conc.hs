@@ -50,6 +50,11 @@ module GHC.Conc
         , threadStatus
         , threadCapability
 
+        -- * Thread priorities
+        , ThreadPriority(..)
+        , setThreadPriority
+        , threadPriority
+
         , newStablePtrPrimMVar, PrimMVar
 
         -- * Waiting
@@ -57,6 +57,11 @@ module GHC.Conc.Sync
         , threadStatus
         , threadCapability
 
+        -- * Thread priorities
+        , ThreadPriority(..)
+        , setThreadPriority
+        , threadPriority
+
         , newStablePtrPrimMVar, PrimMVar
 
         -- * Allocation counter and quota
@@ -596,6 +601,56 @@ threadCapability (ThreadId t) = IO $ \s ->
    case threadStatus# t s of
      (# s', _, cap#, locked# #) -> (# s', (I# cap#, isTrue# (locked# /=# 0#)) #)
 
+-- | The priority class of a thread.  Each capability runs its
+-- 'InteractivePriority' threads ahead of its 'NormalPriority' ones, and
+-- those ahead of its 'BackgroundPriority' ones, so a thread serving a
+-- request need not wait behind a crowd of batch threads.  The lower
+-- classes still get a share of the time, so they are never starved.
+-- Threads start in 'NormalPriority'.
+--
+-- @since 4.16.0.0
+data ThreadPriority
+  = InteractivePriority
+        -- ^run ahead of the other classes
+  | NormalPriority
+        -- ^the default
+  | BackgroundPriority
+        -- ^run when there is nothing more urgent to do
+  deriving ( Eq   -- ^ @since 4.16.0.0
+           , Ord  -- ^ @since 4.16.0.0
+           , Show -- ^ @since 4.16.0.0
+           )
+
+-- | Set the priority class of a thread.  If the thread is waiting to run
+-- when its class changes, the new class takes effect the next time it
+-- is scheduled.
+--
+-- @since 4.16.0.0
+setThreadPriority :: ThreadId -> ThreadPriority -> IO ()
+setThreadPriority (ThreadId t) prio = rts_setThreadPriority t (fromPrio prio)
+  where
+        -- NB. keep these in sync with includes/rts/Constants.h
+    fromPrio InteractivePriority = 0
+    fromPrio NormalPriority      = 1
+    fromPrio BackgroundPriority  = 2
+
+-- | Returns the priority class of a thread.
+--
+-- @since 4.16.0.0
+threadPriority :: ThreadId -> IO ThreadPriority
+threadPriority (ThreadId t) = do
+  prio <- rts_getThreadPriority t
+  return $ case prio of
+    0 -> InteractivePriority
+    2 -> BackgroundPriority
+    _ -> NormalPriority
+
+foreign import ccall unsafe "rts_setThreadPriority"
+  rts_setThreadPriority :: ThreadId# -> CInt -> IO ()
+
+foreign import ccall unsafe "rts_getThreadPriority"
+  rts_getThreadPriority :: ThreadId# -> IO CInt
+
 -- | Make a weak pointer to a 'ThreadId'.  It can be important to do
 -- this if you want to hold a reference to a 'ThreadId' while still
 -- allowing the thread to receive the @BlockedIndefinitely@ family of
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include "sm/GC.h" // for evac_fn below
+
 #if !defined(THREADED_RTS)
 /* awaitEvent(bool wait)
  *
@@ -19,3 +21,37 @@
 RTS_PRIVATE void awaitEvent(bool wait);  /* In posix/Select.c or
                                           * win32/AwaitEvent.c */
 #endif
+
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+/* Threads blocked in waitRead# or waitWrite#.
+ *
+ * These are kept in a table indexed by file descriptor rather than on
+ * a single queue; see Note [Threads blocked on file descriptors] in
+ * posix/Select.c.
+ *
+ * Called from STG :  blockOnFd only
+ * Locks assumed   :  sched_mutex
+ */
+RTS_PRIVATE void initFdWaiters           (void);
+RTS_PRIVATE void freeFdWaiters           (void);
+RTS_PRIVATE void resetFdWaitersAfterFork (void);
+RTS_PRIVATE void blockOnFd               (Capability *cap, StgTSO *tso);
+RTS_PRIVATE void removeFromFdWaiters     (Capability *cap, StgTSO *tso);
+RTS_PRIVATE bool emptyFdWaiters          (void);
+RTS_PRIVATE void markFdWaiters           (evac_fn evac, void *user);
+#endif
+
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+/* Threads blocked in delay#.
+ *
+ * See Note [Sleeping threads] in posix/Select.c.
+ *
+ * Called from STG :  addSleepingThread only
+ * Locks assumed   :  sched_mutex
+ */
+RTS_PRIVATE void addSleepingThread    (StgTSO *tso);
+RTS_PRIVATE void removeSleepingThread (StgTSO *tso);
+RTS_PRIVATE bool emptySleepingThreads (void);
+RTS_PRIVATE void markSleepingThreads  (evac_fn evac, void *user);
+RTS_PRIVATE void freeSleepingThreads  (void);
+#endif
@@ -23,6 +23,7 @@
 #include "Schedule.h"
 #include "Sparks.h"
 #include "Trace.h"
+#include "Timer.h"
 #include "eventlog/EventLog.h" // for flushLocalEventsBuf
 #include "sm/GC.h" // for gcWorkerThread()
 #include "STM.h"
@@ -91,13 +92,93 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+/* ----------------------------------------------------------------------------
+ * stealSparks: steal about half of the sparks in robbed's pool in one go,
+ * returning the oldest useful one and moving the rest into our own pool,
+ * where we (and anyone stealing from us) will find them next time. This
+ * saves idle capabilities from coming back to the same pool, and fighting
+ * over its top with the other thieves, for every single spark.
+ *
+ * Returns NULL if there was nothing useful to steal or we lost a race with
+ * another thief.
+ * ------------------------------------------------------------------------- */
+
+#define MAX_SPARKS_STOLEN 64
+
+static StgClosure *
+stealSparks (Capability *cap, Capability *robbed)
+{
+    StgClosure *stolen[MAX_SPARKS_STOLEN];
+    StgClosure *spark = NULL;
+    StgInt max, n, j;
+
+    // Only take as many as we have room for: nobody else pushes to our
+    // pool, so the pushes below can't fail.
+    max = cap->sparks->size - sparkPoolSize(cap->sparks);
+    if (max > MAX_SPARKS_STOLEN) {
+        max = MAX_SPARKS_STOLEN;
+    } else if (max < 1) {
+        max = 1;
+    }
+
+    do {
+        n = tryStealSparks(robbed->sparks, stolen, max);
+        cap->steal_stats.sparks += n;
+        for (j = 0; j < n; j++) {
+            if (fizzledSpark(stolen[j])) {
+                cap->spark_stats.fizzled++;
+                traceEventSparkFizzle(cap);
+            } else if (spark == NULL) {
+                spark = stolen[j];
+            } else {
+                pushWSDeque(cap->sparks, stolen[j]);
+            }
+        }
+        // if everything we got had fizzled, go back for more
+    } while (n > 0 && spark == NULL);
+
+    return spark;
+}
+
+/* ----------------------------------------------------------------------------
+ * Note [Choosing a victim to steal sparks from]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * An idle Capability looks for sparks to steal in two ways at once:
+ *
+ *  - It starts at a random Capability, so that the idle Capabilities
+ *    don't all queue up behind the same victim (which, if we started at
+ *    Capability 0 each time, would be Capability 0), and so that
+ *    Capabilities with low numbers don't get robbed more than the rest.
+ *
+ *  - With NUMA support on (+RTS --numa), it tries every Capability on its
+ *    own node before any Capability on another node. A spark's thunk,
+ *    and usually the data the thunk refers to, was allocated on the
+ *    victim's node; stealing across nodes means evaluating it through the
+ *    interconnect, so we only do that when there's no local work.
+ *
+ * Each Capability counts its steals in cap->steal_stats, split by whether
+ * the victim was on the same node, which +RTS -s reports.
+ * ------------------------------------------------------------------------- */
+
+STATIC_INLINE uint32_t
+stealRand (Capability *cap)
+{
+    // xorshift32
+    uint32_t x = cap->steal_rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cap->steal_rand = x;
+    return x;
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
   Capability *robbed;
   StgClosurePtr spark;
   bool retry;
-  uint32_t i = 0;
+  uint32_t i = 0, start, pass, passes;
 
   if (!emptyRunQueue(cap) || cap->n_returning_tasks != 0) {
       // If there are other threads, don't try to run any new
@@ -110,11 +191,11 @@ findSpark (Capability *cap)
       retry = false;
 
       // first try to get a spark from our own pool.
-      // We should be using reclaimSpark(), because it works without
-      // needing any atomic instructions:
-      //   spark = reclaimSpark(cap->sparks);
-      // However, measurements show that this makes at least one benchmark
-      // slower (prsa) and doesn't affect the others.
+      // We take the oldest spark, from the same end as the thieves, rather
+      // than popping the newest one from the other end: measurements show
+      // that popping makes at least one benchmark slower (prsa), and
+      // popping isn't safe while other capabilities are stealing half of
+      // our pool at a time (see Note [Stealing half of a WSDeque]).
       spark = tryStealSpark(cap->sparks);
       while (spark != NULL && fizzledSpark(spark)) {
           cap->spark_stats.fizzled++;
@@ -139,35 +220,44 @@ findSpark (Capability *cap)
                  "cap %d: Trying to steal work from other capabilities",
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
-      for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = capabilities[i];
+      /* visit all the other cap.s, starting at a random one, until a
+         theft succeeds: first those on our NUMA node, then the rest.
+         See Note [Choosing a victim to steal sparks from]. */
+      start = stealRand(cap) % n_capabilities;
+      passes = n_numa_nodes > 1 ? 2 : 1;
+      for ( pass=0 ; pass < passes ; pass++ ) {
+        for ( i=0 ; i < n_capabilities ; i++ ) {
+          robbed = capabilities[(start + i) % n_capabilities];
           if (cap == robbed)  // ourselves...
               continue;
 
+          if (passes > 1 && (robbed->node == cap->node) != (pass == 0))
+              continue;
+
           if (emptySparkPoolCap(robbed)) // nothing to steal here
               continue;
 
-          spark = tryStealSpark(robbed->sparks);
-          while (spark != NULL && fizzledSpark(spark)) {
-              cap->spark_stats.fizzled++;
-              traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
-          }
+          spark = stealSparks(cap, robbed);
           if (spark == NULL && !emptySparkPoolCap(robbed)) {
               // we conflicted with another thread while trying to steal;
               // try again later.
+              cap->steal_stats.failed++;
               retry = true;
           }
 
           if (spark != NULL) {
+              if (robbed->node == cap->node) {
+                  cap->steal_stats.local++;
+              } else {
+                  cap->steal_stats.remote++;
+              }
               cap->spark_stats.converted++;
               traceEventSparkSteal(cap, robbed->no);
 
               return spark;
           }
           // otherwise: no success, try next one
+        }
       }
   } while (retry);
 
@@ -191,6 +281,321 @@ anySparks (void)
     }
     return false;
 }
+
+/* ----------------------------------------------------------------------------
+ * Note [Stealing threads]
+ * ~~~~~~~~~~~~~~~~~~~~~~~
+ * Threads are normally shared out by schedulePushWork(): a Capability with
+ * more than one thread to run grabs any free Capabilities and gives them
+ * some of its threads.  It only does this in the scheduler loop, though,
+ * so a thread that calls forkIO a thousand times keeps all the new threads
+ * on its own Capability until it next returns to the scheduler, at the end
+ * of its time slice, while the other Capabilities sit idle.
+ *
+ * With +RTS --steal-threads, idle Capabilities ask for work instead:
+ *
+ *  - When a Capability is freed with nothing to do (releaseCapability_),
+ *    it marks itself hungry, and interrupts the Capability with the most
+ *    threads waiting in its run queue, so that the thread running there
+ *    returns to the scheduler at its next heap check and
+ *    schedulePushWork() shares out the rest.  It asks only once until it
+ *    is fed: schedulePushWork() grabs and releases hungry Capabilities
+ *    that it has no threads for, and asking again then would interrupt
+ *    the pusher over and over.
+ *
+ *  - While any Capability is hungry, scheduleThread() interrupts the
+ *    Capability it puts a new thread on in the same way, so a burst of
+ *    forkIO is shared out a thread at a time as it happens.
+ *
+ * A Capability stops being hungry when schedulePushWork() gives it threads,
+ * or when it next finds something to run.
+ *
+ * The idle Capabilities don't take the threads themselves: everything else
+ * that touches a runnable thread (throwTo, the messages that wake threads
+ * up, the GC) relies on only the Task holding its Capability doing so, and
+ * schedulePushWork() keeps that rule by holding both.  It also keeps bound
+ * threads and threads with TSO_LOCKED where they are.
+ * ------------------------------------------------------------------------- */
+
+volatile StgWord n_hungry_capabilities = 0;
+
+void
+setCapabilityHungry (Capability *cap, bool hungry)
+{
+    if (cap->hungry == hungry) return;
+    cap->hungry = hungry;
+    if (hungry) {
+        atomic_inc(&n_hungry_capabilities, 1);
+    } else {
+        atomic_dec(&n_hungry_capabilities);
+    }
+}
+
+// Mark cap hungry and interrupt the busiest Capability.  Called with
+// cap->lock held, as cap is freed.
+static void
+requestThreads (Capability *cap)
+{
+    Capability *victim = NULL;
+    uint32_t i, n, most = 0;
+
+    if (cap->hungry) return; // we have asked already
+    setCapabilityHungry(cap, true);
+
+    // Start at a random Capability so that ties don't all go the same way;
+    // see Note [Choosing a victim to steal sparks from]
+    uint32_t start = stealRand(cap) % n_capabilities;
+    for (n = 0; n < n_capabilities; n++) {
+        i = (start + n) % n_capabilities;
+        Capability *cap0 = capabilities[i];
+        if (cap0 == cap || cap0->disabled) continue;
+        // Not counting the thread it is running, if any
+        uint32_t queued = RELAXED_LOAD(&cap0->n_run_queue);
+        if (queued > most) {
+            most = queued;
+            victim = cap0;
+        }
+    }
+
+    if (victim != NULL) {
+        debugTrace(DEBUG_sched, "cap %d: asking cap %d for threads (%d queued)",
+                   cap->no, victim->no, most);
+        interruptCapability(victim);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Note [Lazy capability handoff]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A safe foreign call normally releases its Capability in suspendThread(),
+ * which may wake up a worker, and gets it back in resumeThread(), which may
+ * mean waiting for that worker to give it up again.  For a call that takes
+ * well under a microsecond this costs far more than the call itself.
+ *
+ * With +RTS --lazy-handoff=<secs>, a call that leaves nothing for the
+ * Capability to do (no threads to run, messages, sparks or returning Tasks,
+ * and no sync pending) holds on to it instead: the Task stays
+ * cap->running_task, so the Capability still looks busy, and
+ * holdCapability_() numbers the call and stores the number in
+ * cap->ccall_hold and in the Task's InCall.  Whoever clears cap->ccall_hold
+ * with cas() has the Capability:
+ *
+ *  - resumeThread(), if cap->ccall_hold still has its number; the call then
+ *    returns without taking any locks.
+ *
+ *  - Anything that wants the Capability for something else: a Task in
+ *    waitForCapability() (a call returning on another Task, a call-in, or a
+ *    Task syncing for GC), tryGrabCapability(), prodCapability(),
+ *    sendMessage() and hs_try_putmvar().  These call reclaimCapability_(),
+ *    which leaves the Capability free, just as if the call had released
+ *    it, and then carry on as they do when they find it free.
+ *
+ *  - The C-call monitor thread, which looks at every Capability each <secs>
+ *    and releases any that has been held by the same call since it last
+ *    looked.  A long call therefore holds its Capability for between one and
+ *    two periods.  The monitor goes to sleep when it has found nothing held
+ *    a few times running, and holdCapability_() wakes it up again.
+ *
+ * When resumeThread() loses the race it waits for a Capability in the usual
+ * way.  reclaimCapability_() is called with cap->lock held and
+ * waitForCapability() takes it, so by then the Capability has been freed.
+ *
+ * Calls only hold on to a Capability while sched_state is SCHED_RUNNING,
+ * and shutdownCapability() takes back any that is still held, so that
+ * hs_exit() doesn't wait for ever for a call that never gives it up.
+ *
+ * A Task in a foreign call that holds its Capability is still
+ * cap->running_task, but the Capability may be taken from it at any moment,
+ * so the Task must not use it.  Code asking whether the calling Task owns
+ * its Capability must use taskOwnsCapability() rather than looking at
+ * cap->running_task.
+ * ------------------------------------------------------------------------- */
+
+static OSThreadId ccall_monitor;
+static Mutex ccall_monitor_mutex;
+static Condition ccall_monitor_wakeup;
+static bool ccall_monitor_running = false;
+static bool ccall_monitor_stop;             // protected by ccall_monitor_mutex
+static StgWord ccall_monitor_sleeping;
+
+// How many times in a row the monitor finds nothing held before it sleeps
+#define CCALL_MONITOR_IDLE_ROUNDS 16
+
+// Hold on to cap, rather than releasing it, for a safe foreign call that
+// the Task is about to make.  Returns false if the Capability has anything
+// else to do, when it should be released as usual.  Called with cap->lock
+// held.
+bool
+holdCapability_ (Capability *cap, Task *task)
+{
+    ASSERT_LOCK_HELD(&cap->lock);
+
+    // Once we are shutting down, nobody may be left holding a Capability
+    if (RELAXED_LOAD(&sched_state) != SCHED_RUNNING ||
+        !emptyRunQueue(cap) || !emptyInbox(cap) ||
+        cap->n_returning_tasks != 0 || cap->disabled ||
+        !emptySparkPoolCap(cap) || globalWorkToDo() ||
+        SEQ_CST_LOAD(&pending_sync) != NULL) {
+        return false;
+    }
+
+    StgWord hold = ++cap->n_ccall_holds;
+    if (hold == 0) {
+        hold = ++cap->n_ccall_holds;
+    }
+    task->incall->ccall_hold = hold;
+    // Pairs with the monitor's check before it sleeps
+    SEQ_CST_STORE(&cap->ccall_hold, hold);
+    if (SEQ_CST_LOAD(&ccall_monitor_sleeping)) {
+        ACQUIRE_LOCK(&ccall_monitor_mutex);
+        signalCondition(&ccall_monitor_wakeup);
+        RELEASE_LOCK(&ccall_monitor_mutex);
+    }
+    return true;
+}
+
+// Take cap from the foreign call holding on to it, if there is one and it is
+// call number hold (or any call, if hold is 0), leaving it free.  Called
+// with cap->lock held.
+bool
+reclaimCapability_ (Capability *cap, StgWord hold)
+{
+    ASSERT_LOCK_HELD(&cap->lock);
+
+    StgWord cur = SEQ_CST_LOAD(&cap->ccall_hold);
+    if (cur == 0 || (hold != 0 && cur != hold)) {
+        return false;
+    }
+    if (cas((StgVolatilePtr)&cap->ccall_hold, cur, 0) != cur) {
+        return false; // the call has returned
+    }
+    debugTrace(DEBUG_sched, "taking capability %d from a foreign call",
+               cap->no);
+    RELAXED_STORE(&cap->running_task, NULL);
+    return true;
+}
+
+// Release the Capabilities that have been held by the same call since the
+// last look.  Returns true if any Capability was held.
+static bool
+releaseLongCCalls (Task *task)
+{
+    bool held = false;
+
+    for (uint32_t i = 0; i < n_capabilities; i++) {
+        Capability *cap = capabilities[i];
+        StgWord hold = SEQ_CST_LOAD(&cap->ccall_hold);
+
+        if (hold != 0) {
+            held = true;
+            if (hold == cap->ccall_hold_seen) {
+                ACQUIRE_LOCK(&cap->lock);
+                if (reclaimCapability_(cap, hold)) {
+                    RELAXED_STORE(&cap->running_task, task);
+                    releaseCapability_(cap, false);
+                }
+                RELEASE_LOCK(&cap->lock);
+                hold = 0;
+            }
+        }
+        cap->ccall_hold_seen = hold;
+    }
+    return held;
+}
+
+static bool
+anyCCallHolds (void)
+{
+    for (uint32_t i = 0; i < n_capabilities; i++) {
+        if (SEQ_CST_LOAD(&capabilities[i]->ccall_hold) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *
+ccallMonitor (void *arg STG_UNUSED)
+{
+    Task *task = newBoundTask();
+    uint32_t idle_rounds = 0;
+
+    ACQUIRE_LOCK(&ccall_monitor_mutex);
+    while (!ccall_monitor_stop) {
+        if (idle_rounds < CCALL_MONITOR_IDLE_ROUNDS) {
+            timedWaitCondition(&ccall_monitor_wakeup, &ccall_monitor_mutex,
+                               RtsFlags.ParFlags.lazyHandoff);
+        } else {
+            // Pairs with the check in holdCapability_()
+            SEQ_CST_STORE(&ccall_monitor_sleeping, 1);
+            if (!anyCCallHolds()) {
+                waitCondition(&ccall_monitor_wakeup, &ccall_monitor_mutex);
+            }
+            SEQ_CST_STORE(&ccall_monitor_sleeping, 0);
+            idle_rounds = 0;
+        }
+        if (ccall_monitor_stop) {
+            break;
+        }
+        RELEASE_LOCK(&ccall_monitor_mutex);
+
+        if (releaseLongCCalls(task)) {
+            idle_rounds = 0;
+        } else {
+            idle_rounds++;
+        }
+
+        ACQUIRE_LOCK(&ccall_monitor_mutex);
+    }
+    RELEASE_LOCK(&ccall_monitor_mutex);
+
+    exitMyTask();
+    return NULL;
+}
+
+void
+startCCallMonitor (void)
+{
+    if (RtsFlags.ParFlags.lazyHandoff == 0 || ccall_monitor_running) {
+        return;
+    }
+    initMutex(&ccall_monitor_mutex);
+    initCondition(&ccall_monitor_wakeup);
+    ccall_monitor_stop = false;
+    ccall_monitor_sleeping = 0;
+    for (uint32_t i = 0; i < n_capabilities; i++) {
+        capabilities[i]->ccall_hold_seen = 0;
+    }
+    if (createOSThread(&ccall_monitor, "ghc_ccallmon",
+                       ccallMonitor, NULL) != 0) {
+        barf("startCCallMonitor: can't create monitor thread");
+    }
+    ccall_monitor_running = true;
+}
+
+void
+stopCCallMonitor (void)
+{
+    if (!ccall_monitor_running) return;
+
+    ACQUIRE_LOCK(&ccall_monitor_mutex);
+    ccall_monitor_stop = true;
+    signalCondition(&ccall_monitor_wakeup);
+    RELEASE_LOCK(&ccall_monitor_mutex);
+    joinOSThread(ccall_monitor);
+    ccall_monitor_running = false;
+
+    closeMutex(&ccall_monitor_mutex);
+    closeCondition(&ccall_monitor_wakeup);
+}
+
+// In the child of a fork(): the monitor thread is gone, and
+// ccall_monitor_mutex may have been held by it.
+void
+forgetCCallMonitor (void)
+{
+    ccall_monitor_running = false;
+}
 #endif
 
 /* -----------------------------------------------------------------------------
@@ -257,9 +662,16 @@ initCapability (Capability *cap, uint32_t i)
     cap->idle              = 0;
     cap->disabled          = false;
 
-    cap->run_queue_hd      = END_TSO_QUEUE;
-    cap->run_queue_tl      = END_TSO_QUEUE;
+    for (uint32_t p = 0; p < N_TSO_PRIOS; p++) {
+        cap->run_queue_hd[p]      = END_TSO_QUEUE;
+        cap->run_queue_tl[p]      = END_TSO_QUEUE;
+        cap->run_queue_skipped[p] = 0;
+    }
     cap->n_run_queue       = 0;
+    for (uint32_t b = 0; b < RUN_QUEUE_DELAY_BUCKETS; b++) {
+        cap->run_queue_delays[b] = 0;
+    }
+    cap->run_queue_delays_posted = 0;
 
 #if defined(THREADED_RTS)
     initMutex(&cap->lock);
@@ -280,11 +692,23 @@ initCapability (Capability *cap, uint32_t i)
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    cap->steal_stats.local      = 0;
+    cap->steal_stats.remote     = 0;
+    cap->steal_stats.sparks     = 0;
+    cap->steal_stats.failed     = 0;
+    cap->steal_rand             = i + 1; // must not be zero
+    cap->hungry                 = false;
+    cap->ccall_hold             = 0;
+    cap->n_ccall_holds          = 0;
+    cap->ccall_hold_seen        = 0;
+    initBlockCache(&cap->block_cache, cap->node);
+    cap->n_stable_ptr_free      = 0;
 #if !defined(mingw32_HOST_OS)
     cap->io_manager_control_wr_fd = -1;
 #endif
 #endif
     cap->total_allocated        = 0;
+    cap->total_allocated_at_gc  = 0;
 
     cap->f.stgEagerBlackholeInfo = (W_)&__stg_EAGER_BLACKHOLE_info;
     cap->f.stgGCEnter1     = (StgFunPtr)__stg_gc_enter_1;
@@ -316,6 +740,7 @@ initCapability (Capability *cap, uint32_t i)
     cap->interrupt = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
+    cap->pinned_recycle_list = NULL;
 
 #if defined(PROFILING)
     cap->r.rCCCS = CCS_SYSTEM;
@@ -423,8 +848,10 @@ moreCapabilities (uint32_t from USED_IF_THREADS, uint32_t to USED_IF_THREADS)
     // call contextSwitchAllCapabilities, which may see the capabilities array
     // as we free it. The alternative would be to protect the capabilities
     // array with a lock but this seems more expensive than necessary.
-    // See #17289.
+    // See #17289.  The C-call monitor looks at the array too.
     stopTimer();
+    bool monitor = ccall_monitor_running;
+    stopCCallMonitor();
 
     if (to == 1) {
         // THREADED_RTS must work on builds that don't have a mutable
@@ -454,6 +881,9 @@ moreCapabilities (uint32_t from USED_IF_THREADS, uint32_t to USED_IF_THREADS)
         stgFree(old_capabilities);
     }
 
+    if (monitor) {
+        startCCallMonitor();
+    }
     startTimer();
 #endif
 }
@@ -569,7 +999,7 @@ releaseCapability_ (Capability* cap,
     // give this Capability to the appropriate Task.
     if (!emptyRunQueue(cap) && peekRunQueue(cap)->bound) {
         // Make sure we're not about to try to wake ourselves up
-        // ASSERT(task != cap->run_queue_hd->bound);
+        // ASSERT(task != peekRunQueue(cap)->bound);
         // assertion is false: in schedule() we force a yield after
         // ThreadBlocked, but the thread may be back on the run queue
         // by now.
@@ -608,6 +1038,15 @@ releaseCapability_ (Capability* cap,
 #endif
     RELAXED_STORE(&last_free_capability[cap->node], cap);
     debugTrace(DEBUG_sched, "freeing capability %d", cap->no);
+
+    // We may be going idle; see Note [Tickless timer] in Timer.c
+    wakeTimer();
+
+    // See Note [Stealing threads]
+    if (RtsFlags.ParFlags.stealThreads && !cap->disabled &&
+        RELAXED_LOAD(&sched_state) == SCHED_RUNNING) {
+        requestThreads(cap);
+    }
 }
 
 void
@@ -896,7 +1335,8 @@ void waitForCapability (Capability **pCap, Task *task)
     debugTrace(DEBUG_sched, "returning; I want capability %d", cap->no);
 
     ACQUIRE_LOCK(&cap->lock);
-    if (!cap->running_task) {
+    // See Note [Lazy capability handoff]
+    if (!cap->running_task || reclaimCapability_(cap, 0)) {
         // It's free; just grab it
         RELAXED_STORE(&cap->running_task, task);
         RELEASE_LOCK(&cap->lock);
@@ -1086,7 +1526,7 @@ void
 prodCapability (Capability *cap, Task *task)
 {
     ACQUIRE_LOCK(&cap->lock);
-    if (!cap->running_task) {
+    if (!cap->running_task || reclaimCapability_(cap, 0)) {
         cap->running_task = task;
         releaseCapability_(cap,true);
     }
@@ -1110,11 +1550,13 @@ tryGrabCapability (Capability *cap, Task *task)
     int r;
     // N.B. This is benign as we will check again after taking the lock.
     TSAN_ANNOTATE_BENIGN_RACE(&cap->running_task, "tryGrabCapability (cap->running_task)");
-    if (RELAXED_LOAD(&cap->running_task) != NULL) return false;
+    if (RELAXED_LOAD(&cap->running_task) != NULL &&
+        RELAXED_LOAD(&cap->ccall_hold) == 0) return false;
 
     r = TRY_ACQUIRE_LOCK(&cap->lock);
     if (r != 0) return false;
-    if (cap->running_task != NULL) {
+    // See Note [Lazy capability handoff]
+    if (cap->running_task != NULL && !reclaimCapability_(cap, 0)) {
         RELEASE_LOCK(&cap->lock);
         return false;
     }
@@ -1164,7 +1606,9 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
         debugTrace(DEBUG_sched,
                    "shutting down capability %d, attempt %d", cap->no, i);
         ACQUIRE_LOCK(&cap->lock);
-        if (cap->running_task) {
+        // A foreign call may still be holding on to the Capability; see
+        // Note [Lazy capability handoff]
+        if (cap->running_task && !reclaimCapability_(cap, 0)) {
             RELEASE_LOCK(&cap->lock);
             debugTrace(DEBUG_sched, "not owner, yielding");
             yieldThread();
@@ -1303,8 +1747,10 @@ markCapability (evac_fn evac, void *user, Capability *cap,
     // or fewer Capabilities as GC threads, but just in case there
     // are more, we mark every Capability whose number is the GC
     // thread's index plus a multiple of the number of GC threads.
-    evac(user, (StgClosure **)(void *)&cap->run_queue_hd);
-    evac(user, (StgClosure **)(void *)&cap->run_queue_tl);
+    for (uint32_t p = 0; p < N_TSO_PRIOS; p++) {
+        evac(user, (StgClosure **)(void *)&cap->run_queue_hd[p]);
+        evac(user, (StgClosure **)(void *)&cap->run_queue_tl[p]);
+    }
 #if defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&cap->inbox);
 #endif
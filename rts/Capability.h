@@ -24,6 +24,8 @@
 #include "Task.h"
 #include "Sparks.h"
 #include "sm/NonMovingMark.h" // for MarkQueue
+#include "sm/BlockAlloc.h" // for BlockCache
+#include "StablePtr.h" // for STABLE_PTR_CACHE_SIZE
 
 #include "BeginPrivate.h"
 
@@ -61,13 +63,24 @@ struct Capability_ {
 
     bool disabled;
 
-    // The run queue.  The Task owning this Capability has exclusive
-    // access to its run queue, so can wake up threads without
-    // taking a lock, and the common path through the scheduler is
-    // also lock-free.
-    StgTSO *run_queue_hd;
-    StgTSO *run_queue_tl;
-    uint32_t n_run_queue;
+    // The run queues, one per priority class (see Note [Thread
+    // priority classes] in Schedule.c).  The Task owning this
+    // Capability has exclusive access to its run queues, so can wake up
+    // threads without taking a lock, and the common path through the
+    // scheduler is also lock-free.
+    StgTSO *run_queue_hd[N_TSO_PRIOS];
+    StgTSO *run_queue_tl[N_TSO_PRIOS];
+    uint32_t n_run_queue;               // over all the classes
+
+    // How many times in a row each non-empty run queue has been passed
+    // over in favour of a higher class.
+    uint32_t run_queue_skipped[N_TSO_PRIOS];
+
+    // How long threads waited on the run queues before they ran, and when
+    // we last posted that to the eventlog; see Note [Run queue delays] in
+    // Schedule.c
+    StgWord64 run_queue_delays[RUN_QUEUE_DELAY_BUCKETS];
+    Time run_queue_delays_posted;
 
     // Tasks currently making safe foreign calls.  Doubly-linked.
     // When returning, a task first acquires the Capability before
@@ -93,6 +106,15 @@ struct Capability_ {
     bdescr *pinned_object_block;
     // full pinned object blocks allocated since the last GC
     bdescr *pinned_object_blocks;
+    // partly free pinned blocks handed to us by the GC for reuse; see
+    // Note [Pinned block recycling] in Storage.c
+    bdescr *pinned_recycle_list;
+
+#if defined(THREADED_RTS)
+    // free block groups for the use of this Capability's own Task; see
+    // Note [Block caches] in sm/BlockAlloc.c
+    BlockCache block_cache;
+#endif
 
     // per-capability weak pointer list associated with nursery (older
     // lists stored in generation object)
@@ -120,6 +142,9 @@ struct Capability_ {
     // Total words allocated by this cap since rts start
     // See Note [allocation accounting] in Storage.c
     uint64_t total_allocated;
+    // total_allocated at the end of the last GC, for sizing the nursery.
+    // See Note [Adaptive nursery sizing] in GC.c
+    uint64_t total_allocated_at_gc;
 
 #if defined(THREADED_RTS)
     // Worker Tasks waiting in the wings.  Singly-linked.
@@ -155,6 +180,31 @@ struct Capability_ {
 
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
+
+    // Stats on stealing sparks, and the state of the random number
+    // generator we use to pick the first Capability to steal from.
+    StealCounters steal_stats;
+    uint32_t steal_rand;
+
+    // True if this Capability went idle for want of threads to run, and
+    // nobody has given it any since.  Only changed by the Task holding the
+    // Capability.  See Note [Stealing threads] in Capability.c
+    bool hungry;
+
+    // Non-zero while a safe foreign call holds on to this Capability rather
+    // than releasing it, when it is the number of the call.  Whoever clears
+    // it with cas() has the Capability.  n_ccall_holds numbers the calls;
+    // ccall_hold_seen is ccall_hold when the C-call monitor last looked.
+    // See Note [Lazy capability handoff] in Capability.c
+    StgWord ccall_hold;
+    StgWord n_ccall_holds;
+    StgWord ccall_hold_seen;
+
+    // Free stable pointer table entries that this Capability can hand
+    // out without taking stable_ptr_mutex.
+    // See Note [Stable pointer table] in StablePtr.c
+    StgWord stable_ptr_free[STABLE_PTR_CACHE_SIZE];
+    uint32_t n_stable_ptr_free;
 #if !defined(mingw32_HOST_OS)
     // IO manager for this cap
     int io_manager_control_wr_fd;
@@ -205,8 +255,10 @@ struct Capability_ {
 // Task is bound, its thread has just blocked, and it may have been
 // moved to another Capability.
 #define ASSERT_PARTIAL_CAPABILITY_INVARIANTS(cap,task)                  \
-  ASSERT(cap->run_queue_hd == END_TSO_QUEUE ?                           \
-            cap->run_queue_tl == END_TSO_QUEUE && cap->n_run_queue == 0 \
+  ASSERT(cap->n_run_queue == 0 ?                                        \
+            cap->run_queue_hd[TSO_PRIO_INTERACTIVE] == END_TSO_QUEUE && \
+            cap->run_queue_hd[TSO_PRIO_NORMAL] == END_TSO_QUEUE &&      \
+            cap->run_queue_hd[TSO_PRIO_BACKGROUND] == END_TSO_QUEUE     \
          : 1);                                                          \
   ASSERT(cap->suspended_ccalls == NULL ? cap->n_suspended_ccalls == 0 : 1); \
   ASSERT(myTask() == task);                                             \
@@ -340,6 +392,21 @@ bool tryGrabCapability (Capability *cap, Task *task);
 //
 StgClosure *findSpark (Capability *cap);
 
+// The number of hungry Capabilities, and marking one hungry or fed, for
+// +RTS --steal-threads.  See Note [Stealing threads] in Capability.c
+//
+extern volatile StgWord n_hungry_capabilities;
+void setCapabilityHungry (Capability *cap, bool hungry);
+
+// Letting safe foreign calls hold on to their Capability, for
+// +RTS --lazy-handoff.  See Note [Lazy capability handoff] in Capability.c
+//
+bool holdCapability_    (Capability *cap, Task *task);
+bool reclaimCapability_ (Capability *cap, StgWord hold);
+void startCCallMonitor  (void);
+void stopCCallMonitor   (void);
+void forgetCCallMonitor (void);
+
 // True if any capabilities have sparks
 //
 bool anySparks (void);
@@ -495,4 +562,14 @@ INLINE_HEADER bool emptyInbox(Capability *cap)
 
 #endif
 
+// Does the Task own its Capability?  A Task in a safe foreign call does
+// not, even while the call holds on to the Capability and the Task is still
+// its running_task.  See Note [Lazy capability handoff] in Capability.c
+INLINE_HEADER bool taskOwnsCapability (Task *task)
+{
+    return task->cap != NULL &&
+           RELAXED_LOAD(&task->cap->running_task) == task &&
+           (task->incall == NULL || task->incall->suspended_tso == NULL);
+}
+
 #include "EndPrivate.h"
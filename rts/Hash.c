@@ -3,9 +3,7 @@
  * (c) The AQUA Project, Glasgow University, 1995-1998
  * (c) The GHC Team, 1999
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Open addressing hash tables; see Note [Open addressing hash tables].
  * -------------------------------------------------------------------------- */
 
 #include "PosixSource.h"
@@ -17,37 +15,83 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-                            /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD       5       /* Maximum average load of a single hash bucket */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Note [Open addressing hash tables]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * This used to be a dynamically expanding linear hash table with separate
+ * chaining (Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April
+ * 1988), where every lookup chased a list of malloc'd cells.  It is now an
+ * open addressing table in the style of Abseil's "Swiss tables":
+ *
+ *  - The (key, data) pairs live in one flat array of slots.  Alongside
+ *    them is an array of control bytes, one per slot, which is either
+ *    CTRL_EMPTY, CTRL_DELETED, or, for a slot in use, H2(hash): 7 bits of
+ *    the key's hash.
+ *
+ *  - Slots are divided into aligned groups of HGROUP.  A key is looked up
+ *    by probing the groups starting at H1(hash), quadratically.  In each
+ *    group we compare H2(hash) against all the control bytes at once (with
+ *    SSE2 where available, otherwise with bit tricks on a 64-bit word), and
+ *    only compare keys for the slots that match, which is rarely more than
+ *    one.  A probe stops at the first group that has an empty slot.
+ *
+ *  - Removing an entry sets its control byte to CTRL_EMPTY if its group
+ *    has an empty slot (no probe can have gone past this group), and to
+ *    CTRL_DELETED otherwise.  We keep at least 1/8 of the slots empty; when
+ *    an insertion would break that, we rehash into a table that is twice
+ *    as big or, if the table is mostly tombstones, the same size.
+ *
+ * The chained table allowed a key to be inserted more than once, with the
+ * newest entry shadowing the older ones until it was removed, and we
+ * preserve that: the table proper holds one entry per key (the newest), and
+ * the entries it shadows go on a list, table->shadowed.  In practice this
+ * list is almost always empty.  insertHashTable_, which takes no compare
+ * function, cannot spot duplicate keys, so its callers must not insert a
+ * key that is already present.
+ *
+ * The hash functions passed to the *HashTable_ functions return a hash of
+ * the key, not a bucket, and don't depend on the table (the table argument
+ * is only there for compatibility); build custom ones with hashWord.
+ */
+
+#if defined(__SSE2__)
+#define HGROUP      16
+#else
+#define HGROUP      8
+#endif
 
-#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
-                            /* Number of HashList cells to allocate in one go */
+#define HINIT_GROUPS 2      /* Initial number of groups in a table */
 
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+/* Slots in use have a control byte in 0x00..0x7f */
 
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+#define H1(hash)    ((hash) & 0x1ffffff)
+#define H2(hash)    ((uint8_t)((hash) >> 25))
+
+typedef struct {
     StgWord key;
     const void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
+} HashEntry;
 
-typedef struct chunklist {
-  struct chunklist *next;
-} HashListChunk;
+/* An older entry for a key that has been inserted more than once */
+typedef struct shadowedentry {
+    StgWord key;
+    const void *data;
+    struct shadowedentry *next;   /* Next older entry (for any key) */
+} ShadowedEntry;
 
 struct hashtable {
-    int split;              /* Next bucket to split when expanding */
-    int max;                /* Max bucket of smaller table */
-    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
-    int kcount;             /* Number of keys */
-    int bcount;             /* Number of buckets */
-    HashList **dir[HDIRSIZE];   /* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;      /* list of HashListChunks so we can later free them */
+    HashEntry *slots;       /* ngroups * HGROUP slots */
+    uint8_t *ctrl;          /* A control byte for each slot */
+    uint32_t gmask;         /* Number of groups - 1 (a power of 2 - 1) */
+    int kcount;             /* Number of keys, including shadowed ones */
+    int full;               /* Number of slots in use */
+    int growth_left;        /* Number of empty slots we may still fill */
+    ShadowedEntry *shadowed; /* Shadowed entries, newest first */
 };
 
 /* Create an identical structure, but is distinct on a type level,
@@ -56,47 +100,134 @@ struct hashtable {
  * any overhead post-compilation.  */
 struct strhashtable { struct hashtable table; };
 
+#define NOT_FOUND   ((uint32_t)-1)
+
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Matching control bytes a group at a time.
+ *
+ * A GroupBits has one bit set for each slot of the group that matches;
+ * iterate over them with groupBitsSlot() and groupBitsNext().
  * -------------------------------------------------------------------------- */
-int
-hashWord(const HashTable *table, StgWord key)
+
+#if defined(__SSE2__)
+
+typedef uint32_t GroupBits;     /* bit i <=> slot i */
+
+STATIC_INLINE __m128i
+loadGroup(const uint8_t *ctrl)
 {
-    int bucket;
+    return _mm_loadu_si128((const __m128i *)ctrl);
+}
 
-    /* Strip the boring zero bits */
-    key >>= sizeof(StgWord);
+STATIC_INLINE GroupBits
+matchByte(const uint8_t *ctrl, uint8_t b)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(loadGroup(ctrl), _mm_set1_epi8(b)));
+}
 
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
+/* CTRL_EMPTY and CTRL_DELETED are the only control bytes with the top bit
+ * set */
+STATIC_INLINE GroupBits
+matchFree(const uint8_t *ctrl)
+{
+    return _mm_movemask_epi8(loadGroup(ctrl));
+}
 
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = key & table->mask2;
-    }
-    return bucket;
+STATIC_INLINE GroupBits
+matchEmpty(const uint8_t *ctrl)
+{
+    return matchByte(ctrl, CTRL_EMPTY);
 }
 
-int
-hashStr(const HashTable *table, StgWord w)
+STATIC_INLINE uint32_t
+groupBitsSlot(GroupBits bits)
 {
-    const char *key = (char*) w;
-#if defined(x86_64_HOST_ARCH)
-    StgWord h = XXH64 (key, strlen(key), 1048583);
+    return __builtin_ctz(bits);
+}
+
 #else
-    StgWord h = XXH32 (key, strlen(key), 1048583);
+
+typedef uint64_t GroupBits;     /* bit 8*i+7 <=> slot i */
+
+#define LSBS 0x0101010101010101ULL
+#define MSBS 0x8080808080808080ULL
+
+STATIC_INLINE uint64_t
+loadGroup(const uint8_t *ctrl)
+{
+    uint64_t w;
+    memcpy(&w, ctrl, sizeof(w));
+#if defined(WORDS_BIGENDIAN)
+    w = __builtin_bswap64(w);
 #endif
+    return w;
+}
 
-    /* Mod the size of the hash table (a power of 2) */
-    int bucket = h & table->mask1;
+/* This may report false positives, but only for slots in use that follow a
+ * real match, and we compare the keys of matching slots anyway. */
+STATIC_INLINE GroupBits
+matchByte(const uint8_t *ctrl, uint8_t b)
+{
+    uint64_t x = loadGroup(ctrl) ^ (LSBS * b);
+    return (x - LSBS) & ~x & MSBS;
+}
 
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = h & table->mask2;
-    }
+STATIC_INLINE GroupBits
+matchFree(const uint8_t *ctrl)
+{
+    return loadGroup(ctrl) & MSBS;
+}
+
+/* Exact: CTRL_EMPTY is the only control byte with bit 7 set and bit 1 clear */
+STATIC_INLINE GroupBits
+matchEmpty(const uint8_t *ctrl)
+{
+    uint64_t w = loadGroup(ctrl);
+    return w & (~w << 6) & MSBS;
+}
+
+STATIC_INLINE uint32_t
+groupBitsSlot(GroupBits bits)
+{
+    return __builtin_ctzll(bits) >> 3;
+}
+
+#endif
+
+STATIC_INLINE GroupBits
+groupBitsNext(GroupBits bits)
+{
+    return bits & (bits - 1);
+}
+
+/* -----------------------------------------------------------------------------
+ * Hash functions.  These return a 32-bit hash of the key.
+ * -------------------------------------------------------------------------- */
+int
+hashWord(const HashTable *table STG_UNUSED, StgWord key)
+{
+    /* Multiplicative hashing spreads the low bits of the key, which are
+     * mostly zero for pointers, over the top of the word; fold those back
+     * down so that both H1 and H2 get a share. */
+#if SIZEOF_VOID_P == 8
+    StgWord h = key * 0x9e3779b97f4a7c15ULL;
+    return (int)(h ^ (h >> 32));
+#else
+    StgWord h = key * 0x9e3779b9U;
+    return (int)(h ^ (h >> 16));
+#endif
+}
 
-    return bucket;
+int
+hashStr(const HashTable *table STG_UNUSED, StgWord w)
+{
+    const char *key = (char*) w;
+#if defined(x86_64_HOST_ARCH)
+    StgWord64 h = XXH64 (key, strlen(key), 1048583);
+    return (int)(h ^ (h >> 32));
+#else
+    return (int)XXH32 (key, strlen(key), 1048583);
+#endif
 }
 
 STATIC_INLINE int
@@ -111,102 +242,134 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
-
 /* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
+ * Allocating and growing the slot arrays
  * -------------------------------------------------------------------------- */
 
-STATIC_INLINE void
-allocSegment(HashTable *table, int segment)
+STATIC_INLINE uint32_t
+capacity(const HashTable *table)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *),
-                                         "allocSegment");
+    return (table->gmask + 1) * HGROUP;
 }
 
+/* We may fill 7/8 of the slots */
+STATIC_INLINE int
+maxFull(uint32_t cap)
+{
+    return cap - cap / 8;
+}
 
-/* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
- * -------------------------------------------------------------------------- */
+static void
+allocSlots(HashTable *table, uint32_t ngroups)
+{
+    uint32_t cap = ngroups * HGROUP;
+
+    /* One allocation: the slots, then the control bytes */
+    table->slots = stgMallocBytes(cap * (sizeof(HashEntry) + 1), "allocSlots");
+    table->ctrl = (uint8_t *)(table->slots + cap);
+    memset(table->ctrl, CTRL_EMPTY, cap);
+    table->gmask = ngroups - 1;
+    table->full = 0;
+    table->growth_left = maxFull(cap);
+}
+
+/* Find a free slot for a key that isn't in the table */
+STATIC_INLINE uint32_t
+findFreeSlot(const HashTable *table, uint32_t hash)
+{
+    uint32_t g = H1(hash) & table->gmask;
+    uint32_t step = 0;
+
+    for (;;) {
+        GroupBits free = matchFree(&table->ctrl[g * HGROUP]);
+        if (free) {
+            return g * HGROUP + groupBitsSlot(free);
+        }
+        g = (g + ++step) & table->gmask;
+    }
+}
 
 STATIC_INLINE void
-expand(HashTable *table, HashFunction f)
-{
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-        /* Wow!  That's big.  Too big, so don't expand. */
-        return;
-
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
-
-    newbucket = table->max + table->split;
-
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
-
-    if (newindex == 0)
-        allocSegment(table, newsegment);
-
-    if (++table->split == table->max) {
-        table->split = 0;
-        table->max *= 2;
-        table->mask1 = table->mask2;
-        table->mask2 = table->mask2 << 1 | 1;
+fillSlot(HashTable *table, uint32_t i, uint32_t hash,
+         StgWord key, const void *data)
+{
+    if (table->ctrl[i] == CTRL_EMPTY) {
+        table->growth_left--;
     }
-    table->bcount++;
-
-    /* Split the bucket, paying no attention to the original order */
-
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-        next = hl->next;
-        if (f(table, hl->key) == newbucket) {
-            hl->next = new;
-            new = hl;
-        } else {
-            hl->next = old;
-            old = hl;
+    table->ctrl[i] = H2(hash);
+    table->slots[i].key = key;
+    table->slots[i].data = data;
+    table->full++;
+}
+
+/* Make room for at least one more entry.  If at least half of the slots we
+ * may fill hold live entries, double the table; otherwise it's full of
+ * tombstones, so just rehash it at the same size.
+ */
+static void
+rehash(HashTable *table, HashFunction f)
+{
+    HashEntry *old_slots = table->slots;
+    uint8_t *old_ctrl = table->ctrl;
+    uint32_t old_cap = capacity(table);
+    uint32_t ngroups = table->gmask + 1;
+    uint32_t i;
+
+    if (table->full >= maxFull(old_cap) / 2) {
+        ngroups *= 2;
+    }
+    allocSlots(table, ngroups);
+
+    for (i = 0; i < old_cap; i++) {
+        if (!(old_ctrl[i] & 0x80)) {
+            uint32_t hash = (uint32_t)f(table, old_slots[i].key);
+            fillSlot(table, findFreeSlot(table, hash), hash,
+                     old_slots[i].key, old_slots[i].data);
         }
     }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
+    stgFree(old_slots);
+}
+
+/* -----------------------------------------------------------------------------
+ * Looking up
+ * -------------------------------------------------------------------------- */
 
-    return;
+STATIC_INLINE uint32_t
+findSlot(const HashTable *table, uint32_t hash, StgWord key,
+         CompareFunction cmp)
+{
+    uint32_t g = H1(hash) & table->gmask;
+    uint32_t step = 0;
+
+    for (;;) {
+        const uint8_t *ctrl = &table->ctrl[g * HGROUP];
+        GroupBits bits;
+
+        for (bits = matchByte(ctrl, H2(hash)); bits;
+             bits = groupBitsNext(bits)) {
+            uint32_t i = g * HGROUP + groupBitsSlot(bits);
+            if (cmp(table->slots[i].key, key)) {
+                return i;
+            }
+        }
+        if (matchEmpty(ctrl)) {
+            return NOT_FOUND;
+        }
+        g = (g + ++step) & table->gmask;
+    }
 }
 
 STATIC_INLINE void*
 lookupHashTable_inlined(const HashTable *table, StgWord key,
                         HashFunction f, CompareFunction cmp)
 {
-    int bucket;
-    int segment;
-    int index;
-
-    HashList *hl;
-
-    bucket = f(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
+    uint32_t i = findSlot(table, (uint32_t)f(table, key), key, cmp);
 
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key))
-            return (void *) hl->data;
+    if (i == NOT_FOUND) {
+        /* It's not there */
+        return NULL;
     }
-
-    /* It's not there */
-    return NULL;
+    return (void *) table->slots[i].data;
 }
 
 void *
@@ -235,154 +398,136 @@ lookupStrHashTable(const StrHashTable* table, const char* key)
 // If the table is modified concurrently, the function behavior is undefined.
 //
 int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
-    int segment, index;
+    uint32_t i, cap = capacity(table);
     int k = 0;
-    HashList *hl;
-
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
 
-    while (segment >= 0 && k < szKeys) {
-        while (index >= 0 && k < szKeys) {
-            hl = table->dir[segment][index];
-            while (hl && k < szKeys) {
-                keys[k] = hl->key;
-                k += 1;
-                hl = hl->next;
-            }
-            index--;
+    for (i = 0; i < cap && k < szKeys; i++) {
+        if (!(table->ctrl[i] & 0x80)) {
+            keys[k++] = table->slots[i].key;
         }
-        segment--;
-        index = HSEGSIZE - 1;
+    }
+    for (ShadowedEntry *se = table->shadowed; se != NULL && k < szKeys;
+         se = se->next) {
+        keys[k++] = se->key;
     }
     return k;
 }
 
 /* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena. Eventually
- * they will all be freed when we free the HashListChunks.
+ * Inserting
  * -------------------------------------------------------------------------- */
 
-static HashList *
-allocHashList (HashTable *table)
-{
-    if (table->freeList != NULL) {
-        HashList *hl = table->freeList;
-        table->freeList = hl->next;
-        return hl;
-    } else {
-        /* We allocate one block of memory which contains:
-         *
-         *  1. A HashListChunk, which gets linked onto HashTable.chunks.
-         *     This forms a list of all chunks associated with the HashTable
-         *     and is what we will free when we free the HashTable.
-         *
-         *  2. Several HashLists. One of these will get returned. The rest are
-         *     placed on the freeList.
-         *
-         */
-        HashListChunk *cl = stgMallocBytes(sizeof(HashListChunk) + HCHUNK * sizeof(HashList), "allocHashList");
-        HashList *hl = (HashList *) &cl[1];
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        HashList *p = table->freeList;
-        for (; p < hl + HCHUNK - 1; p++)
-            p->next = p + 1;
-        p->next = NULL;
-        return hl;
-    }
-}
-
-static void
-freeHashList (HashTable *table, HashList *hl)
-{
-    // We place the HashList on the freeList. We make no attempt to bound the
-    // size of the free list for the time being. The HashLists on the freeList
-    // are freed when the HashTable itself is freed as a result of freeing the
-    // HashListChunks.
-    hl->next = table->freeList;
-    table->freeList = hl;
-}
-
 STATIC_INLINE void
 insertHashTable_inlined(HashTable *table, StgWord key,
-                        const void *data, HashFunction f)
+                        const void *data, HashFunction f, CompareFunction cmp)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    uint32_t hash = (uint32_t)f(table, key);
 
     // Disable this assert; sometimes it's useful to be able to
     // overwrite entries in the hash table.
     // ASSERT(lookupHashTable(table, key) == NULL);
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
-        expand(table, f);
-
-    bucket = f(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    hl = allocHashList(table);
+    table->kcount++;
+
+    if (cmp != NULL) {
+        uint32_t i = findSlot(table, hash, key, cmp);
+        if (i != NOT_FOUND) {
+            /* The new entry shadows the old one */
+            ShadowedEntry *se = stgMallocBytes(sizeof(ShadowedEntry),
+                                               "insertHashTable");
+            se->key = table->slots[i].key;
+            se->data = table->slots[i].data;
+            se->next = table->shadowed;
+            table->shadowed = se;
+            table->slots[i].key = key;
+            table->slots[i].data = data;
+            return;
+        }
+    }
 
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
+    if (table->growth_left == 0) {
+        rehash(table, f);
+    }
+    fillSlot(table, findFreeSlot(table, hash), hash, key, data);
 }
 
 void
 insertHashTable_(HashTable *table, StgWord key,
                  const void *data, HashFunction f)
 {
-    return insertHashTable_inlined(table, key, data, f);
+    insertHashTable_inlined(table, key, data, f, NULL);
 }
 
 void
 insertHashTable(HashTable *table, StgWord key, const void *data)
 {
-    insertHashTable_inlined(table, key, data, hashWord);
+    insertHashTable_inlined(table, key, data, hashWord, compareWord);
 }
 
 void
 insertStrHashTable(StrHashTable *table, const char * key, const void *data)
 {
-    insertHashTable_inlined(&table->table, (StgWord) key, data, hashStr);
+    insertHashTable_inlined(&table->table, (StgWord) key, data,
+                            hashStr, compareStr);
+}
+
+/* -----------------------------------------------------------------------------
+ * Removing
+ * -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+clearSlot(HashTable *table, uint32_t i)
+{
+    /* If this slot's group has an empty slot, no probe has gone past it,
+     * so this slot can be empty too. */
+    if (matchEmpty(&table->ctrl[i / HGROUP * HGROUP])) {
+        table->ctrl[i] = CTRL_EMPTY;
+        table->growth_left++;
+    } else {
+        table->ctrl[i] = CTRL_DELETED;
+    }
+    table->full--;
 }
 
 STATIC_INLINE void*
 removeHashTable_inlined(HashTable *table, StgWord key, const void *data,
                         HashFunction f, CompareFunction cmp)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = f(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key) && (data == NULL || hl->data == data)) {
-            if (prev == NULL)
-                table->dir[segment][index] = hl->next;
-            else
-                prev->next = hl->next;
-            freeHashList(table,hl);
+    uint32_t i = findSlot(table, (uint32_t)f(table, key), key, cmp);
+    ShadowedEntry *se, **prev;
+    const void *old;
+
+    if (i == NOT_FOUND) {
+        /* It's not there */
+        ASSERT(data == NULL);
+        return NULL;
+    }
+
+    if (data == NULL || table->slots[i].data == data) {
+        old = table->slots[i].data;
+        table->kcount--;
+        /* Bring back the newest entry this one shadowed, if any */
+        for (prev = &table->shadowed; (se = *prev) != NULL; prev = &se->next) {
+            if (cmp(se->key, key)) {
+                table->slots[i].key = se->key;
+                table->slots[i].data = se->data;
+                *prev = se->next;
+                stgFree(se);
+                return (void *) old;
+            }
+        }
+        clearSlot(table, i);
+        return (void *) old;
+    }
+
+    /* Only a shadowed entry can match */
+    for (prev = &table->shadowed; (se = *prev) != NULL; prev = &se->next) {
+        if (cmp(se->key, key) && se->data == data) {
+            *prev = se->next;
+            stgFree(se);
             table->kcount--;
-            return (void *) hl->data;
+            return (void *) data;
         }
-        prev = hl;
     }
 
     /* It's not there */
@@ -419,34 +564,26 @@ removeStrHashTable(StrHashTable *table, const char * key, const void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
-
-    /* Free table segments */
-    while (segment >= 0) {
-        while (index >= 0) {
-            HashList *next;
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = next) {
-                next = hl->next;
-                if (freeDataFun != NULL)
-                    (*freeDataFun)((void *) hl->data);
+    uint32_t i, cap = capacity(table);
+
+    if (freeDataFun != NULL) {
+        for (i = 0; i < cap; i++) {
+            if (!(table->ctrl[i] & 0x80)) {
+                (*freeDataFun)((void *) table->slots[i].data);
             }
-            index--;
         }
-        stgFree(table->dir[segment]);
-        segment--;
-        index = HSEGSIZE - 1;
     }
 
-    /* Free chunks */
-    HashListChunk *cl = table->chunks;
-    while (cl != NULL) {
-        HashListChunk *old = cl;
-        cl = cl->next;
-        stgFree(old);
+    ShadowedEntry *se = table->shadowed;
+    while (se != NULL) {
+        ShadowedEntry *next = se->next;
+        if (freeDataFun != NULL)
+            (*freeDataFun)((void *) se->data);
+        stgFree(se);
+        se = next;
     }
 
+    stgFree(table->slots);
     stgFree(table);
 }
 
@@ -457,88 +594,67 @@ freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 void
 mapHashTable(HashTable *table, void *data, MapHashFn fn)
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
+    uint32_t i, cap = capacity(table);
 
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, hl->key, hl->data);
-            }
-            index--;
+    for (i = 0; i < cap; i++) {
+        if (!(table->ctrl[i] & 0x80)) {
+            fn(data, table->slots[i].key, table->slots[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
+    }
+    for (ShadowedEntry *se = table->shadowed; se != NULL; se = se->next) {
+        fn(data, se->key, se->data);
     }
 }
 
 void
 mapHashTableKeys(HashTable *table, void *data, MapHashFnKeys fn)
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
+    uint32_t i, cap = capacity(table);
 
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, &hl->key, hl->data);
-            }
-            index--;
+    for (i = 0; i < cap; i++) {
+        if (!(table->ctrl[i] & 0x80)) {
+            fn(data, &table->slots[i].key, table->slots[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
+    }
+    for (ShadowedEntry *se = table->shadowed; se != NULL; se = se->next) {
+        fn(data, &se->key, se->data);
     }
 }
 
 void
 iterHashTable(HashTable *table, void *data, IterHashFn fn)
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
+    uint32_t i, cap = capacity(table);
 
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                if (!fn(data, hl->key, hl->data)) {
-                    return;
-                }
+    for (i = 0; i < cap; i++) {
+        if (!(table->ctrl[i] & 0x80)) {
+            if (!fn(data, table->slots[i].key, table->slots[i].data)) {
+                return;
             }
-            index--;
         }
-        segment--;
-        index = HSEGSIZE - 1;
+    }
+    for (ShadowedEntry *se = table->shadowed; se != NULL; se = se->next) {
+        if (!fn(data, se->key, se->data)) {
+            return;
+        }
     }
 }
 
 /* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
+ * When we initialize a hash table, we set up HINIT_GROUPS groups of empty
+ * slots.
  * -------------------------------------------------------------------------- */
 
 HashTable *
 allocHashTable(void)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
-
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-        *hb = NULL;
-
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
+    allocSlots(table, HINIT_GROUPS);
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
+    table->shadowed = NULL;
 
     return table;
 }
@@ -66,6 +66,11 @@ void *      removeStrHashTable ( StrHashTable *table, const char * key,
  * it's not guaranteed. Either way, the functions are parameters
  * as the types should be statically known and thus
  * storing them is unnecessary.
+ *
+ * A HashFunction returns a hash of the whole key (not a bucket index) and
+ * should mix its bits well; the easiest way is to finish with hashWord.
+ * insertHashTable_ can't detect duplicate keys, so the key must not already
+ * be in the table. See Note [Open addressing hash tables] in Hash.c.
  */
 typedef int HashFunction(const HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
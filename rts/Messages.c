@@ -43,7 +43,8 @@ void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
 
     recordClosureMutated(from_cap,(StgClosure*)msg);
 
-    if (to_cap->running_task == NULL) {
+    // See Note [Lazy capability handoff] in Capability.c
+    if (to_cap->running_task == NULL || reclaimCapability_(to_cap, 0)) {
         to_cap->running_task = myTask();
             // precond for releaseCapability_()
         releaseCapability_(to_cap,false);
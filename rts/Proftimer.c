@@ -73,6 +73,21 @@ initProfTimer( void )
     startHeapProfTimer();
 }
 
+// Whether we need timer ticks to take a profile; see Note [Tickless
+// timer] in Timer.c
+bool
+profTimerNeeded( void )
+{
+    bool needed = RELAXED_LOAD(&do_heap_prof_ticks);
+#if defined(PROFILING)
+    needed = needed || RELAXED_LOAD(&do_prof_ticks);
+#endif
+#if defined(TICKY_TICKY) && defined(TRACING)
+    needed = needed || RtsFlags.TraceFlags.ticky;
+#endif
+    return needed;
+}
+
 uint32_t total_ticks = 0;
 
 void
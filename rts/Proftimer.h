@@ -16,6 +16,8 @@ void handleProfTick     ( void );
 void stopHeapProfTimer  ( void );
 void startHeapProfTimer ( void );
 
+bool profTimerNeeded    ( void );
+
 extern bool performHeapProfile;
 extern bool performTickySample;
 
@@ -709,19 +709,21 @@ removeFromQueues(Capability *cap, StgTSO *tso)
   case BlockedOnWrite:
 #if defined(mingw32_HOST_OS)
   case BlockedOnDoProc:
-#endif
       removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
-#if defined(mingw32_HOST_OS)
       /* (Cooperatively) signal that the worker thread should abort
        * the request.
        */
       abandonWorkRequest(tso->block_info.async_result->reqID);
+#else
+      removeFromFdWaiters(cap, tso);
 #endif
       goto done;
 
+#if !defined(mingw32_HOST_OS)
   case BlockedOnDelay:
-        removeThreadFromQueue(cap, &sleeping_queue, tso);
+        removeSleepingThread(tso);
         goto done;
+#endif
 #endif
 
   default:
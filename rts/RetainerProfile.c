@@ -390,8 +390,11 @@ computeRetainerSet( traverseState *ts )
 
     // Consider roots from the stable ptr table.
     markStablePtrTable(retainRoot, (void*)ts);
-    // Remember old stable name addresses.
-    rememberOldStableNameAddresses ();
+    // Remember old stable name addresses.  N belongs to the last GC, so
+    // name the oldest generation explicitly.
+    stableNameLock();
+    rememberOldStableNameAddresses(RtsFlags.GcFlags.generations - 1);
+    stableNameUnlock();
 
     traverseWorkStack(ts, &retainVisitClosure);
 }
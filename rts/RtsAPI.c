@@ -720,7 +720,7 @@ PauseToken *rts_pause (void)
     // other capabilities. Doing this check is justified because rts_pause is a
     // user facing function and we want good error reporting. We also don't
     // expect rts_pause to be performance critical.
-    if (task->cap && task->cap->running_task == task)
+    if (taskOwnsCapability(task))
     {
         // This task owns a capability (and it can't be taken by other capabilities).
         errorBelch(task->cap->in_haskell
@@ -943,8 +943,9 @@ void hs_try_putmvar (/* in */ int capability,
 #else
 
     ACQUIRE_LOCK(&cap->lock);
-    // If the capability is free, we can perform the tryPutMVar immediately
-    if (cap->running_task == NULL) {
+    // If the capability is free, we can perform the tryPutMVar immediately.
+    // See Note [Lazy capability handoff] in Capability.c
+    if (cap->running_task == NULL || reclaimCapability_(cap, 0)) {
         cap->running_task = task;
         task_old_cap = task->cap;
         task->cap = cap;
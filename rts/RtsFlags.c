@@ -117,6 +117,7 @@ static bool read_heap_profiling_flag(const char *arg);
 
 #if defined(TRACING)
 static void read_trace_flags(const char *arg);
+static bool read_trace_sample_flags(const char *arg, uint32_t *values);
 #endif
 
 static void errorUsage (void) GNU_ATTRIBUTE(__noreturn__);
@@ -161,15 +162,19 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.heapLimitGrace     = (1024 * 1024);
     RtsFlags.GcFlags.heapSizeSuggestion = 0;    /* none */
     RtsFlags.GcFlags.heapSizeSuggestionAuto = false;
+    RtsFlags.GcFlags.adaptiveNursery    = false;
+    RtsFlags.GcFlags.nurseryPauseTarget = MSToTime(1);
     RtsFlags.GcFlags.pcFreeHeap         = 3;    /* 3% */
     RtsFlags.GcFlags.oldGenFactor       = 2;
     RtsFlags.GcFlags.useNonmoving       = false;
     RtsFlags.GcFlags.nonmovingSelectorOpt = false;
+    RtsFlags.GcFlags.nonmovingMarkThreads = 1;
     RtsFlags.GcFlags.generations        = 2;
     RtsFlags.GcFlags.squeezeUpdFrames   = true;
     RtsFlags.GcFlags.compact            = false;
     RtsFlags.GcFlags.compactThreshold   = 30.0;
     RtsFlags.GcFlags.sweep              = false;
+    RtsFlags.GcFlags.lazySweep          = false;
     RtsFlags.GcFlags.idleGCDelayTime    = USToTime(300000); // 300ms
     RtsFlags.GcFlags.interIdleGCWait    = 0;
 #if defined(THREADED_RTS)
@@ -178,9 +183,14 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.doIdleGC           = false;
 #endif
     RtsFlags.GcFlags.heapBase           = 0;   /* means don't care */
+    RtsFlags.GcFlags.returnMemoryAsync  = false;
+    RtsFlags.GcFlags.returnMemoryRetain = 0;
+    RtsFlags.GcFlags.returnMemoryDecay  = SecondsToTime(1);
     RtsFlags.GcFlags.allocLimitGrace    = (100*1024) / BLOCK_SIZE;
     RtsFlags.GcFlags.numa               = false;
     RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.hugePages          = false;
+    RtsFlags.GcFlags.prefaultNursery    = false;
     RtsFlags.GcFlags.ringBell           = false;
     RtsFlags.GcFlags.longGCSync         = 0; /* detection turned off */
 
@@ -237,6 +247,12 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.user          = false;
     RtsFlags.TraceFlags.ticky         = false;
     RtsFlags.TraceFlags.trace_output  = NULL;
+    RtsFlags.TraceFlags.async_buffers = 0;
+    RtsFlags.TraceFlags.compress      = false;
+    for (int i = 0; i < TRACE_SAMPLE_CLASSES; i++) {
+        RtsFlags.TraceFlags.sample_every[i] = 1;
+        RtsFlags.TraceFlags.max_rate[i]     = 0;
+    }
 #endif
 
 #if defined(PROFILING)
@@ -246,6 +262,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.tickInterval     = DEFAULT_TICK_INTERVAL;
 #endif
     RtsFlags.ConcFlags.ctxtSwitchTime   = USToTime(20000); // 20ms
+    RtsFlags.MiscFlags.tickless         = false;
 
     RtsFlags.MiscFlags.install_signal_handlers = true;
     RtsFlags.MiscFlags.install_seh_handlers    = true;
@@ -266,6 +283,11 @@ void initRtsFlagsDefaults(void)
 #else
     RtsFlags.MiscFlags.numIoWorkerThreads      = 1;
 #endif
+#if defined(HAVE_SYS_EPOLL_H)
+    RtsFlags.MiscFlags.ioPoller                = IO_POLLER_EPOLL;
+#else
+    RtsFlags.MiscFlags.ioPoller                = IO_POLLER_SELECT;
+#endif
 
 #if defined(THREADED_RTS)
     RtsFlags.ParFlags.nCapabilities     = 1;
@@ -277,6 +299,8 @@ void initRtsFlagsDefaults(void)
     RtsFlags.ParFlags.parGcNoSyncWithIdle   = 0;
     RtsFlags.ParFlags.parGcThreads      = 0; /* defaults to -N */
     RtsFlags.ParFlags.setAffinity       = 0;
+    RtsFlags.ParFlags.stealThreads      = false;
+    RtsFlags.ParFlags.lazyHandoff       = 0;
 #endif
 
 #if defined(THREADED_RTS)
@@ -307,6 +331,10 @@ usage_text[] = {
 "  --nonmoving-gc",
 "            Selects the non-moving mark-and-sweep garbage collector to",
 "            manage the oldest generation.",
+#if defined(THREADED_RTS)
+"  --nonmoving-mark-threads=<n>",
+"            Use <n> threads to mark the non-moving heap (default: 1)",
+#endif
 "  --copying-gc",
 "            Selects the copying garbage collector to manage all generations.",
 "",
@@ -323,9 +351,28 @@ usage_text[] = {
 "            the live data in that generation the last time it was collected",
 "            (default: 2.0)",
 "  -n<size>  Allocation area chunk size (0 = disabled, default: 0)",
+"  --adaptive-nursery[=<sec>]",
+"            Resize the allocation area after each minor GC, aiming for",
+"            pauses of at most <sec> (default: 0.001); -A is the minimum",
 "  -O<size>  Sets the minimum size of the old generation (default 1M)",
 "  -M<size>  Sets the maximum heap size (default unlimited)  Egs: -M256k -M1G",
 "  -H<size>  Sets the minimum heap size (default 0M)   Egs: -H24m  -H1G",
+"  --return-memory-retain=<size>",
+"            Free memory to keep after a major GC, on top of what the next",
+"            one is expected to need (default 0)",
+#if defined(THREADED_RTS)
+"  --return-memory-async",
+"            Return free memory to the OS gradually, from a background thread",
+"  --return-memory-decay=<sec>",
+"            Half-life of the memory the background thread has yet to",
+"            return (default: 1)",
+#endif
+"  --huge-pages",
+"            Align the heap for transparent huge pages, and ask the OS to",
+"            use them",
+"  --prefault-nursery",
+"            Touch the allocation area when it is allocated, rather than",
+"            taking page faults as the program first allocates into it",
 "  -xb<addr> Sets the address from which a suitable start for the heap memory",
 "            will be searched from. This is useful if the default address",
 "            clashes with some third-party library.",
@@ -338,6 +385,8 @@ usage_text[] = {
 "  -c       Use in-place compaction for all oldest generation collections",
 "           (the default is to use copying)",
 "  -w       Use mark-region for the oldest generation (experimental)",
+"  -wl      Use mark-region for the oldest generation, and sweep it after",
+"           each major GC on demand rather than during the GC",
 #if defined(THREADED_RTS)
 "  -I<sec>  Perform full GC after <sec> idle time (default: 0.3, 0 == off)",
 #endif
@@ -413,6 +462,18 @@ usage_text[] = {
 #  endif
 "               -x    disable an event class, for any flag above",
 "             the initial enabled event classes are 'sgpu'",
+#  if defined(THREADED_RTS)
+"  --eventlog-async[=<n>]",
+"             Write the eventlog from a separate thread, with <n> spare",
+"             buffers (default: 8), dropping events if it falls behind",
+#  endif
+"  --eventlog-compress",
+"             Compress the eventlog file (LZ4 frame format)",
+"  --eventlog-sample=<c><n>[,<c><n>...]",
+"             Post only one in <n> events of class <c>, where <c> is one of",
+"             s (scheduler), f (sparks, full detail) or g (GC)",
+"  --eventlog-max-rate=<c><n>[,<c><n>...]",
+"             Post at most <n> events of class <c> per second per capability",
 #endif
 
 "  -i<sec>  Time between heap profile samples (seconds, default: 0.1)",
@@ -432,6 +493,11 @@ usage_text[] = {
 #else
 "            Default: 0.01 sec.",
 #endif
+#if defined(THREADED_RTS)
+"  --tickless",
+"            Only run the timer while a CPU has threads waiting to run,",
+"            a profile is being taken, or the program may be going idle",
+#endif
 "",
 #if defined(DEBUG)
 "  -Ds  DEBUG: scheduler",
@@ -469,6 +535,12 @@ usage_text[] = {
 "  -qn<n>    Use <n> threads for parallel GC (defaults to value of -N)",
 "  -qa       Use the OS to set thread affinity (experimental)",
 "  -qm       Don't automatically migrate threads between CPUs",
+"  --steal-threads",
+"            Idle CPUs ask busy ones for threads, rather than waiting",
+"            for them to share",
+"  --lazy-handoff[=<secs>]",
+"            Let a safe foreign call keep its CPU until another thread",
+"            needs it, or for at most about 2*<secs> (default: 0.00005)",
 "  -qi<n>    If a processor has been idle for the last <n> GCs, do not",
 "            wake it up for a non-load-balancing parallel GC.",
 "            (0 disables,  default: 0)",
@@ -497,6 +569,15 @@ usage_text[] = {
 #endif
 "  --io-manager=<native|posix>",
 "            The I/O manager subsystem to use. (default: posix)",
+#if !defined(mingw32_HOST_OS)
+"  --io-poller=<select|epoll>",
+"            How the non-threaded RTS waits for file descriptors.",
+#if defined(HAVE_SYS_EPOLL_H)
+"            (default: epoll)",
+#else
+"            (default: select)",
+#endif
+#endif
 #if defined(THREADED_RTS)
 #if defined(mingw32_HOST_OS)
 "  --io-manager-threads=<num>",
@@ -971,6 +1052,73 @@ error = true;
                       OPTION_UNSAFE;
                       RtsFlags.MiscFlags.ioManager = IO_MNGR_POSIX;
                   }
+                  else if (strequal("io-poller=select",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.ioPoller = IO_POLLER_SELECT;
+                  }
+                  else if (strequal("io-poller=epoll",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+#if defined(HAVE_SYS_EPOLL_H)
+                      RtsFlags.MiscFlags.ioPoller = IO_POLLER_EPOLL;
+#else
+                      errorBelch("%s: epoll is not supported on this platform",
+                                 rts_argv[arg]);
+                      error = true;
+#endif
+                  }
+                  else if (!strncmp("eventlog-async",
+                                    &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+#if defined(TRACING) && defined(THREADED_RTS)
+                      if (rts_argv[arg][16] == '=') {
+                          int n = strtol(rts_argv[arg]+17, (char **) NULL, 10);
+                          if (n <= 0) {
+                              errorBelch("%s: the number of buffers must be "
+                                         "positive", rts_argv[arg]);
+                              error = true;
+                              break;
+                          }
+                          RtsFlags.TraceFlags.async_buffers = (uint32_t)n;
+                      } else if (rts_argv[arg][16] == '\0') {
+                          RtsFlags.TraceFlags.async_buffers = 8;
+                      } else {
+                          errorBelch("%s: unknown flag", rts_argv[arg]);
+                          error = true;
+                      }
+#else
+                      errorBelch("the flag %s requires the program to be "
+                                 "built with -threaded and -eventlog",
+                                 rts_argv[arg]);
+                      error = true;
+#endif
+                  }
+                  else if (strequal("eventlog-compress",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.compress = true;
+                      );
+                  }
+                  else if (!strncmp("eventlog-sample=",
+                                    &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          error = read_trace_sample_flags(
+                              &rts_argv[arg][18],
+                              RtsFlags.TraceFlags.sample_every);
+                      );
+                  }
+                  else if (!strncmp("eventlog-max-rate=",
+                                    &rts_argv[arg][2], 18)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          error = read_trace_sample_flags(
+                              &rts_argv[arg][20],
+                              RtsFlags.TraceFlags.max_rate);
+                      );
+                  }
                   else if (strequal("info",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
@@ -987,6 +1135,20 @@ error = true;
                       OPTION_SAFE;
                       RtsFlags.GcFlags.useNonmoving = true;
                   }
+                  else if (!strncmp("nonmoving-mark-threads=",
+                                &rts_argv[arg][2], 23)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                      int num = strtol(rts_argv[arg]+25, (char **) NULL, 10);
+                      if (num < 1) {
+                          errorBelch("%s: Expected number of threads to be at least 1.",
+                                     rts_argv[arg]);
+                          error = true;
+                          break;
+                      }
+                      RtsFlags.GcFlags.nonmovingMarkThreads = num;
+                      )
+                  }
 #if defined(THREADED_RTS)
 #if defined(mingw32_HOST_OS)
                   else if (!strncmp("io-manager-threads",
@@ -1070,6 +1232,95 @@ error = true;
                       }
                   }
 #endif
+                  else if (!strncmp("adaptive-nursery",
+                                    &rts_argv[arg][2], 16)) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][18] == '=') {
+                          double t = parseDouble(rts_argv[arg]+19, &error);
+                          if (error || t <= 0) {
+                              errorBelch("bad value for %s", rts_argv[arg]);
+                              error = true;
+                              break;
+                          }
+                          RtsFlags.GcFlags.nurseryPauseTarget =
+                              fsecondsToTime(t);
+                      } else if (rts_argv[arg][18] != '\0') {
+                          bad_option(rts_argv[arg]);
+                      }
+                      RtsFlags.GcFlags.adaptiveNursery = true;
+                  }
+                  else if (strequal("huge-pages",
+                                    &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.hugePages = true;
+                  }
+                  else if (strequal("prefault-nursery",
+                                    &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.prefaultNursery = true;
+                  }
+                  else if (!strncmp("return-memory-retain=",
+                                    &rts_argv[arg][2], 21)) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.returnMemoryRetain = (StgWord)
+                          (decodeSize(rts_argv[arg], 23, 0, HS_WORD_MAX)
+                           / BLOCK_SIZE);
+                  }
+                  else if (strequal("tickless",
+                                    &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.MiscFlags.tickless = true;
+                      )
+                  }
+                  else if (strequal("steal-threads",
+                                    &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.ParFlags.stealThreads = true;
+                      )
+                  }
+                  else if (!strncmp("lazy-handoff",
+                                    &rts_argv[arg][2], 12)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          if (rts_argv[arg][14] == '=') {
+                              double t = parseDouble(rts_argv[arg]+15, &error);
+                              if (error || t <= 0) {
+                                  errorBelch("bad value for %s", rts_argv[arg]);
+                                  error = true;
+                                  break;
+                              }
+                              RtsFlags.ParFlags.lazyHandoff =
+                                  fsecondsToTime(t);
+                          } else if (rts_argv[arg][14] == '\0') {
+                              RtsFlags.ParFlags.lazyHandoff = USToTime(50);
+                          } else {
+                              bad_option(rts_argv[arg]);
+                          }
+                      )
+                  }
+                  else if (strequal("return-memory-async",
+                                    &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.GcFlags.returnMemoryAsync = true;
+                      )
+                  }
+                  else if (!strncmp("return-memory-decay=",
+                                    &rts_argv[arg][2], 20)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          double t = parseDouble(rts_argv[arg]+22, &error);
+                          if (error || t < 0) {
+                              errorBelch("bad value for %s", rts_argv[arg]);
+                              error = true;
+                              break;
+                          }
+                          RtsFlags.GcFlags.returnMemoryDecay =
+                              fsecondsToTime(t);
+                      )
+                  }
                   else if (!strncmp("long-gc-sync=", &rts_argv[arg][2], 13)) {
                       OPTION_SAFE;
                       if (rts_argv[arg][2] == '\0') {
@@ -1127,6 +1378,10 @@ error = true;
                 OPTION_UNSAFE;
                 RtsFlags.GcFlags.sweep = true;
                 unchecked_arg_start++;
+                if (rts_argv[arg][2] == 'l') {
+                    RtsFlags.GcFlags.lazySweep = true;
+                    unchecked_arg_start++;
+                }
                 goto check_rest;
 
               case 'F':
@@ -1840,6 +2095,12 @@ static void normaliseRtsOpts (void)
         }
     }
 
+    // With -qm there is nothing to share; see Note [Stealing threads] in
+    // Capability.c
+    if (!RtsFlags.ParFlags.migrate) {
+        RtsFlags.ParFlags.stealThreads = false;
+    }
+
     // We can't generate dumps without signal handlers
     if (RtsFlags.MiscFlags.generate_dump_file) {
         RtsFlags.MiscFlags.install_seh_handlers = true;
@@ -2321,6 +2582,43 @@ static void read_trace_flags(const char *arg)
         }
     }
 }
+
+/* Parses the argument of --eventlog-sample and --eventlog-max-rate: a
+ * comma-separated list of an event class letter (as for -l) followed by a
+ * number, such as "s100,g10". Returns true on error.
+ */
+static bool read_trace_sample_flags(const char *arg, uint32_t *values)
+{
+    const char *c = arg;
+
+    do {
+        int cls;
+        switch (*c) {
+        case 's': cls = TRACE_SAMPLE_SCHED; break;
+        case 'f': cls = TRACE_SAMPLE_SPARK; break;
+        case 'g': cls = TRACE_SAMPLE_GC;    break;
+        default:
+            errorBelch("unknown event class for sampling: '%c' "
+                       "(expected one of s, f, g)", *c);
+            return true;
+        }
+
+        char *end;
+        long n = strtol(c + 1, &end, 10);
+        if (end == c + 1 || n < 1 || n > UINT32_MAX) {
+            errorBelch("bad number in sampling option: %s", c);
+            return true;
+        }
+        values[cls] = (uint32_t)n;
+        c = end;
+    } while (*c++ == ',');
+
+    if (c[-1] != '\0') {
+        errorBelch("bad sampling option: %s", arg);
+        return true;
+    }
+    return false;
+}
 #endif
 
 static void GNU_ATTRIBUTE(__noreturn__)
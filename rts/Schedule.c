@@ -28,6 +28,7 @@
 #include "Weak.h"
 #include "sm/GC.h" // waitForGcThreads, releaseGCThreads, N
 #include "sm/GCThread.h"
+#include "sm/BlockAlloc.h" // forgetMemoryReturner
 #include "Sparks.h"
 #include "Capability.h"
 #include "Task.h"
@@ -74,7 +75,6 @@
 // Blocked/sleeping threads
 StgTSO *blocked_queue_hd = NULL;
 StgTSO *blocked_queue_tl = NULL;
-StgTSO *sleeping_queue = NULL;    // perhaps replace with a hash table?
 #endif
 
 // Bytes allocated since the last time a HeapOverflow exception was thrown by
@@ -88,6 +88,11 @@ uint64_t allocated_bytes_at_heapoverflow = 0;
  */
 bool heap_overflow = false;
 
+/* Whether to measure how long threads wait on the run queues.
+ * See Note [Run queue delays].
+ */
+bool time_run_queue = false;
+
 /* flag that tracks whether we have done any execution in this time slice.
  * LOCK: currently none, perhaps we should lock (but needs to be
  * updated in the fast path of the scheduler).
@@ -156,6 +161,7 @@ static void schedulePushWork(Capability *cap, Task *task);
 #if defined(THREADED_RTS)
 static void scheduleActivateSpark(Capability *cap);
 #endif
+static void recordRunQueueDelay(Capability *cap, StgTSO *tso);
 static void schedulePostRunThread(Capability *cap, StgTSO *t);
 static bool scheduleHandleHeapOverflow( Capability *cap, StgTSO *t );
 static bool scheduleHandleYield( Capability *cap, StgTSO *t,
@@ -314,6 +320,9 @@ schedule (Capability *initialCapability, Task *task)
     scheduleYield(&cap,task);
 
     if (emptyRunQueue(cap)) continue; // look for work again
+
+    // See Note [Stealing threads] in Capability.c
+    setCapabilityHungry(cap, false);
 #endif
 
 #if !defined(THREADED_RTS)
@@ -437,6 +446,14 @@ run_thread:
     cap->in_haskell = true;
     RELAXED_STORE(&cap->idle, false);
 
+#if defined(THREADED_RTS)
+    // Others are waiting, so t will need preempting; see Note [Tickless
+    // timer] in Timer.c
+    if (!emptyRunQueue(cap)) {
+        wakeTimer();
+    }
+#endif
+
     dirty_TSO(cap,t);
     dirty_STACK(cap,t->stackobj);
 
@@ -465,6 +482,9 @@ run_thread:
     }
 
     traceEventRunThread(cap, t);
+    if (RTS_UNLIKELY(time_run_queue)) {
+        recordRunQueueDelay(cap, t);
+    }
 
     switch (prev_what_next) {
 
@@ -584,18 +604,103 @@ run_thread:
  * Run queue operations
  * -------------------------------------------------------------------------- */
 
+/* Note [Thread priority classes]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A Capability with one run queue gives every runnable thread the same
+ * share of the CPU, so a thread serving a request can wait behind
+ * hundreds of batch threads for several time slices.  Instead, each
+ * thread has a priority class in tso->prio (see TSO_PRIO_* in
+ * Constants.h), set with GHC.Conc.setThreadPriority, and each
+ * Capability has a FIFO run queue per class.  popRunQueue() takes the
+ * next thread from the highest class with threads in it.
+ *
+ * Strict priority would let a steady stream of interactive threads
+ * starve everything else, so cap->run_queue_skipped counts how many
+ * times in a row we have passed over each non-empty queue.  Once that
+ * reaches RUN_QUEUE_MAX_SKIP the queue gets the next turn, so the thread
+ * at the head of any queue runs within RUN_QUEUE_MAX_SKIP+1 turns, and
+ * under full load the background class still gets about one time slice
+ * in nine.
+ *
+ * The class is only read when a thread joins a run queue: a thread
+ * changing another thread's class can't safely move it between another
+ * Capability's queues, so the change takes effect the next time the
+ * thread is scheduled.  tso->run_queue_prio records which queue the
+ * thread is actually on, for removeFromRunQueue().
+ *
+ * New threads start in the normal class.  schedulePushWork() shares out
+ * the higher classes first, and the new queue keeps each thread's class.
+ *
+ * When tracing scheduler events we post EVENT_THREAD_QUEUE_DELAY with
+ * the time each thread waited when it next runs (see Note [Run queue
+ * delays]); EVENT_THREAD_PRIORITY records changes of class.
+ */
+
+/* Note [Run queue delays]
+ * ~~~~~~~~~~~~~~~~~~~~~~~
+ * To tell a thread that is slow to respond because there is too little
+ * CPU from one that is held up by GC pauses, we measure how long threads
+ * wait on the run queues.  If stats are enabled (+RTS -T) or we are
+ * tracing scheduler events, appendToRunQueue() and pushOnRunQueue() stamp
+ * each thread with the time, and when the thread runs recordRunQueueDelay()
+ * adds the wait to a histogram in its Capability.  The buckets are powers
+ * of two in microseconds, from under 1us up to RUN_QUEUE_DELAY_BUCKETS-1,
+ * which also counts anything longer.  A GC that happens while a thread
+ * waits is part of its wait: that is the latency the thread saw.
+ *
+ * Only the Task owning a Capability updates its histogram.
+ * getRTSStats() sums them without locking, so it may miss the updates
+ * made while it reads them.
+ *
+ * The wait is measured from when the thread last joined a run queue.
+ * schedulePushWork() keeps the stamp when it migrates a thread, so the
+ * wait includes the time on the old Capability.
+ *
+ * When tracing, each Capability also posts its histogram so far as
+ * EVENT_RUN_QUEUE_DELAYS, at most every RUN_QUEUE_DELAYS_INTERVAL when
+ * it runs a thread.  An idle Capability posts nothing, but it has
+ * nothing new to report either.
+ */
+
+#define RUN_QUEUE_DELAYS_INTERVAL MSToTime(100)
+
+static void
+recordRunQueueDelay (Capability *cap, StgTSO *tso)
+{
+    Time now = getProcessElapsedTime();
+    Time delay = stg_max(now - tso->run_queue_time, 0);
+    StgWord64 us = TimeToUS(delay);
+    uint32_t b = 0;
+
+    while (us != 0 && b < RUN_QUEUE_DELAY_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    RELAXED_STORE(&cap->run_queue_delays[b], cap->run_queue_delays[b] + 1);
+
+    traceEventThreadQueueDelay(cap, tso, delay);
+#if defined(TRACING)
+    if (RTS_UNLIKELY(TRACE_sched) &&
+        now - cap->run_queue_delays_posted >= RUN_QUEUE_DELAYS_INTERVAL) {
+        traceEventRunQueueDelays(cap, cap->run_queue_delays);
+        cap->run_queue_delays_posted = now;
+    }
+#endif
+}
+
 static void
 removeFromRunQueue (Capability *cap, StgTSO *tso)
 {
+    uint32_t p = tso->run_queue_prio;
     if (tso->block_info.prev == END_TSO_QUEUE) {
-        ASSERT(cap->run_queue_hd == tso);
-        cap->run_queue_hd = tso->_link;
+        ASSERT(cap->run_queue_hd[p] == tso);
+        cap->run_queue_hd[p] = tso->_link;
     } else {
         setTSOLink(cap, tso->block_info.prev, tso->_link);
     }
     if (tso->_link == END_TSO_QUEUE) {
-        ASSERT(cap->run_queue_tl == tso);
-        cap->run_queue_tl = tso->block_info.prev;
+        ASSERT(cap->run_queue_tl[p] == tso);
+        cap->run_queue_tl[p] = tso->block_info.prev;
     } else {
         setTSOPrev(cap, tso->_link, tso->block_info.prev);
     }
@@ -798,61 +903,70 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
         // The number of threads we have left.
         uint32_t n = cap->n_run_queue;
 
-        // prev = the previous thread on this cap's run queue
-        prev = END_TSO_QUEUE;
-
-        // We're going to walk through the run queue, migrating threads to other
-        // capabilities until we have only keep_threads left.  We might
-        // encounter a thread that cannot be migrated, in which case we add it
-        // to the current run queue and decrement keep_threads.
-        for (t = cap->run_queue_hd, i = 0;
-             t != END_TSO_QUEUE && n > keep_threads;
-             t = next)
-        {
-            next = t->_link;
-            t->_link = END_TSO_QUEUE;
-
-            // Should we keep this thread?
-            if (t->bound == task->incall // don't move my bound thread
-                || tsoLocked(t) // don't move a locked thread
-                ) {
-                if (prev == END_TSO_QUEUE) {
-                    cap->run_queue_hd = t;
-                } else {
-                    setTSOLink(cap, prev, t);
+        // We're going to walk through the run queues, highest priority
+        // class first (see Note [Thread priority classes]), migrating
+        // threads to other capabilities until we have only keep_threads
+        // left.  We might encounter a thread that cannot be migrated, in
+        // which case we add it to the current run queue and decrement
+        // keep_threads.
+        i = 0;
+        for (uint32_t p = 0; p < N_TSO_PRIOS && n > keep_threads; p++) {
+
+            // prev = the previous thread on this cap's run queue
+            prev = END_TSO_QUEUE;
+
+            for (t = cap->run_queue_hd[p];
+                 t != END_TSO_QUEUE && n > keep_threads;
+                 t = next)
+            {
+                next = t->_link;
+                t->_link = END_TSO_QUEUE;
+
+                // Should we keep this thread?
+                if (t->bound == task->incall // don't move my bound thread
+                    || tsoLocked(t) // don't move a locked thread
+                    ) {
+                    if (prev == END_TSO_QUEUE) {
+                        cap->run_queue_hd[p] = t;
+                    } else {
+                        setTSOLink(cap, prev, t);
+                    }
+                    setTSOPrev(cap, t, prev);
+                    prev = t;
+                    if (keep_threads > 0) keep_threads--;
                 }
-                setTSOPrev(cap, t, prev);
-                prev = t;
-                if (keep_threads > 0) keep_threads--;
-            }
-
-            // Or migrate it?
-            else {
-                appendToRunQueue(free_caps[i],t);
-                traceEventMigrateThread (cap, t, free_caps[i]->no);
 
-                // See Note [Benign data race due to work-pushing].
-                if (t->bound) {
-                    t->bound->task->cap = free_caps[i];
+                // Or migrate it?
+                else {
+                    // See Note [Run queue delays]
+                    Time queued = t->run_queue_time;
+                    appendToRunQueue(free_caps[i],t);
+                    t->run_queue_time = queued;
+                    traceEventMigrateThread (cap, t, free_caps[i]->no);
+
+                    // See Note [Benign data race due to work-pushing].
+                    if (t->bound) {
+                        t->bound->task->cap = free_caps[i];
+                    }
+                    t->cap = free_caps[i];
+                    n--; // we have one fewer threads now
+                    i++; // move on to the next free_cap
+                    if (i == n_free_caps) i = 0;
                 }
-                t->cap = free_caps[i];
-                n--; // we have one fewer threads now
-                i++; // move on to the next free_cap
-                if (i == n_free_caps) i = 0;
             }
-        }
 
-        // Join up the beginning of the queue (prev)
-        // with the rest of the queue (t)
-        if (t == END_TSO_QUEUE) {
-            cap->run_queue_tl = prev;
-        } else {
-            setTSOPrev(cap, t, prev);
-        }
-        if (prev == END_TSO_QUEUE) {
-            cap->run_queue_hd = t;
-        } else {
-            setTSOLink(cap, prev, t);
+            // Join up the beginning of the queue (prev)
+            // with the rest of the queue (t)
+            if (t == END_TSO_QUEUE) {
+                cap->run_queue_tl[p] = prev;
+            } else {
+                setTSOPrev(cap, t, prev);
+            }
+            if (prev == END_TSO_QUEUE) {
+                cap->run_queue_hd[p] = t;
+            } else {
+                setTSOLink(cap, prev, t);
+            }
         }
         cap->n_run_queue = n;
 
@@ -861,6 +975,10 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
         // release the capabilities
         for (i = 0; i < n_free_caps; i++) {
             task->cap = free_caps[i];
+            if (!emptyRunQueue(free_caps[i])) {
+                // See Note [Stealing threads] in Capability.c
+                setCapabilityHungry(free_caps[i], false);
+            }
             if (sparkPoolSizeCap(cap) > 0) {
                 // If we have sparks to steal, wake up a worker on the
                 // capability, even if it has no threads to run.
@@ -909,7 +1027,7 @@ scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( !EMPTY_BLOCKED_QUEUE() || !EMPTY_SLEEPING_QUEUE() )
     {
         awaitEvent (emptyRunQueue(cap));
     }
@@ -2054,7 +2172,7 @@ forkProcess(HsStablePtr *entry
     ACQUIRE_LOCK(&sched_mutex);
     ACQUIRE_LOCK(&sm_mutex);
     ACQUIRE_LOCK(&stable_ptr_mutex);
-    ACQUIRE_LOCK(&stable_name_mutex);
+    stableNameLock();
 
     for (i=0; i < n_capabilities; i++) {
         ACQUIRE_LOCK(&capabilities[i]->lock);
@@ -2082,7 +2200,7 @@ forkProcess(HsStablePtr *entry
         RELEASE_LOCK(&sched_mutex);
         RELEASE_LOCK(&sm_mutex);
         RELEASE_LOCK(&stable_ptr_mutex);
-        RELEASE_LOCK(&stable_name_mutex);
+        stableNameUnlock();
         RELEASE_LOCK(&task->lock);
 
 #if defined(THREADED_RTS)
@@ -2110,7 +2228,7 @@ forkProcess(HsStablePtr *entry
         initMutex(&sched_mutex);
         initMutex(&sm_mutex);
         initMutex(&stable_ptr_mutex);
-        initMutex(&stable_name_mutex);
+        initStableNameLocks();
         initMutex(&task->lock);
 
         for (i=0; i < n_capabilities; i++) {
@@ -2118,6 +2236,8 @@ forkProcess(HsStablePtr *entry
         }
 
         initMutex(&all_tasks_mutex);
+
+        forgetMemoryReturner();
 #endif
 
 #if defined(TRACING)
@@ -2191,11 +2311,22 @@ forkProcess(HsStablePtr *entry
             generations[g].threads = END_TSO_QUEUE;
         }
 
+#if !defined(THREADED_RTS)
+        // Stop sharing the parent's epoll instance, if we have one.
+        resetFdWaitersAfterFork();
+#endif
+
         // On Unix, all timers are reset in the child, so we need to start
         // the timer again.
         initTimer();
         startTimer();
 
+#if defined(THREADED_RTS)
+        // The C-call monitor thread is gone too
+        forgetCCallMonitor();
+        startCCallMonitor();
+#endif
+
         // TODO: need to trace various other things in the child
         // like startup event, capabilities, process info etc
         traceTaskCreate(task, cap);
@@ -2302,6 +2433,7 @@ setNumCapabilities (uint32_t new_n_capabilities USED_IF_THREADS)
         //
         for (n = new_n_capabilities; n < enabled_capabilities; n++) {
             capabilities[n]->disabled = true;
+            setCapabilityHungry(capabilities[n], false);
             traceCapDisable(capabilities[n]);
         }
         enabled_capabilities = new_n_capabilities;
@@ -2390,8 +2522,8 @@ deleteAllThreads ()
     // being GC'd, and we don't want the "main thread has been GC'd" panic.
 
 #if !defined(THREADED_RTS)
-    ASSERT(blocked_queue_hd == END_TSO_QUEUE);
-    ASSERT(sleeping_queue == END_TSO_QUEUE);
+    ASSERT(EMPTY_BLOCKED_QUEUE());
+    ASSERT(EMPTY_SLEEPING_QUEUE());
 #endif
 }
 
@@ -2501,7 +2633,13 @@ suspendThread (StgRegTable *reg, bool interruptible)
 
   suspendTask(cap,task);
   cap->in_haskell = false;
-  releaseCapability_(cap,false);
+#if defined(THREADED_RTS)
+  // See Note [Lazy capability handoff] in Capability.c
+  if (RtsFlags.ParFlags.lazyHandoff == 0 || !holdCapability_(cap,task))
+#endif
+  {
+      releaseCapability_(cap,false);
+  }
 
   RELEASE_LOCK(&cap->lock);
 
@@ -2533,8 +2671,20 @@ resumeThread (void *task_)
     cap = incall->suspended_cap;
     task->cap = cap;
 
-    // Wait for permission to re-enter the RTS with the result.
-    waitForCapability(&cap,task);
+#if defined(THREADED_RTS)
+    // If the call held on to the Capability and nobody has taken it, we
+    // still have it.  See Note [Lazy capability handoff] in Capability.c
+    StgWord hold = incall->ccall_hold;
+    incall->ccall_hold = 0;
+    if (hold != 0 &&
+        cas((StgVolatilePtr)&cap->ccall_hold, hold, 0) == hold) {
+        ASSERT(cap->running_task == task);
+    } else
+#endif
+    {
+        // Wait for permission to re-enter the RTS with the result.
+        waitForCapability(&cap,task);
+    }
     // we might be on a different capability now... but if so, our
     // entry on the suspended_ccalls list will also have been
     // migrated.
@@ -2595,6 +2745,15 @@ scheduleThread(Capability *cap, StgTSO *tso)
     // The thread goes at the *end* of the run-queue, to avoid possible
     // starvation of any threads already on the queue.
     appendToRunQueue(cap,tso);
+
+#if defined(THREADED_RTS)
+    // If other Capabilities are idle, return to the scheduler soon to share
+    // the new thread with them.  See Note [Stealing threads] in Capability.c
+    if (RELAXED_LOAD(&n_hungry_capabilities) != 0 &&
+        RtsFlags.ParFlags.stealThreads) {
+        interruptCapability(cap);
+    }
+#endif
 }
 
 void
@@ -2724,12 +2883,20 @@ initScheduler(void)
 #if !defined(THREADED_RTS)
   blocked_queue_hd  = END_TSO_QUEUE;
   blocked_queue_tl  = END_TSO_QUEUE;
-  sleeping_queue    = END_TSO_QUEUE;
+#if !defined(mingw32_HOST_OS)
+  initFdWaiters();
+#endif
 #endif
 
   sched_state    = SCHED_RUNNING;
   SEQ_CST_STORE(&recent_activity, ACTIVITY_YES);
 
+  // See Note [Run queue delays]
+  time_run_queue = RtsFlags.GcFlags.giveStats != NO_GC_STATS;
+#if defined(TRACING)
+  time_run_queue = time_run_queue || TRACE_sched;
+#endif
+
 
   /* Initialise the mutex and condition variables used by
    * the scheduler. */
@@ -2761,6 +2928,11 @@ initScheduler(void)
 
   RELEASE_LOCK(&sched_mutex);
 
+#if defined(THREADED_RTS)
+  // See Note [Lazy capability handoff] in Capability.c
+  startCCallMonitor();
+#endif
+
 }
 
 void
@@ -2782,6 +2954,9 @@ exitScheduler (bool wait_foreign USED_IF_THREADS)
     ASSERT(sched_state == SCHED_SHUTTING_DOWN);
 
     shutdownCapabilities(task, wait_foreign);
+#if defined(THREADED_RTS)
+    stopCCallMonitor();
+#endif
 
     // debugBelch("n_failed_trygrab_idles = %d, n_idle_caps = %d\n",
     //            n_failed_trygrab_idles, n_idle_caps);
@@ -2805,6 +2980,10 @@ freeScheduler( void )
     if (still_running == 0) {
         freeCapabilities();
     }
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+    freeFdWaiters();
+    freeSleepingThreads();
+#endif
     RELEASE_LOCK(&sched_mutex);
 #if defined(THREADED_RTS)
     closeMutex(&sched_mutex);
@@ -2817,7 +2996,10 @@ void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
 #if !defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&blocked_queue_hd);
     evac(user, (StgClosure **)(void *)&blocked_queue_tl);
-    evac(user, (StgClosure **)(void *)&sleeping_queue);
+#if !defined(mingw32_HOST_OS)
+    markFdWaiters(evac, user);
+    markSleepingThreads(evac, user);
+#endif
 #endif
 }
 
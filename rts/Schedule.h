@@ -12,6 +12,8 @@
 #include "rts/OSThreads.h"
 #include "Capability.h"
 #include "Trace.h"
+#include "Timer.h"
+#include "AwaitEvent.h"
 
 #include "BeginPrivate.h"
 
@@ -110,11 +112,16 @@ extern volatile StgWord recent_activity;
  */
 #if !defined(THREADED_RTS)
 extern  StgTSO *blocked_queue_hd, *blocked_queue_tl;
-extern  StgTSO *sleeping_queue;
 #endif
 
 extern bool heap_overflow;
 
+/* Whether to stamp threads with the time they join a run queue.
+ * See Note [Run queue delays] in Schedule.c.
+ * Locks required  : none (set once, in initScheduler())
+ */
+extern bool time_run_queue;
+
 #if defined(THREADED_RTS)
 extern Mutex sched_mutex;
 #endif
@@ -132,7 +139,13 @@ void resurrectThreads (StgTSO *);
 
 /* END_TSO_QUEUE and friends now defined in includes/stg/MiscClosures.h */
 
-/* Add a thread to the end of the run queue.
+/* The number of times in a row a non-empty run queue can be passed over
+ * in favour of a higher priority class before it gets a turn.  See
+ * Note [Thread priority classes] in Schedule.c.
+ */
+#define RUN_QUEUE_MAX_SKIP 8
+
+/* Add a thread to the end of the run queue for its priority class.
  * NOTE: tso->link should be END_TSO_QUEUE before calling this macro.
  * ASSUMES: cap->running_task is the current task.
  */
@@ -143,18 +156,34 @@ EXTERN_INLINE void
 appendToRunQueue (Capability *cap, StgTSO *tso)
 {
     ASSERT(tso->_link == END_TSO_QUEUE);
-    if (cap->run_queue_hd == END_TSO_QUEUE) {
-        cap->run_queue_hd = tso;
+    // tso->prio may be set by a thread on another capability
+    uint32_t p = RELAXED_LOAD(&tso->prio);
+    ASSERT(p < N_TSO_PRIOS);
+    tso->run_queue_prio = p;
+    if (cap->run_queue_hd[p] == END_TSO_QUEUE) {
+        cap->run_queue_hd[p] = tso;
         tso->block_info.prev = END_TSO_QUEUE;
     } else {
-        setTSOLink(cap, cap->run_queue_tl, tso);
-        setTSOPrev(cap, tso, cap->run_queue_tl);
+        setTSOLink(cap, cap->run_queue_tl[p], tso);
+        setTSOPrev(cap, tso, cap->run_queue_tl[p]);
     }
-    cap->run_queue_tl = tso;
+    cap->run_queue_tl[p] = tso;
     cap->n_run_queue++;
+    // See Note [Run queue delays] in Schedule.c
+    if (RTS_UNLIKELY(time_run_queue)) {
+        tso->run_queue_time = getProcessElapsedTime();
+    }
+#if defined(THREADED_RTS)
+    // We need ticks to preempt the running thread; see Note [Tickless
+    // timer] in Timer.c
+    if (RTS_UNLIKELY(RELAXED_LOAD(&timer_parked)) && cap->in_haskell) {
+        unparkTimer();
+    }
+#endif
 }
 
-/* Push a thread on the beginning of the run queue.
+/* Push a thread on the beginning of the run queue for its priority
+ * class.
  * ASSUMES: cap->running_task is the current task.
  */
 EXTERN_INLINE void
@@ -163,27 +192,62 @@ pushOnRunQueue (Capability *cap, StgTSO *tso);
 EXTERN_INLINE void
 pushOnRunQueue (Capability *cap, StgTSO *tso)
 {
-    setTSOLink(cap, tso, cap->run_queue_hd);
+    uint32_t p = RELAXED_LOAD(&tso->prio);
+    ASSERT(p < N_TSO_PRIOS);
+    tso->run_queue_prio = p;
+    setTSOLink(cap, tso, cap->run_queue_hd[p]);
     tso->block_info.prev = END_TSO_QUEUE;
-    if (cap->run_queue_hd != END_TSO_QUEUE) {
-        setTSOPrev(cap, cap->run_queue_hd, tso);
+    if (cap->run_queue_hd[p] != END_TSO_QUEUE) {
+        setTSOPrev(cap, cap->run_queue_hd[p], tso);
     }
-    cap->run_queue_hd = tso;
-    if (cap->run_queue_tl == END_TSO_QUEUE) {
-        cap->run_queue_tl = tso;
+    cap->run_queue_hd[p] = tso;
+    if (cap->run_queue_tl[p] == END_TSO_QUEUE) {
+        cap->run_queue_tl[p] = tso;
     }
     cap->n_run_queue++;
+    // See Note [Run queue delays] in Schedule.c
+    if (RTS_UNLIKELY(time_run_queue)) {
+        tso->run_queue_time = getProcessElapsedTime();
+    }
+#if defined(THREADED_RTS)
+    // We need ticks to preempt the running thread; see Note [Tickless
+    // timer] in Timer.c
+    if (RTS_UNLIKELY(RELAXED_LOAD(&timer_parked)) && cap->in_haskell) {
+        unparkTimer();
+    }
+#endif
 }
 
-/* Pop the first thread off the runnable queue.
+/* The priority class whose run queue we should take the next thread
+ * from: the highest non-empty one, unless a lower one has been passed
+ * over RUN_QUEUE_MAX_SKIP times.
+ */
+INLINE_HEADER uint32_t
+nextRunQueuePrio (Capability *cap)
+{
+    uint32_t p, next = N_TSO_PRIOS;
+    for (p = N_TSO_PRIOS; p-- > 0; ) {
+        if (cap->run_queue_hd[p] != END_TSO_QUEUE) {
+            if (cap->run_queue_skipped[p] >= RUN_QUEUE_MAX_SKIP) {
+                return p;
+            }
+            next = p;
+        }
+    }
+    return next;
+}
+
+/* Pop the next thread to run off the run queues.
  */
 INLINE_HEADER StgTSO *
 popRunQueue (Capability *cap)
 {
     ASSERT(cap->n_run_queue > 0);
-    StgTSO *t = cap->run_queue_hd;
+    uint32_t p = nextRunQueuePrio(cap);
+    ASSERT(p < N_TSO_PRIOS);
+    StgTSO *t = cap->run_queue_hd[p];
     ASSERT(t != END_TSO_QUEUE);
-    cap->run_queue_hd = t->_link;
+    cap->run_queue_hd[p] = t->_link;
 
     StgTSO *link = RELAXED_LOAD(&t->_link);
     if (link != END_TSO_QUEUE) {
@@ -191,17 +255,30 @@ popRunQueue (Capability *cap)
     }
     RELAXED_STORE(&t->_link, END_TSO_QUEUE); // no write barrier req'd
 
-    if (cap->run_queue_hd == END_TSO_QUEUE) {
-        cap->run_queue_tl = END_TSO_QUEUE;
+    if (cap->run_queue_hd[p] == END_TSO_QUEUE) {
+        cap->run_queue_tl[p] = END_TSO_QUEUE;
     }
     cap->n_run_queue--;
+
+    // Count the turns the lower classes have missed, so they can't starve
+    cap->run_queue_skipped[p] = 0;
+    for (uint32_t q = p + 1; q < N_TSO_PRIOS; q++) {
+        if (cap->run_queue_hd[q] != END_TSO_QUEUE) {
+            cap->run_queue_skipped[q]++;
+        }
+    }
     return t;
 }
 
+/* The thread popRunQueue() would return, or END_TSO_QUEUE.
+ */
 INLINE_HEADER StgTSO *
 peekRunQueue (Capability *cap)
 {
-    return cap->run_queue_hd;
+    if (cap->n_run_queue == 0) {
+        return END_TSO_QUEUE;
+    }
+    return cap->run_queue_hd[nextRunQueuePrio(cap)];
 }
 
 void promoteInRunQueue (Capability *cap, StgTSO *tso);
@@ -245,14 +322,23 @@ truncateRunQueue(Capability *cap)
     TSAN_ANNOTATE_BENIGN_RACE(&cap->run_queue_hd, "truncateRunQueue");
     TSAN_ANNOTATE_BENIGN_RACE(&cap->run_queue_tl, "truncateRunQueue");
     TSAN_ANNOTATE_BENIGN_RACE(&cap->n_run_queue, "truncateRunQueue");
-    cap->run_queue_hd = END_TSO_QUEUE;
-    cap->run_queue_tl = END_TSO_QUEUE;
+    for (uint32_t p = 0; p < N_TSO_PRIOS; p++) {
+        cap->run_queue_hd[p] = END_TSO_QUEUE;
+        cap->run_queue_tl[p] = END_TSO_QUEUE;
+        cap->run_queue_skipped[p] = 0;
+    }
     cap->n_run_queue = 0;
 }
 
 #if !defined(THREADED_RTS)
+#if defined(mingw32_HOST_OS)
+// delay# puts threads on the blocked_queue, too
 #define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
-#define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
+#define EMPTY_SLEEPING_QUEUE() (true)
+#else
+#define EMPTY_BLOCKED_QUEUE()  (emptyFdWaiters())
+#define EMPTY_SLEEPING_QUEUE() (emptySleepingThreads())
+#endif
 #endif
 
 INLINE_HEADER bool
@@ -14,6 +14,7 @@
 #include "Trace.h"
 #include "Prelude.h"
 #include "Sparks.h"
+#include "Timer.h"
 #include "ThreadLabels.h"
 #include "sm/NonMovingMark.h"
 #include "sm/HeapAlloc.h"
@@ -66,6 +67,8 @@ newSpark (StgRegTable *reg, StgClosure *p)
         if (pushWSDeque(pool,p)) {
             cap->spark_stats.created++;
             traceEventSparkCreate(cap);
+            // See Note [Tickless timer] in Timer.c
+            wakeTimer();
         } else {
             /* overflowing the spark pool */
             cap->spark_stats.overflowed++;
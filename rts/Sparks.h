@@ -24,6 +24,15 @@ typedef struct {
     StgWord fizzled;
 } SparkCounters;
 
+/* Stats on stealing sparks from other Capabilities, see
+ * Note [Choosing a victim to steal sparks from] in Capability.c */
+typedef struct {
+    StgWord local;      // successful steals from a Capability on our node
+    StgWord remote;     // successful steals from a Capability on another node
+    StgWord sparks;     // sparks taken by those steals
+    StgWord failed;     // steals that lost a race with another thief
+} StealCounters;
+
 #if defined(THREADED_RTS)
 
 typedef WSDeque SparkPool;
@@ -31,15 +40,13 @@ typedef WSDeque SparkPool;
 // Initialisation
 SparkPool *allocSparkPool (void);
 
-// Take a spark from the "write" end of the pool.  Can be called
-// by the pool owner only.
-INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool);
-
 // Returns True if the spark pool is empty (can give a false positive
 // if the pool is almost empty).
 INLINE_HEADER bool looksEmpty(SparkPool* deque);
 
 INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool);
+INLINE_HEADER StgInt       tryStealSparks(SparkPool *pool, StgClosure **buf,
+                                          StgInt max);
 INLINE_HEADER bool         fizzledSpark  (StgClosure *);
 
 void         freeSparkPool     (SparkPool *pool);
@@ -54,11 +61,6 @@ INLINE_HEADER long sparkPoolSize  (SparkPool *pool);
  * PRIVATE below here
  * -------------------------------------------------------------------------- */
 
-INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool)
-{
-    return popWSDeque(pool);
-}
-
 INLINE_HEADER bool looksEmpty(SparkPool* deque)
 {
     return looksEmptyWSDeque(deque);
@@ -95,6 +97,27 @@ INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool)
     // other pools before trying again.
 }
 
+/* ----------------------------------------------------------------------------
+ *
+ * tryStealSparks: try to steal about half of the sparks (at most max) from a
+ * Capability with a single atomic operation, storing them in buf, oldest
+ * first.
+ *
+ * Returns the number of sparks stolen, some of which may have fizzled, or 0
+ * if the pool was empty or there was a race with another thief.
+ *
+ * Because of this, the owner of a spark pool must take its own sparks with
+ * tryStealSpark() too, never with popWSDeque(); see Note [Stealing half of
+ * a WSDeque] in WSDeque.c.
+ *
+ -------------------------------------------------------------------------- */
+
+INLINE_HEADER StgInt tryStealSparks (SparkPool *pool, StgClosure **buf,
+                                     StgInt max)
+{
+    return stealHalfWSDeque_(pool, (void **)buf, max);
+}
+
 INLINE_HEADER bool fizzledSpark (StgClosure *spark)
 {
     return (GET_CLOSURE_TAG(spark) != 0 || !closure_SHOULD_SPARK(spark));
@@ -16,13 +16,35 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "StableName.h"
+#include "sm/CNF.h"
+#include "sm/GC.h"
+#include "sm/HeapAlloc.h"
 
 #include <string.h>
 
-snEntry *stable_name_table = NULL;
-static snEntry *stable_name_free = NULL;
-unsigned int SNT_size = 0;
-#define INIT_SNT_SIZE 64
+snEntry **stable_name_table = NULL;
+unsigned int SNT_size = 0;          // number of entries in all segments
+static uint32_t snt_dir_size = 0;   // capacity of stable_name_table
+#define INIT_SNT_DIR_SIZE 8
+
+// Free entries that aren't cached by a shard; a stack of indices with room
+// for every entry in the table.
+static StgWord *stable_name_free = NULL;
+static uint32_t n_stable_name_free = 0;
+
+// Old versions of the segment directory, freed at the next GC.  As for the
+// stable pointer table, we can double the directory at most N times on an
+// N-bit machine.
+#if SIZEOF_VOID_P == 4
+#define MAX_N_OLD_SNTS 32
+#elif SIZEOF_VOID_P == 8
+#define MAX_N_OLD_SNTS 64
+#else
+#error unknown SIZEOF_VOID_P
+#endif
+
+static snEntry **old_SNTs[MAX_N_OLD_SNTS];
+static uint32_t n_old_SNTs = 0;
 
 #if defined(THREADED_RTS)
 Mutex stable_name_mutex;
@@ -30,80 +52,279 @@ Mutex stable_name_mutex;
 
 static void enlargeStableNameTable(void);
 
-/*
- * This hash table maps Haskell objects to stable names, so that every
- * call to lookupStableName on a given object will return the same
- * stable name.
+/* Note [Stable name table]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~
+ * The stable name table is a directory (stable_name_table) of fixed-size
+ * segments of STABLE_NAME_SEGMENT_SIZE entries, like the stable pointer table
+ * (see Note [Stable pointer table] in StablePtr.c).  Entries never move, so
+ * makeStableName# can read an entry without taking any lock.
+ *
+ * Lookup.  lookupStableName must return the same stable name for the same
+ * object, so we need a map from object addresses to stable names.  Instead
+ * of a single hash table behind a single lock, the map is split into
+ * SN_SHARDS shards by address.  Each shard has its own lock, hash table and
+ * small cache of free entries, so threads making stable names for different
+ * objects rarely contend.  stable_name_mutex protects the segments and the
+ * global stack of free entries, and is only taken to grow the table or to
+ * refill a shard's cache.  Lock order: shard locks, in increasing order, then
+ * stable_name_mutex.  stableNameLock() takes all of them, which gives the GC
+ * (and the nonmoving sweep, which runs concurrently with the mutator)
+ * exclusive access to the table.  GarbageCollect takes it once, alongside the
+ * StablePtr table lock, and holds it from marking the roots until
+ * updateStableNameTable, so a collection costs one round of locking however
+ * many of the functions below it calls.
+ *
+ * GC.  Rather than walking the whole table at every GC, we keep every entry
+ * in use on exactly one list (snEntry.list; snEntry.pos is its index in that
+ * list):
+ *
+ *   - sn_lists[g], for g < RtsFlags.GcFlags.generations, holds entries whose
+ *     object and StableName object are both in generation g or older, and
+ *     at least one of them is in generation g;
+ *
+ *   - sn_lists[RtsFlags.GcFlags.generations + i] holds the entries created
+ *     by lookupStableName on shard i since the last GC.  Their StableName
+ *     object has just been allocated, so they belong in generation 0, but
+ *     the shard's own list saves us taking a global lock to put them there.
+ *
+ * When collecting generations 0..N, nothing in an older generation moves or
+ * dies, so rememberOldStableNameAddresses, gcStableNameTable and
+ * updateStableNameTable only need to look at sn_lists[0..N] and the lists
+ * of new entries.  The retainer profiler, which runs after a major GC,
+ * passes the oldest generation to rememberOldStableNameAddresses.  At the
+ * end of the GC updateStableNameTable files each entry it looked at under
+ * the generation its objects now live in.  Objects are never demoted, so an
+ * entry only ever moves to an older list.
  */
 
-static HashTable *addrToStableHash = NULL;
+#if defined(THREADED_RTS)
+#define SN_SHARDS 32
+#else
+#define SN_SHARDS 1
+#endif
+
+// Number of free entries each shard may keep to itself
+#define SN_SHARD_CACHE_SIZE 32
+
+typedef struct {
+#if defined(THREADED_RTS)
+    Mutex lock;
+#endif
+    /*
+     * This hash table maps Haskell objects to stable names, so that every
+     * call to lookupStableName on a given object will return the same
+     * stable name.  Allocated on first use.
+     */
+    HashTable *addrToStableHash;
+
+    StgWord free[SN_SHARD_CACHE_SIZE];
+    uint32_t n_free;
+} SnShard;
+
+static SnShard sn_shards[SN_SHARDS];
+
+typedef struct {
+    StgWord *entries;   // indices into the stable name table
+    uint32_t n_entries;
+    uint32_t size;
+} SnList;
+
+static SnList *sn_lists = NULL;
+static uint32_t n_sn_lists = 0;
+
+// snEntry.list of an entry that isn't on any list
+#define SN_NO_LIST ((uint32_t)-1)
+
+STATIC_INLINE snEntry *
+snEntryOf(StgWord sn)
+{
+    ASSERT(sn < SNT_size);
+    return &stable_name_table[sn >> STABLE_NAME_SEGMENT_BITS]
+                             [sn & STABLE_NAME_SEGMENT_MASK];
+}
+
+STATIC_INLINE SnShard *
+shardOf(StgPtr p)
+{
+    StgWord h = (StgWord)p >> 4;
+    h ^= h >> 8;
+    h ^= h >> 16;
+    return &sn_shards[h % SN_SHARDS];
+}
+
+STATIC_INLINE uint32_t
+newEntriesList(SnShard *shard)
+{
+    return RtsFlags.GcFlags.generations + (uint32_t)(shard - sn_shards);
+}
+
+static void
+snListPush(uint32_t l, StgWord sn)
+{
+    SnList *list = &sn_lists[l];
+    snEntry *p = snEntryOf(sn);
+
+    if (list->n_entries == list->size) {
+        list->size = list->size == 0 ? 64 : list->size * 2;
+        list->entries = stgReallocBytes(list->entries,
+                                        list->size * sizeof(StgWord),
+                                        "snListPush");
+    }
+    p->list = l;
+    p->pos = list->n_entries;
+    list->entries[list->n_entries++] = sn;
+}
+
+static void
+snListRemove(snEntry *p)
+{
+    SnList *list;
+    StgWord last;
+
+    if (p->list == SN_NO_LIST) return;
+    list = &sn_lists[p->list];
+    ASSERT(p->pos < list->n_entries);
+    last = list->entries[--list->n_entries];
+    list->entries[p->pos] = last;
+    snEntryOf(last)->pos = p->pos;
+    p->list = SN_NO_LIST;
+}
 
 void
 stableNameLock(void)
 {
+    uint32_t i;
+
     initStableNameTable();
+    for (i = 0; i < SN_SHARDS; i++) {
+        ACQUIRE_LOCK(&sn_shards[i].lock);
+    }
     ACQUIRE_LOCK(&stable_name_mutex);
 }
 
 void
 stableNameUnlock(void)
 {
+    uint32_t i;
+
     RELEASE_LOCK(&stable_name_mutex);
+    for (i = SN_SHARDS; i > 0; i--) {
+        RELEASE_LOCK(&sn_shards[i-1].lock);
+    }
+}
+
+void
+initStableNameLocks(void)
+{
+#if defined(THREADED_RTS)
+    uint32_t i;
+
+    initMutex(&stable_name_mutex);
+    for (i = 0; i < SN_SHARDS; i++) {
+        initMutex(&sn_shards[i].lock);
+    }
+#endif
 }
 
 /* -----------------------------------------------------------------------------
  * Initialising the table
  * -------------------------------------------------------------------------- */
 
-STATIC_INLINE void
-initSnEntryFreeList(snEntry *table, uint32_t n, snEntry *free)
-{
-  snEntry *p;
-  for (p = table + n - 1; p >= table; p--) {
-    p->addr   = (P_)free;
-    p->old    = NULL;
-    p->sn_obj = NULL;
-    free = p;
-  }
-  stable_name_free = table;
-}
-
 void
 initStableNameTable(void)
 {
+    uint32_t i;
+
     if (SNT_size > 0) return;
-    SNT_size = INIT_SNT_SIZE;
-    stable_name_table = stgMallocBytes(SNT_size * sizeof(snEntry),
+    snt_dir_size = INIT_SNT_DIR_SIZE;
+    stable_name_table = stgMallocBytes(snt_dir_size * sizeof(snEntry *),
                                        "initStableNameTable");
+    enlargeStableNameTable();
+
     /* we don't use index 0 in the stable name table, because that
      * would conflict with the hash table lookup operations which
      * return NULL if an entry isn't found in the hash table.
      */
-    initSnEntryFreeList(stable_name_table + 1,INIT_SNT_SIZE-1,NULL);
-    addrToStableHash = allocHashTable();
+    ASSERT(stable_name_free[n_stable_name_free-1] == 0);
+    n_stable_name_free--;
 
-#if defined(THREADED_RTS)
-    initMutex(&stable_name_mutex);
-#endif
+    for (i = 0; i < SN_SHARDS; i++) {
+        sn_shards[i].addrToStableHash = NULL;
+        sn_shards[i].n_free = 0;
+    }
+
+    n_sn_lists = RtsFlags.GcFlags.generations + SN_SHARDS;
+    sn_lists = stgMallocBytes(n_sn_lists * sizeof(SnList),
+                              "initStableNameTable");
+    for (i = 0; i < n_sn_lists; i++) {
+        sn_lists[i].entries = NULL;
+        sn_lists[i].n_entries = 0;
+        sn_lists[i].size = 0;
+    }
+
+    initStableNameLocks();
 }
 
 /* -----------------------------------------------------------------------------
  * Enlarging the tables
  * -------------------------------------------------------------------------- */
 
+// Must be holding stable_name_mutex
 static void
 enlargeStableNameTable(void)
 {
-    uint32_t old_SNT_size = SNT_size;
+    snEntry *seg;
+    StgWord base, i;
+
+    if (SNT_size == snt_dir_size * STABLE_NAME_SEGMENT_SIZE) {
+        snEntry **new_dir;
+
+        // makeStableName# may be reading the old directory; keep it until
+        // the next GC.
+        snt_dir_size *= 2;
+        new_dir = stgMallocBytes(snt_dir_size * sizeof(snEntry *),
+                                 "enlargeStableNameTable");
+        memcpy(new_dir, stable_name_table,
+               (SNT_size / STABLE_NAME_SEGMENT_SIZE) * sizeof(snEntry *));
+        ASSERT(n_old_SNTs < MAX_N_OLD_SNTS);
+        old_SNTs[n_old_SNTs++] = stable_name_table;
+        RELEASE_STORE(&stable_name_table, new_dir);
+    }
+
+    seg = stgMallocBytes(STABLE_NAME_SEGMENT_SIZE * sizeof(snEntry),
+                         "enlargeStableNameTable");
+    for (i = 0; i < STABLE_NAME_SEGMENT_SIZE; i++) {
+        seg[i].addr   = NULL;
+        seg[i].old    = NULL;
+        seg[i].sn_obj = NULL;
+        seg[i].list   = SN_NO_LIST;
+        seg[i].pos    = 0;
+    }
+    RELEASE_STORE(&stable_name_table[SNT_size / STABLE_NAME_SEGMENT_SIZE], seg);
 
-    // 2nd and subsequent times
-    SNT_size *= 2;
-    stable_name_table =
-        stgReallocBytes(stable_name_table,
-                        SNT_size * sizeof(snEntry),
+    stable_name_free =
+        stgReallocBytes(stable_name_free,
+                        (SNT_size + STABLE_NAME_SEGMENT_SIZE) * sizeof(StgWord),
                         "enlargeStableNameTable");
 
-    initSnEntryFreeList(stable_name_table + old_SNT_size, old_SNT_size, NULL);
+    // Push the new entries so that the lowest index is handed out first.
+    base = SNT_size;
+    for (i = STABLE_NAME_SEGMENT_SIZE; i > 0; i--) {
+        stable_name_free[n_stable_name_free++] = base + i - 1;
+    }
+    SNT_size += STABLE_NAME_SEGMENT_SIZE;
+}
+
+// Must be holding the shard's lock
+static void
+refillShardCache(SnShard *shard)
+{
+    ACQUIRE_LOCK(&stable_name_mutex);
+    while (shard->n_free < SN_SHARD_CACHE_SIZE / 2) {
+        if (n_stable_name_free == 0) enlargeStableNameTable();
+        shard->free[shard->n_free++] = stable_name_free[--n_stable_name_free];
+    }
+    RELEASE_LOCK(&stable_name_mutex);
 }
 
 
@@ -111,30 +332,82 @@ enlargeStableNameTable(void)
  * Freeing entries and tables
  * -------------------------------------------------------------------------- */
 
+static void
+freeOldSNTs(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_old_SNTs; i++) {
+        stgFree(old_SNTs[i]);
+    }
+    n_old_SNTs = 0;
+}
+
 void
 exitStableNameTable(void)
 {
-    if (addrToStableHash)
-        freeHashTable(addrToStableHash, NULL);
-    addrToStableHash = NULL;
+    uint32_t i;
+
+    for (i = 0; i < SN_SHARDS; i++) {
+        if (sn_shards[i].addrToStableHash)
+            freeHashTable(sn_shards[i].addrToStableHash, NULL);
+        sn_shards[i].addrToStableHash = NULL;
+        sn_shards[i].n_free = 0;
+#if defined(THREADED_RTS)
+        closeMutex(&sn_shards[i].lock);
+#endif
+    }
 
-    if (stable_name_table)
+    if (sn_lists) {
+        for (i = 0; i < n_sn_lists; i++) {
+            stgFree(sn_lists[i].entries);
+        }
+        stgFree(sn_lists);
+    }
+    sn_lists = NULL;
+    n_sn_lists = 0;
+
+    if (stable_name_table) {
+        for (i = 0; i < SNT_size / STABLE_NAME_SEGMENT_SIZE; i++) {
+            stgFree(stable_name_table[i]);
+        }
         stgFree(stable_name_table);
+    }
     stable_name_table = NULL;
     SNT_size = 0;
+    snt_dir_size = 0;
+
+    if (stable_name_free)
+        stgFree(stable_name_free);
+    stable_name_free = NULL;
+    n_stable_name_free = 0;
+
+    freeOldSNTs();
 
 #if defined(THREADED_RTS)
     closeMutex(&stable_name_mutex);
 #endif
 }
 
+// Must be holding stableNameLock()
 void
 freeSnEntry(snEntry *sn)
 {
+  SnShard *shard = shardOf(sn->old);
+  StgWord ix;
+
   ASSERT(sn->sn_obj == NULL);
-  removeHashTable(addrToStableHash, (W_)sn->old, NULL);
-  sn->addr = (P_)stable_name_free;
-  stable_name_free = sn;
+  if (shard->addrToStableHash != NULL) {
+      removeHashTable(shard->addrToStableHash, (W_)sn->old, NULL);
+  }
+  // every entry in use is on a list, which is the only place its index is
+  // recorded
+  ASSERT(sn->list != SN_NO_LIST);
+  ix = sn_lists[sn->list].entries[sn->pos];
+  ASSERT(snEntryOf(ix) == sn);
+  snListRemove(sn);
+  sn->addr = NULL;
+  stable_name_free[n_stable_name_free++] = ix;
 }
 
 /* -----------------------------------------------------------------------------
@@ -177,11 +450,10 @@ removeIndirections (StgClosure* p)
 StgWord
 lookupStableName (StgPtr p)
 {
-  stableNameLock();
+  SnShard *shard;
+  snEntry *e;
 
-  if (stable_name_free == NULL) {
-    enlargeStableNameTable();
-  }
+  initStableNameTable();
 
   /* removing indirections increases the likelihood
    * of finding a match in the stable name hash table.
@@ -191,38 +463,75 @@ lookupStableName (StgPtr p)
   // register the untagged pointer.  This just makes things simpler.
   p = (StgPtr)UNTAG_CLOSURE((StgClosure*)p);
 
-  StgWord sn = (StgWord)lookupHashTable(addrToStableHash,(W_)p);
+  shard = shardOf(p);
+  ACQUIRE_LOCK(&shard->lock);
+
+  if (shard->addrToStableHash == NULL) {
+    shard->addrToStableHash = allocHashTable();
+  }
+
+  StgWord sn = (StgWord)lookupHashTable(shard->addrToStableHash,(W_)p);
 
   if (sn != 0) {
-    ASSERT(stable_name_table[sn].addr == p);
+    ASSERT(snEntryOf(sn)->addr == p);
     debugTrace(DEBUG_stable, "cached stable name %ld at %p",sn,p);
-    stableNameUnlock();
+    RELEASE_LOCK(&shard->lock);
     return sn;
   }
 
-  sn = stable_name_free - stable_name_table;
-  stable_name_free  = (snEntry*)(stable_name_free->addr);
-  stable_name_table[sn].addr = p;
-  stable_name_table[sn].sn_obj = NULL;
+  if (shard->n_free == 0) {
+    refillShardCache(shard);
+  }
+
+  sn = shard->free[--shard->n_free];
+  e = snEntryOf(sn);
+  e->addr = p;
+  e->sn_obj = NULL;
+  snListPush(newEntriesList(shard), sn);
   /* debugTrace(DEBUG_stable, "new stable name %d at %p\n",sn,p); */
 
   /* add the new stable name to the hash table */
-  insertHashTable(addrToStableHash, (W_)p, (void *)sn);
+  insertHashTable(shard->addrToStableHash, (W_)p, (void *)sn);
 
-  stableNameUnlock();
+  RELEASE_LOCK(&shard->lock);
 
   return sn;
 }
 
+/* -----------------------------------------------------------------------------
+ * Visiting the entries that may change in this GC
+ *
+ * These are the entries on the lists of generations 0..max_gen and on the
+ * lists of new entries; see Note [Stable name table].  We go backwards
+ * through each list so that CODE may remove the current entry.
+ * -------------------------------------------------------------------------- */
+
+#define FOR_EACH_COLLECTED_STABLE_NAME(sn, p, max_gen, CODE)            \
+    do {                                                                \
+        uint32_t __l;                                                   \
+        for (__l = 0; __l < n_sn_lists; __l++) {                        \
+            SnList *__list = &sn_lists[__l];                            \
+            uint32_t __i;                                               \
+            if (__l > (max_gen) &&                                      \
+                __l < RtsFlags.GcFlags.generations) continue;           \
+            for (__i = __list->n_entries; __i > 0; __i--) {             \
+                StgWord sn = __list->entries[__i - 1];                  \
+                snEntry *p = snEntryOf(sn);                             \
+                do { CODE } while(0);                                   \
+            }                                                           \
+        }                                                               \
+    } while(0)
+
 /* -----------------------------------------------------------------------------
  * Remember old stable name addresses
  * -------------------------------------------------------------------------- */
 
+// Must be holding stableNameLock()
 void
-rememberOldStableNameAddresses(void)
+rememberOldStableNameAddresses(uint32_t max_gen)
 {
-    /* TODO: Only if !full GC */
-    FOR_EACH_STABLE_NAME(p, p->old = p->addr;);
+    // Entries in generations older than max_gen won't move
+    FOR_EACH_COLLECTED_STABLE_NAME(sn, p, max_gen, (void)sn; p->old = p->addr;);
 }
 
 /* -----------------------------------------------------------------------------
@@ -258,25 +567,29 @@ threadStableNameTable( evac_fn evac, void *user )
  * name table entry.  We can re-use stable name table entries for live
  * heap objects, as long as the program has no StableName objects that
  * refer to the entry.
+ *
+ * Only entries in the generations being collected can change; see
+ * Note [Stable name table].
  * -------------------------------------------------------------------------- */
 
+// Must be holding stableNameLock()
 void
 gcStableNameTable( void )
 {
-    // We must take the stable name lock lest we race with the nonmoving
-    // collector (namely nonmovingSweepStableNameTable).
-    stableNameLock();
-    FOR_EACH_STABLE_NAME(
-        p, {
-            // FOR_EACH_STABLE_NAME traverses free entries too, so
-            // check sn_obj
+    // No mutator can be reading an old directory now.
+    freeOldSNTs();
+
+    FOR_EACH_COLLECTED_STABLE_NAME(
+        sn, p, N, {
+            // Entries are put on a list before their StableName object
+            // is allocated, so check sn_obj
             if (p->sn_obj != NULL) {
                 // Update the pointer to the StableName object, if there is one
                 p->sn_obj = isAlive(p->sn_obj);
                 if (p->sn_obj == NULL) {
                     // StableName object died
                     debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
-                               (long)(p - stable_name_table), p->addr);
+                               (long)sn, p->addr);
                     freeSnEntry(p);
                 } else if (p->addr != NULL) {
                     // sn_obj is alive, update pointee
@@ -284,12 +597,11 @@ gcStableNameTable( void )
                     if (p->addr == NULL) {
                         // Pointee died
                         debugTrace(DEBUG_stable, "GC'd pointee %ld",
-                                   (long)(p - stable_name_table));
+                                   (long)sn);
                     }
                 }
             }
         });
-    stableNameUnlock();
 }
 
 /* -----------------------------------------------------------------------------
@@ -299,34 +611,122 @@ gcStableNameTable( void )
  * being done, so we might as well throw away the hash table and build
  * a new one.  For a minor collection, we just re-hash the elements
  * that changed.
+ *
+ * Finally, each entry we looked at moves to the list of the generation its
+ * objects now live in.
  * -------------------------------------------------------------------------- */
 
+// The generation that an object lives in.  Static objects never move, so
+// they count as being in the oldest generation.
+static uint32_t
+closureGen(StgClosure *p)
+{
+    bdescr *bd;
+
+    if (!HEAP_ALLOCED_GC(p)) {
+        return RtsFlags.GcFlags.generations - 1;
+    }
+    bd = Bdescr((P_)p);
+    if (bd->flags & BF_COMPACT) {
+        // only the first block of a compact region's block group is
+        // guaranteed to know its generation
+        bd = Bdescr((P_)objectGetCompactBlock(p));
+    }
+    return bd->gen_no;
+}
+
+static uint32_t
+snEntryGen(snEntry *p)
+{
+    uint32_t g = RtsFlags.GcFlags.generations - 1;
+
+    if (p->addr != NULL) {
+        g = closureGen((StgClosure *)p->addr);
+    }
+    if (p->sn_obj != NULL) {
+        g = stg_min(g, closureGen(p->sn_obj));
+    }
+    return g;
+}
+
+static void
+refileStableNames(uint32_t max_gen)
+{
+    uint32_t l, i, g;
+    SnList *list;
+    snEntry *p;
+
+    // Going from older to younger lists, and doing the lists of new entries
+    // last, means that an entry never moves to a list we have yet to visit.
+    for (l = max_gen + 1; l > 0; l--) {
+        list = &sn_lists[l-1];
+        for (i = list->n_entries; i > 0; i--) {
+            p = snEntryOf(list->entries[i-1]);
+            g = snEntryGen(p);
+            if (g != l-1) {
+                StgWord sn = list->entries[i-1];
+                ASSERT(g > l-1);
+                snListRemove(p);
+                snListPush(g, sn);
+            }
+        }
+    }
+    for (l = RtsFlags.GcFlags.generations; l < n_sn_lists; l++) {
+        list = &sn_lists[l];
+        for (i = list->n_entries; i > 0; i--) {
+            StgWord sn = list->entries[i-1];
+            p = snEntryOf(sn);
+            snListRemove(p);
+            snListPush(snEntryGen(p), sn);
+        }
+    }
+}
+
+// Must be holding stableNameLock()
 void
 updateStableNameTable(bool full)
 {
-    if (full && addrToStableHash != NULL && 0 != keyCountHashTable(addrToStableHash)) {
-        freeHashTable(addrToStableHash,NULL);
-        addrToStableHash = allocHashTable();
-    }
+    uint32_t i;
+
+    if (full) {
+        for (i = 0; i < SN_SHARDS; i++) {
+            HashTable *table = sn_shards[i].addrToStableHash;
+            if (table != NULL && 0 != keyCountHashTable(table)) {
+                freeHashTable(table, NULL);
+                sn_shards[i].addrToStableHash = allocHashTable();
+            }
+        }
 
-    if(full) {
-        FOR_EACH_STABLE_NAME(
-            p, {
+        FOR_EACH_COLLECTED_STABLE_NAME(
+            sn, p, RtsFlags.GcFlags.generations - 1, {
                 if (p->addr != NULL) {
                     // Target still alive, Re-hash this stable name
-                    insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
+                    SnShard *shard = shardOf(p->addr);
+                    if (shard->addrToStableHash == NULL) {
+                        shard->addrToStableHash = allocHashTable();
+                    }
+                    insertHashTable(shard->addrToStableHash, (W_)p->addr, (void *)sn);
                 }
             });
+        refileStableNames(RtsFlags.GcFlags.generations - 1);
     } else {
-        FOR_EACH_STABLE_NAME(
-            p, {
+        FOR_EACH_COLLECTED_STABLE_NAME(
+            sn, p, N, {
                 if (p->addr != p->old) {
-                    removeHashTable(addrToStableHash, (W_)p->old, NULL);
+                    SnShard *shard = shardOf(p->old);
+                    if (shard->addrToStableHash != NULL) {
+                        removeHashTable(shard->addrToStableHash, (W_)p->old, NULL);
+                    }
                     /* Movement happened: */
                     if (p->addr != NULL) {
-                        insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
+                        shard = shardOf(p->addr);
+                        if (shard->addrToStableHash == NULL) {
+                            shard->addrToStableHash = allocHashTable();
+                        }
+                        insertHashTable(shard->addrToStableHash, (W_)p->addr, (void *)sn);
                     }
                 }
             });
+        refileStableNames(N);
     }
 }
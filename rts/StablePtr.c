@@ -16,6 +16,8 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "StablePtr.h"
+#include "Capability.h"
+#include "Task.h"
 
 #include <string.h>
 
@@ -81,23 +83,29 @@
   Stable Pointers are exported to the outside world as indices and not
   pointers, because the stable pointer table is allowed to be
   reallocated for growth. The table is never shrunk for its space to
-  be reclaimed.
+  be reclaimed. (Nowadays the table grows by adding segments rather
+  than by reallocation; see Note [Stable pointer table].)
 
   Future plans for stable ptrs include distinguishing them by the
   generation of the pointed object. See
   https://gitlab.haskell.org/ghc/ghc/issues/7670 for details.
 */
 
-spEntry *stable_ptr_table = NULL;
-static spEntry *stable_ptr_free = NULL;
-static unsigned int SPT_size = 0;
-#define INIT_SPT_SIZE 64
-
-/* Each time the stable pointer table is enlarged, we temporarily retain the old
- * version to ensure dereferences are thread-safe (see Note [Enlarging the
- * stable pointer table]).  Since we double the size of the table each time, we
- * can (theoretically) enlarge it at most N times on an N-bit machine.  Thus,
- * there will never be more than N old versions of the table.
+spEntry **stable_ptr_table = NULL;
+static uint32_t n_spt_segments = 0;   // segments allocated so far
+static uint32_t spt_dir_size = 0;     // capacity of stable_ptr_table
+#define INIT_SPT_DIR_SIZE 8
+
+// Free entries that don't belong to any capability; a stack of indices.
+// There is room in here for every entry in the table.
+static StgWord *stable_ptr_free = NULL;
+static uint32_t n_stable_ptr_free = 0;
+
+/* Each time the segment directory is enlarged, we temporarily retain the old
+ * version to ensure dereferences are thread-safe (see Note [Stable pointer
+ * table]).  Since we double the size of the directory each time, we can
+ * (theoretically) enlarge it at most N times on an N-bit machine.  Thus,
+ * there will never be more than N old versions of the directory.
  */
 #if SIZEOF_VOID_P == 4
 #define MAX_N_OLD_SPTS 32
@@ -107,7 +115,7 @@ static unsigned int SPT_size = 0;
 #error unknown SIZEOF_VOID_P
 #endif
 
-static spEntry *old_SPTs[MAX_N_OLD_SPTS];
+static spEntry **old_SPTs[MAX_N_OLD_SPTS];
 static uint32_t n_old_SPTs = 0;
 
 #if defined(THREADED_RTS)
@@ -116,6 +124,45 @@ Mutex stable_ptr_mutex;
 
 static void enlargeStablePtrTable(void);
 
+/* Note [Stable pointer table]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A stable pointer is an index into the stable pointer table.  The table is
+ * a directory (stable_ptr_table) of fixed-size segments, each holding
+ * STABLE_PTR_SEGMENT_SIZE entries, so that deRefStablePtr is just
+ *
+ *     stable_ptr_table[sp >> STABLE_PTR_SEGMENT_BITS]
+ *                     [sp & STABLE_PTR_SEGMENT_MASK].addr
+ *
+ * To enlarge the table we allocate a new segment.  Existing segments never
+ * move, so growing the table never copies any entries.  Only when the
+ * directory itself is full do we double it; then we copy the (few) segment
+ * pointers to a new directory and keep the old version in old_SPTs until we
+ * free it during GC.  By not immediately freeing the old directory (or
+ * equivalently by not growing it using realloc()), we ensure that another
+ * thread simultaneously dereferencing a stable pointer using the old version
+ * can safely access it without causing a segfault (see #10296).  Because the
+ * directory is doubled in size each time, the old versions together take
+ * less space than the current one.
+ *
+ * An entry in use points to its Haskell object; a free entry is NULL.  Free
+ * entries are kept on stacks of indices rather than threaded through the
+ * table, so the GC can tell the two apart without any range checks.
+ *
+ * In the threaded RTS, making and freeing stable pointers from many
+ * capabilities at once used to contend on stable_ptr_mutex.  So each
+ * capability keeps a small cache of free entries (cap->stable_ptr_free),
+ * which only the Task owning the capability may touch.  getStablePtr and
+ * freeStablePtr use the cache when the calling Task owns a capability, and
+ * only take stable_ptr_mutex to move half a cache's worth of entries to or
+ * from the global stack stable_ptr_free.  Callers that don't own a
+ * capability (C code calling hs_free_stable_ptr from a foreign thread, say)
+ * go straight to the global stack under the lock, as before.
+ *
+ * The GC takes stable_ptr_mutex and runs with all capabilities stopped, so
+ * it sees a consistent table.  Entries cached by a capability are NULL and
+ * hence not roots.
+ */
+
 /* -----------------------------------------------------------------------------
  * We must lock the StablePtr table during GC, to prevent simultaneous
  * calls to freeStablePtr().
@@ -138,25 +185,14 @@ stablePtrUnlock(void)
  * Initialising the table
  * -------------------------------------------------------------------------- */
 
-STATIC_INLINE void
-initSpEntryFreeList(spEntry *table, uint32_t n, spEntry *free)
-{
-  spEntry *p;
-  for (p = table + n - 1; p >= table; p--) {
-      p->addr = (P_)free;
-      free = p;
-  }
-  stable_ptr_free = table;
-}
-
 void
 initStablePtrTable(void)
 {
-    if (SPT_size > 0) return;
-    SPT_size = INIT_SPT_SIZE;
-    stable_ptr_table = stgMallocBytes(SPT_size * sizeof(spEntry),
+    if (spt_dir_size > 0) return;
+    spt_dir_size = INIT_SPT_DIR_SIZE;
+    stable_ptr_table = stgMallocBytes(spt_dir_size * sizeof(spEntry *),
                                       "initStablePtrTable");
-    initSpEntryFreeList(stable_ptr_table,INIT_SPT_SIZE,NULL);
+    enlargeStablePtrTable();
 
 #if defined(THREADED_RTS)
     initMutex(&stable_ptr_mutex);
@@ -171,49 +207,102 @@ initStablePtrTable(void)
 static void
 enlargeStablePtrTable(void)
 {
-    uint32_t old_SPT_size = SPT_size;
-    spEntry *new_stable_ptr_table;
-
-    // 2nd and subsequent times
-    SPT_size *= 2;
+    spEntry *seg;
+    StgWord base, i;
+
+    if (n_spt_segments == spt_dir_size) {
+        spEntry **new_dir;
+
+        /* We temporarily retain the old version instead of freeing it; see
+         * Note [Stable pointer table].
+         */
+        spt_dir_size *= 2;
+        new_dir = stgMallocBytes(spt_dir_size * sizeof(spEntry *),
+                                 "enlargeStablePtrTable");
+        memcpy(new_dir, stable_ptr_table, n_spt_segments * sizeof(spEntry *));
+        ASSERT(n_old_SPTs < MAX_N_OLD_SPTS);
+        old_SPTs[n_old_SPTs++] = stable_ptr_table;
+
+        /* When using the threaded RTS, the update of stable_ptr_table is
+         * assumed to be atomic, so that another thread simultaneously
+         * dereferencing a stable pointer will always read a valid address.
+         * Release ordering to ensure that the new directory is visible to
+         * others.
+         */
+        RELEASE_STORE(&stable_ptr_table, new_dir);
+    }
 
-    /* We temporarily retain the old version instead of freeing it; see Note
-     * [Enlarging the stable pointer table].
-     */
-    new_stable_ptr_table =
-        stgMallocBytes(SPT_size * sizeof(spEntry),
-                       "enlargeStablePtrTable");
-    memcpy(new_stable_ptr_table,
-           stable_ptr_table,
-           old_SPT_size * sizeof(spEntry));
-    ASSERT(n_old_SPTs < MAX_N_OLD_SPTS);
-    old_SPTs[n_old_SPTs++] = stable_ptr_table;
-
-    /* When using the threaded RTS, the update of stable_ptr_table is assumed to
-     * be atomic, so that another thread simultaneously dereferencing a stable
-     * pointer will always read a valid address. Release ordering to ensure
-     * that the new table is visible to others.
-     */
-    RELEASE_STORE(&stable_ptr_table, new_stable_ptr_table);
+    seg = stgMallocBytes(STABLE_PTR_SEGMENT_SIZE * sizeof(spEntry),
+                         "enlargeStablePtrTable");
+    memset(seg, 0, STABLE_PTR_SEGMENT_SIZE * sizeof(spEntry));
+    RELEASE_STORE(&stable_ptr_table[n_spt_segments], seg);
+
+    // There is always room on the free stack for every entry in the table.
+    stable_ptr_free =
+        stgReallocBytes(stable_ptr_free,
+                        (n_spt_segments + 1) * STABLE_PTR_SEGMENT_SIZE
+                            * sizeof(StgWord),
+                        "enlargeStablePtrTable");
+
+    // Push the new entries so that the lowest index is handed out first.
+    base = (StgWord)n_spt_segments * STABLE_PTR_SEGMENT_SIZE;
+    for (i = STABLE_PTR_SEGMENT_SIZE; i > 0; i--) {
+        stable_ptr_free[n_stable_ptr_free++] = base + i - 1;
+    }
+    n_spt_segments++;
+}
 
-    initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
+STATIC_INLINE spEntry *
+spEntryOf(StgWord sp)
+{
+    ASSERT(sp < (StgWord)n_spt_segments * STABLE_PTR_SEGMENT_SIZE);
+    return &stable_ptr_table[sp >> STABLE_PTR_SEGMENT_BITS]
+                            [sp & STABLE_PTR_SEGMENT_MASK];
 }
 
-/* Note [Enlarging the stable pointer table]
- *
- * To enlarge the stable pointer table, we allocate a new table, copy the
- * existing entries, and then store the old version of the table in old_SPTs
- * until we free it during GC.  By not immediately freeing the old version
- * (or equivalently by not growing the table using realloc()), we ensure that
- * another thread simultaneously dereferencing a stable pointer using the old
- * version can safely access the table without causing a segfault (see Trac
- * #10296).
- *
- * Note that because the stable pointer table is doubled in size each time it is
- * enlarged, the total memory needed to store the old versions is always less
- * than that required to hold the current version.
+/* -----------------------------------------------------------------------------
+ * Per-capability caches of free entries
+ * -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+/* The Capability owned by the calling OS thread, or NULL if it doesn't own
+ * one (e.g. it is a foreign thread, or a Haskell thread in a safe foreign
+ * call).  Only the owner of a Capability may use its cache.
  */
+STATIC_INLINE Capability *
+myOwnedCapability(void)
+{
+    Task *task = myTask();
+
+    if (task == NULL || !taskOwnsCapability(task)) return NULL;
+    return task->cap;
+}
+
+static void
+refillStablePtrCache(Capability *cap)
+{
+    ACQUIRE_LOCK(&stable_ptr_mutex);
+    while (cap->n_stable_ptr_free < STABLE_PTR_CACHE_SIZE / 2) {
+        if (n_stable_ptr_free == 0) enlargeStablePtrTable();
+        cap->stable_ptr_free[cap->n_stable_ptr_free++] =
+            stable_ptr_free[--n_stable_ptr_free];
+    }
+    RELEASE_LOCK(&stable_ptr_mutex);
+}
+
+static void
+flushStablePtrCache(Capability *cap)
+{
+    ACQUIRE_LOCK(&stable_ptr_mutex);
+    while (cap->n_stable_ptr_free > STABLE_PTR_CACHE_SIZE / 2) {
+        stable_ptr_free[n_stable_ptr_free++] =
+            cap->stable_ptr_free[--cap->n_stable_ptr_free];
+    }
+    RELEASE_LOCK(&stable_ptr_mutex);
+}
 
+#endif /* THREADED_RTS */
 
 /* -----------------------------------------------------------------------------
  * Freeing entries and tables
@@ -233,10 +322,29 @@ freeOldSPTs(void)
 void
 exitStablePtrTable(void)
 {
-    if (stable_ptr_table)
+    uint32_t i;
+
+    if (stable_ptr_table) {
+        for (i = 0; i < n_spt_segments; i++) {
+            stgFree(stable_ptr_table[i]);
+        }
         stgFree(stable_ptr_table);
+    }
     stable_ptr_table = NULL;
-    SPT_size = 0;
+    n_spt_segments = 0;
+    spt_dir_size = 0;
+
+    if (stable_ptr_free)
+        stgFree(stable_ptr_free);
+    stable_ptr_free = NULL;
+    n_stable_ptr_free = 0;
+
+#if defined(THREADED_RTS)
+    // The entries cached by capabilities are gone too.
+    for (i = 0; i < n_capabilities; i++) {
+        capabilities[i]->n_stable_ptr_free = 0;
+    }
+#endif
 
     freeOldSPTs();
 
@@ -245,23 +353,29 @@ exitStablePtrTable(void)
 #endif
 }
 
-STATIC_INLINE void
-freeSpEntry(spEntry *sp)
-{
-    RELAXED_STORE(&sp->addr, (P_)stable_ptr_free);
-    stable_ptr_free = sp;
-}
-
 void
 freeStablePtrUnsafe(StgStablePtr sp)
 {
-    ASSERT((StgWord)sp < SPT_size);
-    freeSpEntry(&stable_ptr_table[(StgWord)sp]);
+    RELAXED_STORE(&spEntryOf((StgWord)sp)->addr, NULL);
+    stable_ptr_free[n_stable_ptr_free++] = (StgWord)sp;
 }
 
 void
 freeStablePtr(StgStablePtr sp)
 {
+#if defined(THREADED_RTS)
+    Capability *cap = myOwnedCapability();
+
+    if (cap != NULL) {
+        RELAXED_STORE(&spEntryOf((StgWord)sp)->addr, NULL);
+        if (cap->n_stable_ptr_free == STABLE_PTR_CACHE_SIZE) {
+            flushStablePtrCache(cap);
+        }
+        cap->stable_ptr_free[cap->n_stable_ptr_free++] = (StgWord)sp;
+        return;
+    }
+#endif
+
     stablePtrLock();
     freeStablePtrUnsafe(sp);
     stablePtrUnlock();
@@ -276,11 +390,23 @@ getStablePtr(StgPtr p)
 {
   StgWord sp;
 
+#if defined(THREADED_RTS)
+  Capability *cap = myOwnedCapability();
+
+  if (cap != NULL) {
+      if (cap->n_stable_ptr_free == 0) refillStablePtrCache(cap);
+      sp = cap->stable_ptr_free[--cap->n_stable_ptr_free];
+      // release store to ensure that the object is visible to anyone
+      // dereferencing the stable pointer; see deRefStablePtr.
+      RELEASE_STORE(&spEntryOf(sp)->addr, p);
+      return (StgStablePtr)(sp);
+  }
+#endif
+
   stablePtrLock();
-  if (!stable_ptr_free) enlargeStablePtrTable();
-  sp = stable_ptr_free - stable_ptr_table;
-  stable_ptr_free  = (spEntry*)(stable_ptr_free->addr);
-  RELAXED_STORE(&stable_ptr_table[sp].addr, p);
+  if (n_stable_ptr_free == 0) enlargeStablePtrTable();
+  sp = stable_ptr_free[--n_stable_ptr_free];
+  RELAXED_STORE(&spEntryOf(sp)->addr, p);
   stablePtrUnlock();
   return (StgStablePtr)(sp);
 }
@@ -291,15 +417,16 @@ getStablePtr(StgPtr p)
 
 #define FOR_EACH_STABLE_PTR(p, CODE)                                    \
     do {                                                                \
-        spEntry *p;                                                     \
-        spEntry *__end_ptr = &stable_ptr_table[SPT_size];               \
-        for (p = stable_ptr_table; p < __end_ptr; p++) {                \
-            /* Internal pointers are free slots. NULL is last in free */ \
-            /* list. */                                                 \
-            if (p->addr &&                                              \
-                (p->addr < (P_)stable_ptr_table || p->addr >= (P_)__end_ptr)) \
-            {                                                           \
-                do { CODE } while(0);                                   \
+        uint32_t __seg;                                                 \
+        for (__seg = 0; __seg < n_spt_segments; __seg++) {              \
+            spEntry *p;                                                 \
+            spEntry *__end_ptr =                                        \
+                &stable_ptr_table[__seg][STABLE_PTR_SEGMENT_SIZE];      \
+            for (p = stable_ptr_table[__seg]; p < __end_ptr; p++) {     \
+                /* NULL entries are free. */                            \
+                if (p->addr) {                                          \
+                    do { CODE } while(0);                               \
+                }                                                       \
             }                                                           \
         }                                                               \
     } while(0)
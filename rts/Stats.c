@@ -18,6 +18,8 @@
 #include "sm/Storage.h"
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "sm/OSMem.h"
+#include "sm/HeapAlloc.h"
 
 // for spin/yield counters
 #include "sm/GC.h"
@@ -65,6 +67,17 @@ static RTSStats stats;
 
 static W_ GC_end_faults = 0;
 
+// The most free space we have seen in blocks of small pinned objects, and
+// the size of those blocks at the time; see Note [Pinned block recycling]
+// in Storage.c.
+static W_ max_pinned_free_bytes = 0;
+static W_ max_pinned_bytes = 0;
+
+// The total time spent in each phase of GC, and waiting for work while
+// scavenging; see Note [GC phase timing] in GC.c.
+static Time GC_phase_elapsed[N_GC_PHASES];
+static Time GC_par_idle_elapsed;
+
 static Time *GC_coll_cpu = NULL;
 static Time *GC_coll_elapsed = NULL;
 static Time *GC_coll_max_pause = NULL;
@@ -140,6 +153,11 @@ initStats0(void)
 
     GC_end_faults = 0;
 
+    for (uint32_t i = 0; i < N_GC_PHASES; i++) {
+        GC_phase_elapsed[i] = 0;
+    }
+    GC_par_idle_elapsed = 0;
+
     stats = (RTSStats) {
         .gcs = 0,
         .major_gcs = 0,
@@ -408,7 +426,7 @@ stat_startGCWorker (Capability *cap STG_UNUSED, gc_thread *gct)
 }
 
 void
-stat_endGCWorker (Capability *cap STG_UNUSED, gc_thread *gct)
+stat_endGCWorker (Capability *cap, gc_thread *gct)
 {
     bool stats_enabled =
         RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
@@ -418,6 +436,13 @@ stat_endGCWorker (Capability *cap STG_UNUSED, gc_thread *gct)
         gct->gc_end_cpu = getCurrentThreadCPUTime();
         ASSERT(gct->gc_end_cpu >= gct->gc_start_cpu);
     }
+
+    // See Note [GC phase timing] in GC.c
+    traceEventGcThreadTimes(cap,
+                            gct->gc_phase_elapsed[GC_PHASE_ROOTS],
+                            gct->gc_phase_elapsed[GC_PHASE_SCAV],
+                            gct->gc_idle_elapsed,
+                            gct->gc_phase_elapsed[GC_PHASE_SWEEP]);
 }
 
 void
@@ -488,6 +513,39 @@ stat_endGC (Capability *cap, gc_thread *initiating_gct, W_ live, W_ copied, W_ s
     stats.gc.par_max_copied_bytes = par_max_copied * sizeof(W_);
     stats.gc.par_balanced_copied_bytes = par_balanced_copied * sizeof(W_);
 
+    // See Note [Adaptive nursery sizing] in GC.c
+    stats.gc.nursery_bytes = 0;
+    stats.gc.max_nursery_bytes = 0;
+    for (uint32_t i = 0; i < n_nurseries; i++) {
+        uint64_t bytes = nurseries[i].n_blocks * BLOCK_SIZE;
+        stats.gc.nursery_bytes += bytes;
+        stats.gc.max_nursery_bytes = stg_max(stats.gc.max_nursery_bytes, bytes);
+    }
+
+    // See Note [GC phase timing] in GC.c
+    const Time *phase = initiating_gct->gc_phase_elapsed;
+    stats.gc.roots_elapsed_ns = phase[GC_PHASE_ROOTS];
+    stats.gc.cafs_elapsed_ns = phase[GC_PHASE_CAFS];
+    stats.gc.scav_elapsed_ns = phase[GC_PHASE_SCAV];
+    stats.gc.weak_elapsed_ns = phase[GC_PHASE_WEAK];
+    stats.gc.sweep_elapsed_ns = phase[GC_PHASE_SWEEP];
+    stats.gc.free_elapsed_ns = phase[GC_PHASE_FREE];
+    for (uint32_t i = 0; i < N_GC_PHASES; i++) {
+        GC_phase_elapsed[i] += phase[i];
+    }
+    stats.gc.par_idle_elapsed_ns = 0;
+    for (uint32_t i = 0; i < par_n_threads; i++) {
+        if (par_n_threads > 1) {
+            stats.gc.par_idle_elapsed_ns += gc_threads[i]->gc_idle_elapsed;
+        }
+        // The threads of idle capabilities don't take part in the next GC,
+        // so don't leave them counting this one.
+        memset(gc_threads[i]->gc_phase_elapsed, 0,
+               sizeof(gc_threads[i]->gc_phase_elapsed));
+        gc_threads[i]->gc_idle_elapsed = 0;
+    }
+    GC_par_idle_elapsed += stats.gc.par_idle_elapsed_ns;
+
     bool stats_enabled =
         RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
         rtsConfig.gcDoneHook != NULL;
@@ -602,6 +660,28 @@ stat_endGC (Capability *cap, gc_thread *initiating_gct, W_ live, W_ copied, W_ s
                                stats.gc.live_bytes);
         }
 
+        // Fragmentation of the pinned blocks
+        W_ pinned_bytes = 0, pinned_free_bytes = 0;
+        for (uint32_t g = 0; g < RtsFlags.GcFlags.generations; g++) {
+            pinned_bytes += generations[g].n_pinned_blocks * BLOCK_SIZE;
+            pinned_free_bytes +=
+                generations[g].n_pinned_free_words * sizeof(W_);
+        }
+        if (pinned_free_bytes > max_pinned_free_bytes) {
+            max_pinned_free_bytes = pinned_free_bytes;
+            max_pinned_bytes = pinned_bytes;
+        }
+        traceEventPinnedFragmentation(cap, CAPSET_HEAP_DEFAULT,
+                                      pinned_bytes, pinned_free_bytes);
+
+        traceEventGcPhases(cap, CAPSET_HEAP_DEFAULT,
+                           stats.gc.roots_elapsed_ns,
+                           stats.gc.cafs_elapsed_ns,
+                           stats.gc.scav_elapsed_ns,
+                           stats.gc.weak_elapsed_ns,
+                           stats.gc.sweep_elapsed_ns,
+                           stats.gc.free_elapsed_ns);
+
         // -------------------------------------------------
         // Print GC stats to stdout or a file (+RTS -S/-s)
 
@@ -835,6 +915,19 @@ static void report_summary(const RTSSummaryStats* sum)
     showStgWord64(stats.max_slop_bytes, temp, true/*commas*/);
     statsPrintf("%16s bytes maximum slop\n", temp);
 
+    if (max_pinned_free_bytes > 0) {
+        char temp2[512];
+        showStgWord64(max_pinned_free_bytes, temp, true/*commas*/);
+        showStgWord64(max_pinned_bytes, temp2, true/*commas*/);
+        statsPrintf("%16s bytes maximum free in pinned blocks (of %s bytes)\n",
+                    temp, temp2);
+    }
+
+    if (RtsFlags.GcFlags.hugePages) {
+        showStgWord64(sum->huge_page_bytes, temp, true/*commas*/);
+        statsPrintf("%16s bytes of the heap in huge pages at exit\n", temp);
+    }
+
     statsPrintf("%16" FMT_Word64 " MiB total memory in use (%"
                 FMT_Word64 " MB lost due to fragmentation)\n\n",
                 stats.max_mem_in_use_bytes  / (1024 * 1024),
@@ -895,6 +988,25 @@ static void report_summary(const RTSSummaryStats* sum)
                 sum->sparks.converted, sum->sparks.overflowed,
                 sum->sparks.dud, sum->sparks.gcd,
                 sum->sparks.fizzled);
+
+    if (n_capabilities > 1) {
+        statsPrintf("  STEALS: %" FMT_Word " local, %" FMT_Word
+                    " remote (%" FMT_Word " sparks, %" FMT_Word
+                    " lost races)\n",
+                    sum->steals.local, sum->steals.remote,
+                    sum->steals.sparks, sum->steals.failed);
+        if (RtsFlags.GcFlags.giveStats >= VERBOSE_GC_STATS) {
+            for (uint32_t i = 0; i < n_capabilities; i++) {
+                const StealCounters *s = &capabilities[i]->steal_stats;
+                statsPrintf("    cap %2d (node %d): %" FMT_Word " local, %"
+                            FMT_Word " remote (%" FMT_Word " sparks, %"
+                            FMT_Word " lost races)\n",
+                            i, capabilities[i]->node, s->local, s->remote,
+                            s->sparks, s->failed);
+            }
+        }
+        statsPrintf("\n");
+    }
 #endif
 
     statsPrintf("  INIT    time  %7.3fs  (%7.3fs elapsed)\n",
@@ -1100,6 +1212,9 @@ static void report_machine_readable (const RTSSummaryStats * sum)
             stats.max_large_objects_bytes);
     MR_STAT("max_compact_bytes", FMT_Word64, stats.max_compact_bytes);
     MR_STAT("max_slop_bytes", FMT_Word64, stats.max_slop_bytes);
+    MR_STAT("max_pinned_free_bytes", FMT_Word, max_pinned_free_bytes);
+    MR_STAT("max_pinned_bytes", FMT_Word, max_pinned_bytes);
+    MR_STAT("huge_page_bytes", FMT_Word64, sum->huge_page_bytes);
     // This duplicates, except for unit, peak_megabytes_allocated above
     MR_STAT("max_mem_in_use_bytes", FMT_Word64, stats.max_mem_in_use_bytes);
     MR_STAT("cumulative_live_bytes", FMT_Word64, stats.cumulative_live_bytes);
@@ -1110,6 +1225,22 @@ static void report_machine_readable (const RTSSummaryStats * sum)
     MR_STAT("cumulative_par_balanced_copied_bytes", FMT_Word64,
             stats.cumulative_par_balanced_copied_bytes);
 
+    // See Note [GC phase timing] in GC.c
+    MR_STAT("GC_roots_wall_seconds", "f",
+            TimeToSecondsDbl(GC_phase_elapsed[GC_PHASE_ROOTS]));
+    MR_STAT("GC_cafs_wall_seconds", "f",
+            TimeToSecondsDbl(GC_phase_elapsed[GC_PHASE_CAFS]));
+    MR_STAT("GC_scav_wall_seconds", "f",
+            TimeToSecondsDbl(GC_phase_elapsed[GC_PHASE_SCAV]));
+    MR_STAT("GC_weak_wall_seconds", "f",
+            TimeToSecondsDbl(GC_phase_elapsed[GC_PHASE_WEAK]));
+    MR_STAT("GC_sweep_wall_seconds", "f",
+            TimeToSecondsDbl(GC_phase_elapsed[GC_PHASE_SWEEP]));
+    MR_STAT("GC_free_wall_seconds", "f",
+            TimeToSecondsDbl(GC_phase_elapsed[GC_PHASE_FREE]));
+    MR_STAT("GC_par_idle_wall_seconds", "f",
+            TimeToSecondsDbl(GC_par_idle_elapsed));
+
     // next, the computed fields in RTSSummaryStats
 #if !defined(THREADED_RTS) // THREADED_RTS
     MR_STAT("gc_cpu_percent", "f", sum->gc_cpu_percent);
@@ -1132,6 +1263,10 @@ static void report_machine_readable (const RTSSummaryStats * sum)
     MR_STAT("sparks_dud ", FMT_Word, sum->sparks.dud);
     MR_STAT("sparks_gcd", FMT_Word, sum->sparks.gcd);
     MR_STAT("sparks_fizzled", FMT_Word, sum->sparks.fizzled);
+    MR_STAT("steals_local", FMT_Word, sum->steals.local);
+    MR_STAT("steals_remote", FMT_Word, sum->steals.remote);
+    MR_STAT("steals_sparks", FMT_Word, sum->steals.sparks);
+    MR_STAT("steals_failed", FMT_Word, sum->steals.failed);
     MR_STAT("work_balance", "f", sum->work_balance);
 
     // next, globals (other than internal counters)
@@ -1363,6 +1498,10 @@ stat_exitReport (void)
                   capabilities[i]->spark_stats.converted;
                 sum.sparks.gcd       += capabilities[i]->spark_stats.gcd;
                 sum.sparks.fizzled   += capabilities[i]->spark_stats.fizzled;
+                sum.steals.local     += capabilities[i]->steal_stats.local;
+                sum.steals.remote    += capabilities[i]->steal_stats.remote;
+                sum.steals.sparks    += capabilities[i]->steal_stats.sparks;
+                sum.steals.failed    += capabilities[i]->steal_stats.failed;
             }
 
             sum.sparks_count = sum.sparks.created
@@ -1393,6 +1532,17 @@ stat_exitReport (void)
                          - hw_alloc_blocks * BLOCK_SIZE_W)
                 / (uint64_t)sizeof(W_);
 
+            // See Note [Transparent huge pages] in posix/OSMem.c
+            if (osHugePageSize() != 0) {
+    #if defined(USE_LARGE_ADDRESS_SPACE)
+                sum.huge_page_bytes =
+                    osHugePageBytes(mblock_address_space.begin,
+                                    mblock_address_space.end);
+    #else
+                sum.huge_page_bytes = osHugePageBytes(0, (W_)-1);
+    #endif
+            }
+
             sum.average_bytes_used = stats.major_gcs == 0 ? 0 :
                  stats.cumulative_live_bytes/stats.major_gcs,
 
@@ -1662,9 +1812,10 @@ statDescribeGens(void)
       for (i = 0; i < n_capabilities; i++) {
           mut += countOccupied(capabilities[i]->mut_lists[g]);
 
-          // Add the pinned object block.
+          // Add the pinned object block, unless it is a recycled one,
+          // which is already on a large_objects list.
           bd = capabilities[i]->pinned_object_block;
-          if (bd != NULL) {
+          if (bd != NULL && pinnedBlockHeader(bd)->hole == NULL) {
               gen_live   += bd->free - bd->start;
               gen_blocks += bd->blocks;
           }
@@ -1725,6 +1876,15 @@ void getRTSStats( RTSStats *s )
         stats.nonmoving_gc_cpu_ns;
     s->mutator_elapsed_ns = current_elapsed - end_init_elapsed -
         stats.gc_elapsed_ns;
+
+    // See Note [Run queue delays] in Schedule.c
+    for (uint32_t b = 0; b < RUN_QUEUE_DELAY_BUCKETS; b++) {
+        s->run_queue_delay_histogram[b] = 0;
+        for (uint32_t i = 0; i < n_capabilities; i++) {
+            s->run_queue_delay_histogram[b] +=
+                RELAXED_LOAD(&capabilities[i]->run_queue_delays[b]);
+        }
+    }
 }
 
 /* -----------------------------------------------------------------------------
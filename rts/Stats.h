@@ -101,12 +101,14 @@ typedef struct RTSSummaryStats_ {
     uint32_t bound_task_count;
     uint64_t sparks_count;
     SparkCounters sparks;
+    StealCounters steals;
     double work_balance;
 #else // THREADED_RTS
     double gc_cpu_percent;
     double gc_elapsed_percent;
 #endif
     uint64_t fragmentation_bytes;
+    uint64_t huge_page_bytes;
     uint64_t average_bytes_used; // This is not shown in the '+RTS -s' report
     uint64_t alloc_rate;
     double productivity_cpu_percent;
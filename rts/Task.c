@@ -272,6 +272,7 @@ newInCall (Task *task)
     incall->task = task;
     incall->suspended_tso = NULL;
     incall->suspended_cap = NULL;
+    incall->ccall_hold    = 0;
     incall->rstat         = NoStatus;
     incall->ret           = NULL;
     incall->next = NULL;
@@ -93,6 +93,10 @@ typedef struct InCall_ {
                                 // without owning a Capability in the
                                 // first place.
 
+    StgWord ccall_hold;         // Non-zero if the foreign call holds on
+                                // to suspended_cap; see Note [Lazy
+                                // capability handoff] in Capability.c
+
     SchedulerStatus  rstat;     // return status
     StgClosure **    ret;       // return value
 
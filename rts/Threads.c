@@ -111,6 +111,11 @@ createThread(Capability *cap, W_ size)
 
     ASSIGN_Int64((W_*)&(tso->alloc_limit), 0);
 
+    // See Note [Thread priority classes] in Schedule.c
+    tso->prio           = TSO_PRIO_NORMAL;
+    tso->run_queue_prio = TSO_PRIO_NORMAL;
+    tso->run_queue_time = 0;
+
     tso->trec = NO_TREC;
 
 #if defined(PROFILING)
@@ -196,6 +201,26 @@ void rts_disableThreadAllocationLimit(StgPtr tso)
     ((StgTSO *)tso)->flags &= ~TSO_ALLOC_LIMIT;
 }
 
+/* ---------------------------------------------------------------------------
+ * Setting and getting a thread's priority class
+ *
+ * The thread may be on another Capability's run queue, so the new class
+ * takes effect when it next joins a run queue; see Note [Thread priority
+ * classes] in Schedule.c.
+ * ------------------------------------------------------------------------ */
+
+void rts_setThreadPriority(StgPtr tso, int prio)
+{
+    ASSERT(prio >= 0 && prio < N_TSO_PRIOS);
+    RELAXED_STORE(&((StgTSO *)tso)->prio, (StgWord16)prio);
+    traceEventThreadPriority(rts_unsafeGetMyCapability(), (StgTSO *)tso, prio);
+}
+
+int rts_getThreadPriority(StgPtr tso)
+{
+    return RELAXED_LOAD(&((StgTSO *)tso)->prio);
+}
+
 /* -----------------------------------------------------------------------------
    Remove a thread from a queue.
    Fails fatally if the TSO is not on the queue.
@@ -941,8 +966,10 @@ printAllThreads(void)
   for (i = 0; i < n_capabilities; i++) {
       cap = capabilities[i];
       debugBelch("threads on capability %d:\n", cap->no);
-      for (t = cap->run_queue_hd; t != END_TSO_QUEUE; t = t->_link) {
-          printThreadStatus(t);
+      for (uint32_t p = 0; p < N_TSO_PRIOS; p++) {
+          for (t = cap->run_queue_hd[p]; t != END_TSO_QUEUE; t = t->_link) {
+              printThreadStatus(t);
+          }
       }
   }
 
@@ -24,6 +24,7 @@
 #include "Ticker.h"
 #include "Capability.h"
 #include "RtsSignals.h"
+#include "Sparks.h"
 
 // This global counter is used to allow multiple threads to stop the
 // timer temporarily with a stopTimer()/startTimer() pair.  If
@@ -90,6 +91,93 @@ static int idle_ticks_to_gc = 0;
 /* - countdown for minimum time *between* idle GCs (set by -Iw) */
 static int inter_gc_ticks_to_gc = 0;
 
+/*
+ Note [Tickless timer]
+ ---------------------
+
+ The timer ticks every -V interval for as long as the program runs Haskell
+ code, and each tick context switches every capability.  When each
+ capability has only the thread it is running, that switch achieves
+ nothing, and a host full of mostly idle services spends its CPU on
+ wakeups.  With +RTS --tickless the timer parks itself when no tick is
+ needed, which is when
+
+   - no capability has a thread waiting on its run queue, or sparks that
+     an idle capability might want,
+   - no profile is being taken (profTimerNeeded()), and
+   - some capability is running Haskell code.  If none is, the program may
+     be going idle, and we need the ticks to count down to the idle GC
+     (Note [GC During Idle Time]) and deadlock detection.
+
+ handle_tick() checks this after each tick; since a capability running
+ Haskell code means the program is busy, it also resets recent_activity
+ so that the idle GC countdown starts afresh when the timer restarts.
+ Parking and unparking are a stopTimer()/startTimer() pair, made exactly
+ once each by the CAS on timer_parked.  initTimer() resets timer_disabled,
+ so it clears timer_parked too: the child of forkProcess() inherits both,
+ and a stale timer_parked would make the next unpark start the timer a
+ second time.
+
+ The timer is unparked (wakeTimer()) when a tick becomes needed:
+
+   - when a thread joins the run queue of a capability running Haskell
+     code (appendToRunQueue() and pushOnRunQueue()), or is about to run
+     with others waiting behind it (schedule()),
+   - when a spark is created (newSpark()), and
+   - when a capability has nothing left to do (releaseCapability_()).
+
+ The check in handle_tick() and the enqueue on a capability are not
+ synchronised: a thread could join a run queue just as the timer parks
+ and miss the wakeup.  We don't pay for a memory fence on every enqueue to
+ prevent that.  The waiting thread gets its turn when the running one next
+ returns to the scheduler, at the latest at the next GC, which is no worse
+ than a thread that doesn't allocate does anyway.
+*/
+
+#if defined(THREADED_RTS)
+StgWord timer_parked = 0;
+
+static bool
+tickNeeded (void)
+{
+    bool running = false;
+
+    if (profTimerNeeded()) {
+        return true;
+    }
+    for (uint32_t i = 0; i < n_capabilities; i++) {
+        Capability *cap = capabilities[i];
+        if (RELAXED_LOAD(&cap->n_run_queue) != 0 ||
+            sparkPoolSizeCap(cap) != 0) {
+            return true;
+        }
+        if (RELAXED_LOAD(&cap->in_haskell)) {
+            running = true;
+        }
+    }
+    return !running;
+}
+
+static void
+parkTimer (void)
+{
+    if (cas((StgVolatilePtr)&timer_parked, 0, 1) == 0) {
+        // We're busy, so don't count the time parked towards the idle GC
+        cas((StgVolatilePtr)&recent_activity,
+            ACTIVITY_MAYBE_NO, ACTIVITY_YES);
+        stopTimer();
+    }
+}
+
+void
+unparkTimer (void)
+{
+    if (cas((StgVolatilePtr)&timer_parked, 1, 0) == 1) {
+        startTimer();
+    }
+}
+#endif
+
 /*
  * Function: handle_tick()
  *
@@ -157,6 +245,14 @@ handle_tick(int unused STG_UNUSED)
   default:
       break;
   }
+
+#if defined(THREADED_RTS)
+  // See Note [Tickless timer]
+  if (RtsFlags.MiscFlags.tickless && SEQ_CST_LOAD(&timer_disabled) == 0 &&
+      !tickNeeded()) {
+      parkTimer();
+  }
+#endif
 }
 
 void
@@ -167,6 +263,10 @@ initTimer(void)
         initTicker(RtsFlags.MiscFlags.tickInterval, handle_tick);
     }
     SEQ_CST_STORE(&timer_disabled, 1);
+#if defined(THREADED_RTS)
+    // See Note [Tickless timer]
+    SEQ_CST_STORE(&timer_parked, 0);
+#endif
 }
 
 void
@@ -10,3 +10,16 @@
 
 RTS_PRIVATE void initTimer (void);
 RTS_PRIVATE void exitTimer (bool wait);
+
+#if defined(THREADED_RTS)
+// See Note [Tickless timer] in Timer.c
+extern RTS_PRIVATE StgWord timer_parked;
+RTS_PRIVATE void unparkTimer (void);
+
+INLINE_HEADER void wakeTimer (void)
+{
+    if (RTS_UNLIKELY(RELAXED_LOAD(&timer_parked))) {
+        unparkTimer();
+    }
+}
+#endif
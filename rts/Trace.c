@@ -207,6 +207,14 @@ static void traceSchedEvent_stderr (Capability *cap, EventTypeNum tag,
         debugBelch("cap %d: waking up thread %" FMT_Word "[\"%s\"]" " on cap %d\n",
                    cap->no, (W_)tso->id, threadLabel, (int)info1);
         break;
+    case EVENT_THREAD_PRIORITY: // (cap, thread, priority)
+        debugBelch("cap %d: thread %" FMT_Word "[\"%s\"]" " has priority class %d\n",
+                   cap->no, (W_)tso->id, threadLabel, (int)info1);
+        break;
+    case EVENT_THREAD_QUEUE_DELAY: // (cap, thread, priority, delay_ns)
+        debugBelch("cap %d: thread %" FMT_Word "[\"%s\"]" " waited %" FMT_Word "ns on run queue %d\n",
+                   cap->no, (W_)tso->id, threadLabel, (W_)info2, (int)info1);
+        break;
 
     case EVENT_STOP_THREAD:     // (cap, thread, status)
         if (info1 == 6 + BlockedOnBlackHole) {
@@ -369,6 +377,70 @@ void traceEventGcStats_  (Capability *cap,
     }
 }
 
+void traceEventPinnedFragmentation_ (Capability *cap,
+                                     CapsetID    heap_capset,
+                                     W_          pinned_bytes,
+                                     W_          free_bytes)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postEventPinnedFragmentation(cap, heap_capset,
+                                     pinned_bytes, free_bytes);
+    }
+}
+
+void traceEventGcPhases_ (Capability *cap,
+                          CapsetID    heap_capset,
+                          Time        roots,
+                          Time        cafs,
+                          Time        scav,
+                          Time        weak,
+                          Time        sweep,
+                          Time        freeing)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postEventGcPhases(cap, heap_capset, roots, cafs,
+                          scav, weak, sweep, freeing);
+    }
+}
+
+void traceEventGcThreadTimes_ (Capability *cap,
+                               Time        roots,
+                               Time        scav,
+                               Time        idle,
+                               Time        sweep)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postEventGcThreadTimes(cap, roots, scav, idle, sweep);
+    }
+}
+
+void traceEventRunQueueDelays_ (Capability *cap, StgWord64 *counts)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for these ones */
+    } else
+#endif
+    {
+        postEventRunQueueDelays(cap, counts);
+    }
+}
+
 void traceCapEvent_ (Capability   *cap,
                      EventTypeNum  tag)
 {
@@ -824,6 +896,13 @@ void traceConcMarkEnd(StgWord32 marked_obj_count)
         postConcMarkEnd(marked_obj_count);
 }
 
+void traceConcMarkWorker(StgWord32 worker, StgWord32 marked_obj_count,
+                         StgWord64 busy_ns)
+{
+    if (eventlog_enabled)
+        postConcMarkWorker(worker, marked_obj_count, busy_ns);
+}
+
 void traceConcSyncBegin()
 {
     if (eventlog_enabled)
@@ -158,6 +158,31 @@ void traceEventGcStats_  (Capability *cap,
                           W_        par_tot_copied,
                           W_        par_balanced_copied);
 
+void traceEventPinnedFragmentation_ (Capability *cap,
+                                     CapsetID    heap_capset,
+                                     W_          pinned_bytes,
+                                     W_          free_bytes);
+
+void traceEventGcPhases_ (Capability *cap,
+                          CapsetID    heap_capset,
+                          Time        roots,
+                          Time        cafs,
+                          Time        scav,
+                          Time        weak,
+                          Time        sweep,
+                          Time        freeing);
+
+void traceEventGcThreadTimes_ (Capability *cap,
+                               Time        roots,
+                               Time        scav,
+                               Time        idle,
+                               Time        sweep);
+
+/*
+ * Record the histogram of run queue delays
+ */
+void traceEventRunQueueDelays_ (Capability *cap, StgWord64 *counts);
+
 /*
  * Record a spark event
  */
@@ -312,6 +337,8 @@ void traceProfBegin(void);
 
 void traceConcMarkBegin(void);
 void traceConcMarkEnd(StgWord32 marked_obj_count);
+void traceConcMarkWorker(StgWord32 worker, StgWord32 marked_obj_count,
+                         StgWord64 busy_ns);
 void traceConcSyncBegin(void);
 void traceConcSyncEnd(void);
 void traceConcSweepBegin(void);
@@ -332,6 +359,12 @@ void flushTrace(void);
                            par_n_threads, par_max_copied, \
                            par_tot_copied, par_balanced_copied) /* nothing */
 #define traceHeapEvent(cap, tag, heap_capset, info1) /* nothing */
+#define traceEventPinnedFragmentation_(cap, heap_capset, \
+                                       pinned_bytes, free_bytes) /* nothing */
+#define traceEventGcPhases_(cap, heap_capset, roots, cafs, \
+                            scav, weak, sweep, freeing) /* nothing */
+#define traceEventGcThreadTimes_(cap, roots, scav, idle, sweep) /* nothing */
+#define traceEventRunQueueDelays_(cap, counts) /* nothing */
 #define traceEventHeapInfo_(heap_capset, gens, \
                             maxHeapSize, allocAreaSize, \
                             mblockSize, blockSize) /* nothing */
@@ -361,6 +394,7 @@ void flushTrace(void);
 
 #define traceConcMarkBegin() /* nothing */
 #define traceConcMarkEnd(marked_obj_count) /* nothing */
+#define traceConcMarkWorker(worker, marked_obj_count, busy_ns) /* nothing */
 #define traceConcSyncBegin() /* nothing */
 #define traceConcSyncEnd() /* nothing */
 #define traceConcSweepBegin() /* nothing */
@@ -594,6 +628,31 @@ INLINE_HEADER void traceEventMigrateThread(Capability *cap     STG_UNUSED,
                         (EventCapNo)new_cap);
 }
 
+INLINE_HEADER void traceEventThreadPriority(Capability *cap  STG_UNUSED,
+                                            StgTSO     *tso  STG_UNUSED,
+                                            uint32_t    prio STG_UNUSED)
+{
+    traceSchedEvent(cap, EVENT_THREAD_PRIORITY, tso, prio);
+}
+
+// How long the thread waited on the run queue before running; see
+// Note [Run queue delays] in Schedule.c
+INLINE_HEADER void traceEventThreadQueueDelay(Capability *cap   STG_UNUSED,
+                                              StgTSO     *tso   STG_UNUSED,
+                                              Time        delay STG_UNUSED)
+{
+    traceSchedEvent2(cap, EVENT_THREAD_QUEUE_DELAY, tso, tso->run_queue_prio,
+                     TimeToNS(delay));
+}
+
+INLINE_HEADER void traceEventRunQueueDelays(Capability *cap    STG_UNUSED,
+                                            StgWord64  *counts STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceEventRunQueueDelays_(cap, counts);
+    }
+}
+
 INLINE_HEADER void traceCapCreate(Capability *cap STG_UNUSED)
 {
     traceCapEvent(cap, EVENT_CAP_CREATE);
@@ -763,6 +822,43 @@ INLINE_HEADER void traceEventHeapLive(Capability *cap         STG_UNUSED,
     dtraceEventHeapLive(heap_capset, heap_live);
 }
 
+INLINE_HEADER void traceEventPinnedFragmentation(Capability *cap  STG_UNUSED,
+                                                 CapsetID    heap_capset  STG_UNUSED,
+                                                 W_          pinned_bytes STG_UNUSED,
+                                                 W_          free_bytes   STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventPinnedFragmentation_(cap, heap_capset,
+                                       pinned_bytes, free_bytes);
+    }
+}
+
+INLINE_HEADER void traceEventGcPhases(Capability *cap         STG_UNUSED,
+                                      CapsetID    heap_capset STG_UNUSED,
+                                      Time        roots       STG_UNUSED,
+                                      Time        cafs        STG_UNUSED,
+                                      Time        scav        STG_UNUSED,
+                                      Time        weak        STG_UNUSED,
+                                      Time        sweep       STG_UNUSED,
+                                      Time        freeing     STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcPhases_(cap, heap_capset, roots, cafs,
+                            scav, weak, sweep, freeing);
+    }
+}
+
+INLINE_HEADER void traceEventGcThreadTimes(Capability *cap   STG_UNUSED,
+                                           Time        roots STG_UNUSED,
+                                           Time        scav  STG_UNUSED,
+                                           Time        idle  STG_UNUSED,
+                                           Time        sweep STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcThreadTimes_(cap, roots, scav, idle, sweep);
+    }
+}
+
 INLINE_HEADER void traceCapsetCreate(CapsetID   capset      STG_UNUSED,
                                      CapsetType capset_type STG_UNUSED)
 {
@@ -192,6 +192,57 @@ stealWSDeque (WSDeque *q)
     return stolen;
 }
 
+/* -----------------------------------------------------------------------------
+ * stealHalfWSDeque
+ *
+ * Note [Stealing half of a WSDeque]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A thief that takes one element per cas on top has to come back for
+ * every element it wants, and when many idle threads are stealing from
+ * one deque they spend most of their time fighting over top.
+ * stealHalfWSDeque_ instead claims the oldest half of the elements,
+ * [t, t+n) with n = ceil((b-t)/2), with a single cas of top from t to t+n,
+ * so that the thief can work through them locally.
+ *
+ * This is not safe against popWSDeque. The owner's pop takes the element
+ * at bottom-1 without a cas whenever it sees t < bottom-1, which is fine
+ * when thieves only ever take element t, but a thief that read an old
+ * bottom may have claimed elements right up to the one the owner is
+ * popping; after a few pops by the owner the two ranges overlap. So a
+ * deque that is stolen from in halves must be consumed by its owner from
+ * the "read" end too, with stealWSDeque_() or stealHalfWSDeque_(). Spark
+ * pools are used this way (see findSpark()); the GC's todo_q is not.
+ *
+ * pushWSDeque() is still fine: the thief reads the elements before its cas,
+ * and the owner only overwrites one of them after seeing top move past it,
+ * in which case the cas fails.
+ * -------------------------------------------------------------------------- */
+
+StgInt
+stealHalfWSDeque_ (WSDeque *q, void **buf, StgInt max)
+{
+    StgInt t = ACQUIRE_LOAD(&q->top);
+    SEQ_CST_FENCE();
+    StgInt b = ACQUIRE_LOAD(&q->bottom);
+
+    StgInt n = (b - t + 1) / 2;
+    if (n <= 0) {
+        /* Empty queue */
+        return 0;
+    }
+    if (n > max) {
+        n = max;
+    }
+
+    for (StgInt i = 0; i < n; i++) {
+        buf[i] = RELAXED_LOAD(&q->elements[(t + i) & q->moduloSize]);
+    }
+    if (!cas_top(q, t, t+n)) {
+        return 0;
+    }
+    return n;
+}
+
 /* -----------------------------------------------------------------------------
  * pushWSQueue
  * -------------------------------------------------------------------------- */
@@ -83,6 +83,15 @@ void * stealWSDeque_ (WSDeque *q);
 // NULL if the pool is empty.
 void * stealWSDeque (WSDeque *q);
 
+// Removes about half of the elements of the deque (at least one and at
+// most max) from the "read" end with a single cas, storing them in buf
+// oldest first. Returns the number of elements removed: 0 if the deque
+// is empty or there was a collision with another thief.
+//
+// Only safe if the owner never calls popWSDeque() on this deque; see
+// Note [Stealing half of a WSDeque] in WSDeque.c.
+StgInt stealHalfWSDeque_ (WSDeque *q, void **buf, StgInt max);
+
 // "guesses" whether a deque is empty. Can return false negatives in
 // presence of concurrent steal() calls, and false positives in
 // presence of a concurrent pushBottom().
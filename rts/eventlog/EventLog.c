@@ -35,6 +35,45 @@ static const EventLogWriter *event_log_writer = NULL;
 
 static int flushCount;
 
+// Are any events sampled? See Note [Eventlog sampling]
+static bool eventlog_sampling = false;
+
+// The credit each sampled event of a class costs, in ns, or 0 if the class
+// isn't rate-limited
+static StgWord64 sample_cost[TRACE_SAMPLE_CLASSES];
+
+// How much credit can build up while no events are posted
+#define SAMPLE_BURST_NS 100000000 // 100ms
+
+// Per-capability state for sampling one class of events, see
+// Note [Eventlog sampling]
+typedef struct {
+  uint32_t countdown; // events to skip before we post the next one
+  bool posting;       // are we posting the current thread's run, or GC?
+  bool decided;       // GC: have we copied the decision for the coming GC?
+  StgWord64 credit;   // credit for --eventlog-max-rate, in ns
+  StgWord64 last;     // when we last added to the credit
+} EventSampler;
+
+// The sampler for GC events, used only by the GC leader, and the decision
+// it made for the next collection; see Note [Eventlog sampling]
+static EventSampler gc_sampler;
+static bool gc_sample_next = true;
+
+static void
+initEventSampler (EventSampler *s, int cls)
+{
+    *s = (EventSampler) {
+        .countdown = 0,
+        .posting = true,
+        .decided = false,
+        .credit = stg_max(sample_cost[cls], SAMPLE_BURST_NS),
+        .last = 0,
+    };
+}
+
+static bool sampleEvent (EventSampler *s, int cls);
+
 // Struct for record keeping of buffer to store event types and events.
 typedef struct _EventsBuf {
   StgInt8 *begin;
@@ -42,6 +81,12 @@ typedef struct _EventsBuf {
   StgInt8 *marker;
   StgWord64 size;
   EventCapNo capno; // which capability this buffer belongs to, or -1
+  StgWord64 n_events; // events in the buffer, not counting the block marker
+  // events and bytes dropped since we last handed a buffer to the
+  // asynchronous writer (see Note [Asynchronous eventlog writer])
+  StgWord64 dropped_events;
+  StgWord64 dropped_bytes;
+  EventSampler samplers[TRACE_SAMPLE_CLASSES];
 } EventsBuf;
 
 EventsBuf *capEventBuf; // one EventsBuf for each Capability
@@ -123,6 +168,14 @@ char *EventDesc[] = {
   [EVENT_NONMOVING_HEAP_CENSUS]  = "Nonmoving heap census",
   [EVENT_TICKY_COUNTER_DEF]    = "Ticky-ticky entry counter definition",
   [EVENT_TICKY_COUNTER_SAMPLE] = "Ticky-ticky entry counter sample",
+  [EVENT_EVENTS_DROPPED]       = "Events dropped",
+  [EVENT_CONC_MARK_WORKER]     = "Concurrent mark worker pass",
+  [EVENT_PINNED_FRAGMENTATION] = "Free space in pinned blocks",
+  [EVENT_GC_PHASES]            = "GC phase times",
+  [EVENT_GC_THREAD_TIMES]      = "GC thread times",
+  [EVENT_THREAD_PRIORITY]      = "Thread priority",
+  [EVENT_THREAD_QUEUE_DELAY]   = "Thread queueing delay",
+  [EVENT_RUN_QUEUE_DELAYS]     = "Run queue delay histogram",
 };
 
 // Event type.
@@ -138,6 +191,14 @@ EventType eventTypes[NUM_GHC_EVENT_TAGS];
 static void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno);
 static void resetEventsBuf(EventsBuf* eb);
 static void printAndClearEventBuf (EventsBuf *eventsBuf);
+static void flushEventsBuf (EventsBuf *eventsBuf);
+
+#if defined(THREADED_RTS)
+static void startAsyncEventLogWriter (void);
+static void stopAsyncEventLogWriter (void);
+static void waitForAsyncEventLogWriter (void);
+static void forgetAsyncEventLogWriter (void);
+#endif
 
 static void postEventType(EventsBuf *eb, EventType *et);
 
@@ -201,7 +262,7 @@ static inline StgWord64 time_ns(void)
 { return TimeToNS(stat_getElapsedTime()); }
 
 static inline void postEventTypeNum(EventsBuf *eb, EventTypeNum etNum)
-{ postWord16(eb, etNum); }
+{ postWord16(eb, etNum); eb->n_events++; }
 
 static inline void postTimestamp(EventsBuf *eb)
 { postWord64(eb, time_ns()); }
@@ -276,6 +337,9 @@ stopEventLogWriter(void)
 static void
 flushEventLogWriter(void)
 {
+#if defined(THREADED_RTS)
+    waitForAsyncEventLogWriter();
+#endif
     if (event_log_writer != NULL &&
             event_log_writer->flushEventLog != NULL) {
         event_log_writer->flushEventLog();
@@ -309,6 +373,21 @@ init_event_types(void)
                                + sizeof(EventThreadID);
             break;
 
+        case EVENT_THREAD_PRIORITY: // (cap, thread, priority)
+            eventTypes[t].size = sizeof(EventThreadID) + sizeof(StgWord16);
+            break;
+
+        case EVENT_THREAD_QUEUE_DELAY: // (cap, thread, priority, delay_ns)
+            eventTypes[t].size = sizeof(EventThreadID)
+                               + sizeof(StgWord16)
+                               + sizeof(StgWord64);
+            break;
+
+        case EVENT_RUN_QUEUE_DELAYS: // (n_buckets, counts...)
+            eventTypes[t].size = sizeof(StgWord16)
+                               + sizeof(StgWord64) * RUN_QUEUE_DELAY_BUCKETS;
+            break;
+
         case EVENT_CAP_CREATE:      // (cap)
         case EVENT_CAP_DELETE:      // (cap)
         case EVENT_CAP_ENABLE:      // (cap)
@@ -384,6 +463,23 @@ init_event_types(void)
             eventTypes[t].size = sizeof(EventCapsetID) + sizeof(StgWord64);
             break;
 
+        case EVENT_PINNED_FRAGMENTATION: // (heap_capset, pinned_bytes,
+                                         //  free_bytes)
+            eventTypes[t].size = sizeof(EventCapsetID)
+                               + sizeof(StgWord64) * 2;
+            break;
+
+        case EVENT_GC_PHASES:         // (heap_capset, roots_ns, cafs_ns,
+                                      //  scav_ns, weak_ns, sweep_ns, free_ns)
+            eventTypes[t].size = sizeof(EventCapsetID)
+                               + sizeof(StgWord64) * 6;
+            break;
+
+        case EVENT_GC_THREAD_TIMES:   // (roots_ns, scav_ns, idle_ns,
+                                      //  sweep_ns)
+            eventTypes[t].size = sizeof(StgWord64) * 4;
+            break;
+
         case EVENT_HEAP_INFO_GHC:     // (heap_capset, n_generations,
                                       //  max_heap_size, alloc_area_size,
                                       //  mblock_size, block_size)
@@ -481,6 +577,10 @@ init_event_types(void)
             eventTypes[t].size = 4;
             break;
 
+        case EVENT_CONC_MARK_WORKER: // (worker, marked_obj_count, busy_ns)
+            eventTypes[t].size = 4 + 4 + 8;
+            break;
+
         case EVENT_CONC_UPD_REM_SET_FLUSH: // (cap)
             eventTypes[t].size =
                 sizeof(EventCapNo);
@@ -498,6 +598,10 @@ init_event_types(void)
             eventTypes[t].size = 8*4;
             break;
 
+        case EVENT_EVENTS_DROPPED: // (events, bytes)
+            eventTypes[t].size = 8*2;
+            break;
+
         default:
             continue; /* ignore deprecated events */
         }
@@ -561,6 +665,16 @@ initEventLogging()
      * Use a single buffer to store the header with event types, then flush
      * the buffer so all buffers are empty for writing events.
      */
+    for (int i = 0; i < TRACE_SAMPLE_CLASSES; i++) {
+        uint32_t rate = RtsFlags.TraceFlags.max_rate[i];
+        sample_cost[i] = rate != 0 ? 1000000000 / rate : 0;
+        if (RtsFlags.TraceFlags.sample_every[i] > 1 || rate != 0) {
+            eventlog_sampling = true;
+        }
+    }
+    initEventSampler(&gc_sampler, TRACE_SAMPLE_GC);
+    gc_sample_next = sampleEvent(&gc_sampler, TRACE_SAMPLE_GC);
+
     moreCapEventBufs(0, get_n_capabilities());
 
     initEventsBuf(&eventBuf, EVENT_LOG_SIZE, (EventCapNo)(-1));
@@ -593,6 +707,12 @@ startEventLogging_(void)
      */
     printAndClearEventBuf(&eventBuf);
 
+#if defined(THREADED_RTS)
+    if (RtsFlags.TraceFlags.async_buffers > 0) {
+        startAsyncEventLogWriter();
+    }
+#endif
+
     for (uint32_t c = 0; c < get_n_capabilities(); ++c) {
         postBlockMarker(&capEventBuf[c]);
     }
@@ -615,6 +735,9 @@ startEventLogging(const EventLogWriter *ev_writer)
 void
 restartEventLogging(void)
 {
+#if defined(THREADED_RTS)
+    forgetAsyncEventLogWriter();
+#endif
     freeEventLogging();
     stopEventLogWriter();
     initEventLogging();  // allocate new per-capability buffers
@@ -631,11 +754,16 @@ endEventLogging(void)
 
     // Flush all events remaining in the buffers.
     for (uint32_t c = 0; c < n_capabilities; ++c) {
-        printAndClearEventBuf(&capEventBuf[c]);
+        flushEventsBuf(&capEventBuf[c]);
     }
-    printAndClearEventBuf(&eventBuf);
+    flushEventsBuf(&eventBuf);
     resetEventsBuf(&eventBuf); // we don't want the block marker
 
+#if defined(THREADED_RTS)
+    // Write everything out, and then write the end marker ourselves.
+    stopAsyncEventLogWriter();
+#endif
+
     // Mark end of events (data).
     postEventTypeNum(&eventBuf, EVENT_DATA_END);
 
@@ -685,6 +813,122 @@ freeEventLogging(void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+ * Note [Eventlog sampling]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~
+ * A busy scheduler posts millions of events a second, which makes leaving
+ * the eventlog on in production expensive. Rather than all or nothing, the
+ * scheduler, full-detail spark and GC classes can be sampled:
+ *
+ *   --eventlog-sample=s100     post one in 100 scheduler events
+ *   --eventlog-max-rate=s5000  post at most 5000 scheduler events a second
+ *
+ * per capability. Each EventsBuf has an EventSampler per class; sampling
+ * is per capability so that checking it takes no synchronisation, and a
+ * single flag, eventlog_sampling, keeps the cost to one well-predicted
+ * branch when sampling is off.
+ *
+ * The rate limit is a token bucket: each event costs 1/rate seconds of
+ * credit, credit builds up in real time, and at most SAMPLE_BURST_NS (or
+ * the cost of one event, if that is more) can be saved up, so a capability
+ * that has been quiet can post a short burst.
+ *
+ * Dropping events arbitrarily would leave the eventlog inconsistent, so
+ * some events follow the decision made for another one:
+ *
+ *   - EVENT_STOP_THREAD is posted if and only if the EVENT_RUN_THREAD
+ *     before it was, so threads are never seen to start without stopping
+ *     or vice versa.  So is EVENT_THREAD_QUEUE_DELAY, which follows
+ *     EVENT_RUN_THREAD.
+ *
+ *   - GC events are sampled a whole collection at a time, and the same way
+ *     on every capability, so that a parallel GC is either all there or not
+ *     there at all. The GC leader decides for the next collection as it
+ *     posts EVENT_GC_END, using gc_sampler, and leaves the decision in
+ *     gc_sample_next. Each capability takes a copy of it at its first GC
+ *     event of a collection, EVENT_REQUEST_{SEQ,PAR}_GC on the leader and
+ *     EVENT_GC_START on the others, and its GC events up to its next
+ *     collection follow the copy. The decision can't be made when a
+ *     collection starts: the other capabilities may post EVENT_GC_START
+ *     before the leader has posted anything. For the GC class, <n> counts
+ *     collections rather than events.
+ *
+ * Tools can tell that an eventlog was sampled from the RTS flags in the
+ * EVENT_PROGRAM_ARGS event.
+ * -------------------------------------------------------------------------- */
+
+static bool
+sampleEvent (EventSampler *s, int cls)
+{
+    if (s->countdown > 0) {
+        s->countdown--;
+        return false;
+    }
+    s->countdown = RtsFlags.TraceFlags.sample_every[cls] - 1;
+
+    StgWord64 cost = sample_cost[cls];
+    if (cost != 0) {
+        StgWord64 now = time_ns();
+        s->credit = stg_min(s->credit + (now - s->last),
+                            stg_max(cost, SAMPLE_BURST_NS));
+        s->last = now;
+        if (s->credit < cost) {
+            return false;
+        }
+        s->credit -= cost;
+    }
+    return true;
+}
+
+static bool
+sampleSchedEvent (EventsBuf *eb, EventTypeNum tag)
+{
+    EventSampler *s = &eb->samplers[TRACE_SAMPLE_SCHED];
+
+    switch (tag) {
+    case EVENT_RUN_THREAD:
+        s->posting = sampleEvent(s, TRACE_SAMPLE_SCHED);
+        return s->posting;
+    case EVENT_STOP_THREAD:
+    case EVENT_THREAD_QUEUE_DELAY:
+        return s->posting;
+    default:
+        return sampleEvent(s, TRACE_SAMPLE_SCHED);
+    }
+}
+
+static bool
+sampleGcEvent (EventsBuf *eb, EventTypeNum tag)
+{
+    EventSampler *s = &eb->samplers[TRACE_SAMPLE_GC];
+
+    switch (tag) {
+    case EVENT_REQUEST_SEQ_GC:
+    case EVENT_REQUEST_PAR_GC:
+        if (!s->decided) {
+            s->posting = RELAXED_LOAD(&gc_sample_next);
+            s->decided = true;
+        }
+        return s->posting;
+    case EVENT_GC_START:
+        if (!s->decided) {
+            s->posting = RELAXED_LOAD(&gc_sample_next);
+        }
+        s->decided = false;
+        return s->posting;
+    default:
+        return s->posting;
+    }
+}
+
+// EVENT_GC_END on the GC leader: decide for the next collection
+static bool
+sampleGcEnd (EventsBuf *eb)
+{
+    RELAXED_STORE(&gc_sample_next, sampleEvent(&gc_sampler, TRACE_SAMPLE_GC));
+    return eb->samplers[TRACE_SAMPLE_GC].posting;
+}
+
 /*
  * Post an event message to the capability's eventlog buffer.
  * If the buffer is full, prints out the buffer and clears it.
@@ -697,6 +941,9 @@ postSchedEvent (Capability *cap,
                 StgWord info2)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) && !sampleSchedEvent(eb, tag)) {
+        return;
+    }
     ensureRoomForEvent(eb, tag);
 
     postEventHeader(eb, tag);
@@ -732,6 +979,21 @@ postSchedEvent (Capability *cap,
         break;
     }
 
+    case EVENT_THREAD_PRIORITY: // (cap, thread, priority)
+    {
+        postThreadID(eb,thread);
+        postWord16(eb,info1 /* priority */);
+        break;
+    }
+
+    case EVENT_THREAD_QUEUE_DELAY: // (cap, thread, priority, delay_ns)
+    {
+        postThreadID(eb,thread);
+        postWord16(eb,info1 /* priority */);
+        postWord64(eb,info2 /* delay_ns */);
+        break;
+    }
+
     default:
         barf("postSchedEvent: unknown event tag %d", tag);
     }
@@ -743,6 +1005,10 @@ postSparkEvent (Capability *cap,
                 StgWord info1)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !sampleEvent(&eb->samplers[TRACE_SAMPLE_SPARK], TRACE_SAMPLE_SPARK)) {
+        return;
+    }
     ensureRoomForEvent(eb, tag);
 
     postEventHeader(eb, tag);
@@ -980,6 +1246,9 @@ void postHeapEvent (Capability    *cap,
                     W_           info1)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) && !sampleGcEvent(eb, tag)) {
+        return;
+    }
     ensureRoomForEvent(eb, tag);
 
     postEventHeader(eb, tag);
@@ -999,6 +1268,86 @@ void postHeapEvent (Capability    *cap,
     }
 }
 
+void postEventPinnedFragmentation (Capability    *cap,
+                                   EventCapsetID  heap_capset,
+                                   W_             pinned_bytes,
+                                   W_             free_bytes)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !sampleGcEvent(eb, EVENT_PINNED_FRAGMENTATION)) {
+        return;
+    }
+    ensureRoomForEvent(eb, EVENT_PINNED_FRAGMENTATION);
+
+    postEventHeader(eb, EVENT_PINNED_FRAGMENTATION);
+    postCapsetID(eb, heap_capset);
+    postWord64(eb, pinned_bytes);
+    postWord64(eb, free_bytes);
+}
+
+void postEventGcPhases (Capability    *cap,
+                        EventCapsetID  heap_capset,
+                        Time           roots,
+                        Time           cafs,
+                        Time           scav,
+                        Time           weak,
+                        Time           sweep,
+                        Time           freeing)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !sampleGcEvent(eb, EVENT_GC_PHASES)) {
+        return;
+    }
+    ensureRoomForEvent(eb, EVENT_GC_PHASES);
+
+    postEventHeader(eb, EVENT_GC_PHASES);
+    postCapsetID(eb, heap_capset);
+    postWord64(eb, TimeToNS(roots));
+    postWord64(eb, TimeToNS(cafs));
+    postWord64(eb, TimeToNS(scav));
+    postWord64(eb, TimeToNS(weak));
+    postWord64(eb, TimeToNS(sweep));
+    postWord64(eb, TimeToNS(freeing));
+}
+
+void postEventGcThreadTimes (Capability *cap,
+                             Time        roots,
+                             Time        scav,
+                             Time        idle,
+                             Time        sweep)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !sampleGcEvent(eb, EVENT_GC_THREAD_TIMES)) {
+        return;
+    }
+    ensureRoomForEvent(eb, EVENT_GC_THREAD_TIMES);
+
+    postEventHeader(eb, EVENT_GC_THREAD_TIMES);
+    postWord64(eb, TimeToNS(roots));
+    postWord64(eb, TimeToNS(scav));
+    postWord64(eb, TimeToNS(idle));
+    postWord64(eb, TimeToNS(sweep));
+}
+
+void postEventRunQueueDelays (Capability *cap, StgWord64 *counts)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !sampleSchedEvent(eb, EVENT_RUN_QUEUE_DELAYS)) {
+        return;
+    }
+    ensureRoomForEvent(eb, EVENT_RUN_QUEUE_DELAYS);
+
+    postEventHeader(eb, EVENT_RUN_QUEUE_DELAYS);
+    postWord16(eb, RUN_QUEUE_DELAY_BUCKETS);
+    for (uint32_t b = 0; b < RUN_QUEUE_DELAY_BUCKETS; b++) {
+        postWord64(eb, counts[b]);
+    }
+}
+
 void postEventHeapInfo (EventCapsetID heap_capset,
                         uint32_t    gens,
                         W_          maxHeapSize,
@@ -1035,6 +1384,10 @@ void postEventGcStats  (Capability    *cap,
                         W_           par_balanced_copied)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !sampleGcEvent(eb, EVENT_GC_STATS_GHC)) {
+        return;
+    }
     ensureRoomForEvent(eb, EVENT_GC_STATS_GHC);
 
     postEventHeader(eb, EVENT_GC_STATS_GHC);
@@ -1110,6 +1463,9 @@ void
 postEvent (Capability *cap, EventTypeNum tag)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
+    if (RTS_UNLIKELY(eventlog_sampling) && !sampleGcEvent(eb, tag)) {
+        return;
+    }
     ensureRoomForEvent(eb, tag);
     postEventHeader(eb, tag);
 }
@@ -1118,6 +1474,11 @@ void
 postEventAtTimestamp (Capability *cap, EventTimestamp ts, EventTypeNum tag)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
+    // Only the GC leader posts GC events with its own timestamp
+    if (RTS_UNLIKELY(eventlog_sampling) &&
+        !(tag == EVENT_GC_END ? sampleGcEnd(eb) : sampleGcEvent(eb, tag))) {
+        return;
+    }
     ensureRoomForEvent(eb, tag);
 
     /* Normally we'd call postEventHeader(), but that generates its own
@@ -1249,6 +1610,18 @@ void postConcMarkEnd(StgWord32 marked_obj_count)
     RELEASE_LOCK(&eventBufMutex);
 }
 
+void postConcMarkWorker(StgWord32 worker, StgWord32 marked_obj_count,
+                        StgWord64 busy_ns)
+{
+    ACQUIRE_LOCK(&eventBufMutex);
+    ensureRoomForEvent(&eventBuf, EVENT_CONC_MARK_WORKER);
+    postEventHeader(&eventBuf, EVENT_CONC_MARK_WORKER);
+    postWord32(&eventBuf, worker);
+    postWord32(&eventBuf, marked_obj_count);
+    postWord64(&eventBuf, busy_ns);
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 void postNonmovingHeapCensus(int log_blk_size,
                              const struct NonmovingAllocCensus *census)
 {
@@ -1289,6 +1662,7 @@ void postBlockMarker (EventsBuf *eb)
     postWord32(eb,0); // these get filled in later by closeBlockMarker();
     postWord64(eb,0);
     postCapNo(eb, eb->capno);
+    eb->n_events = 0;
 }
 
 static HeapProfBreakdown getHeapProfBreakdown(void)
@@ -1530,13 +1904,313 @@ void postTickyCounterSamples(StgEntCounter *counters)
 }
 #endif /* TICKY_TICKY */
 
-void printAndClearEventBuf (EventsBuf *ebuf)
+#if defined(THREADED_RTS)
+/* -----------------------------------------------------------------------------
+ * Note [Asynchronous eventlog writer]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Normally, when a Capability's EventsBuf fills up, printAndClearEventBuf
+ * writes it out there and then, so whichever Haskell thread happened to post
+ * the last event waits for the write, which can take milliseconds.
+ *
+ * With +RTS --eventlog-async[=<n>] we instead start a dedicated writer
+ * thread and allocate <n> spare buffers, each EVENT_LOG_SIZE bytes. To get
+ * rid of a full buffer, a Capability takes a spare buffer off the
+ * free_blocks queue, puts the full one on the full_blocks queue for the
+ * writer, and carries on posting events into the spare. The writer thread
+ * writes each full buffer with the EventLogWriter and returns it to
+ * free_blocks. Both queues are lock-free (EventBlockQueue, below), so a
+ * Capability never waits for the writer; it only takes writer_mutex to wake
+ * the writer up if it's asleep.
+ *
+ * The spare buffers bound the memory we use. If the writer falls behind and
+ * there is no spare buffer, we throw away the contents of the full buffer,
+ * remembering how many events and bytes it held, and post an
+ * EVENT_EVENTS_DROPPED event with the totals at the start of the next
+ * block, so that whoever reads the eventlog knows what is missing from it.
+ *
+ * We don't drop events when flushing the eventlog (flushEventLog(),
+ * endEventLogging(), etc.): flushEventsBuf waits for the writer to catch up
+ * instead. Buffers reach the file in the order they were handed over, but
+ * blocks from different Capabilities were never ordered in the eventlog,
+ * and readers sort events by timestamp anyway.
+ * -------------------------------------------------------------------------- */
+
+/* A bounded multi-producer multi-consumer queue of buffers, after Dmitry
+ * Vyukov's. Each cell has a sequence number saying whether it is ready to
+ * be filled (seq == pos) or emptied (seq == pos + 1) by the operation at
+ * position pos. */
+typedef struct {
+    StgWord seq;
+    StgInt8 *buf;
+    StgWord64 len;
+} EventBlockCell;
+
+typedef struct {
+    EventBlockCell *cells;
+    StgWord mask;           // number of cells - 1
+    StgWord head;           // next position to dequeue from
+    StgWord tail;           // next position to enqueue at
+} EventBlockQueue;
+
+static EventBlockQueue full_blocks;     // for the writer to write
+static EventBlockQueue free_blocks;     // spare buffers
+
+// Is the writer thread running?
+static bool eventlog_async = false;
+
+static OSThreadId writer_thread;
+static Mutex writer_mutex;
+static Condition writer_wakeup;         // there is work for the writer
+static Condition writer_done;           // writer_pending has reached zero
+static bool writer_sleeping;            // is the writer waiting for work?
+static bool writer_stop;                // should the writer exit?
+static StgWord writer_pending;          // buffers handed over, not written
+
+static void
+initEventBlockQueue (EventBlockQueue *q, uint32_t n)
+{
+    StgWord size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    q->cells = stgMallocBytes(size * sizeof(EventBlockCell),
+                              "initEventBlockQueue");
+    for (StgWord i = 0; i < size; i++) {
+        q->cells[i].seq = i;
+    }
+    q->mask = size - 1;
+    q->head = 0;
+    q->tail = 0;
+}
+
+static bool
+enqueueEventBlock (EventBlockQueue *q, StgInt8 *buf, StgWord64 len)
+{
+    EventBlockCell *cell;
+    StgWord pos = RELAXED_LOAD(&q->tail);
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        StgInt diff = (StgInt)ACQUIRE_LOAD(&cell->seq) - (StgInt)pos;
+        if (diff == 0) {
+            if (cas(&q->tail, pos, pos + 1) == pos) break;
+            pos = RELAXED_LOAD(&q->tail);
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = RELAXED_LOAD(&q->tail);
+        }
+    }
+    cell->buf = buf;
+    cell->len = len;
+    RELEASE_STORE(&cell->seq, pos + 1);
+    return true;
+}
+
+static bool
+dequeueEventBlock (EventBlockQueue *q, StgInt8 **buf, StgWord64 *len)
+{
+    EventBlockCell *cell;
+    StgWord pos = RELAXED_LOAD(&q->head);
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        StgInt diff = (StgInt)ACQUIRE_LOAD(&cell->seq) - (StgInt)(pos + 1);
+        if (diff == 0) {
+            if (cas(&q->head, pos, pos + 1) == pos) break;
+            pos = RELAXED_LOAD(&q->head);
+        } else if (diff < 0) {
+            return false; // empty
+        } else {
+            pos = RELAXED_LOAD(&q->head);
+        }
+    }
+    *buf = cell->buf;
+    *len = cell->len;
+    RELEASE_STORE(&cell->seq, pos + q->mask + 1);
+    return true;
+}
+
+static void
+freeEventBlockQueue (EventBlockQueue *q)
+{
+    StgInt8 *buf;
+    StgWord64 len;
+
+    while (dequeueEventBlock(q, &buf, &len)) {
+        stgFree(buf);
+    }
+    stgFree(q->cells);
+}
+
+static void *
+asyncEventLogWriter (void *arg STG_UNUSED)
+{
+    StgInt8 *buf;
+    StgWord64 len;
+
+    for (;;) {
+        while (dequeueEventBlock(&full_blocks, &buf, &len)) {
+            if (!writeEventLog(buf, len)) {
+                debugBelch("asyncEventLogWriter: could not write event log\n");
+            }
+            // there is always room: the queue can hold every spare buffer
+            enqueueEventBlock(&free_blocks, buf, 0);
+            if (atomic_dec(&writer_pending) == 0) {
+                ACQUIRE_LOCK(&writer_mutex);
+                broadcastCondition(&writer_done);
+                RELEASE_LOCK(&writer_mutex);
+            }
+        }
+
+        ACQUIRE_LOCK(&writer_mutex);
+        if (writer_stop) {
+            RELEASE_LOCK(&writer_mutex);
+            return NULL;
+        }
+        // A Capability increments writer_pending before handing over a
+        // buffer, and checks writer_sleeping afterwards, so either we see
+        // its buffer here or it sees that we are asleep and wakes us up.
+        SEQ_CST_STORE(&writer_sleeping, true);
+        if (SEQ_CST_LOAD(&writer_pending) == 0) {
+            waitCondition(&writer_wakeup, &writer_mutex);
+        }
+        SEQ_CST_STORE(&writer_sleeping, false);
+        RELEASE_LOCK(&writer_mutex);
+    }
+}
+
+static void
+startAsyncEventLogWriter (void)
+{
+    uint32_t n = RtsFlags.TraceFlags.async_buffers;
+
+    initEventBlockQueue(&full_blocks, n);
+    initEventBlockQueue(&free_blocks, n);
+    for (uint32_t i = 0; i < n; i++) {
+        enqueueEventBlock(&free_blocks,
+                          stgMallocBytes(EVENT_LOG_SIZE,
+                                         "startAsyncEventLogWriter"), 0);
+    }
+
+    initMutex(&writer_mutex);
+    initCondition(&writer_wakeup);
+    initCondition(&writer_done);
+    writer_sleeping = false;
+    writer_stop = false;
+    writer_pending = 0;
+
+    if (createOSThread(&writer_thread, "ghc_eventlog",
+                       asyncEventLogWriter, NULL) != 0) {
+        barf("startAsyncEventLogWriter: can't create writer thread");
+    }
+    eventlog_async = true;
+}
+
+// Wait until the writer has written every buffer handed to it so far.
+static void
+waitForAsyncEventLogWriter (void)
+{
+    if (!eventlog_async) return;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    while (SEQ_CST_LOAD(&writer_pending) != 0) {
+        waitCondition(&writer_done, &writer_mutex);
+    }
+    RELEASE_LOCK(&writer_mutex);
+}
+
+static void
+stopAsyncEventLogWriter (void)
+{
+    if (!eventlog_async) return;
+
+    if (osThreadId() != writer_thread) {
+        waitForAsyncEventLogWriter();
+        ACQUIRE_LOCK(&writer_mutex);
+        writer_stop = true;
+        signalCondition(&writer_wakeup);
+        RELEASE_LOCK(&writer_mutex);
+        joinOSThread(writer_thread);
+    }
+    eventlog_async = false;
+
+    freeEventBlockQueue(&full_blocks);
+    freeEventBlockQueue(&free_blocks);
+    closeMutex(&writer_mutex);
+    closeCondition(&writer_wakeup);
+    closeCondition(&writer_done);
+}
+
+// In the child of a fork(): the writer thread is gone, and the parent
+// flushed everything before forking, so just free the spare buffers.
+static void
+forgetAsyncEventLogWriter (void)
+{
+    if (!eventlog_async) return;
+
+    eventlog_async = false;
+    freeEventBlockQueue(&full_blocks);
+    freeEventBlockQueue(&free_blocks);
+}
+
+// Hand a full buffer to the writer and carry on with a spare one, or drop
+// its contents if there is no spare (unless wait is true, in which case we
+// wait for the writer to give one back).
+static void
+handOffEventBuf (EventsBuf *ebuf, size_t size, bool wait)
+{
+    StgInt8 *spare;
+    StgWord64 unused;
+
+    while (!dequeueEventBlock(&free_blocks, &spare, &unused)) {
+        if (!wait) {
+            ebuf->dropped_events += ebuf->n_events;
+            ebuf->dropped_bytes += size;
+            resetEventsBuf(ebuf);
+            return;
+        }
+        waitForAsyncEventLogWriter();
+    }
+
+    atomic_inc(&writer_pending, 1);
+    // there is always room: the queue can hold every spare buffer
+    enqueueEventBlock(&full_blocks, ebuf->begin, size);
+    if (SEQ_CST_LOAD(&writer_sleeping)) {
+        ACQUIRE_LOCK(&writer_mutex);
+        signalCondition(&writer_wakeup);
+        RELEASE_LOCK(&writer_mutex);
+    }
+
+    // The buffer we just handed over reported any events dropped before it
+    ebuf->dropped_events = 0;
+    ebuf->dropped_bytes = 0;
+    ebuf->begin = spare;
+    resetEventsBuf(ebuf);
+}
+#endif /* THREADED_RTS */
+
+static void printAndClearEventBuf_ (EventsBuf *ebuf, bool wait USED_IF_THREADS)
 {
     closeBlockMarker(ebuf);
 
     if (ebuf->begin != NULL && ebuf->pos != ebuf->begin)
     {
         size_t elog_size = ebuf->pos - ebuf->begin;
+#if defined(THREADED_RTS)
+        if (eventlog_async) {
+            handOffEventBuf(ebuf, elog_size, wait);
+            flushCount++;
+            postBlockMarker(ebuf);
+            if (ebuf->dropped_events != 0) {
+                // See Note [Asynchronous eventlog writer]
+                postEventHeader(ebuf, EVENT_EVENTS_DROPPED);
+                postWord64(ebuf, ebuf->dropped_events);
+                postWord64(ebuf, ebuf->dropped_bytes);
+            }
+            return;
+        }
+#endif
         if (!writeEventLog(ebuf->begin, elog_size)) {
             debugBelch(
                     "printAndClearEventLog: could not flush event log\n"
@@ -1553,18 +2227,40 @@ void printAndClearEventBuf (EventsBuf *ebuf)
     }
 }
 
+// Write out a full buffer to make room for more events.
+void printAndClearEventBuf (EventsBuf *ebuf)
+{
+    printAndClearEventBuf_(ebuf, false);
+}
+
+// Write out a buffer because someone asked us to flush the eventlog. In
+// asynchronous mode this doesn't drop events, and doesn't wait for the
+// writer unless there's no spare buffer; flushEventLogWriter() waits for it
+// to write everything out.
+static void flushEventsBuf (EventsBuf *ebuf)
+{
+    printAndClearEventBuf_(ebuf, true);
+}
+
 void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
 {
     eb->begin = eb->pos = stgMallocBytes(size, "initEventsBuf");
     eb->size = size;
     eb->marker = NULL;
     eb->capno = capno;
+    eb->n_events = 0;
+    eb->dropped_events = 0;
+    eb->dropped_bytes = 0;
+    for (int i = 0; i < TRACE_SAMPLE_CLASSES; i++) {
+        initEventSampler(&eb->samplers[i], i);
+    }
 }
 
 void resetEventsBuf(EventsBuf* eb)
 {
     eb->pos = eb->begin;
     eb->marker = NULL;
+    eb->n_events = 0;
 }
 
 StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
@@ -1627,7 +2323,7 @@ void postEventType(EventsBuf *eb, EventType *et)
 void flushLocalEventsBuf(Capability *cap)
 {
     EventsBuf *eb = &capEventBuf[cap->no];
-    printAndClearEventBuf(eb);
+    flushEventsBuf(eb);
 }
 
 // Flush all capabilities' event buffers when we already hold all capabilities.
@@ -1635,7 +2331,7 @@ void flushLocalEventsBuf(Capability *cap)
 void flushAllCapsEventsBufs()
 {
     ACQUIRE_LOCK(&eventBufMutex);
-    printAndClearEventBuf(&eventBuf);
+    flushEventsBuf(&eventBuf);
     RELEASE_LOCK(&eventBufMutex);
 
     for (unsigned int i=0; i < n_capabilities; i++) {
@@ -1647,7 +2343,7 @@ void flushAllCapsEventsBufs()
 void flushEventLog(Capability **cap USED_IF_THREADS)
 {
     ACQUIRE_LOCK(&eventBufMutex);
-    printAndClearEventBuf(&eventBuf);
+    flushEventsBuf(&eventBuf);
     RELEASE_LOCK(&eventBufMutex);
 
 #if defined(THREADED_RTS)
@@ -115,6 +115,28 @@ void postHeapEvent (Capability    *cap,
                     EventCapsetID  heap_capset,
                     W_           info1);
 
+void postEventPinnedFragmentation (Capability    *cap,
+                                   EventCapsetID  heap_capset,
+                                   W_             pinned_bytes,
+                                   W_             free_bytes);
+
+void postEventGcPhases (Capability    *cap,
+                        EventCapsetID  heap_capset,
+                        Time           roots,
+                        Time           cafs,
+                        Time           scav,
+                        Time           weak,
+                        Time           sweep,
+                        Time           freeing);
+
+void postEventGcThreadTimes (Capability *cap,
+                             Time        roots,
+                             Time        scav,
+                             Time        idle,
+                             Time        sweep);
+
+void postEventRunQueueDelays (Capability *cap, StgWord64 *counts);
+
 void postEventHeapInfo (EventCapsetID heap_capset,
                         uint32_t    gens,
                         W_          maxHeapSize,
@@ -172,6 +194,8 @@ void postProfBegin(void);
 
 void postConcUpdRemSetFlush(Capability *cap);
 void postConcMarkEnd(StgWord32 marked_obj_count);
+void postConcMarkWorker(StgWord32 worker, StgWord32 marked_obj_count,
+                        StgWord64 busy_ns);
 void postNonmovingHeapCensus(int log_blk_size,
                              const struct NonmovingAllocCensus *census);
 
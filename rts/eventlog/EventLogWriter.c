@@ -44,9 +44,324 @@ static bool writeEventLogFile(void *eventlog, size_t eventlog_size);
 static void flushEventLogFile(void);
 static void stopEventLogFileWriter(void);
 
+/* -----------------------------------------------------------------------------
+ * Note [Compressed eventlog]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * With +RTS --eventlog-compress, the file writer compresses the eventlog
+ * into a standard LZ4 frame (https://github.com/lz4/lz4/blob/dev/doc/), so
+ * that `lz4 -d prog.eventlog.lz4 | ghc-events show -` works as usual:
+ *
+ *   - The frame header says that blocks are independent, up to 4MB each,
+ *     without checksums or a content size.
+ *
+ *   - Each call to writeEventLogFile() becomes one LZ4 block. EventLog.c
+ *     calls us once per EventsBuf it flushes, so apart from the first
+ *     block (the eventlog header) and the last (the end-of-data marker),
+ *     every block holds exactly one eventlog block, starting with its
+ *     EVENT_BLOCK_MARKER. We store a block uncompressed if compressing it
+ *     doesn't make it smaller, as the format allows.
+ *
+ *   - After the end of the frame, stopEventLogFileWriter() writes an index
+ *     of the blocks in an LZ4 skippable frame (which lz4 ignores):
+ *
+ *       Word32 0x184D2A5E               skippable frame magic
+ *       Word32 size                     16 * n + 8
+ *       n * (Word64 file offset,        of the block's size field
+ *            Word64 data offset)        of its data in the raw eventlog
+ *       Word64 n                        number of blocks
+ *
+ *     all little-endian, as in the rest of the LZ4 format. A reader finds
+ *     the index from the last 8 bytes of the file, and can then decode the
+ *     header block and any other block by itself, without decompressing
+ *     the rest of the eventlog.
+ *
+ * Each caller compresses into a CompressBuffer of its own, without holding
+ * event_log_mutex, so capabilities flushing their buffers at the same time
+ * compress in parallel. The mutex is only held to append the blocks to the
+ * file and the index, which keeps a call's blocks together and the index
+ * in file order. Buffers are kept on a free list for the next caller, so
+ * there are only ever as many as there have been concurrent writers. With
+ * --eventlog-async the writer thread does the compression, off the
+ * mutator's path altogether. Like the raw eventlog, the file is flushed
+ * after every write.
+ *
+ * The compressor is a simple greedy one in the style of LZ4's fast mode: a
+ * hash table of the last position each 4-byte sequence was seen at, and no
+ * lazy matching. Eventlogs compress well even so, as most events are a
+ * small header and a few fields that change slowly.
+ * -------------------------------------------------------------------------- */
+
+#define LZ4_FRAME_MAGIC     0x184D2204
+#define LZ4_SKIPPABLE_MAGIC 0x184D2A5E
+#define LZ4_MAX_BLOCK       (4 * 1024 * 1024)
+#define LZ4_UNCOMPRESSED    0x80000000  // block size flag: stored raw
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5   // the last 5 bytes are always literals
+#define LZ4_MF_LIMIT        12  // the last match starts 12 bytes from the end
+#define LZ4_HASH_LOG        14
+
+// Room needed to compress a block of the given size: its size field and
+// either the compressed data or the raw data, whichever is smaller
+#define LZ4_BLOCK_BOUND(n)  ((n) + (n) / 255 + 16)
+
+typedef struct {
+    StgWord64 file_offset;
+    StgWord64 data_offset;
+} CompressedBlock;
+
+// Index of the blocks written so far, protected by event_log_mutex
+static CompressedBlock *compressed_blocks = NULL;
+static StgWord64 n_compressed_blocks, max_compressed_blocks;
+static StgWord64 compressed_file_offset, compressed_data_offset;
+
+// Room to compress a call's worth of eventlog: the compressor's hash table,
+// then the blocks, each with its size field.
+typedef struct CompressBuffer_ {
+    struct CompressBuffer_ *next;   // on free_compress_buffers
+    size_t size;                    // room in blocks[]
+    StgWord32 table[1 << LZ4_HASH_LOG];
+    uint8_t blocks[];
+} CompressBuffer;
+
+// Buffers not in use, protected by event_log_mutex
+static CompressBuffer *free_compress_buffers = NULL;
+
+static inline void putWord32LE(uint8_t *p, StgWord32 w)
+{
+    p[0] = w; p[1] = w >> 8; p[2] = w >> 16; p[3] = w >> 24;
+}
+
+static inline void putWord64LE(uint8_t *p, StgWord64 w)
+{
+    putWord32LE(p, (StgWord32)w);
+    putWord32LE(p + 4, (StgWord32)(w >> 32));
+}
+
+static inline StgWord32 getWord32LE(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (StgWord32)p[3] << 24;
+}
+
+static inline StgWord32 getWord32(const uint8_t *p)
+{
+    StgWord32 w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static uint8_t *lz4PutLength(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *lz4PutSequence(uint8_t *op, const uint8_t *lit,
+                               size_t lit_len, size_t offset, size_t match_len)
+{
+    uint8_t *token = op++;
+
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15) {
+        op = lz4PutLength(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len != 0) {
+        size_t ml = match_len - LZ4_MIN_MATCH;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        *token |= ml >= 15 ? 15 : ml;
+        if (ml >= 15) {
+            op = lz4PutLength(op, ml - 15);
+        }
+    }
+    return op;
+}
+
+// Compress src[0..size) into dst, which has room for LZ4_BLOCK_BOUND(size)
+// bytes, as a single LZ4 block. Returns the compressed size.
+static size_t lz4CompressBlock(const uint8_t *src, size_t size, uint8_t *dst,
+                               StgWord32 *table)
+{
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *end = src + size;
+    uint8_t *op = dst;
+
+    if (size > LZ4_MF_LIMIT) {
+        const uint8_t *mf_limit = end - LZ4_MF_LIMIT;
+        const uint8_t *match_limit = end - LZ4_LAST_LITERALS;
+
+        memset(table, 0, sizeof(StgWord32) << LZ4_HASH_LOG);
+
+        while (ip <= mf_limit) {
+            StgWord32 seq = getWord32(ip);
+            StgWord32 h = (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+            const uint8_t *ref = src + table[h];
+            table[h] = ip - src;
+
+            if (ref >= ip || ip - ref > 0xffff || getWord32(ref) != seq) {
+                // Skip faster through data that doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            const uint8_t *m = ip + LZ4_MIN_MATCH;
+            const uint8_t *r = ref + LZ4_MIN_MATCH;
+            while (m < match_limit && *m == *r) {
+                m++; r++;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--; ref--;
+            }
+            op = lz4PutSequence(op, anchor, ip - anchor, ip - ref, m - ip);
+            ip = anchor = m;
+        }
+    }
+
+    return lz4PutSequence(op, anchor, end - anchor, 0, 0) - dst;
+}
+
+static bool writeAll(const void *buf, size_t size)
+{
+    return fwrite(buf, 1, size, event_log_file) == size;
+}
+
+static void writeCompressedHeader(void)
+{
+    uint8_t header[7];
+
+    putWord32LE(header, LZ4_FRAME_MAGIC);
+    header[4] = 0x60;   // version 01, independent blocks
+    header[5] = 0x70;   // 4MB maximum block size
+    header[6] = 0x73;   // (xxh32(header[4..5]) >> 8) & 0xff
+    writeAll(header, sizeof(header));
+
+    n_compressed_blocks = 0;
+    max_compressed_blocks = 64;
+    compressed_blocks =
+        stgMallocBytes(max_compressed_blocks * sizeof(CompressedBlock),
+                       "writeCompressedHeader");
+    compressed_file_offset = sizeof(header);
+    compressed_data_offset = 0;
+}
+
+// Room needed for the blocks of eventlog_size bytes of eventlog
+static size_t compressedBound(size_t eventlog_size)
+{
+    size_t n = (eventlog_size + LZ4_MAX_BLOCK - 1) / LZ4_MAX_BLOCK;
+    return n * (4 + LZ4_BLOCK_BOUND(0)) + eventlog_size + eventlog_size / 255;
+}
+
+static CompressBuffer *getCompressBuffer(size_t size)
+{
+    CompressBuffer *cb;
+
+    acquire_event_log_lock();
+    cb = free_compress_buffers;
+    if (cb != NULL) {
+        free_compress_buffers = cb->next;
+    }
+    release_event_log_lock();
+
+    if (cb == NULL || cb->size < size) {
+        if (cb != NULL) {
+            stgFree(cb);
+        }
+        cb = stgMallocBytes(sizeof(CompressBuffer) + size,
+                            "getCompressBuffer");
+        cb->size = size;
+    }
+    return cb;
+}
+
+static bool writeCompressed(const uint8_t *eventlog, size_t eventlog_size)
+{
+    CompressBuffer *cb = getCompressBuffer(compressedBound(eventlog_size));
+    uint8_t *op = cb->blocks;
+    const uint8_t *ip = eventlog;
+    size_t remain = eventlog_size;
+    bool ok;
+
+    // Compress outside the lock; see Note [Compressed eventlog]
+    while (remain > 0) {
+        size_t size = stg_min(remain, LZ4_MAX_BLOCK);
+        size_t csize = lz4CompressBlock(ip, size, op + 4, cb->table);
+
+        if (csize < size) {
+            putWord32LE(op, csize);
+        } else {
+            csize = size;
+            putWord32LE(op, size | LZ4_UNCOMPRESSED);
+            memcpy(op + 4, ip, size);
+        }
+        op += 4 + csize;
+        ip += size;
+        remain -= size;
+    }
+
+    acquire_event_log_lock();
+    for (const uint8_t *p = cb->blocks; p < op; ) {
+        size_t size = stg_min(eventlog_size, LZ4_MAX_BLOCK);
+        size_t csize = getWord32LE(p) & ~LZ4_UNCOMPRESSED;
+
+        if (n_compressed_blocks == max_compressed_blocks) {
+            max_compressed_blocks *= 2;
+            compressed_blocks =
+                stgReallocBytes(compressed_blocks,
+                                max_compressed_blocks * sizeof(CompressedBlock),
+                                "writeCompressed");
+        }
+        compressed_blocks[n_compressed_blocks++] = (CompressedBlock) {
+            .file_offset = compressed_file_offset,
+            .data_offset = compressed_data_offset,
+        };
+        compressed_file_offset += 4 + csize;
+        compressed_data_offset += size;
+        eventlog_size -= size;
+        p += 4 + csize;
+    }
+    ok = writeAll(cb->blocks, op - cb->blocks);
+    cb->next = free_compress_buffers;
+    free_compress_buffers = cb;
+    release_event_log_lock();
+
+    return ok;
+}
+
+// Finish the LZ4 frame and write the block index; see
+// Note [Compressed eventlog].
+static void writeCompressedTrailer(void)
+{
+    StgWord64 index_size = 16 * n_compressed_blocks + 8;
+    uint8_t *buf = stgMallocBytes(12 + index_size, "writeCompressedTrailer");
+    uint8_t *p = buf;
+
+    putWord32LE(p, 0);  // end of the frame
+    putWord32LE(p + 4, LZ4_SKIPPABLE_MAGIC);
+    putWord32LE(p + 8, index_size);
+    p += 12;
+    for (StgWord64 i = 0; i < n_compressed_blocks; i++) {
+        putWord64LE(p, compressed_blocks[i].file_offset);
+        putWord64LE(p + 8, compressed_blocks[i].data_offset);
+        p += 16;
+    }
+    putWord64LE(p, n_compressed_blocks);
+    writeAll(buf, 12 + index_size);
+    stgFree(buf);
+}
+
 static char *outputFileName(void)
 {
 
+    // A forked child has the parent's pid here, until we set its own (#4512)
+    bool forked = event_log_pid != -1;
+    event_log_pid = getpid();
+
     if (RtsFlags.TraceFlags.trace_output) {
         return strdup(RtsFlags.TraceFlags.trace_output);
     } else {
@@ -63,24 +378,24 @@ static char *outputFileName(void)
             }
         }
 #endif
+        const char *suffix =
+            RtsFlags.TraceFlags.compress ? ".eventlog.lz4" : ".eventlog";
         char *filename = stgMallocBytes(strlen(prog)
                                         + 10 /* .%d */
-                                        + 10 /* .eventlog */,
+                                        + strlen(suffix) + 1,
                                         "initEventLogFileWriter");
 
-        if (event_log_pid == -1) { // #4512
+        if (!forked) { // #4512
             // Single process
-            sprintf(filename, "%s.eventlog", prog);
-            event_log_pid = getpid();
+            sprintf(filename, "%s%s", prog, suffix);
         } else {
             // Forked process, eventlog already started by the parent
             // before fork
-            event_log_pid = getpid();
             // We don't have a FMT* symbol for pid_t, so we go via Word64
             // to be sure of not losing range. It would be nicer to have a
             // FMT* symbol or similar, though.
-            sprintf(filename, "%s.%" FMT_Word64 ".eventlog",
-                    prog, (StgWord64)event_log_pid);
+            sprintf(filename, "%s.%" FMT_Word64 "%s",
+                    prog, (StgWord64)event_log_pid, suffix);
         }
         stgFree(prog);
         return filename;
@@ -103,6 +418,10 @@ initEventLogFileWriter(void)
 #if defined(THREADED_RTS)
     initMutex(&event_log_mutex);
 #endif
+
+    if (RtsFlags.TraceFlags.compress) {
+        writeCompressedHeader();
+    }
 }
 
 static bool
@@ -111,6 +430,14 @@ writeEventLogFile(void *eventlog, size_t eventlog_size)
     unsigned char *begin = eventlog;
     size_t remain = eventlog_size;
 
+    if (RtsFlags.TraceFlags.compress) {
+        if (!writeCompressed(begin, remain)) {
+            return false;
+        }
+        flushEventLogFile ();
+        return true;
+    }
+
     acquire_event_log_lock();
     while (remain > 0) {
         size_t written = fwrite(begin, 1, remain, event_log_file);
@@ -139,6 +466,20 @@ static void
 stopEventLogFileWriter(void)
 {
     if (event_log_file != NULL) {
+        // A forked child mustn't finish off its parent's file: it is about
+        // to open its own.
+        if (compressed_blocks != NULL) {
+            if (event_log_pid == getpid()) {
+                writeCompressedTrailer();
+            }
+            stgFree(compressed_blocks);
+            compressed_blocks = NULL;
+            while (free_compress_buffers != NULL) {
+                CompressBuffer *cb = free_compress_buffers;
+                free_compress_buffers = cb->next;
+                stgFree(cb);
+            }
+        }
         fclose(event_log_file);
         event_log_file = NULL;
     }
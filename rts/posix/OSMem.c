@@ -75,9 +75,127 @@
 
 static void *next_request = 0;
 
+// See Note [Transparent huge pages]
+static W_ huge_page_size = 0;
+
+static W_ get_huge_page_size (void);
+
 void osMemInit(void)
 {
     next_request = (void *)RtsFlags.GcFlags.heapBase;
+
+    if (RtsFlags.GcFlags.hugePages) {
+        huge_page_size = get_huge_page_size();
+        if (huge_page_size == 0) {
+            errorBelch("warning: transparent huge pages are not available, "
+                       "ignoring --huge-pages");
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Note [Transparent huge pages]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A large heap mapped with ordinary 4k pages needs a TLB entry for every
+   4k that the GC touches, and scavenging a big old generation misses the
+   TLB constantly.  On Linux, transparent huge pages let the kernel back
+   an aligned 2M stretch of memory with a single page instead, if the
+   mapping has been advised with MADV_HUGEPAGE (or if THP is set to
+   "always", which most distributions don't do).
+
+   With --huge-pages we therefore
+
+     - align the heap reservation (osTryReserveHeapMemory) to the huge page
+       size rather than to a megablock, so that megablocks pair up into
+       huge pages;
+
+     - advise every range we commit with MADV_HUGEPAGE, in
+       post_mmap_madvise().  Committing replaces the mapping, so the advice
+       on the reservation itself would be lost; adjacent committed ranges
+       with the same advice merge into one mapping again;
+
+     - commit fresh megablocks up to the next huge page boundary (see
+       getFreshMBlocks() in MBlock.c), so that a huge page is never half
+       committed.  The rest of the page stays above mblock_high_watermark
+       until a later getFreshMBlocks() hands it out.
+
+   All of the heap is covered, so the nursery and all the generations get
+   huge pages alike.  Decommitting part of a huge page (when we return
+   memory to the OS) splits it, and the kernel may put it back together
+   later.  How much of the heap ended up in huge pages is shown by
+   +RTS -s, from the AnonHugePages lines of /proc/self/smaps.
+   -------------------------------------------------------------------------- */
+
+static W_
+get_huge_page_size (void)
+{
+#if defined(linux_HOST_OS) && defined(MADV_HUGEPAGE)
+    FILE *f;
+    char buf[64];
+    unsigned long size = 0;
+
+    // With "[never]" the kernel ignores MADV_HUGEPAGE
+    f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fgets(buf, sizeof(buf), f) == NULL || strstr(buf, "[never]")) {
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    // Older kernels don't say, but only support 2M pages
+    f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%lu", &size) != 1) {
+            size = 0;
+        }
+        fclose(f);
+    }
+    if (size == 0 || (size & (size - 1)) != 0) {
+        size = 2 * 1024 * 1024;
+    }
+    return size;
+#else
+    return 0;
+#endif
+}
+
+W_ osHugePageSize (void)
+{
+    return huge_page_size;
+}
+
+StgWord64 osHugePageBytes (W_ start, W_ end)
+{
+#if defined(linux_HOST_OS)
+    FILE *f;
+    char line[256];
+    unsigned long from, to, kb;
+    bool in_range = false;
+    StgWord64 bytes = 0;
+
+    f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    // Each mapping starts with a line "from-to perms ...", followed by
+    // lines of "Field: value"
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &from, &to) == 2) {
+            in_range = from < end && to > start;
+        } else if (in_range &&
+                   sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            bytes += (StgWord64)kb * 1024;
+        }
+    }
+    fclose(f);
+    return bytes;
+#else
+    (void)start; (void)end;
+    return 0;
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -166,6 +284,12 @@ post_mmap_madvise(int operation, W_ size, void *ret)
         madvise(ret, size, MADV_WILLNEED);
 # if defined(MADV_DODUMP)
         madvise(ret, size, MADV_DODUMP);
+# endif
+# if defined(MADV_HUGEPAGE)
+        // See Note [Transparent huge pages]
+        if (huge_page_size != 0) {
+            madvise(ret, size, MADV_HUGEPAGE);
+        }
 # endif
     } else {
         madvise(ret, size, MADV_DONTNEED);
@@ -477,28 +601,30 @@ osTryReserveHeapMemory (W_ len, void *hint)
 {
     void *base, *top;
     void *start, *end;
+    // See Note [Transparent huge pages]
+    W_ align = stg_max(MBLOCK_SIZE, huge_page_size);
 
     ASSERT((len & ~MBLOCK_MASK) == len);
 
-    /* We try to allocate len + MBLOCK_SIZE,
-       because we need memory which is MBLOCK_SIZE aligned,
-       and then we discard what we don't need */
+    /* We try to allocate len + align,
+       because we need memory which is align-aligned (at least
+       MBLOCK_SIZE), and then we discard what we don't need */
 
-    base = my_mmap(hint, len + MBLOCK_SIZE, MEM_RESERVE);
+    base = my_mmap(hint, len + align, MEM_RESERVE);
     if (base == NULL)
         return NULL;
 
-    top = (void*)((W_)base + len + MBLOCK_SIZE);
+    top = (void*)((W_)base + len + align);
 
-    if (((W_)base & MBLOCK_MASK) != 0) {
-        start = MBLOCK_ROUND_UP(base);
-        end = MBLOCK_ROUND_DOWN(top);
-        ASSERT(((W_)end - (W_)start) == len);
+    if (((W_)base & (align - 1)) != 0) {
+        start = (void*)(((W_)base + align - 1) & ~(align - 1));
+        end = (void*)((W_)start + len);
+        ASSERT(end <= top);
 
         if (munmap(base, (W_)start-(W_)base) < 0) {
             sysErrorBelch("unable to release slop before heap");
         }
-        if (munmap(end, (W_)top-(W_)end) < 0) {
+        if (end != top && munmap(end, (W_)top-(W_)end) < 0) {
             sysErrorBelch("unable to release slop after heap");
         }
     } else {
@@ -42,6 +42,9 @@
 #include <string.h>
 #endif
 
+#include <errno.h>
+#include <time.h>
+
 #if defined(darwin_HOST_OS) || defined(freebsd_HOST_OS)
 #include <sys/types.h>
 #include <sys/sysctl.h>
@@ -117,6 +120,25 @@ waitCondition ( Condition* pCond, Mutex* pMut )
   return (pthread_cond_wait(pCond,pMut) == 0);
 }
 
+bool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+  struct timespec ts;
+  uint64_t nsec;
+
+  // pthread_cond_timedwait() wants an absolute time on the realtime clock
+  clock_gettime(CLOCK_REALTIME, &ts);
+  nsec = (uint64_t)ts.tv_nsec + TimeToNS(timeout);
+  ts.tv_sec += nsec / 1000000000;
+  ts.tv_nsec = nsec % 1000000000;
+
+  int ret = pthread_cond_timedwait(pCond, pMut, &ts);
+  if (ret != 0 && ret != ETIMEDOUT) {
+      barf("timedWaitCondition: %s", strerror(ret));
+  }
+  return ret == 0;
+}
+
 void
 yieldThread(void)
 {
@@ -31,6 +31,14 @@
 #  include <sys/types.h>
 # endif
 
+# if defined(HAVE_SYS_EPOLL_H)
+#  include <sys/epoll.h>
+# endif
+
+# if defined(HAVE_UNISTD_H)
+#  include <unistd.h>
+# endif
+
 #include <errno.h>
 #include <string.h>
 
@@ -82,6 +90,173 @@ LowResTime getDelayTarget (HsInt us)
     }
 }
 
+/* Note [Sleeping threads]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~
+ * Threads blocked in threadDelay (delay#) are kept in a binary min-heap,
+ * sleeping_heap[], ordered by their target wakeup time, so that adding
+ * a sleeper costs O(log n) rather than a walk along a sorted list.
+ * Each entry records the target alongside the TSO, which also carries it
+ * in tso->block_info.target.
+ *
+ * Removing a thread from the middle of the heap would need to know where
+ * it is, and there is nowhere in the TSO to keep that.  Instead,
+ * removeSleepingThread() (called when a sleeping thread receives an
+ * exception, e.g. from System.Timeout) just counts the entry as
+ * cancelled and leaves it in place.  Cancelled entries are recognised
+ * because their TSO is no longer BlockedOnDelay with the same target, and
+ * are dropped when they reach the top of the heap.  The heap is also
+ * compacted once more than half of it is cancelled, so cancelling is O(1)
+ * amortised.
+ *
+ * The heap is a GC root; see markSleepingThreads().  That drops any
+ * cancelled entries before marking, so they never keep a thread alive:
+ * a killed thread can be collected at the next GC rather than when its
+ * delay would have run out.
+ *
+ * Threads whose delays have expired go on the end of the run queue in
+ * the order of their targets, so they run in deadline order.
+ */
+
+typedef struct {
+    LowResTime  target;
+    StgTSO     *tso;
+} SleepingThread;
+
+static SleepingThread *sleeping_heap = NULL;
+static uint32_t        n_sleeping = 0;
+static uint32_t        sleeping_heap_size = 0;
+static uint32_t        n_cancelled_sleeping = 0;
+
+static bool
+sleeperIsLive (SleepingThread *s)
+{
+    return s->tso->why_blocked == BlockedOnDelay
+        && s->tso->block_info.target == s->target;
+}
+
+static void
+siftUpSleeping (uint32_t i)
+{
+    SleepingThread s = sleeping_heap[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (sleeping_heap[parent].target <= s.target) break;
+        sleeping_heap[i] = sleeping_heap[parent];
+        i = parent;
+    }
+    sleeping_heap[i] = s;
+}
+
+static void
+siftDownSleeping (uint32_t i)
+{
+    SleepingThread s = sleeping_heap[i];
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n_sleeping) break;
+        if (child + 1 < n_sleeping
+            && sleeping_heap[child + 1].target < sleeping_heap[child].target) {
+            child++;
+        }
+        if (s.target <= sleeping_heap[child].target) break;
+        sleeping_heap[i] = sleeping_heap[child];
+        i = child;
+    }
+    sleeping_heap[i] = s;
+}
+
+static void
+popSleeping (void)
+{
+    ASSERT(n_sleeping > 0);
+    sleeping_heap[0] = sleeping_heap[--n_sleeping];
+    if (n_sleeping > 0) {
+        siftDownSleeping(0);
+    }
+}
+
+/*
+ * Throw away the cancelled entries and rebuild the heap.
+ */
+static void
+purgeSleeping (void)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < n_sleeping; i++) {
+        if (sleeperIsLive(&sleeping_heap[i])) {
+            sleeping_heap[n++] = sleeping_heap[i];
+        }
+    }
+    n_sleeping = n;
+    n_cancelled_sleeping = 0;
+    for (i = n_sleeping / 2; i-- > 0; ) {
+        siftDownSleeping(i);
+    }
+}
+
+void
+addSleepingThread (StgTSO *tso)
+{
+    ASSERT(tso->why_blocked == BlockedOnDelay);
+    ASSERT(tso->_link == END_TSO_QUEUE);
+
+    if (n_sleeping == sleeping_heap_size) {
+        sleeping_heap_size = sleeping_heap_size == 0 ? 64
+                                                     : sleeping_heap_size * 2;
+        sleeping_heap = stgReallocBytes(sleeping_heap,
+                                        sleeping_heap_size
+                                          * sizeof(SleepingThread),
+                                        "addSleepingThread");
+    }
+    sleeping_heap[n_sleeping].target = tso->block_info.target;
+    sleeping_heap[n_sleeping].tso = tso;
+    siftUpSleeping(n_sleeping++);
+}
+
+void
+removeSleepingThread (StgTSO *tso)
+{
+    ASSERT(tso->why_blocked == BlockedOnDelay);
+    // This is what marks the entry for tso as cancelled.
+    tso->why_blocked = NotBlocked;
+    n_cancelled_sleeping++;
+    if (n_cancelled_sleeping > 32 && n_cancelled_sleeping > n_sleeping / 2) {
+        purgeSleeping();
+    }
+}
+
+bool
+emptySleepingThreads (void)
+{
+    return n_sleeping == n_cancelled_sleeping;
+}
+
+void
+markSleepingThreads (evac_fn evac, void *user)
+{
+    uint32_t i;
+
+    // See Note [Sleeping threads]
+    if (n_cancelled_sleeping > 0) {
+        purgeSleeping();
+    }
+
+    for (i = 0; i < n_sleeping; i++) {
+        evac(user, (StgClosure **)(void *)&sleeping_heap[i].tso);
+    }
+}
+
+void
+freeSleepingThreads (void)
+{
+    stgFree(sleeping_heap);
+    sleeping_heap = NULL;
+    n_sleeping = sleeping_heap_size = n_cancelled_sleeping = 0;
+}
+
 /* There's a clever trick here to avoid problems when the time wraps
  * around.  Since our maximum delay is smaller than 31 bits of ticks
  * (it's actually 31 bits of microseconds), we can safely check
@@ -92,38 +267,337 @@ LowResTime getDelayTarget (HsInt us)
  *
  * if this is true, then our time has expired.
  * (idea due to Andy Gill).
+ *
+ * On return the top of sleeping_heap, if any, is a live entry.
  */
 static bool wakeUpSleepingThreads (LowResTime now)
 {
     StgTSO *tso;
     bool flag = false;
 
-    while (sleeping_queue != END_TSO_QUEUE) {
-        tso = sleeping_queue;
+    while (n_sleeping > 0) {
+        if (!sleeperIsLive(&sleeping_heap[0])) {
+            popSleeping();
+            // Can only be zero if a thread was cancelled and then went
+            // back to sleep with exactly the same target, giving it two
+            // live-looking entries, and we purged in between.
+            if (n_cancelled_sleeping > 0) {
+                n_cancelled_sleeping--;
+            }
+            continue;
+        }
+        tso = sleeping_heap[0].tso;
         if (((long)now - (long)tso->block_info.target) < 0) {
             break;
         }
-        sleeping_queue = tso->_link;
+        popSleeping();
         tso->why_blocked = NotBlocked;
         tso->_link = END_TSO_QUEUE;
         IF_DEBUG(scheduler, debugBelch("Waking up sleeping thread %lu\n",
                                        (unsigned long)tso->id));
-        // MainCapability: this code is !THREADED_RTS
-        pushOnRunQueue(&MainCapability,tso);
+        // MainCapability: this code is !THREADED_RTS.  Appending keeps
+        // the threads in deadline order.
+        appendToRunQueue(&MainCapability,tso);
         flag = true;
     }
     return flag;
 }
 
+/* Note [Threads blocked on file descriptors]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A thread that calls waitRead# or waitWrite# in the non-threaded RTS
+ * is put on a queue belonging to the file descriptor it is waiting on:
+ * fd_waiters[fd].readers or fd_waiters[fd].writers.  The queues are
+ * linked through tso->_link, oldest waiter first, and when a
+ * descriptor becomes ready its waiters go on the end of the run queue
+ * in that order, so that a thread that has been waiting longer gets
+ * the first go at the data.  The descriptors that have at least
+ * one waiter are also recorded in the dense array active_fds[], so
+ * that we can enumerate them without scanning the whole table (for
+ * the GC, and for the select() poller).
+ *
+ * There are two pollers to choose from (+RTS --io-poller):
+ *
+ *  - select(): the fd_sets are rebuilt from active_fds[] on every
+ *    call, which costs O(number of blocked descriptors) and limits us
+ *    to descriptors below FD_SETSIZE.
+ *
+ *  - epoll (Linux): each descriptor is registered with the kernel once
+ *    and stays registered until it is closed, so blocking on a
+ *    descriptor costs at most one epoll_ctl(), and epoll_wait() only
+ *    tells us about the descriptors that are ready.  We register with
+ *    EPOLLONESHOT: after an event is delivered the registration is
+ *    disarmed until we re-arm it with EPOLL_CTL_MOD, which we do
+ *    lazily (fd_waiters[fd].armed tracks what the kernel is watching
+ *    for, and descriptors that need re-arming are kept in dirty_fds[]).
+ *    That way a descriptor nobody is waiting on any more can produce
+ *    at most one spurious event, rather than a stream of them.
+ *
+ * In both cases waking up the threads blocked on a ready descriptor
+ * touches only that descriptor's queues.
+ *
+ * Descriptors that epoll refuses to watch (regular files and
+ * directories, EPERM) are treated as always ready, which is what
+ * select() reports for them.  Descriptors that turn out to be invalid
+ * when we try to register them get blockedOnBadFD thrown to their
+ * waiters, as with select() (#4934).  A descriptor that is closed
+ * while some thread is blocked on it silently drops out of the epoll
+ * interest set; like in the threaded RTS, such threads are only woken
+ * if the descriptor is closed with closeFdWith.
+ */
+
+typedef struct {
+    StgTSO   *readers;      // threads in waitRead#, linked by _link
+    StgTSO   *writers;      // threads in waitWrite#, linked by _link
+    uint32_t  active_ix;    // index in active_fds[], if there are waiters
+    uint8_t   armed;        // FD_EV_* the kernel is watching for (epoll)
+    bool      registered;   // in the epoll interest set
+    bool      dirty;        // on dirty_fds[]
+} FdWaiters;
+
+#define FD_EV_READ  1
+#define FD_EV_WRITE 2
+
+static FdWaiters *fd_waiters = NULL;
+static uint32_t   fd_waiters_size = 0;
+
+static int       *active_fds = NULL;
+static uint32_t   n_active_fds = 0;
+static uint32_t   active_fds_size = 0;
+
+static IO_POLLER  io_poller;
+
+#if defined(HAVE_SYS_EPOLL_H)
+static int       *dirty_fds = NULL;
+static uint32_t   n_dirty_fds = 0;
+static uint32_t   dirty_fds_size = 0;
+
+static int        epoll_fd = -1;
+
+// How many events we ask epoll_wait() for at once; any others are
+// returned by the next call.
+#define EPOLL_MAX_EVENTS 256
+#endif
+
 static void GNUC3_ATTRIBUTE(__noreturn__)
 fdOutOfRange (int fd)
 {
     errorBelch("file descriptor %d out of range for select (0--%d).\n"
-               "Recompile with -threaded to work around this.",
+               "Recompile with -threaded, or use +RTS --io-poller=epoll,"
+               " to work around this.",
                fd, (int)FD_SETSIZE);
     stg_exit(EXIT_FAILURE);
 }
 
+static void
+growIntArray (int **arr, uint32_t *size, char *msg)
+{
+    *size = *size == 0 ? 64 : *size * 2;
+    *arr = stgReallocBytes(*arr, *size * sizeof(int), msg);
+}
+
+static void
+ensureFdWaiters (int fd)
+{
+    uint32_t i, new_size;
+
+    if ((uint32_t)fd < fd_waiters_size) return;
+
+    new_size = fd_waiters_size == 0 ? 64 : fd_waiters_size;
+    while (new_size <= (uint32_t)fd) {
+        new_size *= 2;
+    }
+    fd_waiters = stgReallocBytes(fd_waiters, new_size * sizeof(FdWaiters),
+                                 "ensureFdWaiters");
+    for (i = fd_waiters_size; i < new_size; i++) {
+        fd_waiters[i].readers    = END_TSO_QUEUE;
+        fd_waiters[i].writers    = END_TSO_QUEUE;
+        fd_waiters[i].active_ix  = 0;
+        fd_waiters[i].armed      = 0;
+        fd_waiters[i].registered = false;
+        fd_waiters[i].dirty      = false;
+    }
+    fd_waiters_size = new_size;
+}
+
+static uint8_t
+wantedEvents (FdWaiters *w)
+{
+    return (w->readers != END_TSO_QUEUE ? FD_EV_READ  : 0)
+         | (w->writers != END_TSO_QUEUE ? FD_EV_WRITE : 0);
+}
+
+/*
+ * Bring active_fds[] and dirty_fds[] up to date after the set of
+ * threads waiting on fd has changed.
+ */
+static void
+fdWaitersChanged (int fd)
+{
+    FdWaiters *w = &fd_waiters[fd];
+    uint8_t wanted = wantedEvents(w);
+
+    if (wanted == 0) {
+        // active_ix may be stale: after fd was removed as the last entry
+        // it points past the end, where its number may still be lying.
+        if (w->active_ix < n_active_fds && active_fds[w->active_ix] == fd) {
+            int last = active_fds[--n_active_fds];
+            active_fds[w->active_ix] = last;
+            fd_waiters[last].active_ix = w->active_ix;
+        }
+        // We leave the descriptor registered with epoll: if it is
+        // still armed it can fire once more, which is harmless, and
+        // the next thread to block on it will only need a MOD.
+        return;
+    }
+
+    if (n_active_fds == 0 || w->active_ix >= n_active_fds
+        || active_fds[w->active_ix] != fd) {
+        if (n_active_fds == active_fds_size) {
+            growIntArray(&active_fds, &active_fds_size, "fdWaitersChanged");
+        }
+        w->active_ix = n_active_fds;
+        active_fds[n_active_fds++] = fd;
+    }
+
+#if defined(HAVE_SYS_EPOLL_H)
+    if (io_poller == IO_POLLER_EPOLL && (wanted & ~w->armed) && !w->dirty) {
+        if (n_dirty_fds == dirty_fds_size) {
+            growIntArray(&dirty_fds, &dirty_fds_size, "fdWaitersChanged");
+        }
+        w->dirty = true;
+        dirty_fds[n_dirty_fds++] = fd;
+    }
+#endif
+}
+
+void
+blockOnFd (Capability *cap, StgTSO *tso)
+{
+    int fd = (int)tso->block_info.fd;
+    StgTSO **q, *last;
+
+    ASSERT(tso->_link == END_TSO_QUEUE);
+    ASSERT(tso->why_blocked == BlockedOnRead
+           || tso->why_blocked == BlockedOnWrite);
+
+    if (fd < 0) {
+        errorBelch("file descriptor %d out of range", fd);
+        stg_exit(EXIT_FAILURE);
+    }
+
+    ensureFdWaiters(fd);
+    q = tso->why_blocked == BlockedOnRead ? &fd_waiters[fd].readers
+                                          : &fd_waiters[fd].writers;
+    if (*q == END_TSO_QUEUE) {
+        *q = tso;
+    } else {
+        // Join the end of the queue; there are rarely more than a few
+        // threads waiting on one descriptor.
+        for (last = *q; last->_link != END_TSO_QUEUE; last = last->_link) {}
+        setTSOLink(cap, last, tso);
+    }
+    fdWaitersChanged(fd);
+}
+
+void
+removeFromFdWaiters (Capability *cap, StgTSO *tso)
+{
+    int fd = (int)tso->block_info.fd;
+    StgTSO **q, *t, *prev;
+
+    ASSERT(fd >= 0 && (uint32_t)fd < fd_waiters_size);
+    q = tso->why_blocked == BlockedOnRead ? &fd_waiters[fd].readers
+                                          : &fd_waiters[fd].writers;
+
+    prev = NULL;
+    for (t = *q; t != END_TSO_QUEUE; prev = t, t = t->_link) {
+        if (t == tso) {
+            if (prev) {
+                setTSOLink(cap, prev, t->_link);
+            } else {
+                *q = t->_link;
+            }
+            t->_link = END_TSO_QUEUE;
+            fdWaitersChanged(fd);
+            return;
+        }
+    }
+    barf("removeFromFdWaiters: not found");
+}
+
+bool
+emptyFdWaiters (void)
+{
+    return n_active_fds == 0;
+}
+
+void
+markFdWaiters (evac_fn evac, void *user)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_active_fds; i++) {
+        FdWaiters *w = &fd_waiters[active_fds[i]];
+        evac(user, (StgClosure **)(void *)&w->readers);
+        evac(user, (StgClosure **)(void *)&w->writers);
+    }
+}
+
+/*
+ * Make every thread on the queue *q runnable.
+ */
+static void
+wakeFdQueue (StgTSO **q)
+{
+    StgTSO *tso, *next;
+
+    for (tso = *q; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        IF_DEBUG(scheduler,
+                 debugBelch("Waking up blocked thread %lu\n",
+                            (unsigned long)tso->id));
+        tso->why_blocked = NotBlocked;
+        tso->_link = END_TSO_QUEUE;
+        // MainCapability: this code is !THREADED_RTS.  Appending keeps
+        // the waiters in the order they blocked; see
+        // Note [Threads blocked on file descriptors].
+        appendToRunQueue(&MainCapability,tso);
+    }
+    *q = END_TSO_QUEUE;
+}
+
+static void
+fdReady (int fd, uint8_t events)
+{
+    FdWaiters *w = &fd_waiters[fd];
+
+    if (events & FD_EV_READ) {
+        wakeFdQueue(&w->readers);
+    }
+    if (events & FD_EV_WRITE) {
+        wakeFdQueue(&w->writers);
+    }
+    fdWaitersChanged(fd);
+}
+
+/*
+ * Don't let RTS loop on bad descriptors, pass an IOError to the
+ * threads blocked on them (#4934).  raiseAsync() takes each thread
+ * off its queue via removeFromFdWaiters().
+ */
+static void
+raiseOnBadFd (StgTSO **q, int fd STG_UNUSED)
+{
+    while (*q != END_TSO_QUEUE) {
+        IF_DEBUG(scheduler,
+                 debugBelch("Killing blocked thread %lu on bad fd=%i\n",
+                            (unsigned long)(*q)->id, fd));
+        raiseAsync(&MainCapability, *q,
+                   (StgClosure *)blockedOnBadFD_closure, false, NULL);
+    }
+}
+
 /*
  * State of individual file descriptor after a 'select()' poll.
  */
@@ -203,6 +677,353 @@ static enum FdState fdPollWriteState (int fd)
         return RTS_FD_IS_READY;
 }
 
+/*
+ * The poller was interrupted by a signal.  Returns true if we should
+ * return to the scheduler straight away rather than carry on waiting.
+ */
+static bool
+pollInterrupted (void)
+{
+    /* We got a signal; could be one of ours.  If so, we need
+     * to start up the signal handler straight away, otherwise
+     * we could block for a long time before the signal is
+     * serviced.
+     */
+#if defined(RTS_USER_SIGNALS)
+    if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+        startSignalHandlers(&MainCapability);
+        return true;
+    }
+#endif
+
+    /* we were interrupted, return to the scheduler immediately.
+     */
+    if (sched_state >= SCHED_INTERRUPTING) {
+        return true;
+    }
+
+    /* check for threads that need waking up
+     */
+    wakeUpSleepingThreads(getLowResTimeOfDay());
+
+    /* If new runnable threads have arrived, stop waiting for
+     * I/O and run them.
+     */
+    return !emptyRunQueue(&MainCapability);
+}
+
+/*
+ * Wait for at most 'timeout' (forever if negative) for one of the
+ * active descriptors to become ready, using select().
+ */
+static void
+selectFds (Time timeout)
+{
+    fd_set rfd,wfd;
+    int numFound;
+    int maxfd = -1;
+    bool seen_bad_fd = false;
+    struct timeval tv, *ptv;
+    uint32_t i;
+
+    /*
+     * Collect all of the fd's that we're interested in
+     */
+    FD_ZERO(&rfd);
+    FD_ZERO(&wfd);
+
+    for (i = 0; i < n_active_fds; i++) {
+        int fd = active_fds[i];
+        FdWaiters *w = &fd_waiters[fd];
+
+        /* On older FreeBSDs, FD_SETSIZE is unsigned. Cast it to signed int
+         * in order to switch off the 'comparison between signed and
+         * unsigned error message
+         * Newer versions of FreeBSD have switched to unsigned int:
+         *   https://github.com/freebsd/freebsd/commit/12ae7f74a071f0439763986026525094a7032dfd
+         *   http://fa.freebsd.cvs-all.narkive.com/bCWNHbaC/svn-commit-r265051-head-sys-sys
+         * So the (int) cast should be removed across the code base once
+         * GHC requires a version of FreeBSD that has that change in it.
+         */
+        if (fd >= (int)FD_SETSIZE) {
+            fdOutOfRange(fd);
+        }
+        maxfd = (fd > maxfd) ? fd : maxfd;
+        if (w->readers != END_TSO_QUEUE) {
+            FD_SET(fd, &rfd);
+        }
+        if (w->writers != END_TSO_QUEUE) {
+            FD_SET(fd, &wfd);
+        }
+    }
+
+    if (timeout < 0) {
+        ptv = NULL;
+    } else {
+        tv.tv_sec  = TimeToSeconds(timeout);
+        tv.tv_usec = TimeToUS(timeout) % 1000000;
+        ptv = &tv;
+    }
+
+    /* Check for any interesting events */
+
+    while ((numFound = select(maxfd+1, &rfd, &wfd, NULL, ptv)) < 0) {
+        if (errno != EINTR) {
+          if ( errno == EBADF ) {
+              seen_bad_fd = true;
+              break;
+          } else {
+              sysErrorBelch("select");
+              stg_exit(EXIT_FAILURE);
+          }
+        }
+
+        if (pollInterrupted()) {
+            return; /* still hold the lock */
+        }
+    }
+
+    if (numFound == 0) {
+        return;
+    }
+
+    /* Step through the active descriptors, unblocking every thread
+     * that now has a file descriptor in a ready state.  We go
+     * backwards because fdWaitersChanged() may move the last active
+     * descriptor into the slot of the one we have just emptied.
+     */
+    for (i = n_active_fds; i-- > 0; ) {
+        int fd = active_fds[i];
+        FdWaiters *w = &fd_waiters[fd];
+        uint8_t ready = 0;
+
+        if (seen_bad_fd) {
+            enum FdState rd = RTS_FD_IS_BLOCKING, wr = RTS_FD_IS_BLOCKING;
+            if (w->readers != END_TSO_QUEUE) {
+                rd = fdPollReadState(fd);
+            }
+            if (w->writers != END_TSO_QUEUE) {
+                wr = fdPollWriteState(fd);
+            }
+            if (rd == RTS_FD_IS_INVALID || wr == RTS_FD_IS_INVALID) {
+                raiseOnBadFd(&w->readers, fd);
+                raiseOnBadFd(&w->writers, fd);
+                continue;
+            }
+            ready |= rd == RTS_FD_IS_READY ? FD_EV_READ  : 0;
+            ready |= wr == RTS_FD_IS_READY ? FD_EV_WRITE : 0;
+        } else {
+            ready |= FD_ISSET(fd, &rfd) ? FD_EV_READ  : 0;
+            ready |= FD_ISSET(fd, &wfd) ? FD_EV_WRITE : 0;
+        }
+
+        if (ready) {
+            fdReady(fd, ready);
+        }
+    }
+}
+
+#if defined(HAVE_SYS_EPOLL_H)
+static uint32_t
+epollEvents (uint8_t events)
+{
+    return EPOLLONESHOT
+         | ((events & FD_EV_READ)  ? EPOLLIN  : 0)
+         | ((events & FD_EV_WRITE) ? EPOLLOUT : 0);
+}
+
+/*
+ * Arm the epoll registrations of the descriptors on dirty_fds[].
+ * Returns true if doing so made some threads runnable.
+ */
+static bool
+epollFlushDirty (void)
+{
+    bool woken = false;
+    uint32_t i;
+
+    // fdReady() and raiseOnBadFd() can't make a descriptor dirty
+    // again, since they leave it with fewer waiters, but we don't
+    // rely on that and re-read n_dirty_fds on every iteration.
+    for (i = 0; i < n_dirty_fds; i++) {
+        int fd = dirty_fds[i];
+        FdWaiters *w = &fd_waiters[fd];
+        uint8_t wanted = wantedEvents(w);
+        struct epoll_event ev;
+        int r = -1;
+
+        w->dirty = false;
+        if ((wanted & ~w->armed) == 0) {
+            continue;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = epollEvents(wanted);
+        ev.data.fd = fd;
+
+        if (w->registered) {
+            r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            if (r == -1 && errno == ENOENT) {
+                // closed and re-opened since we last registered it
+                w->registered = false;
+            }
+        }
+        if (!w->registered) {
+            r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            if (r == -1 && errno == EEXIST) {
+                r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            }
+        }
+
+        if (r == 0) {
+            w->registered = true;
+            w->armed = wanted;
+            continue;
+        }
+
+        switch (errno) {
+        case EPERM:
+            // Regular files and directories can't be polled, and
+            // select() always reports them as ready.
+            w->registered = false;
+            fdReady(fd, FD_EV_READ | FD_EV_WRITE);
+            woken = true;
+            break;
+        case EBADF:
+            w->registered = false;
+            raiseOnBadFd(&w->readers, fd);
+            raiseOnBadFd(&w->writers, fd);
+            woken = true;
+            break;
+        default:
+            sysErrorBelch("epoll_ctl");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    n_dirty_fds = 0;
+    return woken;
+}
+
+/*
+ * Wait for at most 'timeout' (forever if negative) for one of the
+ * registered descriptors to become ready, using epoll.
+ */
+static void
+epollFds (Time timeout)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int i, n, timeout_ms;
+
+    if (epollFlushDirty()) {
+        // don't block, there are threads to run already
+        timeout = 0;
+    }
+
+    if (timeout < 0) {
+        timeout_ms = -1;
+    } else {
+        // round up: better to wake up late than spin
+        timeout_ms = (int)TimeToMS(timeout + MSToTime(1) - 1);
+    }
+
+    while ((n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS,
+                           timeout_ms)) < 0) {
+        if (errno != EINTR) {
+            sysErrorBelch("epoll_wait");
+            stg_exit(EXIT_FAILURE);
+        }
+        if (pollInterrupted()) {
+            return; /* still hold the lock */
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        uint32_t e = events[i].events;
+        uint8_t ready = 0;
+
+        // EPOLLONESHOT: the kernel has disarmed the registration
+        fd_waiters[fd].armed = 0;
+
+        if (e & (EPOLLERR | EPOLLHUP)) {
+            ready = FD_EV_READ | FD_EV_WRITE;
+        }
+        ready |= (e & EPOLLIN)  ? FD_EV_READ  : 0;
+        ready |= (e & EPOLLOUT) ? FD_EV_WRITE : 0;
+        fdReady(fd, ready);
+    }
+}
+
+static void
+startEpoll (void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        IF_DEBUG(scheduler,
+                 debugBelch("epoll_create1 failed (%s), using select()\n",
+                            strerror(errno)));
+        io_poller = IO_POLLER_SELECT;
+    }
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+void
+initFdWaiters (void)
+{
+    io_poller = RtsFlags.MiscFlags.ioPoller;
+#if defined(HAVE_SYS_EPOLL_H)
+    if (io_poller == IO_POLLER_EPOLL) {
+        startEpoll();
+    }
+#endif
+}
+
+void
+freeFdWaiters (void)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    stgFree(dirty_fds);
+    dirty_fds = NULL;
+    n_dirty_fds = dirty_fds_size = 0;
+#endif
+    stgFree(fd_waiters);
+    fd_waiters = NULL;
+    fd_waiters_size = 0;
+    stgFree(active_fds);
+    active_fds = NULL;
+    n_active_fds = active_fds_size = 0;
+}
+
+/*
+ * The child of forkProcess() shares the parent's epoll instance; it
+ * must not touch it, or it would change what the parent is watching.
+ */
+void
+resetFdWaitersAfterFork (void)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    uint32_t i;
+
+    if (io_poller != IO_POLLER_EPOLL) return;
+
+    close(epoll_fd);
+    for (i = 0; i < fd_waiters_size; i++) {
+        fd_waiters[i].registered = false;
+        fd_waiters[i].armed = 0;
+        fd_waiters[i].dirty = false;
+    }
+    n_dirty_fds = 0;
+    startEpoll();
+    for (i = 0; i < n_active_fds; i++) {
+        fdWaitersChanged(active_fds[i]);
+    }
+#endif
+}
+
 /* Argument 'wait' says whether to wait for I/O to become available,
  * or whether to just check and return immediately.  If there are
  * other threads ready to run, we normally do the non-waiting variety,
@@ -219,12 +1040,7 @@ static enum FdState fdPollWriteState (int fd)
 void
 awaitEvent(bool wait)
 {
-    StgTSO *tso, *prev, *next;
-    fd_set rfd,wfd;
-    int numFound;
-    int maxfd = -1;
-    bool seen_bad_fd = false;
-    struct timeval tv, *ptv;
+    Time timeout;
     LowResTime now;
 
     IF_DEBUG(scheduler,
@@ -247,58 +1063,10 @@ awaitEvent(bool wait)
           return;
       }
 
-      /*
-       * Collect all of the fd's that we're interested in
-       */
-      FD_ZERO(&rfd);
-      FD_ZERO(&wfd);
-
-      for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
-        next = tso->_link;
-
-      /* On older FreeBSDs, FD_SETSIZE is unsigned. Cast it to signed int
-       * in order to switch off the 'comparison between signed and
-       * unsigned error message
-       * Newer versions of FreeBSD have switched to unsigned int:
-       *   https://github.com/freebsd/freebsd/commit/12ae7f74a071f0439763986026525094a7032dfd
-       *   http://fa.freebsd.cvs-all.narkive.com/bCWNHbaC/svn-commit-r265051-head-sys-sys
-       * So the (int) cast should be removed across the code base once
-       * GHC requires a version of FreeBSD that has that change in it.
-       */
-        switch (tso->why_blocked) {
-        case BlockedOnRead:
-          {
-            int fd = tso->block_info.fd;
-            if ((fd >= (int)FD_SETSIZE) || (fd < 0)) {
-                fdOutOfRange(fd);
-            }
-            maxfd = (fd > maxfd) ? fd : maxfd;
-            FD_SET(fd, &rfd);
-            continue;
-          }
-
-        case BlockedOnWrite:
-          {
-            int fd = tso->block_info.fd;
-            if ((fd >= (int)FD_SETSIZE) || (fd < 0)) {
-                fdOutOfRange(fd);
-            }
-            maxfd = (fd > maxfd) ? fd : maxfd;
-            FD_SET(fd, &wfd);
-            continue;
-          }
-
-        default:
-          barf("AwaitEvent");
-        }
-      }
-
       if (!wait) {
           // just poll
-          tv.tv_sec  = 0;
-          tv.tv_usec = 0;
-          ptv = &tv;
-      } else if (sleeping_queue != END_TSO_QUEUE) {
+          timeout = 0;
+      } else if (n_sleeping > 0) {
           /* SUSv2 allows implementations to have an implementation defined
            * maximum timeout for select(2). The standard requires
            * implementations to silently truncate values exceeding this maximum
@@ -307,148 +1075,33 @@ awaitEvent(bool wait)
            * timeout of 1e8.
            *
            * Select returning an error crashes the runtime in a bad way. To
-           * play it safe we truncate any timeout to 31 days, as SUSv2 requires
-           * any implementations maximum timeout to be larger than this.
+           * play it safe we truncate any timeout to 24 days, as SUSv2
+           * requires any implementations maximum timeout to be larger
+           * than 31 days, and epoll_wait(2) takes the timeout in
+           * milliseconds as an int.
            *
            * Truncating the timeout is not an issue, because if nothing
            * interesting happens when the timeout expires, we'll see that the
            * thread still wants to be blocked longer and simply block on a new
            * iteration of select(2).
            */
-          const time_t max_seconds = 2678400; // 31 * 24 * 60 * 60
+          const Time max_timeout = SecondsToTime(2073600); // 24 * 24 * 60 * 60
 
-          Time min = LowResTimeToTime(sleeping_queue->block_info.target - now);
-          tv.tv_sec  = TimeToSeconds(min);
-          if (tv.tv_sec < max_seconds) {
-              tv.tv_usec = TimeToUS(min) % 1000000;
-          } else {
-              tv.tv_sec = max_seconds;
-              tv.tv_usec = 0;
+          timeout = LowResTimeToTime(sleeping_heap[0].target - now);
+          if (timeout > max_timeout) {
+              timeout = max_timeout;
           }
-          ptv = &tv;
       } else {
-          ptv = NULL;
+          timeout = -1;
       }
 
-      /* Check for any interesting events */
-
-      while ((numFound = select(maxfd+1, &rfd, &wfd, NULL, ptv)) < 0) {
-          if (errno != EINTR) {
-            if ( errno == EBADF ) {
-                seen_bad_fd = true;
-                break;
-            } else {
-                sysErrorBelch("select");
-                stg_exit(EXIT_FAILURE);
-            }
-          }
-
-          /* We got a signal; could be one of ours.  If so, we need
-           * to start up the signal handler straight away, otherwise
-           * we could block for a long time before the signal is
-           * serviced.
-           */
-#if defined(RTS_USER_SIGNALS)
-          if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
-              startSignalHandlers(&MainCapability);
-              return; /* still hold the lock */
-          }
+#if defined(HAVE_SYS_EPOLL_H)
+      if (io_poller == IO_POLLER_EPOLL) {
+          epollFds(timeout);
+      } else
 #endif
-
-          /* we were interrupted, return to the scheduler immediately.
-           */
-          if (sched_state >= SCHED_INTERRUPTING) {
-              return; /* still hold the lock */
-          }
-
-          /* check for threads that need waking up
-           */
-          wakeUpSleepingThreads(getLowResTimeOfDay());
-
-          /* If new runnable threads have arrived, stop waiting for
-           * I/O and run them.
-           */
-          if (!emptyRunQueue(&MainCapability)) {
-              return; /* still hold the lock */
-          }
-      }
-
-      /* Step through the waiting queue, unblocking every thread that now has
-       * a file descriptor in a ready state.
-       */
-
-      prev = NULL;
       {
-          /*
-           * The queue is being rebuilt in this loop:
-           * 'blocked_queue_hd' will contain already
-           * traversed blocked TSOs. As a result you
-           * can't use functions accessing 'blocked_queue_hd'.
-           */
-          for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
-              next = tso->_link;
-              int fd;
-              enum FdState fd_state = RTS_FD_IS_BLOCKING;
-
-              switch (tso->why_blocked) {
-              case BlockedOnRead:
-                  fd = tso->block_info.fd;
-
-                  if (seen_bad_fd) {
-                      fd_state = fdPollReadState (fd);
-                  } else if (FD_ISSET(fd, &rfd)) {
-                      fd_state = RTS_FD_IS_READY;
-                  }
-                  break;
-              case BlockedOnWrite:
-                  fd = tso->block_info.fd;
-
-                  if (seen_bad_fd) {
-                      fd_state = fdPollWriteState (fd);
-                  } else if (FD_ISSET(fd, &wfd)) {
-                      fd_state = RTS_FD_IS_READY;
-                  }
-                  break;
-              default:
-                  barf("awaitEvent");
-              }
-
-              switch (fd_state) {
-              case RTS_FD_IS_INVALID:
-                  /*
-                   * Don't let RTS loop on such descriptors,
-                   * pass an IOError to blocked threads (#4934)
-                   */
-                  IF_DEBUG(scheduler,
-                      debugBelch("Killing blocked thread %lu on bad fd=%i\n",
-                                 (unsigned long)tso->id, fd));
-                  raiseAsync(&MainCapability, tso,
-                      (StgClosure *)blockedOnBadFD_closure, false, NULL);
-                  break;
-              case RTS_FD_IS_READY:
-                  IF_DEBUG(scheduler,
-                      debugBelch("Waking up blocked thread %lu\n",
-                                 (unsigned long)tso->id));
-                  tso->why_blocked = NotBlocked;
-                  tso->_link = END_TSO_QUEUE;
-                  pushOnRunQueue(&MainCapability,tso);
-                  break;
-              case RTS_FD_IS_BLOCKING:
-                  if (prev == NULL)
-                      blocked_queue_hd = tso;
-                  else
-                      setTSOLink(&MainCapability, prev, tso);
-                  prev = tso;
-                  break;
-              }
-          }
-
-          if (prev == NULL)
-              blocked_queue_hd = blocked_queue_tl = END_TSO_QUEUE;
-          else {
-              prev->_link = END_TSO_QUEUE;
-              blocked_queue_tl = prev;
-          }
+          selectFds(timeout);
       }
 
     } while (wait && sched_state == SCHED_RUNNING
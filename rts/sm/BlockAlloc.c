@@ -21,9 +21,12 @@
 #include "Storage.h"
 #include "RtsUtils.h"
 #include "BlockAlloc.h"
+#include "Capability.h"
+#include "Sweep.h"
 #include "OSMem.h"
 
 #include <string.h>
+#include <math.h>
 
 static void  initMBlock(void *mblock, uint32_t node);
 
@@ -166,6 +169,12 @@ W_ hw_alloc_blocks;  // high-water allocated blocks
 
 W_ n_alloc_blocks_by_node[MAX_NUMA_NODES];
 
+#if defined(THREADED_RTS)
+// Block caches for threads without a capability, see Note [Block caches]
+static BlockCache node_block_caches[MAX_NUMA_NODES];
+static SpinLock node_block_cache_locks[MAX_NUMA_NODES];
+#endif
+
 /* -----------------------------------------------------------------------------
    Initialisation
    -------------------------------------------------------------------------- */
@@ -179,6 +188,10 @@ void initBlockAllocator(void)
         }
         free_mblock_list[node] = NULL;
         n_alloc_blocks_by_node[node] = 0;
+#if defined(THREADED_RTS)
+        initBlockCache(&node_block_caches[node], node);
+        initSpinLock(&node_block_cache_locks[node]);
+#endif
     }
     n_alloc_blocks = 0;
     hw_alloc_blocks = 0;
@@ -462,6 +475,17 @@ allocGroupOnNode (uint32_t node, W_ n)
         ln++;
     }
 
+    // Before we take more memory from the OS, see whether sweeping some
+    // more of the oldest generation frees up enough. See Note [Lazy
+    // sweeping] in Sweep.c.
+    while (ln == NUM_FREE_LISTS && lazySweepPending()) {
+        lazySweep(LAZY_SWEEP_BLOCKS);
+        ln = log_2_ceil(n);
+        while (ln < NUM_FREE_LISTS && free_list[node][ln] == NULL) {
+            ln++;
+        }
+    }
+
     if (ln == NUM_FREE_LISTS) {
 #if 0  /* useful for debugging fragmentation */
         if ((W_)mblocks_allocated * BLOCKS_PER_MBLOCK * BLOCK_SIZE_W
@@ -689,10 +713,288 @@ bdescr* allocLargeChunk (W_ min, W_ max)
     return allocLargeChunkOnNode(nodeWithLeastBlocks(), min, max);
 }
 
+/* -----------------------------------------------------------------------------
+   Block caches
+   -------------------------------------------------------------------------- */
+
+/* Note [Block caches]
+ * ~~~~~~~~~~~~~~~~~~~
+ * The free lists are protected by sm_mutex, which allocGroup_lock() and
+ * freeGroup_lock() must take.  With many capabilities allocating large
+ * objects, pinned blocks and nursery blocks at once, that lock is a point
+ * of contention, even though almost all of these requests are for a single
+ * block or a small group.  So in the threaded RTS each capability
+ * keeps a cache of free groups of 1..BLOCK_CACHE_MAX_GROUP blocks
+ * (cap->block_cache), which it uses without taking any lock:
+ *
+ *  - When the cache has no group of the requested size, we take sm_mutex
+ *    once, allocate BLOCK_CACHE_BATCH blocks' worth of groups of that size,
+ *    return one of them and keep the rest.
+ *
+ *  - When a freed group takes the cache over BLOCK_CACHE_LIMIT blocks, we
+ *    take sm_mutex once and return groups to the free lists, largest first,
+ *    until the cache holds BLOCK_CACHE_LIMIT - BLOCK_CACHE_BATCH blocks.
+ *
+ * Only the task running on a capability may use its cache, so the cache
+ * needs no lock of its own.  Other threads -- the nonmoving collector's mark
+ * thread, say, or a foreign thread calling into the RTS -- use a cache per
+ * NUMA node (node_block_caches), protected by a spin lock.  Nothing takes
+ * sm_mutex while holding one of those spin locks, so flushBlockCaches() can
+ * take them with sm_mutex held.  A cache only holds groups from its own
+ * node; anything else takes the old route through sm_mutex, as does
+ * allocGroup_lock() from a thread without a capability, since that has to
+ * pick a node under the lock.
+ *
+ * To the rest of the block allocator a group in a cache is still allocated:
+ * it is counted in n_alloc_blocks, its bd->free is not -1 (so freeGroup()
+ * won't coalesce a neighbour with it, see Note [Data races in freeGroup])
+ * and its last block still points to its head.  memInventory() counts the
+ * cached blocks with blockCacheBlocks().
+ *
+ * The GC allocates with allocGroup_sync() and friends, under
+ * gc_alloc_block_sync rather than sm_mutex, and already takes single
+ * blocks in batches into gct->free_blocks, so it doesn't use the caches.
+ * Instead, GarbageCollect() empties them all into the free lists with
+ * flushBlockCaches(), so that memory doesn't sit in a cache across a GC and
+ * returnMemoryToOS() can see it.
+ */
+
+#if defined(THREADED_RTS)
+
+void
+initBlockCache (BlockCache *cache, uint32_t node)
+{
+    for (uint32_t i = 0; i < BLOCK_CACHE_MAX_GROUP; i++) {
+        cache->groups[i] = NULL;
+    }
+    cache->n_blocks = 0;
+    cache->node = node;
+}
+
+STATIC_INLINE bool
+block_cache_fits (W_ n)
+{
+    return n >= 1 && n <= BLOCK_CACHE_MAX_GROUP;
+}
+
+// The capability whose block cache the calling thread may use, if any
+STATIC_INLINE Capability *
+my_block_cache_cap (void)
+{
+    Task *task = myTask();
+    if (task != NULL && taskOwnsCapability(task)) {
+        return task->cap;
+    }
+    return NULL;
+}
+
+// The cache to use for groups on the given node, and the lock to take (or
+// NULL) when using it.
+STATIC_INLINE BlockCache *
+my_block_cache (uint32_t node, SpinLock **lock)
+{
+    Capability *cap = my_block_cache_cap();
+    if (cap != NULL && cap->block_cache.node == node) {
+        *lock = NULL;
+        return &cap->block_cache;
+    }
+    *lock = &node_block_cache_locks[node];
+    return &node_block_caches[node];
+}
+
+STATIC_INLINE void
+lock_block_cache (SpinLock *lock)
+{
+    if (lock != NULL) ACQUIRE_SPIN_LOCK(lock);
+}
+
+STATIC_INLINE void
+unlock_block_cache (SpinLock *lock)
+{
+    if (lock != NULL) RELEASE_SPIN_LOCK(lock);
+}
+
+STATIC_INLINE void
+block_cache_push (BlockCache *cache, bdescr *bd)
+{
+    ASSERT(block_cache_fits(bd->blocks) && bd->node == cache->node);
+    bd->link = cache->groups[bd->blocks - 1];
+    cache->groups[bd->blocks - 1] = bd;
+    cache->n_blocks += bd->blocks;
+}
+
+STATIC_INLINE bdescr *
+block_cache_pop (BlockCache *cache, W_ n)
+{
+    bdescr *bd = cache->groups[n - 1];
+    if (bd != NULL) {
+        cache->groups[n - 1] = bd->link;
+        cache->n_blocks -= n;
+    }
+    return bd;
+}
+
+// Take groups off a cache, largest first, until it holds at most limit
+// blocks, and return them as a chain.
+static bdescr *
+block_cache_trim (BlockCache *cache, uint32_t limit)
+{
+    bdescr *chain = NULL, *bd;
+    for (int i = BLOCK_CACHE_MAX_GROUP - 1; i >= 0; i--) {
+        while (cache->n_blocks > limit && cache->groups[i] != NULL) {
+            bd = block_cache_pop(cache, i + 1);
+            bd->link = chain;
+            chain = bd;
+        }
+    }
+    return chain;
+}
+
+static bdescr *
+alloc_group_cached (uint32_t node, W_ n)
+{
+    BlockCache *cache;
+    SpinLock *lock;
+    bdescr *bd, *spare, *next;
+    W_ i;
+
+    cache = my_block_cache(node, &lock);
+    lock_block_cache(lock);
+    bd = block_cache_pop(cache, n);
+    unlock_block_cache(lock);
+
+    if (bd != NULL) {
+        // As allocGroupOnNode() would leave it
+        initGroup(bd);
+        IF_DEBUG(zero_on_gc, memset(bd->start, 0xaa, bd->blocks * BLOCK_SIZE));
+        return bd;
+    }
+
+    // Refill: one group for the caller, the rest of the batch for the cache
+    spare = NULL;
+    ACQUIRE_SM_LOCK;
+    bd = allocGroupOnNode(node, n);
+    for (i = n; i + n <= BLOCK_CACHE_BATCH; i += n) {
+        next = allocGroupOnNode(node, n);
+        next->link = spare;
+        spare = next;
+    }
+    RELEASE_SM_LOCK;
+
+    lock_block_cache(lock);
+    for (; spare != NULL; spare = next) {
+        next = spare->link;
+        block_cache_push(cache, spare);
+    }
+    unlock_block_cache(lock);
+    return bd;
+}
+
+static void
+free_group_cached (bdescr *p)
+{
+    BlockCache *cache;
+    SpinLock *lock;
+    bdescr *drain = NULL;
+
+    ASSERT(RELAXED_LOAD(&p->free) != (P_)-1);
+
+    // Forget what the group held, as freeGroup() would, but leave it
+    // looking allocated; see Note [Block caches].
+#if defined(DEBUG)
+    for (uint32_t i=0; i < p->blocks; i++) {
+        p[i].flags = 0;
+    }
+#endif
+    RELAXED_STORE(&p->free, p->start);
+    RELAXED_STORE(&p->gen, NULL);
+    RELAXED_STORE(&p->gen_no, 0);
+    IF_DEBUG(zero_on_gc, memset(p->start, 0xaa, (W_)p->blocks * BLOCK_SIZE));
+
+    cache = my_block_cache(p->node, &lock);
+    lock_block_cache(lock);
+    block_cache_push(cache, p);
+    if (cache->n_blocks > BLOCK_CACHE_LIMIT) {
+        drain = block_cache_trim(cache, BLOCK_CACHE_LIMIT - BLOCK_CACHE_BATCH);
+    }
+    unlock_block_cache(lock);
+
+    if (drain != NULL) {
+        ACQUIRE_SM_LOCK;
+        freeChain(drain);
+        RELEASE_SM_LOCK;
+    }
+}
+
+// Return every cached group to the free lists.  Called by the GC with
+// sm_mutex held and every capability stopped.
+void
+flushBlockCaches (void)
+{
+    uint32_t i, node;
+    bdescr *chain;
+
+    ASSERT_SM_LOCK();
+    for (i = 0; i < n_capabilities; i++) {
+        freeChain(block_cache_trim(&capabilities[i]->block_cache, 0));
+    }
+    for (node = 0; node < n_numa_nodes; node++) {
+        ACQUIRE_SPIN_LOCK(&node_block_cache_locks[node]);
+        chain = block_cache_trim(&node_block_caches[node], 0);
+        RELEASE_SPIN_LOCK(&node_block_cache_locks[node]);
+        freeChain(chain);
+    }
+}
+
+// The number of blocks in all the caches, for memInventory()
+W_
+blockCacheBlocks (void)
+{
+    uint32_t i, node;
+    W_ n = 0;
+    for (i = 0; i < n_capabilities; i++) {
+        n += capabilities[i]->block_cache.n_blocks;
+    }
+    for (node = 0; node < n_numa_nodes; node++) {
+        n += node_block_caches[node].n_blocks;
+    }
+    return n;
+}
+
+#if defined(DEBUG)
+static void
+markBlockCache (BlockCache *cache)
+{
+    for (uint32_t i = 0; i < BLOCK_CACHE_MAX_GROUP; i++) {
+        markBlocks(cache->groups[i]);
+    }
+}
+
+void
+markBlockCaches (void)
+{
+    uint32_t i, node;
+    for (i = 0; i < n_capabilities; i++) {
+        markBlockCache(&capabilities[i]->block_cache);
+    }
+    for (node = 0; node < n_numa_nodes; node++) {
+        markBlockCache(&node_block_caches[node]);
+    }
+}
+#endif
+
+#endif /* THREADED_RTS */
+
 bdescr *
 allocGroup_lock(W_ n)
 {
     bdescr *bd;
+#if defined(THREADED_RTS)
+    Capability *cap = my_block_cache_cap();
+    if (cap != NULL && block_cache_fits(n)) {
+        return alloc_group_cached(cap->node, n);
+    }
+#endif
     ACQUIRE_SM_LOCK;
     bd = allocGroup(n);
     RELEASE_SM_LOCK;
@@ -702,17 +1004,18 @@ allocGroup_lock(W_ n)
 bdescr *
 allocBlock_lock(void)
 {
-    bdescr *bd;
-    ACQUIRE_SM_LOCK;
-    bd = allocBlock();
-    RELEASE_SM_LOCK;
-    return bd;
+    return allocGroup_lock(1);
 }
 
 bdescr *
 allocGroupOnNode_lock(uint32_t node, W_ n)
 {
     bdescr *bd;
+#if defined(THREADED_RTS)
+    if (block_cache_fits(n)) {
+        return alloc_group_cached(node, n);
+    }
+#endif
     ACQUIRE_SM_LOCK;
     bd = allocGroupOnNode(node,n);
     RELEASE_SM_LOCK;
@@ -722,11 +1025,7 @@ allocGroupOnNode_lock(uint32_t node, W_ n)
 bdescr *
 allocBlockOnNode_lock(uint32_t node)
 {
-    bdescr *bd;
-    ACQUIRE_SM_LOCK;
-    bd = allocBlockOnNode(node);
-    RELEASE_SM_LOCK;
-    return bd;
+    return allocGroupOnNode_lock(node, 1);
 }
 
 /* -----------------------------------------------------------------------------
@@ -904,6 +1203,12 @@ freeGroup(bdescr *p)
 void
 freeGroup_lock(bdescr *p)
 {
+#if defined(THREADED_RTS)
+    if (block_cache_fits(p->blocks)) {
+        free_group_cached(p);
+        return;
+    }
+#endif
     ACQUIRE_SM_LOCK;
     freeGroup(p);
     RELEASE_SM_LOCK;
@@ -923,6 +1228,20 @@ freeChain(bdescr *bd)
 void
 freeChain_lock(bdescr *bd)
 {
+#if defined(THREADED_RTS)
+    bdescr *next, *rest = NULL;
+    for (; bd != NULL; bd = next) {
+        next = bd->link;
+        if (block_cache_fits(bd->blocks)) {
+            free_group_cached(bd);
+        } else {
+            bd->link = rest;
+            rest = bd;
+        }
+    }
+    if (rest == NULL) return;
+    bd = rest;
+#endif
     ACQUIRE_SM_LOCK;
     freeChain(bd);
     RELEASE_SM_LOCK;
@@ -984,7 +1303,10 @@ countAllocdBlocks(bdescr *bd)
     return n;
 }
 
-void returnMemoryToOS(uint32_t n /* megablocks */)
+// Give up to n free megablocks back to the MBlock layer, and return the
+// number we wanted to but couldn't.
+static uint32_t
+return_free_mblocks (uint32_t n)
 {
     bdescr *bd;
     uint32_t node;
@@ -1013,6 +1335,13 @@ void returnMemoryToOS(uint32_t n /* megablocks */)
         free_mblock_list[node] = bd;
     }
 
+    return n;
+}
+
+void returnMemoryToOS(uint32_t n /* megablocks */)
+{
+    n = return_free_mblocks(n);
+
     // Ask the OS to release any address space portion
     // that was associated with the just released MBlocks
     //
@@ -1030,6 +1359,195 @@ void returnMemoryToOS(uint32_t n /* megablocks */)
     );
 }
 
+/* -----------------------------------------------------------------------------
+   Returning memory in the background
+
+   Note [Returning memory in the background]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   At the end of a major GC, GarbageCollect() works out how many megablocks
+   the next major GC is likely to need (plus --return-memory-retain) and
+   gives the free megablocks beyond that back to the OS.  Doing that there
+   and then has two costs:
+
+     - the madvise() or munmap() calls happen during the GC pause, with
+       every mutator stopped; and
+
+     - a program whose live data shrinks for a moment gives all of its
+       spare memory back at once, and has to map it and fault it in again
+       as soon as it gets busy.
+
+   With --return-memory-async the GC instead records the number of
+   megablocks it wants to keep in return_target, and wakes the returner
+   thread.  While mblocks_allocated exceeds the target, the returner wakes
+   up every return_interval() and returns
+
+       excess * (1 - 2^(-dt / decay))
+
+   megablocks (at least one), where dt is the time since its last step and
+   decay is --return-memory-decay, so the excess shrinks exponentially with
+   that half-life.  It takes sm_mutex for RETURN_BATCH megablocks at a
+   time, so that it never holds up allocation for long.  Memory that the
+   program allocates again in the meantime is no longer free and so is no
+   longer returned; and a later major GC replaces the target, so a program
+   that grows again stops the returner early.  How the memory goes back is
+   up to the OS layer: on Linux, osDecommitMemory() uses MADV_FREE, or
+   MADV_DONTNEED with --disable-delayed-os-memory-return.
+
+   The returner sleeps on return_wakeup when it has nothing to do.  A new
+   target bumps return_requests, under return_mutex, so that the returner
+   can tell whether one arrived while it was busy.
+
+   The thread is started by the first major GC that wants to return memory,
+   stopped by exitStorage(), and forgotten in the child of forkProcess(),
+   where it no longer exists; the next major GC starts a new one.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+#define RETURN_BATCH 4   // megablocks returned per acquisition of sm_mutex
+
+static Mutex      return_mutex;
+static Condition  return_wakeup;
+static OSThreadId return_thread;
+static bool       returner_running = false;
+static bool       return_stop;      // protected by return_mutex
+static W_         return_target;    // ditto
+static W_         return_requests;  // ditto
+
+static Time
+return_interval (void)
+{
+    // A few steps per half-life, but not so many that we keep waking up
+    return stg_max(RtsFlags.GcFlags.returnMemoryDecay / 8, MSToTime(10));
+}
+
+// Return the share of the free megablocks above target that decays in time
+// dt, and return true if there is more to return.
+static bool
+return_some_memory (W_ target, Time dt)
+{
+    const Time decay = RtsFlags.GcFlags.returnMemoryDecay;
+    W_ excess, n;
+
+    ACQUIRE_SM_LOCK;
+    excess = mblocks_allocated > target ? mblocks_allocated - target : 0;
+    RELEASE_SM_LOCK;
+
+    if (excess == 0) {
+        return false;
+    }
+    if (decay == 0) {
+        n = excess;
+    } else {
+        n = (W_)ceil(excess * (1 - exp2(-(double)dt / decay)));
+        n = stg_max(n, 1);
+    }
+
+    while (n > 0 && !RELAXED_LOAD(&return_stop)) {
+        uint32_t batch = stg_min(n, RETURN_BATCH);
+        uint32_t left;
+
+        ACQUIRE_SM_LOCK;
+        left = return_free_mblocks(batch);
+        releaseFreeMemory();
+        RELEASE_SM_LOCK;
+
+        if (left != 0) {
+            // the rest of the excess is in use; wait for the next GC
+            return false;
+        }
+        n -= batch;
+        excess -= batch;
+    }
+    return excess > 0;
+}
+
+static void *
+memoryReturner (void *arg STG_UNUSED)
+{
+    Time last = getProcessElapsedTime();
+
+    ACQUIRE_LOCK(&return_mutex);
+    while (!return_stop) {
+        W_ target = return_target;
+        W_ requests = return_requests;
+        RELEASE_LOCK(&return_mutex);
+
+        Time now = getProcessElapsedTime();
+        bool more = return_some_memory(target, now - last);
+        last = now;
+
+        ACQUIRE_LOCK(&return_mutex);
+        if (return_stop) {
+            break;
+        }
+        if (more) {
+            timedWaitCondition(&return_wakeup, &return_mutex,
+                               return_interval());
+        } else if (requests == return_requests) {
+            waitCondition(&return_wakeup, &return_mutex);
+            // don't count the time we had nothing to do
+            last = getProcessElapsedTime();
+        }
+    }
+    RELEASE_LOCK(&return_mutex);
+    return NULL;
+}
+
+// Called at the end of a major GC, with sm_mutex held.
+void
+returnMemoryInBackground (W_ keep /* megablocks */)
+{
+    if (!returner_running) {
+        if (mblocks_allocated <= keep) {
+            return;
+        }
+        initMutex(&return_mutex);
+        initCondition(&return_wakeup);
+        return_stop = false;
+        return_target = keep;
+        return_requests = 0;
+        if (createOSThread(&return_thread, "ghc_memreturn",
+                           memoryReturner, NULL) != 0) {
+            barf("returnMemoryInBackground: can't create returner thread");
+        }
+        returner_running = true;
+        return;
+    }
+
+    ACQUIRE_LOCK(&return_mutex);
+    return_target = keep;
+    return_requests++;
+    signalCondition(&return_wakeup);
+    RELEASE_LOCK(&return_mutex);
+}
+
+void
+stopMemoryReturner (void)
+{
+    if (!returner_running) return;
+
+    ACQUIRE_LOCK(&return_mutex);
+    RELAXED_STORE(&return_stop, true);
+    signalCondition(&return_wakeup);
+    RELEASE_LOCK(&return_mutex);
+    joinOSThread(return_thread);
+    returner_running = false;
+
+    closeMutex(&return_mutex);
+    closeCondition(&return_wakeup);
+}
+
+// In the child of a fork(): the returner thread is gone, and return_mutex
+// may have been held by it.  The next major GC starts a new one.
+void
+forgetMemoryReturner (void)
+{
+    returner_running = false;
+}
+
+#endif /* THREADED_RTS */
+
 /* -----------------------------------------------------------------------------
    Debugging
    -------------------------------------------------------------------------- */
@@ -13,6 +13,42 @@
 bdescr *allocLargeChunk (W_ min, W_ max);
 bdescr *allocLargeChunkOnNode (uint32_t node, W_ min, W_ max);
 
+/* Block caches ------------------------------------------------------------ */
+
+#if defined(THREADED_RTS)
+
+// See Note [Block caches] in BlockAlloc.c
+#define BLOCK_CACHE_MAX_GROUP 4   // the largest group a cache holds
+#define BLOCK_CACHE_BATCH     16  // blocks moved by one refill or drain
+#define BLOCK_CACHE_LIMIT     64  // blocks a cache holds before draining
+
+typedef struct {
+    // groups[i] is a list of free groups of i+1 blocks, linked by bd->link
+    bdescr *groups[BLOCK_CACHE_MAX_GROUP];
+    uint32_t n_blocks;   // blocks in all the groups
+    uint32_t node;       // NUMA node of every group in the cache
+} BlockCache;
+
+void initBlockCache   (BlockCache *cache, uint32_t node);
+void flushBlockCaches (void);
+W_   blockCacheBlocks (void);
+#if defined(DEBUG)
+void markBlockCaches  (void);
+#endif
+
+#endif
+
+/* Returning memory in the background -------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+// See Note [Returning memory in the background] in BlockAlloc.c
+void returnMemoryInBackground (W_ keep /* megablocks */);
+void stopMemoryReturner       (void);
+void forgetMemoryReturner     (void);
+
+#endif
+
 /* Debugging  -------------------------------------------------------------- */
 
 extern W_ countBlocks       (bdescr *bd);
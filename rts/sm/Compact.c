@@ -124,6 +124,12 @@ get_iptr_tag(StgInfoTable *iptr)
     }
 }
 
+#if defined(THREADED_RTS)
+// Are other GC threads threading pointers at the same time as us? See
+// Note [Parallel compaction].
+static bool compact_parallel = false;
+#endif
+
 STATIC_INLINE void
 thread (StgClosure **p)
 {
@@ -140,9 +146,22 @@ thread (StgClosure **p)
 
         if (bd->flags & BF_MARKED)
         {
+            W_ link = (W_)p + 1 + (q0_tagged ? 1 : 0);
+#if defined(THREADED_RTS)
+            if (compact_parallel) {
+                // Push p onto the chain, making sure that anyone who sees p
+                // on the chain also sees the rest of the chain in it.
+                W_ iptr;
+                do {
+                    iptr = RELAXED_LOAD(q);
+                    *p = (StgClosure *)iptr;
+                } while (cas((StgVolatilePtr)q, iptr, link) != iptr);
+                return;
+            }
+#endif
             W_ iptr = *q;
             *p = (StgClosure *)iptr;
-            *q = (W_)p + 1 + (q0_tagged ? 1 : 0);
+            *q = link;
         }
     }
 }
@@ -196,7 +215,8 @@ loop:
 STATIC_INLINE StgInfoTable*
 get_threaded_info( P_ p )
 {
-    W_ q = (W_)GET_INFO(UNTAG_CLOSURE((StgClosure *)p));
+    // Other GC threads may be pushing onto the chain, see thread()
+    W_ q = ACQUIRE_LOAD((P_)UNTAG_CLOSURE((StgClosure *)p));
 
 loop:
     switch (GET_PTR_TAG(q))
@@ -207,7 +227,7 @@ loop:
     case 1:
     case 2:
     {
-        q = *(P_)(UNTAG_PTR(q));
+        q = ACQUIRE_LOAD((P_)(UNTAG_PTR(q)));
         goto loop;
     }
     default:
@@ -538,9 +558,9 @@ update_fwd_cnf( bdescr *bd )
 }
 
 static void
-update_fwd_large( bdescr *bd )
+update_fwd_large( bdescr *bd, uint32_t n )
 {
-  for (; bd != NULL; bd = bd->link) {
+  for (; n > 0; n--, bd = bd->link) {
 
     // nothing to do in a pinned block; it might not even have an object
     // at the beginning.
@@ -804,12 +824,10 @@ thread_obj (const StgInfoTable *info, P_ p)
 }
 
 static void
-update_fwd( bdescr *blocks )
+update_fwd( bdescr *bd, uint32_t n )
 {
-    bdescr *bd = blocks;
-
-    // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
+    // cycle through n blocks of the step
+    for (; n > 0; n--, bd = bd->link) {
         P_ p = bd->start;
 
         // linearly scan the objects in this block
@@ -821,82 +839,181 @@ update_fwd( bdescr *blocks )
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Note [Parallel compaction]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   The classic threaded compactor (Jonkers) makes two passes over the
+   compacted heap: a forward pass that unthreads the pointers to each object
+   seen so far and threads the object's own fields, and a backward pass that
+   unthreads the rest and moves the objects. Both passes depend on visiting
+   the objects in address order, and on the destination of each object,
+   which is the total size of the live objects before it. So they can only
+   run on one thread, and with a large old generation the compaction can
+   take much longer than the marking, which all the GC threads share.
+
+   Instead we compact in three phases, with a barrier between each:
+
+   1. Thread. Thread every pointer into the compacted heap: the roots, the
+      fields of every object in the other generations, and the fields of
+      every live object in the compacted heap. This is embarrassingly
+      parallel, so the GC threads share out the blocks in chunks of
+      COMPACT_WORK_BLOCKS (CompactWork). The only interference is that
+      several threads may thread pointers to the same object at once, so
+      thread() pushes onto the chain with a CAS, and get_threaded_info()
+      can walk a chain that is being pushed onto. Nothing unthreads anything
+      in this phase, so a field on a chain never changes.
+
+   2. Unthread. The compacted heap is split into regions of contiguous
+      blocks (CompactRegion), and each region slides its live objects down
+      to its own first blocks. A region's objects' destinations depend only
+      on the live objects before them in the same region, so the regions can
+      be processed independently: for each object in order, we find its
+      size from the info pointer at the end of its chain, work out its
+      destination, and unthread its chain, writing the destination into
+      every field that pointed to it. The fields may be anywhere, but every
+      field is on exactly one chain, and each chain is unthreaded by the
+      thread that owns the object it belongs to, so there are no races.
+
+   3. Move. Each region's objects are moved to their destinations. By now
+      every pointer in the heap is up to date, including the ones inside the
+      objects being moved, which is why this needs its own phase.
+
+   With one GC thread, there is only one region and this does the same
+   compaction as Jonkers's algorithm, with about the same amount of work:
+   each live object is visited three times rather than twice, but each
+   chain is only unthreaded once. The price of parallelism is some unused
+   space at the end of each region, at most a block per region. We keep
+   regions to at least COMPACT_REGION_MIN_BLOCKS so that this is small.
+
+   The GC threads other than the leader take part by calling compactWorker()
+   once they have finished marking (see gcWorkerThread); the leader tells
+   them what to do by bumping compact_phase.
+   -------------------------------------------------------------------------- */
+
+// Number of blocks in each unit of work in the threading phase
+#define COMPACT_WORK_BLOCKS 32
+
+// Regions per GC thread, for load balancing, and the smallest region
+#define COMPACT_REGIONS_PER_THREAD 4
+#define COMPACT_REGION_MIN_BLOCKS 256
+
+typedef enum {
+    WORK_BLOCKS,        // update_fwd() on a chain of blocks
+    WORK_LARGE,         // update_fwd_large() on a chain of large objects
+    WORK_COMPACT,       // thread_compact() on blocks being compacted
+} CompactWorkType;
+
+typedef struct {
+    bdescr *bd;         // the first block
+    uint32_t n;         // number of blocks (or large objects)
+    CompactWorkType type;
+} CompactWork;
+
+typedef struct {
+    bdescr *first;      // the region's first block,
+    bdescr *last;       // and its last
+    bdescr *free_bd;    // after moving: the last block still in use
+} CompactRegion;
+
+static CompactWork *compact_work;
+static StgWord compact_n_work;
+static CompactRegion *compact_regions;
+static StgWord compact_n_regions;
+
+// The next unit of work, or region, for a thread to take
+static volatile StgWord compact_next;
+
+typedef enum {
+    COMPACT_IDLE,
+    COMPACT_THREAD,
+    COMPACT_UNTHREAD,
+    COMPACT_MOVE,
+    COMPACT_DONE,
+} CompactPhase;
+
+#if defined(THREADED_RTS)
+static volatile StgWord compact_phase = COMPACT_IDLE;
+// Number of helper threads that have finished the current phase
+static volatile StgWord compact_helpers_done;
+#endif
+
+// Thread the fields of the live objects in n blocks
+static void
+thread_compact( bdescr *bd, uint32_t n )
+{
+    for (; n > 0; n--, bd = bd->link) {
+        P_ p = bd->start;
+
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
+                p++;
+            }
+            if (p >= bd->free) {
+                break;
+            }
+            StgInfoTable *info = INFO_PTR_TO_STRUCT(get_threaded_info(p));
+            p = thread_obj(info, p);
+        }
+    }
+}
+
+// Work out where each live object in a region is going, and unthread the
+// pointers to it.
 static void
-update_fwd_compact( bdescr *blocks )
+unthread_region( CompactRegion *region )
 {
-    bdescr *bd = blocks;
-    bdescr *free_bd = blocks;
+    bdescr *free_bd = region->first;
     P_ free = free_bd->start;
 
-    // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
+    for (bdescr *bd = region->first; ; bd = bd->link) {
         P_ p = bd->start;
 
-        while (p < bd->free ) {
-
-            while ( p < bd->free && !is_marked(p,bd) ) {
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
                 p++;
             }
             if (p >= bd->free) {
                 break;
             }
 
-            // Problem: we need to know the destination for this cell
-            // in order to unthread its info pointer.  But we can't
-            // know the destination without the size, because we may
-            // spill into the next block.  So we have to run down the
-            // threaded list and get the info ptr first.
-            //
-            // ToDo: one possible avenue of attack is to use the fact
-            // that if (p&BLOCK_MASK) >= (free&BLOCK_MASK), then we
-            // definitely have enough room.  Also see bug #1147.
             StgInfoTable *iptr = get_threaded_info(p);
-            StgInfoTable *info = INFO_PTR_TO_STRUCT(iptr);
-
-            P_ q = p;
+            W_ size = closure_sizeW_((StgClosure *)p, INFO_PTR_TO_STRUCT(iptr));
 
-            p = thread_obj(info, p);
-
-            W_ size = p - q;
             if (free + size > free_bd->start + BLOCK_SIZE_W) {
                 // set the next bit in the bitmap to indicate that this object
-                // needs to be pushed into the next block.  This saves us having
-                // to run down the threaded info pointer list twice during the
-                // next pass. See Note [Mark bits in mark-compact collector] in
-                // Compact.h.
-                mark(q+1,bd);
+                // needs to be pushed into the next block. See Note [Mark bits
+                // in mark-compact collector] in Compact.h.
+                mark(p+1,bd);
                 free_bd = free_bd->link;
                 free = free_bd->start;
             } else {
-                ASSERT(!is_marked(q+1,bd));
+                ASSERT(!is_marked(p+1,bd));
             }
 
-            StgWord iptr_tag = get_iptr_tag(iptr);
-            unthread(q, (W_)free, iptr_tag);
+            unthread(p, (W_)free, get_iptr_tag(iptr));
             free += size;
+            p += size;
         }
+
+        if (bd == region->last) break;
     }
 }
 
-static W_
-update_bkwd_compact( generation *gen )
+// Move the live objects in a region to their new homes
+static void
+move_region( CompactRegion *region )
 {
-    bdescr *bd, *free_bd;
-    bd = free_bd = gen->old_blocks;
-
+    bdescr *free_bd = region->first;
     P_ free = free_bd->start;
-    W_ free_blocks = 1;
 
-    // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
+    for (bdescr *bd = region->first; ; bd = bd->link) {
         P_ p = bd->start;
 
         while (p < bd->free) {
-
             while (p < bd->free && !is_marked(p,bd)) {
                 p++;
             }
-
             if (p >= bd->free) {
                 break;
             }
@@ -914,12 +1031,8 @@ update_bkwd_compact( generation *gen )
 
                 free_bd = free_bd->link;
                 free = free_bd->start;
-                free_blocks++;
             }
 
-            StgInfoTable *iptr = get_threaded_info(p);
-            StgWord iptr_tag = get_iptr_tag(iptr);
-            unthread(p, (W_)free, iptr_tag);
             ASSERT(LOOKS_LIKE_INFO_PTR((W_)((StgClosure *)p)->header.info));
             const StgInfoTable *info = get_itbl((StgClosure *)p);
             W_ size = closure_sizeW_((StgClosure *)p,info);
@@ -936,14 +1049,12 @@ update_bkwd_compact( generation *gen )
             free += size;
             p += size;
         }
+
+        if (bd == region->last) break;
     }
 
-    // Free the remaining blocks and count what's left.
     free_bd->free = free;
-    if (free_bd->link != NULL) {
-        freeChain(free_bd->link);
-        free_bd->link = NULL;
-    }
+    region->free_bd = free_bd;
 
     // Zero the free bits of the last used block.
     IF_DEBUG(zero_on_gc, {
@@ -952,16 +1063,220 @@ update_bkwd_compact( generation *gen )
         W_ block_free_bytes = block_size_bytes - block_in_use_bytes;
         memset(free_bd->free, 0xaa, block_free_bytes);
     });
+}
+
+static void
+addCompactWork( bdescr *bd, CompactWorkType type, StgWord *max_work )
+{
+    while (bd != NULL) {
+        if (compact_n_work == *max_work) {
+            *max_work *= 2;
+            compact_work = stgReallocBytes(compact_work,
+                                           *max_work * sizeof(CompactWork),
+                                           "addCompactWork");
+        }
+        CompactWork *w = &compact_work[compact_n_work++];
+        w->bd = bd;
+        w->type = type;
+        for (w->n = 0; w->n < COMPACT_WORK_BLOCKS && bd != NULL; w->n++) {
+            bd = bd->link;
+        }
+    }
+}
+
+// Share out the work of compacting the heap
+static void
+initCompactWork( uint32_t n_threads )
+{
+    StgWord max_work = 64;
+
+    compact_work = stgMallocBytes(max_work * sizeof(CompactWork),
+                                  "initCompactWork");
+    compact_n_work = 0;
+
+    for (W_ g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        generation *gen = &generations[g];
+        addCompactWork(gen->blocks, WORK_BLOCKS, &max_work);
+        for (W_ n = 0; n < n_capabilities; n++) {
+            addCompactWork(gc_threads[n]->gens[g].todo_bd, WORK_BLOCKS,
+                           &max_work);
+            addCompactWork(gc_threads[n]->gens[g].part_list, WORK_BLOCKS,
+                           &max_work);
+        }
+        addCompactWork(gen->scavenged_large_objects, WORK_LARGE, &max_work);
+    }
+
+    generation *gen = oldest_gen;
+    StgWord n_old = 0;
+    for (bdescr *bd = gen->old_blocks; bd != NULL; bd = bd->link) {
+        n_old++;
+    }
+    addCompactWork(gen->old_blocks, WORK_COMPACT, &max_work);
+
+    compact_n_regions =
+        stg_min((StgWord)n_threads * COMPACT_REGIONS_PER_THREAD,
+                n_old / COMPACT_REGION_MIN_BLOCKS);
+    if (compact_n_regions == 0 && n_old > 0) {
+        compact_n_regions = 1;
+    }
+    compact_regions = stgMallocBytes(stg_max(compact_n_regions, 1) *
+                                     sizeof(CompactRegion),
+                                     "initCompactWork");
+
+    bdescr *bd = gen->old_blocks;
+    for (StgWord r = 0; r < compact_n_regions; r++) {
+        // spread the remainder over the first regions
+        StgWord n = n_old / compact_n_regions +
+            (r < n_old % compact_n_regions ? 1 : 0);
+        compact_regions[r].first = bd;
+        while (--n > 0) {
+            bd = bd->link;
+        }
+        compact_regions[r].last = bd;
+        bd = bd->link;
+    }
+    ASSERT(bd == NULL);
+}
+
+// Take units of work, or regions, until there are none left
+static void
+doCompactPhase( CompactPhase phase )
+{
+    StgWord i;
+
+    switch (phase) {
+    case COMPACT_THREAD:
+        while ((i = atomic_inc(&compact_next, 1) - 1) < compact_n_work) {
+            CompactWork *w = &compact_work[i];
+            switch (w->type) {
+            case WORK_BLOCKS:
+                update_fwd(w->bd, w->n);
+                break;
+            case WORK_LARGE:
+                update_fwd_large(w->bd, w->n);
+                break;
+            case WORK_COMPACT:
+                thread_compact(w->bd, w->n);
+                break;
+            }
+        }
+        break;
+    case COMPACT_UNTHREAD:
+        while ((i = atomic_inc(&compact_next, 1) - 1) < compact_n_regions) {
+            unthread_region(&compact_regions[i]);
+        }
+        break;
+    case COMPACT_MOVE:
+        while ((i = atomic_inc(&compact_next, 1) - 1) < compact_n_regions) {
+            move_region(&compact_regions[i]);
+        }
+        break;
+    default:
+        barf("doCompactPhase");
+    }
+}
+
+#if defined(THREADED_RTS)
+// Start a phase, which the helpers will join in
+static void
+startCompactPhase( CompactPhase phase )
+{
+    compact_next = 0;
+    compact_helpers_done = 0;
+    RELEASE_STORE(&compact_phase, phase);
+}
+
+// Wait for the helpers to finish the current phase
+static void
+waitCompactHelpers( uint32_t n_helpers )
+{
+    while (ACQUIRE_LOAD(&compact_helpers_done) != n_helpers) {
+        busy_wait_nop();
+    }
+}
+
+// Called by each GC thread other than the leader when it has finished
+// marking, to help with compacting the heap. Returns when the compaction
+// is done. See Note [Parallel compaction].
+void
+compactWorker( void )
+{
+    StgWord phase = COMPACT_IDLE;
+
+    for (;;) {
+        StgWord next;
+        while ((next = ACQUIRE_LOAD(&compact_phase)) == phase) {
+            busy_wait_nop();
+        }
+        phase = next;
+        if (phase != COMPACT_DONE) {
+            doCompactPhase(phase);
+        }
+        atomic_inc(&compact_helpers_done, 1);
+        if (phase == COMPACT_DONE) {
+            return;
+        }
+    }
+}
+#endif
+
+// Join the compacted regions back into one chain, freeing the blocks that
+// are no longer needed. Returns the number of blocks left.
+static W_
+finishCompactRegions( generation *gen )
+{
+    bdescr **link = &gen->old_blocks;
+    W_ blocks = 0;
+
+    for (StgWord r = 0; r < compact_n_regions; r++) {
+        CompactRegion *region = &compact_regions[r];
+        bdescr *unused;
+
+        if (region->free_bd == region->first &&
+            region->first->free == region->first->start) {
+            // nothing lives here any more
+            unused = region->first;
+        } else {
+            *link = region->first;
+            for (bdescr *bd = region->first; ; bd = bd->link) {
+                blocks++;
+                if (bd == region->free_bd) break;
+            }
+            link = &region->free_bd->link;
+            unused = region->free_bd == region->last ?
+                NULL : region->free_bd->link;
+        }
+
+        if (unused != NULL) {
+            region->last->link = NULL;
+            freeChain(unused);
+        }
+    }
+    *link = NULL;
 
-    return free_blocks;
+    stgFree(compact_regions);
+    stgFree(compact_work);
+    return blocks;
 }
 
 void
 compact(StgClosure *static_objects,
         StgWeak **dead_weak_ptr_list,
-        StgTSO **resurrected_threads)
+        StgTSO **resurrected_threads,
+        uint32_t n_helpers USED_IF_THREADS)
 {
-    // 1. thread the roots
+    generation *gen = oldest_gen;
+
+#if defined(THREADED_RTS)
+    compact_parallel = n_helpers > 0;
+    initCompactWork(n_helpers + 1);
+    startCompactPhase(COMPACT_THREAD);
+#else
+    initCompactWork(1);
+    compact_next = 0;
+#endif
+
+    // 1. thread the roots, while any helpers start on the heap
     markCapabilities((evac_fn)thread_root, NULL);
 
     markScheduler((evac_fn)thread_root, NULL);
@@ -1019,33 +1334,49 @@ compact(StgClosure *static_objects,
     // the CAF list (used by GHCi)
     markCAFs((evac_fn)thread_root, NULL);
 
-    // 2. update forward ptrs
+    // the keys of the hash tables in compact regions
     for (W_ g = 0; g < RtsFlags.GcFlags.generations; g++) {
-        generation *gen = &generations[g];
-        debugTrace(DEBUG_gc, "update_fwd:  %d", g);
-
-        update_fwd(gen->blocks);
-        for (W_ n = 0; n < n_capabilities; n++) {
-            update_fwd(gc_threads[n]->gens[g].todo_bd);
-            update_fwd(gc_threads[n]->gens[g].part_list);
-        }
-        update_fwd_large(gen->scavenged_large_objects);
-        update_fwd_cnf(gen->live_compact_objects);
-        if (g == RtsFlags.GcFlags.generations-1 && gen->old_blocks != NULL) {
-            debugTrace(DEBUG_gc, "update_fwd:  %d (compact)", g);
-            update_fwd_compact(gen->old_blocks);
-        }
+        update_fwd_cnf(generations[g].live_compact_objects);
     }
 
-    // 3. update backward ptrs
-    generation *gen = oldest_gen;
-    if (gen->old_blocks != NULL) {
-        W_ blocks = update_bkwd_compact(gen);
-        debugTrace(DEBUG_gc,
-                   "update_bkwd: %d (compact, old: %d blocks, now %d blocks)",
-                   gen->no, gen->n_old_blocks, blocks);
-        gen->n_old_blocks = blocks;
-    }
+    // and the heap
+    debugTrace(DEBUG_gc, "compact: threading (%" FMT_Word " units)",
+               compact_n_work);
+    doCompactPhase(COMPACT_THREAD);
+
+    // 2. work out where everything is going, and update the pointers
+    debugTrace(DEBUG_gc, "compact: unthreading (%" FMT_Word " regions)",
+               compact_n_regions);
+#if defined(THREADED_RTS)
+    waitCompactHelpers(n_helpers);
+    startCompactPhase(COMPACT_UNTHREAD);
+#else
+    compact_next = 0;
+#endif
+    doCompactPhase(COMPACT_UNTHREAD);
+
+    // 3. move the objects
+#if defined(THREADED_RTS)
+    waitCompactHelpers(n_helpers);
+    startCompactPhase(COMPACT_MOVE);
+#else
+    compact_next = 0;
+#endif
+    doCompactPhase(COMPACT_MOVE);
+
+#if defined(THREADED_RTS)
+    waitCompactHelpers(n_helpers);
+    startCompactPhase(COMPACT_DONE);
+    waitCompactHelpers(n_helpers);
+    RELAXED_STORE(&compact_phase, COMPACT_IDLE);
+    compact_parallel = false;
+#endif
+
+    W_ blocks = finishCompactRegions(gen);
+    debugTrace(DEBUG_gc,
+               "compact: %d (old: %d blocks, now %d blocks)",
+               gen->no, gen->n_old_blocks, blocks);
+    gen->n_old_blocks = blocks;
 
     // 4. Re-hash hash tables of threaded CNFs.
     // See Note [CNFs in compacting GC] above.
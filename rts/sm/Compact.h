@@ -76,6 +76,11 @@ is_marked(StgPtr p, bdescr *bd)
 
 void compact (StgClosure *static_objects,
               StgWeak **dead_weak_ptr_list,
-              StgTSO **resurrected_threads);
+              StgTSO **resurrected_threads,
+              uint32_t n_helpers);
+
+#if defined(THREADED_RTS)
+void compactWorker (void);
+#endif
 
 #include "EndPrivate.h"
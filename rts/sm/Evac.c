@@ -665,6 +665,13 @@ loop:
           return;
       }
 
+      // A small pinned object: mark the lines it occupies, whether or not
+      // its block has been evacuated yet. See Note [Pinned block
+      // recycling] in Storage.c.
+      if (flags & BF_LINES) {
+          markPinnedLines(bd, (P_)q, arr_words_sizeW((StgArrBytes *)q));
+      }
+
       // pointer into to-space: just return it.  It might be a pointer
       // into a generation that we aren't collecting (> N), or it
       // might just be a pointer into to-space.  The latter doesn't
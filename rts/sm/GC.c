@@ -152,6 +152,12 @@ volatile StgWord64 whitehole_gc_spin = 0;
 
 bool work_stealing;
 
+// Are the GC threads going to compact or sweep the oldest generation
+// together once they have finished marking? See Note [Parallel compaction]
+// in Compact.c and Note [Parallel sweep] in Sweep.c.
+static bool par_compact;
+static bool par_sweep;
+
 uint32_t static_flag = STATIC_FLAG_B;
 uint32_t prev_static_flag = STATIC_FLAG_A;
 
@@ -165,13 +171,18 @@ static void mark_root               (void *user, StgClosure **root);
 static void prepare_collected_gen   (generation *gen);
 static void prepare_uncollected_gen (generation *gen);
 static void init_gc_thread          (gc_thread *t);
+static void begin_gc_phase          (void);
+static void end_gc_phase            (GcPhase phase);
 static void resize_nursery          (void);
+static void adapt_nursery           (void);
 static void start_gc_threads        (void);
 static void scavenge_until_all_done (void);
 static StgWord inc_running          (void);
 static StgWord dec_running          (void);
 static void wakeup_gc_threads       (uint32_t me, bool idle_cap[]);
-static void shutdown_gc_threads     (uint32_t me, bool idle_cap[]);
+static void shutdown_gc_threads     (uint32_t me, bool idle_cap[],
+                                     StgWord state);
+static uint32_t count_gc_helpers    (uint32_t me, bool idle_cap[]);
 static void collect_gct_blocks      (void);
 static void collect_pinned_object_blocks (void);
 static void heapOverflow            (void);
@@ -283,6 +294,11 @@ GarbageCollect (uint32_t collect_gen,
   // the table from occurring during GC.
   stablePtrLock();
 
+  // Likewise the stable name table, which the nonmoving sweep may be using
+  // concurrently (nonmovingSweepStableNameTable).  We hold it until
+  // updateStableNameTable; see Note [Stable name table] in StableName.c.
+  stableNameLock();
+
 #if defined(DEBUG)
   zeroMutListScavStats(&mutlist_scav_stats);
 #endif
@@ -300,6 +316,11 @@ GarbageCollect (uint32_t collect_gen,
   N = collect_gen;
   major_gc = (N == RtsFlags.GcFlags.generations-1);
 
+  // The allocator mustn't sweep the oldest generation while we GC, and we
+  // can't collect it until it has been swept. See Note [Lazy sweeping] in
+  // Sweep.c.
+  pauseLazySweep(major_gc);
+
   /* See Note [Deadlock detection under nonmoving collector]. */
   deadlock_detect_gc = deadlock_detect;
 
@@ -365,6 +386,10 @@ GarbageCollect (uint32_t collect_gen,
   debugTrace(DEBUG_gc, "GC (gen %d, using %d thread(s))",
              N, n_gc_threads);
 
+  // finish allocating into recycled pinned blocks; do this before
+  // memInventory(), which counts the current pinned blocks as nursery
+  retirePinnedHoles(N);
+
 #if defined(DEBUG)
   // check for memory leaks if DEBUG is on
   memInventory(DEBUG_gc);
@@ -414,10 +439,16 @@ GarbageCollect (uint32_t collect_gen,
   // exiting prematurely, so we can start them now.
   // NB. do this after the mutable lists have been saved above, otherwise
   // the other GC threads will be writing into the old mutable lists.
+  par_compact = major_gc && oldest_gen->mark && oldest_gen->compact &&
+      n_gc_threads > 1;
+  par_sweep = major_gc && oldest_gen->mark && !oldest_gen->compact &&
+      !RtsFlags.GcFlags.lazySweep && n_gc_threads > 1;
+
   inc_running();
   wakeup_gc_threads(gct->thread_index, idle_cap);
 
   traceEventGcWork(gct->cap);
+  begin_gc_phase();
 
   // scavenge the capability-private mutable lists.  This isn't part
   // of markSomeCapabilities() because markSomeCapabilities() can only
@@ -443,8 +474,10 @@ GarbageCollect (uint32_t collect_gen,
   }
 
   // follow roots from the CAF list (used by GHCi)
+  end_gc_phase(GC_PHASE_ROOTS);
   gct->evac_gen_no = 0;
   markCAFs(mark_root, gct);
+  end_gc_phase(GC_PHASE_CAFS);
 
   // follow all the roots that the application knows about.
   gct->evac_gen_no = 0;
@@ -467,7 +500,8 @@ GarbageCollect (uint32_t collect_gen,
   markStablePtrTable(mark_root, gct);
 
   // Remember old stable name addresses.
-  rememberOldStableNameAddresses ();
+  rememberOldStableNameAddresses(N);
+  end_gc_phase(GC_PHASE_ROOTS);
 
   /* -------------------------------------------------------------------------
    * Repeatedly scavenge all the areas we know about until there's no
@@ -480,13 +514,17 @@ GarbageCollect (uint32_t collect_gen,
   for (;;)
   {
       scavenge_until_all_done();
+      end_gc_phase(GC_PHASE_SCAV);
 
       // The other threads are now stopped.  We might recurse back to
       // here, but from now on this is the only thread.
 
       // must be last...  invariant is that everything is fully
-      // scavenged at this point.
-      if (traverseWeakPtrList(&dead_weak_ptr_list, &resurrected_threads)) { // returns true if evaced something
+      // scavenged at this point.  Returns true if it evacuated something.
+      bool evacuated =
+          traverseWeakPtrList(&dead_weak_ptr_list, &resurrected_threads);
+      end_gc_phase(GC_PHASE_WEAK);
+      if (evacuated) {
           inc_running();
           continue;
       }
@@ -495,7 +533,10 @@ GarbageCollect (uint32_t collect_gen,
       break;
   }
 
-  shutdown_gc_threads(gct->thread_index, idle_cap);
+  shutdown_gc_threads(gct->thread_index, idle_cap,
+                      par_compact ? GC_THREAD_WAITING_TO_COMPACT :
+                      par_sweep   ? GC_THREAD_WAITING_TO_SWEEP :
+                                    GC_THREAD_WAITING_TO_CONTINUE);
 
   // Now see which stable names are still alive.
   gcStableNameTable();
@@ -529,12 +570,22 @@ GarbageCollect (uint32_t collect_gen,
 
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
-      if (oldest_gen->compact)
+      begin_gc_phase();
+      uint32_t n_helpers = par_compact || par_sweep ?
+          count_gc_helpers(gct->thread_index, idle_cap) : 0;
+      if (oldest_gen->compact) {
           compact(gct->scavenged_static_objects,
                   &dead_weak_ptr_list,
-                  &resurrected_threads);
-      else
-          sweep(oldest_gen);
+                  &resurrected_threads,
+                  n_helpers);
+      } else {
+          sweep(oldest_gen, n_helpers);
+      }
+      if (par_compact || par_sweep) {
+          shutdown_gc_threads(gct->thread_index, idle_cap,
+                              GC_THREAD_WAITING_TO_CONTINUE);
+      }
+      end_gc_phase(GC_PHASE_SWEEP);
   }
 
   copied = 0;
@@ -601,6 +652,7 @@ GarbageCollect (uint32_t collect_gen,
   //   - free from-space
   //   - make to-space the new from-space (set BF_EVACUATED on all blocks)
   //
+  begin_gc_phase();
   live_words = 0;
   live_blocks = 0;
 
@@ -684,6 +736,9 @@ GarbageCollect (uint32_t collect_gen,
                 if (prev != NULL) {
                     prev->link = gen->blocks;
                     gen->blocks = gen->old_blocks;
+                    if (!gen->compact && RtsFlags.GcFlags.lazySweep) {
+                        startLazySweep(gen);
+                    }
                 }
             }
             // add the new blocks to the block tally
@@ -703,7 +758,16 @@ GarbageCollect (uint32_t collect_gen,
          * scavenged_large, having been moved during garbage
          * collection from large_objects.  Any objects left on the
          * large_objects list are therefore dead, so we free them here.
+         * Surviving pinned blocks may have room to reuse; see Note
+         * [Pinned block recycling] in Storage.c.
          */
+        gen->n_pinned_blocks = 0;
+        gen->n_pinned_free_words = 0;
+        for (bd = gen->scavenged_large_objects; bd; bd = bd->link) {
+            if (bd->flags & BF_LINES) {
+                recyclePinnedBlock(gen, bd);
+            }
+        }
         freeChain(gen->large_objects);
         gen->large_objects  = gen->scavenged_large_objects;
         gen->n_large_blocks = gen->n_scavenged_large_blocks;
@@ -735,6 +799,9 @@ GarbageCollect (uint32_t collect_gen,
          */
         for (bd = gen->scavenged_large_objects; bd; bd = next) {
             next = bd->link;
+            if (bd->flags & BF_LINES) {
+                recyclePinnedBlock(gen, bd);
+            }
             dbl_link_onto(bd, &gen->large_objects);
             gen->n_large_words += bd->free - bd->start;
         }
@@ -774,6 +841,7 @@ GarbageCollect (uint32_t collect_gen,
         }
     }
   } // for all generations
+  end_gc_phase(GC_PHASE_FREE);
 
   // Flush the update remembered sets. See Note [Eager update remembered set
   // flushing] in NonMovingMark.c
@@ -828,13 +896,14 @@ GarbageCollect (uint32_t collect_gen,
       resizeGenerations();
 
   // Free the mark stack.
+  begin_gc_phase();
   if (mark_stack_top_bd != NULL) {
       debugTrace(DEBUG_gc, "mark stack: %d blocks",
                  countBlocks(mark_stack_top_bd));
       freeChain(mark_stack_top_bd);
   }
 
-  // Free any bitmaps.
+  // Free any bitmaps (except one that the lazy sweeper has taken).
   for (g = 0; g <= N; g++) {
       gen = &generations[g];
       if (gen->bitmap != NULL) {
@@ -842,6 +911,9 @@ GarbageCollect (uint32_t collect_gen,
           gen->bitmap = NULL;
       }
   }
+  end_gc_phase(GC_PHASE_FREE);
+
+  resumeLazySweep();
 
   resize_nursery();
 
@@ -857,6 +929,7 @@ GarbageCollect (uint32_t collect_gen,
 
   // Update the stable name hash table
   updateStableNameTable(major_gc);
+  stableNameUnlock();
 
   // unlock the StablePtr table.  Must be before scheduleFinalizers(),
   // because a finalizer may call hs_free_fun_ptr() or
@@ -920,10 +993,18 @@ GarbageCollect (uint32_t collect_gen,
   resurrectThreads(resurrected_threads);
   ACQUIRE_SM_LOCK;
 
+#if defined(THREADED_RTS)
+  // Give back the blocks the capabilities have cached, so that they can
+  // be returned to the OS below. See Note [Block caches] in BlockAlloc.c.
+  flushBlockCaches();
+#endif
+
   if (major_gc) {
       W_ need_prealloc, need_live, need, got;
       uint32_t i;
 
+      begin_gc_phase();
+
       need_live = 0;
       for (i = 0; i < RtsFlags.GcFlags.generations; i++) {
           need_live += genLiveBlocks(&generations[i]);
@@ -953,6 +1034,11 @@ GarbageCollect (uint32_t collect_gen,
        */
       need = stg_max(RtsFlags.GcFlags.heapSizeSuggestion, need);
 
+      /* And keep any extra the user asked for, to save returning memory
+       * that the program is about to need again.
+       */
+      need += RtsFlags.GcFlags.returnMemoryRetain;
+
       /* But with a large nursery, the above estimate might exceed
        * maxHeapSize.  A large resident set size might make the OS
        * kill this process, or swap unnecessarily.  Therefore we
@@ -966,9 +1052,16 @@ GarbageCollect (uint32_t collect_gen,
 
       got = mblocks_allocated;
 
+#if defined(THREADED_RTS)
+      if (RtsFlags.GcFlags.returnMemoryAsync) {
+          // See Note [Returning memory in the background] in BlockAlloc.c
+          returnMemoryInBackground(need);
+      } else
+#endif
       if (got > need) {
           returnMemoryToOS(got - need);
       }
+      end_gc_phase(GC_PHASE_FREE);
   }
 
   // extra GC trace info
@@ -1219,6 +1312,7 @@ static void
 scavenge_until_all_done (void)
 {
     DEBUG_ONLY( uint32_t r );
+    Time idle_start;
 
 
 loop:
@@ -1233,6 +1327,7 @@ loop:
 #endif
 
     collect_gct_blocks();
+    idle_start = getProcessElapsedTime();
 
     // scavenge_loop() only exits when there's no work to do
 
@@ -1252,6 +1347,7 @@ loop:
         // usleep(1);
         if (any_work()) {
             inc_running();
+            gct->gc_idle_elapsed += getProcessElapsedTime() - idle_start;
             traceEventGcWork(gct->cap);
             goto loop;
         }
@@ -1261,6 +1357,7 @@ loop:
         // scavenge_loop() to perform any pending work.
     }
 
+    gct->gc_idle_elapsed += getProcessElapsedTime() - idle_start;
     traceEventGcDone(gct->cap);
 }
 
@@ -1292,13 +1389,16 @@ gcWorkerThread (Capability *cap)
     init_gc_thread(gct);
 
     traceEventGcWork(gct->cap);
+    begin_gc_phase();
 
     // Every thread evacuates some roots.
     gct->evac_gen_no = 0;
     markCapability(mark_root, gct, cap, true/*prune sparks*/);
     scavenge_capability_mut_lists(cap);
+    end_gc_phase(GC_PHASE_ROOTS);
 
     scavenge_until_all_done();
+    end_gc_phase(GC_PHASE_SCAV);
 
 #if defined(THREADED_RTS)
     // Now that the whole heap is marked, we discard any sparks that
@@ -1310,6 +1410,20 @@ gcWorkerThread (Capability *cap)
     pruneSparkQueue(false, cap);
 #endif
 
+    // Help to compact or sweep the oldest generation, now that it has been
+    // marked
+    if (par_compact) {
+        SEQ_CST_STORE(&gct->wakeup, GC_THREAD_WAITING_TO_COMPACT);
+        begin_gc_phase();
+        compactWorker();
+        end_gc_phase(GC_PHASE_SWEEP);
+    } else if (par_sweep) {
+        SEQ_CST_STORE(&gct->wakeup, GC_THREAD_WAITING_TO_SWEEP);
+        begin_gc_phase();
+        sweepWorker();
+        end_gc_phase(GC_PHASE_SWEEP);
+    }
+
     // Wait until we're told to continue
     RELEASE_SPIN_LOCK(&gct->gc_spin);
     debugTrace(DEBUG_gc, "GC thread %d waiting to continue...",
@@ -1420,12 +1534,30 @@ wakeup_gc_threads (uint32_t me USED_IF_THREADS,
 #endif
 }
 
+// The number of GC threads other than me taking part in this GC
+static uint32_t
+count_gc_helpers (uint32_t me, bool idle_cap[])
+{
+    uint32_t i, n = 0;
+
+    for (i=0; i < n_gc_threads; i++) {
+        if (i == me || idle_cap[i]) continue;
+        n++;
+    }
+    return n;
+}
+
 // After GC is complete, we must wait for all GC threads to enter the
 // standby state, otherwise they may still be executing inside
 // any_work(), and may even remain awake until the next GC starts.
+//
+// When compacting in parallel we do this twice: once to wait for the other
+// threads to finish marking (state GC_THREAD_WAITING_TO_COMPACT), and once
+// more after the compaction.
 static void
 shutdown_gc_threads (uint32_t me USED_IF_THREADS,
-                     bool idle_cap[] USED_IF_THREADS)
+                     bool idle_cap[] USED_IF_THREADS,
+                     StgWord state USED_IF_THREADS)
 {
 #if defined(THREADED_RTS)
     uint32_t i;
@@ -1434,7 +1566,7 @@ shutdown_gc_threads (uint32_t me USED_IF_THREADS,
 
     for (i=0; i < n_gc_threads; i++) {
         if (i == me || idle_cap[i]) continue;
-        while (SEQ_CST_LOAD(&gc_threads[i]->wakeup) != GC_THREAD_WAITING_TO_CONTINUE) {
+        while (SEQ_CST_LOAD(&gc_threads[i]->wakeup) != state) {
             busy_wait_nop();
         }
     }
@@ -1562,9 +1694,13 @@ prepare_collected_gen (generation *gen)
         bd->flags &= ~BF_EVACUATED;
     }
 
-    // mark the large objects as from-space
+    // mark the large objects as from-space, and clear the line maps of
+    // pinned blocks (see Note [Pinned block recycling] in Storage.c)
     for (bd = gen->large_objects; bd; bd = bd->link) {
         bd->flags &= ~BF_EVACUATED;
+        if (bd->flags & BF_LINES) {
+            pinnedBlockHeader(bd)->lines = 1;
+        }
     }
 
     // mark the compact objects as from-space
@@ -1758,6 +1894,47 @@ init_gc_thread (gc_thread *t)
     t->any_work = 0;
     t->no_work = 0;
     t->scav_find_work = 0;
+    for (uint32_t i = 0; i < N_GC_PHASES; i++) {
+        t->gc_phase_elapsed[i] = 0;
+    }
+    t->gc_idle_elapsed = 0;
+}
+
+/* -----------------------------------------------------------------------------
+   Note [GC phase timing]
+   ~~~~~~~~~~~~~~~~~~~~~~
+   To see where the time in a GC pause goes, each GC thread adds up the
+   elapsed time it spends in each of the phases in GcPhase (GCThread.h),
+   and how much of its scavenging was spent waiting for work.  A phase is
+   timed with a begin_gc_phase() and an end_gc_phase(); since
+   end_gc_phase() starts the clock again, phases that follow one another
+   need only the end_gc_phase().  Whatever falls outside the phases (waking
+   up the GC threads, the stable name and spark tables, finalizers, ...) is
+   the rest of the pause.
+
+   Only the thread leading the GC goes through all the phases; the other
+   threads mark their own roots, scavenge, and help to compact or sweep.
+   stat_endGCWorker() posts an EVENT_GC_THREAD_TIMES for each thread, and
+   stat_endGC() reports the phases of the leader (and the idle time of all
+   the threads) in the GCDetails of getRTSStats, in a GC_PHASES event, and
+   in the totals printed by +RTS -t --machine-readable.
+
+   We read the clock a dozen or so times per GC, which is cheap enough to do
+   whether or not anybody is looking.
+   -------------------------------------------------------------------------- */
+
+static void
+begin_gc_phase (void)
+{
+    gct->gc_phase_start = getProcessElapsedTime();
+}
+
+static void
+end_gc_phase (GcPhase phase)
+{
+    Time now = getProcessElapsedTime();
+    gct->gc_phase_elapsed[phase] += now - gct->gc_phase_start;
+    gct->gc_phase_start = now;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1998,6 +2175,10 @@ resize_nursery (void)
 
             resizeNurseries((W_)blocks);
         }
+        else if (RtsFlags.GcFlags.adaptiveNursery)
+        {
+            adapt_nursery();
+        }
         else
         {
             // we might have added extra blocks to the nursery, so
@@ -2007,6 +2188,132 @@ resize_nursery (void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Note [Adaptive nursery sizing]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Normally each nursery is as big as -A (or -n), whatever the program
+   does.  With --adaptive-nursery, each minor GC instead chooses the total
+   size of the nurseries for the next one, from
+
+     - the survival rate s: the fraction of the data allocated since the
+       last GC that this GC copied, and
+
+     - the pause t: the time since this GC started (by now the copying is
+       done, so this is most of it),
+
+   measured against the pause target T given with the flag (default 1ms).
+   A minor GC costs a fixed amount, for stopping the threads and scanning
+   the roots, plus an amount roughly proportional to what it copies, which
+   is s times the size of the nursery; and the number of minor GCs is
+   inversely proportional to the size of the nursery.  So:
+
+     - if t > T the nursery is too big for the target, and we shrink it by
+       T/t, but at most halve it;
+
+     - otherwise, if s > 10%, a lot of what the program allocates lives
+       long enough to be copied anyway.  A bigger nursery would only make
+       the pauses longer and push allocation out of the cache, so we shrink
+       it by a quarter, towards -A (which ought to be about the size of
+       the L2 or L3 cache);
+
+     - otherwise, if t < T/2 and the GCs are frequent, taking at least 5% of
+       the time since the previous one, the fixed cost dominates and there
+       is room under the target: grow the nursery by T/2t, at most
+       doubling it.
+
+   The total stays between -A per capability and ADAPTIVE_NURSERY_MAX times
+   that, and under a quarter of -M if there is one.  A major GC keeps the
+   total it had, since its pause says nothing about the nursery.
+
+   We share the total out between the capabilities in proportion to how
+   much each of them allocated since the last GC, with at least -A each.
+   A minor GC happens when any capability runs out of nursery, so this way
+   they all run out at about the same time, instead of one busy capability
+   triggering every GC while the others still have most of theirs left.
+   Nursery i belongs to capability i, except with -n, when the chunks are
+   shared by all the capabilities already and we make them all the same
+   size.
+
+   getRTSStats reports the chosen sizes in gcdetails_nursery_bytes and
+   gcdetails_max_nursery_bytes.
+   -------------------------------------------------------------------------- */
+
+#define ADAPTIVE_NURSERY_MAX 64  // the largest total, as a multiple of -A
+
+static W_   adaptive_nursery_blocks = 0;  // the total; 0 until the first GC
+static Time last_gc_end = 0;              // when the previous GC finished
+
+static void
+adapt_nursery (void)
+{
+    const W_ min_cap_blocks = RtsFlags.GcFlags.minAllocAreaSize;
+    const W_ min_blocks = min_cap_blocks * (W_)n_capabilities;
+    const Time target = RtsFlags.GcFlags.nurseryPauseTarget;
+    Time now = getProcessElapsedTime();
+    Time pause = now - gct->gc_start_elapsed;
+    Time mutator = gct->gc_start_elapsed - last_gc_end;
+    W_ max_blocks = min_blocks * ADAPTIVE_NURSERY_MAX;
+    uint64_t allocated = 0;
+    uint32_t i;
+
+    for (i = 0; i < n_capabilities; i++) {
+        allocated += capabilities[i]->total_allocated
+                   - capabilities[i]->total_allocated_at_gc;
+    }
+
+    if (adaptive_nursery_blocks == 0) {
+        adaptive_nursery_blocks = countNurseryBlocks();
+    }
+
+    if (N == 0 && allocated > 0) {
+        double survival = (double)copied / (double)allocated;
+        double factor = 1;
+
+        if (pause > target) {
+            factor = stg_max(0.5, (double)target / (double)pause);
+        } else if (survival > 0.1) {
+            factor = 0.75;
+        } else if (pause < target / 2 && pause * 20 > mutator) {
+            factor = pause == 0 ? 2.0
+                : stg_min(2.0, (double)target / (double)(2 * pause));
+        }
+
+        if (RtsFlags.GcFlags.maxHeapSize != 0) {
+            max_blocks = stg_min(max_blocks,
+                                 (W_)RtsFlags.GcFlags.maxHeapSize / 4);
+        }
+        max_blocks = stg_max(max_blocks, min_blocks);
+
+        adaptive_nursery_blocks =
+            (W_)((double)adaptive_nursery_blocks * factor);
+        adaptive_nursery_blocks =
+            stg_min(stg_max(adaptive_nursery_blocks, min_blocks), max_blocks);
+
+        debugTrace(DEBUG_gc, "adaptive nursery: survival %.1f%%, pause %"
+                   FMT_Word64 "us, total now %" FMT_Word " blocks",
+                   survival * 100, (StgWord64)TimeToUS(pause),
+                   adaptive_nursery_blocks);
+    }
+
+    if (RtsFlags.GcFlags.nurseryChunkSize == 0 && allocated > 0) {
+        for (i = 0; i < n_capabilities; i++) {
+            uint64_t cap_allocated = capabilities[i]->total_allocated
+                                   - capabilities[i]->total_allocated_at_gc;
+            W_ blocks = (W_)((double)adaptive_nursery_blocks
+                             * (double)cap_allocated / (double)allocated);
+            resizeNursery(i, stg_max(blocks, min_cap_blocks));
+        }
+    } else {
+        resizeNurseries(adaptive_nursery_blocks);
+    }
+
+    for (i = 0; i < n_capabilities; i++) {
+        capabilities[i]->total_allocated_at_gc =
+            capabilities[i]->total_allocated;
+    }
+    last_gc_end = now;
+}
+
 /* -----------------------------------------------------------------------------
    Sanity code for CAF garbage collection.
 
@@ -2076,5 +2383,16 @@ void gcCAFs(void)
 
 bool doIdleGCWork(Capability *cap STG_UNUSED, bool all)
 {
-    return runSomeFinalizers(all);
+    bool more = runSomeFinalizers(all);
+
+    if (lazySweepPending()) {
+        ACQUIRE_SM_LOCK;
+        do {
+            lazySweep(LAZY_SWEEP_BLOCKS);
+        } while (all && lazySweepPending());
+        more = more || lazySweepPending();
+        RELEASE_SM_LOCK;
+    }
+
+    return more;
 }
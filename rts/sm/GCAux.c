@@ -68,8 +68,14 @@ isAlive(StgClosure *p)
         return p;
     }
 
-    // if it's a pointer into to-space, then we're done
+    // if it's a pointer into to-space, then we're done; unless it's a
+    // dead object in a live pinned block, whose space may be reused (see
+    // Note [Pinned block recycling] in Storage.c)
     if (bd->flags & BF_EVACUATED) {
+        if ((bd->flags & BF_LINES) &&
+            !pinnedLinesMarked(bd, (P_)q, arr_words_sizeW((StgArrBytes *)q))) {
+            return NULL;
+        }
         return p;
     }
 
@@ -119,6 +119,20 @@ typedef struct gen_workspace_ {
 #define GC_THREAD_STANDING_BY          1
 #define GC_THREAD_RUNNING              2
 #define GC_THREAD_WAITING_TO_CONTINUE  3
+#define GC_THREAD_WAITING_TO_COMPACT   4
+#define GC_THREAD_WAITING_TO_SWEEP     5
+
+/* The phases of a GC that we time separately.  See Note [GC phase timing]
+   in GC.c. */
+typedef enum {
+    GC_PHASE_ROOTS,     // marking the roots and the mutable lists
+    GC_PHASE_CAFS,      // marking the CAF list
+    GC_PHASE_SCAV,      // scavenging, until every thread runs out of work
+    GC_PHASE_WEAK,      // traversing the weak pointer list
+    GC_PHASE_SWEEP,     // compacting or sweeping the oldest generation
+    GC_PHASE_FREE,      // freeing from-space, and returning memory to the OS
+    N_GC_PHASES
+} GcPhase;
 
 typedef struct gc_thread_ {
     Capability *cap;
@@ -192,6 +206,11 @@ typedef struct gc_thread_ {
     Time gc_end_elapsed;           // process elapsed time
     W_ gc_start_faults;
 
+    Time gc_phase_start;           // when the current phase started
+    Time gc_phase_elapsed[N_GC_PHASES]; // elapsed time in each phase
+    Time gc_idle_elapsed;          // part of GC_PHASE_SCAV spent waiting
+                                   // for other threads to find work
+
     // -------------------
     // workspaces
 
@@ -96,6 +96,9 @@ typedef struct free_list {
 
 static free_list *free_list_head;
 static W_ mblock_high_watermark;
+// Everything from mblock_high_watermark up to here is committed but unused;
+// see getFreshMBlocks()
+static W_ mblock_committed_top;
 /*
  * it is quite important that these are in the same cache line as they
  * are both needed by HEAP_ALLOCED. Moreover, we need to ensure that they
@@ -194,19 +197,45 @@ static void *getFreshMBlocks(uint32_t n)
 {
     W_ size = MBLOCK_SIZE * (W_)n;
     void *addr = (void*)mblock_high_watermark;
+    W_ top = mblock_high_watermark + size;
 
-    if (mblock_high_watermark + size > mblock_address_space.end)
+    if (top > mblock_address_space.end)
     {
         // whoa, 1 TB of heap?
         errorBelch("out of memory");
         stg_exit(EXIT_HEAPOVERFLOW);
     }
 
-    osCommitMemory(addr, size);
-    mblock_high_watermark += size;
+    if (top > mblock_committed_top) {
+        // With --huge-pages, commit up to the end of the huge page, so
+        // that the kernel can back all of it with one.
+        // See Note [Transparent huge pages] in posix/OSMem.c
+        W_ huge = osHugePageSize();
+        W_ commit_top = top;
+        if (huge != 0) {
+            commit_top = stg_min((top + huge - 1) & ~(huge - 1),
+                                 mblock_address_space.end);
+        }
+        osCommitMemory((void*)mblock_committed_top,
+                       commit_top - mblock_committed_top);
+        mblock_committed_top = commit_top;
+    }
+    mblock_high_watermark = top;
     return addr;
 }
 
+// Give back the committed memory above the high watermark as it drops, so
+// that getFreshMBlocks() commits it afresh.
+static void lowerHighWatermark(W_ size)
+{
+    if (mblock_committed_top > mblock_high_watermark) {
+        osDecommitMemory((void*)mblock_high_watermark,
+                         mblock_committed_top - mblock_high_watermark);
+    }
+    mblock_high_watermark -= size;
+    mblock_committed_top = mblock_high_watermark;
+}
+
 static void *getCommittedMBlocks(uint32_t n)
 {
     void *p;
@@ -240,7 +269,7 @@ static void decommitMBlocks(char *addr, uint32_t n)
             iter->size += size;
 
             if (address + size == mblock_high_watermark) {
-                mblock_high_watermark -= iter->size;
+                lowerHighWatermark(iter->size);
                 if (iter->prev) {
                     iter->prev->next = NULL;
                 } else {
@@ -309,7 +338,7 @@ static void decommitMBlocks(char *addr, uint32_t n)
 
     /* Fast path the case of releasing high or all memory */
     if (address + size == mblock_high_watermark) {
-        mblock_high_watermark -= size;
+        lowerHighWatermark(size);
     } else {
         struct free_list *new_iter;
 
@@ -635,6 +664,7 @@ freeAllMBlocks(void)
     mblock_address_space.begin = (W_)-1;
     mblock_address_space.end = (W_)-1;
     mblock_high_watermark = (W_)-1;
+    mblock_committed_top = (W_)-1;
 #else
     osFreeAllMBlocks();
 
@@ -671,6 +701,7 @@ initMBlocks(void)
         mblock_address_space.begin = (W_)addr;
         mblock_address_space.end = (W_)addr + size;
         mblock_high_watermark = (W_)addr;
+        mblock_committed_top = (W_)addr;
     }
 #elif SIZEOF_VOID_P == 8
     memset(mblock_cache,0xff,sizeof(mblock_cache));
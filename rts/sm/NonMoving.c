@@ -148,8 +148,8 @@ Mutex concurrent_coll_finished_lock;
  *     this file).
  *
  *  2. [STW] Snapshot update: Here we update the segment snapshot metadata
- *     (see nonmovingPrepareMark) and move the filled segments to
- *     nonmovingHeap.sweep_list, which is the set of segments which we will
+ *     (see nonmovingPrepareMark) and move the filled segments to the
+ *     allocators' sweep lists, which hold the set of segments which we will
  *     sweep this GC cycle.
  *
  *  3. [STW] Root collection: Here we walk over a variety of root sources
@@ -163,9 +163,12 @@ Mutex concurrent_coll_finished_lock;
  *     flush their final update remembered sets, and mark any new references
  *     we find.
  *
- *  6. [CONC] Sweep: Here we walk over the nonmoving segments on sweep_list
- *     and place them back on either the active, current, or filled list,
- *     depending upon how much live data they contain.
+ *  6. [CONC] Sweep: Here we walk over the nonmoving segments on the sweep
+ *     lists and place them back on either the active, current, or filled
+ *     list, depending upon how much live data they contain. The sweep is
+ *     shared between the mark threads, and the allocator sweeps segments
+ *     itself when it runs out of active segments (see
+ *     Note [Lazy sweeping of nonmoving segments] in NonMovingSweep.c).
  *
  *
  * === Marking ===
@@ -671,6 +674,12 @@ void *nonmovingAllocate(Capability *cap, StgWord sz)
         // first look for a new segment in the active list
         struct NonmovingSegment *new_current = pop_active_segment(alloca);
 
+        // then sweep one that the concurrent sweep hasn't reached yet.
+        // See Note [Lazy sweeping of nonmoving segments] in NonMovingSweep.c.
+        if (new_current == NULL && RELAXED_LOAD(&alloca->sweep_list) != NULL) {
+            new_current = nonmovingLazySweep(alloca);
+        }
+
         // there are no active segments, allocate new segment
         if (new_current == NULL) {
             new_current = nonmovingAllocSegment(cap->node);
@@ -688,20 +697,42 @@ void *nonmovingAllocate(Capability *cap, StgWord sz)
 /* Allocate a nonmovingAllocator */
 static struct NonmovingAllocator *alloc_nonmoving_allocator(uint32_t n_caps)
 {
-    size_t allocator_sz =
-        sizeof(struct NonmovingAllocator) +
-        sizeof(void*) * n_caps; // current segment pointer for each capability
     struct NonmovingAllocator *alloc =
-        stgMallocBytes(allocator_sz, "nonmovingInit");
-    memset(alloc, 0, allocator_sz);
+        stgMallocBytes(sizeof(struct NonmovingAllocator), "nonmovingInit");
+    memset(alloc, 0, sizeof(struct NonmovingAllocator));
+    // current segment pointer for each capability
+    alloc->current =
+        stgCallocBytes(n_caps, sizeof(void*), "nonmovingInit");
     return alloc;
 }
 
 static void free_nonmoving_allocator(struct NonmovingAllocator *alloc)
 {
+    stgFree(alloc->current);
     stgFree(alloc);
 }
 
+/* Arrays of current segments replaced by nonmovingAddCapabilities, kept until
+ * no concurrent collection can be reading them. See
+ * Note [Growing the nonmoving allocators].
+ */
+struct RetiredCurrent {
+    struct RetiredCurrent *link;
+    struct NonmovingSegment **current;
+};
+
+static struct RetiredCurrent *retired_current = NULL;
+
+static void free_retired_current(void)
+{
+    while (retired_current) {
+        struct RetiredCurrent *r = retired_current;
+        retired_current = r->link;
+        stgFree(r->current);
+        stgFree(r);
+    }
+}
+
 void nonmovingInit(void)
 {
     if (! RtsFlags.GcFlags.useNonmoving) return;
@@ -747,11 +778,31 @@ void nonmovingExit(void)
     for (unsigned int i = 0; i < NONMOVING_ALLOCA_CNT; i++) {
         free_nonmoving_allocator(nonmovingHeap.allocators[i]);
     }
+    free_retired_current();
 }
 
 /*
- * Assumes that no garbage collector or mutator threads are running to safely
- * resize the nonmoving_allocators.
+ * Note [Growing the nonmoving allocators]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * setNumCapabilities stops all capabilities before growing the allocators'
+ * current arrays, but that does not stop a concurrent nonmoving collection:
+ * the mark thread, the parallel sweepers (see Note [Parallel marking] in
+ * NonMovingMark.c) and the census at the end of a collection may all be
+ * looking at the allocators at that moment. The sweepers pop segments from
+ * each allocator's sweep_list with a CAS on the allocator itself, so we must
+ * neither move an allocator nor copy its lists.
+ *
+ * Consequently the NonmovingAllocators are never reallocated: only their
+ * current arrays are, and nothing but the mutators (which are stopped) writes
+ * those. The new array is published before n_capabilities grows. The old array
+ * may still be read by the census of an on-going collection, so rather than
+ * freeing it immediately we keep it on retired_current until the next
+ * nonmovingPrepareMark, at which point the previous collection has finished.
+ */
+
+/*
+ * Must be called with all capabilities stopped, but a concurrent collection
+ * may be running; see Note [Growing the nonmoving allocators].
  *
  * Must hold sm_mutex.
  */
@@ -761,23 +812,30 @@ void nonmovingAddCapabilities(uint32_t new_n_caps)
     struct NonmovingAllocator **allocs = nonmovingHeap.allocators;
 
     for (unsigned int i = 0; i < NONMOVING_ALLOCA_CNT; i++) {
-        struct NonmovingAllocator *old = allocs[i];
-        allocs[i] = alloc_nonmoving_allocator(new_n_caps);
+        struct NonmovingAllocator *alloca = allocs[i];
+        struct NonmovingSegment **old = alloca->current;
+        struct NonmovingSegment **current =
+            stgMallocBytes(sizeof(void*) * new_n_caps, "nonmovingAddCapabilities");
 
         // Copy the old state
-        allocs[i]->filled = old->filled;
-        allocs[i]->active = old->active;
         for (unsigned int j = 0; j < old_n_caps; j++) {
-            allocs[i]->current[j] = old->current[j];
+            current[j] = old[j];
         }
-        stgFree(old);
 
         // Initialize current segments for the new capabilities
         for (unsigned int j = old_n_caps; j < new_n_caps; j++) {
-            allocs[i]->current[j] = nonmovingAllocSegment(capabilities[j]->node);
-            nonmovingInitSegment(allocs[i]->current[j], NONMOVING_ALLOCA0 + i);
-            allocs[i]->current[j]->link = NULL;
+            current[j] = nonmovingAllocSegment(capabilities[j]->node);
+            nonmovingInitSegment(current[j], NONMOVING_ALLOCA0 + i);
+            current[j]->link = NULL;
         }
+
+        RELEASE_STORE(&alloca->current, current);
+
+        struct RetiredCurrent *r =
+            stgMallocBytes(sizeof(struct RetiredCurrent), "nonmovingAddCapabilities");
+        r->current = old;
+        r->link = retired_current;
+        retired_current = r;
     }
     nonmovingHeap.n_caps = new_n_caps;
 }
@@ -796,13 +854,17 @@ static void nonmovingPrepareMark(void)
     static_flag =
         static_flag == STATIC_FLAG_A ? STATIC_FLAG_B : STATIC_FLAG_A;
 
-    // Should have been cleared by the last sweep
-    ASSERT(nonmovingHeap.sweep_list == NULL);
+    // No collection is running, so nothing can be reading the current arrays
+    // replaced since the last one. See Note [Growing the nonmoving allocators].
+    free_retired_current();
 
     nonmovingBumpEpoch();
     for (int alloca_idx = 0; alloca_idx < NONMOVING_ALLOCA_CNT; ++alloca_idx) {
         struct NonmovingAllocator *alloca = nonmovingHeap.allocators[alloca_idx];
 
+        // Should have been cleared by the last sweep
+        ASSERT(alloca->sweep_list == NULL);
+
         // Update current segments' snapshot pointers
         for (uint32_t cap_n = 0; cap_n < n_capabilities; ++cap_n) {
             struct NonmovingSegment *seg = alloca->current[cap_n];
@@ -811,6 +873,7 @@ static void nonmovingPrepareMark(void)
 
         // Save the filled segments for later processing during the concurrent
         // mark phase.
+        ASSERT(alloca->saved_filled == NULL);
         alloca->saved_filled = alloca->filled;
         alloca->filled = NULL;
 
@@ -1036,28 +1099,22 @@ static void nonmovingMark_(MarkQueue *mark_queue, StgWeak **dead_weaks, StgTSO *
     debugTrace(DEBUG_nonmoving_gc, "Starting mark...");
     stat_startNonmovingGc();
 
-    // Walk the list of filled segments that we collected during preparation,
-    // updated their snapshot pointers and move them to the sweep list.
+    // Walk the list of filled segments that we collected during preparation
+    // and update their snapshot pointers. They stay on saved_filled until
+    // nonmovingSweep moves them to the sweep lists.
     for (int alloca_idx = 0; alloca_idx < NONMOVING_ALLOCA_CNT; ++alloca_idx) {
-        struct NonmovingSegment *filled = nonmovingHeap.allocators[alloca_idx]->saved_filled;
-        uint32_t n_filled = 0;
-        if (filled) {
-            struct NonmovingSegment *seg = filled;
-            while (true) {
-                // Set snapshot
-                nonmovingSegmentInfo(seg)->next_free_snap = seg->next_free;
-                n_filled++;
-                if (seg->link)
-                    seg = seg->link;
-                else
-                    break;
-            }
-            // add filled segments to sweep_list
-            seg->link = nonmovingHeap.sweep_list;
-            nonmovingHeap.sweep_list = filled;
+        struct NonmovingAllocator *alloca = nonmovingHeap.allocators[alloca_idx];
+        for (struct NonmovingSegment *seg = alloca->saved_filled; seg; seg = seg->link) {
+            // Set snapshot
+            nonmovingSegmentInfo(seg)->next_free_snap = seg->next_free;
         }
     }
 
+#if defined(THREADED_RTS)
+    // See Note [Parallel marking] in NonMovingMark.c
+    nonmovingStartMarkWorkers(mark_queue);
+#endif
+
     // Do concurrent marking; most of the heap will get marked here.
     nonmovingMarkThreadsWeaks(mark_queue);
 
@@ -1067,7 +1124,8 @@ static void nonmovingMark_(MarkQueue *mark_queue, StgWeak **dead_weaks, StgTSO *
     // If at this point if we've decided to exit then just return
     if (sched_state > SCHED_RUNNING) {
         // Note that we break our invariants here and leave segments in
-        // nonmovingHeap.sweep_list, don't free nonmoving_large_objects etc.
+        // the allocators' saved_filled lists, don't free
+        // nonmoving_large_objects etc.
         // However because we won't be running mark-sweep in the final GC this
         // is OK.
 
@@ -1083,6 +1141,7 @@ static void nonmovingMark_(MarkQueue *mark_queue, StgWeak **dead_weaks, StgTSO *
         nonmoving_old_weak_ptr_list = NULL;
         nonmoving_weak_ptr_list = NULL;
 
+        nonmovingStopMarkWorkers();
         goto finish;
     }
 
@@ -1200,9 +1259,12 @@ static void nonmovingMark_(MarkQueue *mark_queue, StgWeak **dead_weaks, StgTSO *
     nonmovingSweepStableNameTable();
 
     nonmovingSweep();
-    ASSERT(nonmovingHeap.sweep_list == NULL);
     debugTrace(DEBUG_nonmoving_gc, "Finished sweeping.");
     traceConcSweepEnd();
+#if defined(THREADED_RTS)
+    // The mark workers also sweep; see Note [Parallel marking]
+    nonmovingStopMarkWorkers();
+#endif
 #if defined(DEBUG)
     if (RtsFlags.DebugFlags.nonmoving_gc)
         nonmovingPrintAllocatorCensus();
@@ -1252,15 +1314,19 @@ void assert_in_nonmoving_heap(StgPtr p)
         return;
     }
 
-    // Search snapshot segments
-    for (struct NonmovingSegment *seg = nonmovingHeap.sweep_list; seg; seg = seg->link) {
-        if (p >= (P_)seg && p < (((P_)seg) + NONMOVING_SEGMENT_SIZE_W)) {
-            return;
-        }
-    }
-
     for (int alloca_idx = 0; alloca_idx < NONMOVING_ALLOCA_CNT; ++alloca_idx) {
         struct NonmovingAllocator *alloca = nonmovingHeap.allocators[alloca_idx];
+        // Search snapshot segments
+        for (struct NonmovingSegment *seg = alloca->saved_filled; seg; seg = seg->link) {
+            if (p >= (P_)seg && p < (((P_)seg) + NONMOVING_SEGMENT_SIZE_W)) {
+                return;
+            }
+        }
+        for (struct NonmovingSegment *seg = alloca->sweep_list; seg; seg = seg->link) {
+            if (p >= (P_)seg && p < (((P_)seg) + NONMOVING_SEGMENT_SIZE_W)) {
+                return;
+            }
+        }
         // Search current segments
         for (uint32_t cap_idx = 0; cap_idx < n_capabilities; ++cap_idx) {
             struct NonmovingSegment *seg = alloca->current[cap_idx];
@@ -1468,8 +1534,11 @@ void nonmovingPrintSweepList()
 {
     debugBelch("==== SWEEP LIST =====\n");
     int i = 0;
-    for (struct NonmovingSegment *seg = nonmovingHeap.sweep_list; seg; seg = seg->link) {
-        debugBelch("%d: %p\n", i++, (void*)seg);
+    for (int alloca_idx = 0; alloca_idx < NONMOVING_ALLOCA_CNT; ++alloca_idx) {
+        struct NonmovingAllocator *alloca = nonmovingHeap.allocators[alloca_idx];
+        for (struct NonmovingSegment *seg = alloca->sweep_list; seg; seg = seg->link) {
+            debugBelch("%d: %p\n", i++, (void*)seg);
+        }
     }
     debugBelch("= END OF SWEEP LIST =\n");
 }
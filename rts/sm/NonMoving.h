@@ -64,8 +64,15 @@ struct NonmovingAllocator {
     struct NonmovingSegment *filled;
     struct NonmovingSegment *saved_filled;
     struct NonmovingSegment *active;
-    // indexed by capability number
-    struct NonmovingSegment *current[];
+    // The segments of this size being swept in this GC. Segments are moved
+    // here from saved_filled during mark and moved back to either the filled,
+    // active, or free lists during sweep; the allocator may also sweep them
+    // itself (see Note [Lazy sweeping of nonmoving segments]). Accessed
+    // atomically; should be NULL before mark and after sweep.
+    struct NonmovingSegment *sweep_list;
+    // indexed by capability number; grown by nonmovingAddCapabilities, see
+    // Note [Growing the nonmoving allocators]
+    struct NonmovingSegment **current;
 };
 
 // first allocator is of size 2^NONMOVING_ALLOCA0 (in bytes)
@@ -90,12 +97,6 @@ struct NonmovingHeap {
 
     // records the current length of the nonmovingAllocator.current arrays
     unsigned int n_caps;
-
-    // The set of segments being swept in this GC. Segments are moved here from
-    // the filled list during preparation and moved back to either the filled,
-    // active, or free lists during sweep.  Should be NULL before mark and
-    // after sweep.
-    struct NonmovingSegment *sweep_list;
 };
 
 extern struct NonmovingHeap nonmovingHeap;
@@ -26,6 +26,8 @@
 #include "MarkWeak.h"
 #include "sm/Storage.h"
 #include "CNF.h"
+#include "GetTime.h"
+#include "RtsUtils.h"
 
 static bool check_in_nonmoving_heap(StgClosure *p);
 static void mark_closure (MarkQueue *queue, const StgClosure *p, StgClosure **origin);
@@ -249,12 +251,42 @@ StgWord nonmoving_write_barrier_enabled = false;
  */
 MarkQueue *current_mark_queue = NULL;
 
+#if defined(THREADED_RTS)
+/* The mark workers of the current collection. See Note [Parallel marking].
+ * mark_worker_queues[0] is the queue of the mark thread itself.
+ */
+typedef struct {
+    OSThreadId thread;
+    unsigned int count;  // entries processed in the last mark pass
+} MarkWorker;
+
+MarkQueue **mark_worker_queues = NULL;
+uint32_t n_mark_workers = 1;
+static MarkWorker *mark_workers = NULL;
+
+/* Protects mark_pass, mark_workers_job, mark_helpers_busy and
+ * mark_workers_exit */
+static Mutex mark_workers_lock;
+static Condition mark_pass_start_cond;
+static Condition mark_pass_done_cond;
+static uint32_t mark_pass = 0;
+static void (*mark_workers_job)(uint32_t no) = NULL;
+static uint32_t mark_helpers_busy = 0;
+static bool mark_workers_exit = false;
+
+/* The number of workers that may still produce work in this pass */
+static volatile StgWord mark_workers_running = 0;
+#endif
+
 /* Initialise update remembered set data structures */
 void nonmovingMarkInitUpdRemSet() {
 #if defined(THREADED_RTS)
     initMutex(&upd_rem_set_lock);
     initCondition(&upd_rem_set_flushed_cond);
     initMutex(&nonmoving_large_objects_mutex);
+    initMutex(&mark_workers_lock);
+    initCondition(&mark_pass_start_cond);
+    initCondition(&mark_pass_done_cond);
 #endif
 }
 
@@ -431,11 +463,16 @@ push (MarkQueue *q, const MarkQueueEnt *ent)
             // allocate a fresh block.
             ACQUIRE_SM_LOCK;
             bdescr *bd = allocGroup(MARK_QUEUE_BLOCKS);
+            RELEASE_SM_LOCK;
+            ((MarkQueueBlock *) bd->start)->head = 0;
+
+            // The full block becomes stealable; see Note [Parallel marking]
+            ACQUIRE_SPIN_LOCK(&q->lock);
             bd->link = q->blocks;
             q->blocks = bd;
             q->top = (MarkQueueBlock *) bd->start;
-            q->top->head = 0;
-            RELEASE_SM_LOCK;
+            RELAXED_STORE(&q->stealable, q->stealable + 1);
+            RELEASE_SPIN_LOCK(&q->lock);
         }
     }
 
@@ -808,9 +845,13 @@ again:
 
     // Are we at the beginning of the block?
     if (top->head == 0) {
+        // Other mark workers may be stealing the blocks below top; see
+        // Note [Parallel marking].
+        ACQUIRE_SPIN_LOCK(&q->lock);
         // Is this the first block of the queue?
         if (q->blocks->link == NULL) {
             // Yes, therefore queue is empty...
+            RELEASE_SPIN_LOCK(&q->lock);
             MarkQueueEnt none = { .null_entry = { .p = NULL } };
             return none;
         } else {
@@ -818,6 +859,8 @@ again:
             bdescr *old_block = q->blocks;
             q->blocks = old_block->link;
             q->top = (MarkQueueBlock*)q->blocks->start;
+            RELAXED_STORE(&q->stealable, q->stealable - 1);
+            RELEASE_SPIN_LOCK(&q->lock);
             ACQUIRE_SM_LOCK;
             freeGroup(old_block); // TODO: hold on to a block to avoid repeated allocation/deallocation?
             RELEASE_SM_LOCK;
@@ -882,6 +925,11 @@ static void init_mark_queue_ (MarkQueue *queue)
     queue->blocks = bd;
     queue->top = (MarkQueueBlock *) bd->start;
     queue->top->head = 0;
+    queue->stealable = 0;
+    queue->live_words = 0;
+#if defined(THREADED_RTS)
+    initSpinLock(&queue->lock);
+#endif
 #if MARK_PREFETCH_QUEUE_DEPTH > 0
     memset(&queue->prefetch_queue, 0, sizeof(queue->prefetch_queue));
     queue->prefetch_head = 0;
@@ -915,6 +963,51 @@ void freeMarkQueue (MarkQueue *queue)
     freeChain_lock(queue->blocks);
 }
 
+/* Replace the blocks of an empty mark queue with a chain of blocks, taken from
+ * the update remembered set or stolen from another mark worker.
+ */
+static void mark_queue_take_blocks (MarkQueue *q, bdescr *chain)
+{
+    StgWord n = 0;
+    for (bdescr *bd = chain->link; bd != NULL; bd = bd->link) {
+        n++;
+    }
+
+    ACQUIRE_SPIN_LOCK(&q->lock);
+    bdescr *old = q->blocks;
+    ASSERT(old->link == NULL);
+    q->blocks = chain;
+    q->top = (MarkQueueBlock *) chain->start;
+    RELAXED_STORE(&q->stealable, n);
+    RELEASE_SPIN_LOCK(&q->lock);
+
+    ACQUIRE_SM_LOCK;
+    freeGroup(old);
+    RELEASE_SM_LOCK;
+}
+
+/* Move the update remembered set into an empty mark queue. Returns false if
+ * there was nothing to take.
+ */
+static bool take_upd_rem_set_blocks (MarkQueue *q)
+{
+    if (RELAXED_LOAD(&upd_rem_set_block_list) == NULL) {
+        return false;
+    }
+
+    ACQUIRE_LOCK(&upd_rem_set_lock);
+    bdescr *blocks = upd_rem_set_block_list;
+    upd_rem_set_block_list = NULL;
+    RELEASE_LOCK(&upd_rem_set_lock);
+
+    // Another mark worker may have beaten us to it
+    if (blocks == NULL) {
+        return false;
+    }
+    mark_queue_take_blocks(q, blocks);
+    return true;
+}
+
 #if defined(THREADED_RTS) && defined(DEBUG)
 static uint32_t
 markQueueLength (MarkQueue *q)
@@ -1289,12 +1382,18 @@ mark_closure (MarkQueue *queue, const StgClosure *p0, StgClosure **origin)
             }
 
             if (! (bd->flags & BF_MARKED)) {
-                dbl_link_remove(bd, &nonmoving_compact_objects);
-                dbl_link_onto(bd, &nonmoving_marked_compact_objects);
-                StgWord blocks = str->totalW / BLOCK_SIZE_W;
-                n_nonmoving_compact_blocks -= blocks;
-                n_nonmoving_marked_compact_blocks += blocks;
-                bd->flags |= BF_MARKED;
+                // Other mark workers may be marking the same region; see
+                // Note [Parallel marking].
+                ACQUIRE_LOCK(&nonmoving_large_objects_mutex);
+                if (! (bd->flags & BF_MARKED)) {
+                    dbl_link_remove(bd, &nonmoving_compact_objects);
+                    dbl_link_onto(bd, &nonmoving_marked_compact_objects);
+                    StgWord blocks = str->totalW / BLOCK_SIZE_W;
+                    n_nonmoving_compact_blocks -= blocks;
+                    n_nonmoving_marked_compact_blocks += blocks;
+                    bd->flags |= BF_MARKED;
+                }
+                RELEASE_LOCK(&nonmoving_large_objects_mutex);
             }
 
             // N.B. the object being marked is in a compact region so by
@@ -1654,7 +1753,7 @@ mark_closure (MarkQueue *queue, const StgClosure *p0, StgClosure **origin)
         struct NonmovingSegment *seg = nonmovingGetSegment((StgPtr) p);
         nonmoving_block_idx block_idx = nonmovingGetBlockIdx((StgPtr) p);
         nonmovingSetMark(seg, block_idx);
-        nonmoving_live_words += nonmovingSegmentBlockSize(seg) / sizeof(W_);
+        queue->live_words += nonmovingSegmentBlockSize(seg) / sizeof(W_);
     }
 
     // If we found a indirection to shortcut keep going.
@@ -1673,19 +1772,12 @@ done:
     }
 }
 
-/* This is the main mark loop.
- * Invariants:
- *
- *  a. nonmovingPrepareMark has been called.
- *  b. the nursery has been fully evacuated into the non-moving generation.
- *  c. the mark queue has been seeded with a set of roots.
- *
+/* Mark from the given queue until both it and the update remembered set are
+ * empty. Returns the number of entries processed.
  */
-GNUC_ATTR_HOT void
-nonmovingMark (MarkQueue *queue)
+static GNUC_ATTR_HOT unsigned int
+mark_loop (MarkQueue *queue)
 {
-    traceConcMarkBegin();
-    debugTrace(DEBUG_nonmoving_gc, "Starting mark pass");
     unsigned int count = 0;
     while (true) {
         count++;
@@ -1713,27 +1805,315 @@ nonmovingMark (MarkQueue *queue)
         }
         case NULL_ENTRY:
             // Perhaps the update remembered set has more to mark...
-            if (upd_rem_set_block_list) {
-                ACQUIRE_LOCK(&upd_rem_set_lock);
-                bdescr *old = queue->blocks;
-                queue->blocks = upd_rem_set_block_list;
-                queue->top = (MarkQueueBlock *) queue->blocks->start;
-                upd_rem_set_block_list = NULL;
-                RELEASE_LOCK(&upd_rem_set_lock);
-
-                ACQUIRE_SM_LOCK;
-                freeGroup(old);
-                RELEASE_SM_LOCK;
-            } else {
+            if (!take_upd_rem_set_blocks(queue)) {
                 // Nothing more to do
-                debugTrace(DEBUG_nonmoving_gc, "Finished mark pass: %d", count);
-                traceConcMarkEnd(count);
-                return;
+                return count;
             }
         }
     }
 }
 
+#if defined(THREADED_RTS)
+/* Note [Parallel marking]
+ * ~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * With --nonmoving-mark-threads=<n> the mark thread is joined by n-1 helper
+ * threads for the duration of a collection. Each worker has its own MarkQueue
+ * (the mark thread's is mark_worker_queues[0]); workers push the fields of the
+ * objects they mark onto their own queue, so the hot path is unchanged.
+ *
+ * Every call to nonmovingMark by the mark thread is a mark pass: it wakes the
+ * helpers, marks alongside them, and returns once every worker has run out of
+ * work. Between passes the helpers sleep while the mark thread alone tidies
+ * threads and weak pointers and synchronises with the mutators, so everything
+ * outside of nonmovingMark stays single-threaded.
+ *
+ * Work moves between workers a block at a time. The full blocks below the top
+ * of a queue (q->stealable of them) may be taken by any worker that has run
+ * dry. Only the owner touches the top block, but both the owner and thieves
+ * change the chain below it, so they do so holding q->lock: the owner when it
+ * pushes a new block or unwinds to the previous one, which happens once every
+ * MARK_QUEUE_BLOCK_ENTRIES entries. Idle workers also take the update
+ * remembered set (upd_rem_set_block_list) under upd_rem_set_lock, exactly as
+ * the single mark thread does, so the protocol described in
+ * Note [Update remembered set] is unchanged; the final pass after the
+ * post-mark synchronisation drains every flushed block as before.
+ *
+ * Termination follows scavenge_until_all_done in GC.c: mark_workers_running
+ * counts the workers that may still produce work. A worker out of work
+ * decrements it and spins looking for work to steal, incrementing it again
+ * before stealing; once it reaches zero every queue is empty and the pass is
+ * over. Mutators may still add to the update remembered set after that,
+ * which the next pass picks up, as with a single mark thread.
+ *
+ * Marking itself is mostly idempotent and so tolerates races between workers:
+ * mark bits are set with plain byte stores, static objects are claimed with
+ * bump_static_flag and stacks with stack->marking. Large objects and compact
+ * regions move between lists, so they are marked under
+ * nonmoving_large_objects_mutex. Live words are counted per queue and summed
+ * at the end of the pass; two workers that race to mark the same object will
+ * both count it, which only affects the live_estimate heuristic.
+ *
+ * Once marking is done the same workers share the sweep of the non-moving
+ * segments (see nonmovingSweep); nonmovingRunWorkers runs any such job on
+ * all of them.
+ *
+ * Each worker emits a CONC_MARK_WORKER event at the end of each pass with the
+ * number of entries it processed and the time it spent marking (rather than
+ * waiting for work), from which per-worker throughput can be read off.
+ */
+
+/* Is there work for worker no to steal? */
+static bool mark_work_available (uint32_t no)
+{
+    if (RELAXED_LOAD(&upd_rem_set_block_list) != NULL) {
+        return true;
+    }
+    for (uint32_t i = 0; i < n_mark_workers; i++) {
+        if (i != no && RELAXED_LOAD(&mark_worker_queues[i]->stealable) > 0) {
+            return true;
+        }
+    }
+    yieldThread();
+    return false;
+}
+
+/* Steal a block from another worker into the (empty) queue of worker no */
+static bool steal_mark_block (uint32_t no)
+{
+    MarkQueue *q = mark_worker_queues[no];
+
+    if (take_upd_rem_set_blocks(q)) {
+        return true;
+    }
+
+    for (uint32_t i = 1; i < n_mark_workers; i++) {
+        MarkQueue *victim = mark_worker_queues[(no + i) % n_mark_workers];
+        if (RELAXED_LOAD(&victim->stealable) == 0) {
+            continue;
+        }
+
+        bdescr *bd = NULL;
+        ACQUIRE_SPIN_LOCK(&victim->lock);
+        if (victim->stealable > 0) {
+            bd = victim->blocks->link;
+            victim->blocks->link = bd->link;
+            RELAXED_STORE(&victim->stealable, victim->stealable - 1);
+        }
+        RELEASE_SPIN_LOCK(&victim->lock);
+
+        if (bd != NULL) {
+            bd->link = NULL;
+            mark_queue_take_blocks(q, bd);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Take part in a mark pass as worker no */
+static void mark_worker_pass (uint32_t no)
+{
+    MarkQueue *queue = mark_worker_queues[no];
+    unsigned int count = 0;
+    StgWord64 busy = 0;
+
+loop:
+    {
+        StgWord64 start = getMonotonicNSec();
+        do {
+            count += mark_loop(queue);
+        } while (steal_mark_block(no));
+        busy += getMonotonicNSec() - start;
+    }
+
+    // This atomic decrement also serves as a full barrier to ensure that
+    // our marks are visible to the other workers.
+    atomic_dec(&mark_workers_running);
+
+    while (SEQ_CST_LOAD(&mark_workers_running) != 0) {
+        if (mark_work_available(no)) {
+            atomic_inc(&mark_workers_running, 1);
+            goto loop;
+        }
+    }
+
+    mark_workers[no].count = count;
+    traceConcMarkWorker(no, count, busy);
+}
+
+static void *
+mark_worker_thread (void *data)
+{
+    uint32_t no = (uint32_t) (W_) data;
+    uint32_t pass = 0;
+
+    ACQUIRE_LOCK(&mark_workers_lock);
+    while (true) {
+        while (mark_pass == pass && !mark_workers_exit) {
+            waitCondition(&mark_pass_start_cond, &mark_workers_lock);
+        }
+        if (mark_workers_exit) {
+            break;
+        }
+        pass = mark_pass;
+        void (*job)(uint32_t) = mark_workers_job;
+        RELEASE_LOCK(&mark_workers_lock);
+
+        job(no);
+
+        ACQUIRE_LOCK(&mark_workers_lock);
+        if (--mark_helpers_busy == 0) {
+            signalCondition(&mark_pass_done_cond);
+        }
+    }
+    RELEASE_LOCK(&mark_workers_lock);
+    return NULL;
+}
+
+/* Start the helper mark workers for a collection marking from the given
+ * queue. Called by the mark thread before it starts marking.
+ */
+void nonmovingStartMarkWorkers (MarkQueue *queue)
+{
+    uint32_t n = RtsFlags.GcFlags.nonmovingMarkThreads;
+    if (n <= 1) {
+        return;
+    }
+
+    mark_worker_queues =
+        stgMallocBytes(n * sizeof(MarkQueue *), "nonmovingStartMarkWorkers");
+    mark_workers =
+        stgMallocBytes(n * sizeof(MarkWorker), "nonmovingStartMarkWorkers");
+    mark_worker_queues[0] = queue;
+    for (uint32_t i = 1; i < n; i++) {
+        MarkQueue *q = stgMallocBytes(sizeof(MarkQueue), "mark queue");
+        ACQUIRE_SM_LOCK;
+        initMarkQueue(q);
+        RELEASE_SM_LOCK;
+        mark_worker_queues[i] = q;
+    }
+
+    mark_pass = 0;
+    mark_workers_exit = false;
+    n_mark_workers = n;
+
+    for (uint32_t i = 1; i < n; i++) {
+        if (createOSThread(&mark_workers[i].thread, "non-moving mark worker",
+                           mark_worker_thread, (void *) (W_) i) != 0) {
+            barf("nonmovingStartMarkWorkers: failed to spawn mark worker: %s",
+                 strerror(errno));
+        }
+    }
+    debugTrace(DEBUG_nonmoving_gc, "Started %d mark workers", n);
+}
+
+/* Stop the helper mark workers. Their queues are empty since the last mark
+ * pass drained them.
+ */
+void nonmovingStopMarkWorkers (void)
+{
+    uint32_t n = n_mark_workers;
+    if (n <= 1) {
+        return;
+    }
+
+    ACQUIRE_LOCK(&mark_workers_lock);
+    mark_workers_exit = true;
+    broadcastCondition(&mark_pass_start_cond);
+    RELEASE_LOCK(&mark_workers_lock);
+
+    n_mark_workers = 1;
+    for (uint32_t i = 1; i < n; i++) {
+        joinOSThread(mark_workers[i].thread);
+        ASSERT(markQueueIsEmpty(mark_worker_queues[i]));
+        freeMarkQueue(mark_worker_queues[i]);
+        stgFree(mark_worker_queues[i]);
+    }
+    stgFree(mark_worker_queues);
+    stgFree(mark_workers);
+    mark_worker_queues = NULL;
+    mark_workers = NULL;
+}
+
+/* Run job(no) on every worker, the calling mark thread being worker 0, and
+ * return when they have all finished. Used for mark passes and by
+ * nonmovingSweep.
+ */
+void nonmovingRunWorkers (void (*job)(uint32_t no))
+{
+    ACQUIRE_LOCK(&mark_workers_lock);
+    mark_workers_job = job;
+    mark_helpers_busy = n_mark_workers - 1;
+    mark_pass++;
+    broadcastCondition(&mark_pass_start_cond);
+    RELEASE_LOCK(&mark_workers_lock);
+
+    job(0);
+
+    ACQUIRE_LOCK(&mark_workers_lock);
+    while (mark_helpers_busy > 0) {
+        waitCondition(&mark_pass_done_cond, &mark_workers_lock);
+    }
+    RELEASE_LOCK(&mark_workers_lock);
+}
+
+/* Run a mark pass with every worker. Returns the number of entries processed. */
+static unsigned int
+mark_in_parallel (void)
+{
+    mark_workers_running = n_mark_workers;
+    nonmovingRunWorkers(mark_worker_pass);
+
+    unsigned int count = 0;
+    for (uint32_t i = 0; i < n_mark_workers; i++) {
+        MarkQueue *q = mark_worker_queues[i];
+        count += mark_workers[i].count;
+        nonmoving_live_words += q->live_words;
+        q->live_words = 0;
+    }
+    return count;
+}
+#endif
+
+/* This is the main mark loop.
+ * Invariants:
+ *
+ *  a. nonmovingPrepareMark has been called.
+ *  b. the nursery has been fully evacuated into the non-moving generation.
+ *  c. the mark queue has been seeded with a set of roots.
+ *
+ */
+/* Run one mark pass. Returns the number of entries processed. */
+static unsigned int
+run_mark_pass (MarkQueue *queue)
+{
+#if defined(THREADED_RTS)
+    if (n_mark_workers > 1) {
+        ASSERT(queue == mark_worker_queues[0]);
+        return mark_in_parallel();
+    }
+#endif
+    unsigned int count = mark_loop(queue);
+    nonmoving_live_words += queue->live_words;
+    queue->live_words = 0;
+    return count;
+}
+
+GNUC_ATTR_HOT void
+nonmovingMark (MarkQueue *queue)
+{
+    traceConcMarkBegin();
+    debugTrace(DEBUG_nonmoving_gc, "Starting mark pass");
+#if defined(DEBUG) || defined(TRACING)
+    unsigned int count = run_mark_pass(queue);
+    debugTrace(DEBUG_nonmoving_gc, "Finished mark pass: %d", count);
+    traceConcMarkEnd(count);
+#else
+    run_mark_pass(queue);
+#endif
+}
+
 // A variant of `isAlive` that works for non-moving heap. Used for:
 //
 // - Collecting weak pointers; checking key of a weak pointer.
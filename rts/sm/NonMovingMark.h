@@ -94,6 +94,19 @@ typedef struct MarkQueue_ {
     // Is this a mark queue or a capability-local update remembered set?
     bool is_upd_rem_set;
 
+    // The number of blocks below top, which other mark workers may steal.
+    // See Note [Parallel marking] in NonMovingMark.c.
+    StgWord stealable;
+
+#if defined(THREADED_RTS)
+    // Taken by the owner when it changes blocks, and by thieves.
+    SpinLock lock;
+#endif
+
+    // Words of the non-moving heap marked from this queue; added to
+    // nonmoving_live_words at the end of each mark pass.
+    memcount live_words;
+
 #if MARK_PREFETCH_QUEUE_DEPTH > 0
     // A ring-buffer of entries which we will mark next
     MarkQueueEnt prefetch_queue[MARK_PREFETCH_QUEUE_DEPTH];
@@ -132,6 +145,10 @@ extern StgIndStatic *debug_caf_list_snapshot;
 #endif
 
 extern MarkQueue *current_mark_queue;
+#if defined(THREADED_RTS)
+extern MarkQueue **mark_worker_queues;
+extern uint32_t n_mark_workers;
+#endif
 extern bdescr *upd_rem_set_block_list;
 
 
@@ -157,6 +174,12 @@ void initMarkQueue(MarkQueue *queue);
 void freeMarkQueue(MarkQueue *queue);
 void nonmovingMark(struct MarkQueue_ *restrict queue);
 
+#if defined(THREADED_RTS)
+void nonmovingStartMarkWorkers(MarkQueue *queue);
+void nonmovingStopMarkWorkers(void);
+void nonmovingRunWorkers(void (*job)(uint32_t no));
+#endif
+
 bool nonmovingTidyWeaks(struct MarkQueue_ *queue);
 void nonmovingTidyThreads(void);
 void nonmovingMarkDeadWeaks(struct MarkQueue_ *queue, StgWeak **dead_weak_ptr_list);
@@ -127,33 +127,128 @@ clear_segment_free_blocks(struct NonmovingSegment* seg)
 
 #endif
 
+/* Note [Lazy sweeping of nonmoving segments]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Once mark has finished, nonmovingSweep moves each allocator's saved_filled
+ * segments to its sweep_list and sweeps them, sharing the work among the mark
+ * workers (see Note [Parallel marking] in NonMovingMark.c). Workers pop
+ * segments one at a time, starting at different allocators.
+ *
+ * Meanwhile the mutators keep allocating. When nonmovingAllocate fills its
+ * current segment and finds no active segment of that size, it pops segments
+ * off the allocator's sweep list and sweeps them itself
+ * (nonmovingLazySweep), rather than waiting for the sweep to get there or
+ * allocating a fresh segment. A segment with free blocks becomes its current
+ * segment directly; filled segments go to the filled list as usual.
+ *
+ * Segments are popped with a CAS. A segment never returns to a sweep list
+ * during the sweep that removed it, so the pop is free of ABA problems, and
+ * each segment is swept by exactly one thread. The sweep lists are only
+ * published once the mark bitmaps are final, so the allocator never sees a
+ * segment that is still being marked.
+ */
+
+/* Pop a segment to sweep off an allocator's sweep list, or return NULL */
+static struct NonmovingSegment *
+pop_sweep_segment(struct NonmovingAllocator *alloca)
+{
+    while (true) {
+        struct NonmovingSegment *seg = ACQUIRE_LOAD(&alloca->sweep_list);
+        if (seg == NULL) {
+            return NULL;
+        }
+        if (cas((StgVolatilePtr) &alloca->sweep_list,
+                (StgWord) seg,
+                (StgWord) seg->link) == (StgWord) seg) {
+            return seg;
+        }
+    }
+}
+
+static void
+sweep_segment(struct NonmovingSegment *seg)
+{
+    enum SweepResult ret = nonmovingSweepSegment(seg);
+
+    switch (ret) {
+    case SEGMENT_FREE:
+        IF_DEBUG(sanity, clear_segment(seg));
+        nonmovingPushFreeSegment(seg);
+        break;
+    case SEGMENT_PARTIAL:
+        IF_DEBUG(sanity, clear_segment_free_blocks(seg));
+        nonmovingPushActiveSegment(seg);
+        break;
+    case SEGMENT_FILLED:
+        nonmovingPushFilledSegment(seg);
+        break;
+    default:
+        barf("nonmovingSweep: weird sweep return: %d\n", ret);
+    }
+}
+
+/* Sweep until every sweep list is empty, as mark worker no */
+static void
+sweep_worker(uint32_t no)
+{
+    for (int i = 0; i < NONMOVING_ALLOCA_CNT; ++i) {
+        struct NonmovingAllocator *alloca =
+            nonmovingHeap.allocators[(no + i) % NONMOVING_ALLOCA_CNT];
+        struct NonmovingSegment *seg;
+        while ((seg = pop_sweep_segment(alloca)) != NULL) {
+            sweep_segment(seg);
+        }
+    }
+}
+
 GNUC_ATTR_HOT void nonmovingSweep(void)
 {
-    while (nonmovingHeap.sweep_list) {
-        struct NonmovingSegment *seg = nonmovingHeap.sweep_list;
+    // From here on the allocator may sweep segments too.
+    // See Note [Lazy sweeping of nonmoving segments].
+    for (int i = 0; i < NONMOVING_ALLOCA_CNT; ++i) {
+        struct NonmovingAllocator *alloca = nonmovingHeap.allocators[i];
+        ASSERT(alloca->sweep_list == NULL);
+        RELEASE_STORE(&alloca->sweep_list, alloca->saved_filled);
+        alloca->saved_filled = NULL;
+    }
 
-        // Pushing the segment to one of the free/active/filled segments
-        // updates the link field, so update sweep_list here
-        nonmovingHeap.sweep_list = seg->link;
+#if defined(THREADED_RTS)
+    if (n_mark_workers > 1) {
+        nonmovingRunWorkers(sweep_worker);
+    } else
+#endif
+    {
+        sweep_worker(0);
+    }
 
-        enum SweepResult ret = nonmovingSweepSegment(seg);
+    for (int i = 0; i < NONMOVING_ALLOCA_CNT; ++i) {
+        ASSERT(nonmovingHeap.allocators[i]->sweep_list == NULL);
+    }
+}
 
-        switch (ret) {
+/* Sweep segments off the allocator's sweep list until one has free blocks,
+ * and return it, or NULL if there are no segments left to sweep. The segment
+ * is ready for allocation at next_free.
+ * See Note [Lazy sweeping of nonmoving segments].
+ */
+struct NonmovingSegment *nonmovingLazySweep(struct NonmovingAllocator *alloca)
+{
+    struct NonmovingSegment *seg;
+    while ((seg = pop_sweep_segment(alloca)) != NULL) {
+        switch (nonmovingSweepSegment(seg)) {
         case SEGMENT_FREE:
             IF_DEBUG(sanity, clear_segment(seg));
-            nonmovingPushFreeSegment(seg);
-            break;
+            return seg;
         case SEGMENT_PARTIAL:
             IF_DEBUG(sanity, clear_segment_free_blocks(seg));
-            nonmovingPushActiveSegment(seg);
-            break;
+            return seg;
         case SEGMENT_FILLED:
             nonmovingPushFilledSegment(seg);
             break;
-        default:
-            barf("nonmovingSweep: weird sweep return: %d\n", ret);
         }
     }
+    return NULL;
 }
 
 /* Must a closure remain on the mutable list?
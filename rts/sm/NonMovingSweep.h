@@ -12,6 +12,9 @@
 
 GNUC_ATTR_HOT void nonmovingSweep(void);
 
+// Sweep a segment for the allocator to allocate into
+struct NonmovingSegment *nonmovingLazySweep(struct NonmovingAllocator *alloca);
+
 // Remove unmarked entries in oldest generation mut_lists
 void nonmovingSweepMutLists(void);
 
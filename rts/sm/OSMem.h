@@ -24,6 +24,14 @@ uint32_t osNumaNodes(void);
 uint64_t osNumaMask(void);
 void osBindMBlocksToNode(void *addr, StgWord size, uint32_t node);
 
+// With --huge-pages, the size of the transparent huge pages that the heap
+// is aligned to and advised to use, and 0 otherwise.  See
+// Note [Transparent huge pages] in posix/OSMem.c.
+W_ osHugePageSize(void);
+// How many bytes of the address range [start, end) are backed by huge
+// pages, or 0 if the OS can't tell us.
+StgWord64 osHugePageBytes(W_ start, W_ end);
+
 INLINE_HEADER size_t
 roundDownToPage (size_t x)
 {
@@ -21,6 +21,7 @@
 #include "RtsUtils.h"
 #include "sm/Storage.h"
 #include "sm/BlockAlloc.h"
+#include "sm/Sweep.h"
 #include "GCThread.h"
 #include "Sanity.h"
 #include "Schedule.h"
@@ -1051,14 +1052,21 @@ findMemoryLeak (void)
             struct NonmovingAllocator *alloc = nonmovingHeap.allocators[i];
             markNonMovingSegments(alloc->filled);
             markNonMovingSegments(alloc->active);
+            markNonMovingSegments(alloc->saved_filled);
+            markNonMovingSegments(alloc->sweep_list);
             for (j = 0; j < n_capabilities; j++) {
                 markNonMovingSegments(alloc->current[j]);
             }
         }
-        markNonMovingSegments(nonmovingHeap.sweep_list);
         markNonMovingSegments(nonmovingHeap.free);
         if (current_mark_queue)
             markBlocks(current_mark_queue->blocks);
+#if defined(THREADED_RTS)
+        // The leader's queue is mark_worker_queues[0], counted above
+        for (i = 1; i < n_mark_workers; i++) {
+            markBlocks(mark_worker_queues[i]->blocks);
+        }
+#endif
     }
 
 #if defined(PROFILING)
@@ -1075,6 +1083,10 @@ findMemoryLeak (void)
   // count the blocks containing executable memory
   markBlocks(exec_block);
 
+#if defined(THREADED_RTS)
+  markBlockCaches();
+#endif
+
   reportUnmarkedBlocks();
 }
 
@@ -1082,14 +1094,17 @@ void
 checkRunQueue(Capability *cap)
 {
     StgTSO *prev, *tso;
-    prev = END_TSO_QUEUE;
-    uint32_t n;
-    for (n = 0, tso = cap->run_queue_hd; tso != END_TSO_QUEUE;
-         prev = tso, tso = tso->_link, n++) {
-        ASSERT(prev == END_TSO_QUEUE || prev->_link == tso);
-        ASSERT(tso->block_info.prev == prev);
+    uint32_t n = 0;
+    for (uint32_t p = 0; p < N_TSO_PRIOS; p++) {
+        prev = END_TSO_QUEUE;
+        for (tso = cap->run_queue_hd[p]; tso != END_TSO_QUEUE;
+             prev = tso, tso = tso->_link, n++) {
+            ASSERT(prev == END_TSO_QUEUE || prev->_link == tso);
+            ASSERT(tso->block_info.prev == prev);
+            ASSERT(tso->run_queue_prio == p);
+        }
+        ASSERT(cap->run_queue_tl[p] == prev);
     }
-    ASSERT(cap->run_queue_tl == prev);
     ASSERT(cap->n_run_queue == n);
 }
 
@@ -1130,6 +1145,11 @@ genBlocks (generation *gen)
         ret += countNonMovingHeap(&nonmovingHeap);
         if (current_mark_queue)
             ret += countBlocks(current_mark_queue->blocks);
+#if defined(THREADED_RTS)
+        for (uint32_t i = 1; i < n_mark_workers; i++) {
+            ret += countBlocks(mark_worker_queues[i]->blocks);
+        }
+#endif
     } else {
         ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
         ASSERT(countCompactBlocks(gen->compact_objects) == gen->n_compact_blocks);
@@ -1161,7 +1181,9 @@ static W_
 countNonMovingAllocator(struct NonmovingAllocator *alloc)
 {
     W_ ret = countNonMovingSegments(alloc->filled)
-           + countNonMovingSegments(alloc->active);
+           + countNonMovingSegments(alloc->active)
+           + countNonMovingSegments(alloc->saved_filled)
+           + countNonMovingSegments(alloc->sweep_list);
     for (uint32_t i = 0; i < n_capabilities; ++i) {
         ret += countNonMovingSegments(alloc->current[i]);
     }
@@ -1175,7 +1197,6 @@ countNonMovingHeap(struct NonmovingHeap *heap)
     for (int alloc_idx = 0; alloc_idx < NONMOVING_ALLOCA_CNT; alloc_idx++) {
         ret += countNonMovingAllocator(heap->allocators[alloc_idx]);
     }
-    ret += countNonMovingSegments(heap->sweep_list);
     ret += countNonMovingSegments(heap->free);
     return ret;
 }
@@ -1187,7 +1208,7 @@ memInventory (bool show)
   W_ gen_blocks[RtsFlags.GcFlags.generations];
   W_ nursery_blocks = 0, retainer_blocks = 0,
       arena_blocks = 0, exec_blocks = 0, gc_free_blocks = 0,
-      upd_rem_set_blocks = 0;
+      upd_rem_set_blocks = 0, cached_blocks = 0;
   W_ live_blocks = 0, free_blocks = 0;
   bool leak;
 
@@ -1212,6 +1233,9 @@ memInventory (bool show)
       gen_blocks[g] += genBlocks(&generations[g]);
   }
 
+  // the mark bitmap of a lazy sweep
+  gen_blocks[oldest_gen->no] += lazySweepBlocks();
+
   for (i = 0; i < n_nurseries; i++) {
       ASSERT(countBlocks(nurseries[i].blocks) == nurseries[i].n_blocks);
       nursery_blocks += nurseries[i].n_blocks;
@@ -1219,8 +1243,10 @@ memInventory (bool show)
   for (i = 0; i < n_capabilities; i++) {
       W_ n = countBlocks(gc_threads[i]->free_blocks);
       gc_free_blocks += n;
-      if (capabilities[i]->pinned_object_block != NULL) {
-          nursery_blocks += capabilities[i]->pinned_object_block->blocks;
+      // a recycled pinned block belongs to its generation already
+      bdescr *pinned_bd = capabilities[i]->pinned_object_block;
+      if (pinned_bd != NULL && pinnedBlockHeader(pinned_bd)->hole == NULL) {
+          nursery_blocks += pinned_bd->blocks;
       }
       nursery_blocks += countBlocks(capabilities[i]->pinned_object_blocks);
   }
@@ -1237,6 +1263,11 @@ memInventory (bool show)
   // count the blocks containing executable memory
   exec_blocks = countAllocdBlocks(exec_block);
 
+#if defined(THREADED_RTS)
+  // count the blocks in the capabilities' block caches
+  cached_blocks = blockCacheBlocks();
+#endif
+
   /* count the blocks on the free list */
   free_blocks = countFreeList();
 
@@ -1252,7 +1283,7 @@ memInventory (bool show)
   }
   live_blocks += nursery_blocks +
                + retainer_blocks + arena_blocks + exec_blocks + gc_free_blocks
-               + upd_rem_set_blocks;
+               + upd_rem_set_blocks + cached_blocks;
 
 #define MB(n) (((double)(n) * BLOCK_SIZE_W) / ((1024*1024)/sizeof(W_)))
 
@@ -1279,6 +1310,8 @@ memInventory (bool show)
                  exec_blocks, MB(exec_blocks));
       debugBelch("  GC free pool : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  gc_free_blocks, MB(gc_free_blocks));
+      debugBelch("  block caches : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 cached_blocks, MB(cached_blocks));
       debugBelch("  free         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  free_blocks, MB(free_blocks));
       debugBelch("  UpdRemSet    : %5" FMT_Word " blocks (%6.1lf MB)\n",
@@ -91,6 +91,8 @@ initGeneration (generation *gen, int g)
     gen->collections = 0;
     gen->par_collections = 0;
     gen->failed_promotions = 0;
+    gen->n_pinned_blocks = 0;
+    gen->n_pinned_free_words = 0;
     gen->max_blocks = 0;
     gen->blocks = NULL;
     gen->n_blocks = 0;
@@ -302,6 +304,9 @@ void
 exitStorage (void)
 {
     nonmovingExit();
+#if defined(THREADED_RTS)
+    stopMemoryReturner();
+#endif
     updateNurseriesStats();
     stat_exitReport();
 }
@@ -717,6 +722,28 @@ assignNurseriesToCapabilities (uint32_t from, uint32_t to)
     }
 }
 
+// With --prefault-nursery, touch every page of the new nurseries, so that
+// the mutator doesn't take a page fault for each one as it first allocates
+// into it.  A nursery bound to a NUMA node is still placed on that node,
+// because the memory was bound when we allocated it.
+static void
+prefaultNurseries (uint32_t from, uint32_t to)
+{
+    const W_ page_mask = ~((W_)getPageSize() - 1);
+    W_ last = 0;
+    uint32_t i;
+    bdescr *bd;
+
+    for (i = from; i < to; i++) {
+        for (bd = nurseries[i].blocks; bd != NULL; bd = bd->link) {
+            if (((W_)bd->start & page_mask) != last) {
+                *(volatile StgWord *)bd->start = 0;
+                last = (W_)bd->start & page_mask;
+            }
+        }
+    }
+}
+
 static void
 allocNurseries (uint32_t from, uint32_t to)
 {
@@ -733,6 +760,10 @@ allocNurseries (uint32_t from, uint32_t to)
         nurseries[i].blocks = allocNursery(capNoToNumaNode(i), NULL, n_blocks);
         nurseries[i].n_blocks = n_blocks;
     }
+
+    if (RtsFlags.GcFlags.prefaultNursery) {
+        prefaultNurseries(from, to);
+    }
 }
 
 void
@@ -771,53 +802,64 @@ countNurseryBlocks (void)
 }
 
 //
-// Resize each of the nurseries to the specified size.
+// Resize nursery i to the specified size.
 //
-static void
-resizeNurseriesEach (W_ blocks)
+void
+resizeNursery (uint32_t i, W_ blocks)
 {
-    uint32_t i, node;
+    uint32_t node;
     bdescr *bd;
     W_ nursery_blocks;
     nursery *nursery;
 
-    for (i = 0; i < n_nurseries; i++) {
-        nursery = &nurseries[i];
-        nursery_blocks = nursery->n_blocks;
-        if (nursery_blocks == blocks) continue;
+    nursery = &nurseries[i];
+    nursery_blocks = nursery->n_blocks;
+    if (nursery_blocks == blocks) return;
+
+    node = capNoToNumaNode(i);
+    if (nursery_blocks < blocks) {
+        debugTrace(DEBUG_gc, "increasing size of nursery to %d blocks",
+                   blocks);
+        nursery->blocks = allocNursery(node, nursery->blocks,
+                                       blocks-nursery_blocks);
+    }
+    else
+    {
+        bdescr *next_bd;
+
+        debugTrace(DEBUG_gc, "decreasing size of nursery to %d blocks",
+                   blocks);
 
-        node = capNoToNumaNode(i);
+        bd = nursery->blocks;
+        while (nursery_blocks > blocks) {
+            next_bd = bd->link;
+            next_bd->u.back = NULL;
+            nursery_blocks -= bd->blocks; // might be a large block
+            freeGroup(bd);
+            bd = next_bd;
+        }
+        nursery->blocks = bd;
+        // might have gone just under, by freeing a large block, so make
+        // up the difference.
         if (nursery_blocks < blocks) {
-            debugTrace(DEBUG_gc, "increasing size of nursery to %d blocks",
-                       blocks);
             nursery->blocks = allocNursery(node, nursery->blocks,
                                            blocks-nursery_blocks);
         }
-        else
-        {
-            bdescr *next_bd;
-
-            debugTrace(DEBUG_gc, "decreasing size of nursery to %d blocks",
-                       blocks);
-
-            bd = nursery->blocks;
-            while (nursery_blocks > blocks) {
-                next_bd = bd->link;
-                next_bd->u.back = NULL;
-                nursery_blocks -= bd->blocks; // might be a large block
-                freeGroup(bd);
-                bd = next_bd;
-            }
-            nursery->blocks = bd;
-            // might have gone just under, by freeing a large block, so make
-            // up the difference.
-            if (nursery_blocks < blocks) {
-                nursery->blocks = allocNursery(node, nursery->blocks,
-                                               blocks-nursery_blocks);
-            }
-        }
-        nursery->n_blocks = blocks;
-        ASSERT(countBlocks(nursery->blocks) == nursery->n_blocks);
+    }
+    nursery->n_blocks = blocks;
+    ASSERT(countBlocks(nursery->blocks) == nursery->n_blocks);
+}
+
+//
+// Resize each of the nurseries to the specified size.
+//
+static void
+resizeNurseriesEach (W_ blocks)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_nurseries; i++) {
+        resizeNursery(i, blocks);
     }
 }
 
@@ -1032,8 +1074,8 @@ allocateMightFail (Capability *cap, W_ n)
         // Only credit allocation after we've passed the size check above
         accountAllocation(cap, n);
 
-        ACQUIRE_SM_LOCK
-        bd = allocGroupOnNode(cap->node,req_blocks);
+        bd = allocGroupOnNode_lock(cap->node,req_blocks);
+        ACQUIRE_SM_LOCK;
         dbl_link_onto(bd, &g0->large_objects);
         g0->n_large_blocks += bd->blocks; // might be larger than req_blocks
         g0->n_new_large_words += n;
@@ -1061,10 +1103,8 @@ allocateMightFail (Capability *cap, W_ n)
         if (bd == NULL) {
             // The nursery is empty: allocate a fresh block (we can't
             // fail here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlockOnNode(cap->node);
+            bd = allocBlockOnNode_lock(cap->node);
             cap->r.rNursery->n_blocks++;
-            RELEASE_SM_LOCK;
             initBdescr(bd, g0, g0);
             bd->flags = 0;
             // If we had to allocate a new block, then we'll GC
@@ -1133,12 +1173,232 @@ allocateMightFail (Capability *cap, W_ n)
     do { (void)(p); (void)(val); (void)(len_w); } while(0)
 #endif
 
+/* -----------------------------------------------------------------------------
+   Note [Pinned block recycling]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   The GC retains a block of small pinned objects as a unit: if any object
+   in it is reachable, the whole block is kept (and promoted).  A program
+   that allocates lots of short-lived ByteStrings and holds on to a few of
+   them can therefore keep a whole block alive for each ByteString it
+   holds, many times its real residency.
+
+   We can't move pinned objects, but we can reuse the dead parts of their
+   blocks, in the style of Immix (Blackburn & McKinley, PLDI 2008).  Each
+   block of small pinned objects has BF_LINES set and starts with a
+   PinnedBlockHeader (see Storage.h), whose line map has a bit for each of
+   the PINNED_BLOCK_LINES lines of the block (8 words each on a 64-bit
+   machine).  Line 0 holds the header, so its bit is always set.  Large
+   pinned objects have a block group to themselves and no line map.
+
+    - When a generation is collected, prepare_collected_gen() clears the
+      line maps of its pinned blocks, and evacuate() sets the bits of the
+      lines covered by each live object it finds in one (markPinnedLines).
+
+    - At the end of GC, recyclePinnedBlock() hands each surviving block with
+      at least a quarter of its lines free to a Capability, on its
+      pinned_recycle_list.
+
+    - allocatePinned() takes blocks from that list before it takes a fresh
+      block, and bump-allocates into one run of free lines (a "hole") at a
+      time, between bd->free and hdr->limit.  When it leaves a hole,
+      retire_pinned_hole() marks the lines it used, so the line map always
+      covers every object in the block.
+
+   A recycled block stays on the large_objects list of its generation, so
+   the objects we allocate into it are born in that generation.  That is
+   safe for the same reason that pinning is: byte arrays contain no
+   pointers, so they can't point to younger objects.  It does mean that
+   they can't be reclaimed until that generation is next collected.
+
+   At the start of each GC, retirePinnedHoles() finishes the current hole
+   of each Capability, and drops the recycled blocks of the generations we
+   are about to collect, since they may be freed.  The survivors are
+   recycled again at the end of the GC.  A fresh pinned_object_block is
+   left attached as before, but gets the lines allocated so far marked.
+
+   isAlive() treats an object in a BF_LINES block as dead unless all of its
+   lines are marked, since a dead object's lines may be reused.  (The line
+   map is conservative, so an object sharing a line with a live one may
+   still be considered alive, as any object in a live pinned block was
+   before.)
+
+   The nonmoving collector marks pinned blocks as a whole, so we don't
+   recycle them when it is in use.
+
+   The free space in pinned blocks is counted per generation
+   (n_pinned_free_words), and reported by +RTS -s and the
+   PINNED_FRAGMENTATION event; see stat_endGC().
+   -------------------------------------------------------------------------- */
+
+// Finish allocating into the current hole of a recycled pinned block: mark
+// the lines we used, and account for what we allocated there.
+static void
+retire_pinned_hole (Capability *cap, bdescr *bd)
+{
+    PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+
+    if (bd->free > hdr->hole) {
+        StgWord bits = pinnedLineBits(bd, hdr->hole, bd->free - hdr->hole);
+        hdr->lines |= bits;
+        cap->total_allocated += bd->free - hdr->hole;
+        __atomic_fetch_sub(&bd->gen->n_pinned_free_words,
+                           __builtin_popcountll(bits) * PINNED_LINE_SIZE_W,
+                           __ATOMIC_RELAXED);
+    }
+
+    // Between holes a recycled block is treated as full, so that it is
+    // counted properly in its generation's n_large_words.
+    bd->free = bd->start + BLOCK_SIZE_W;
+}
+
+// Find a hole in a recycled pinned block big enough for n words at the
+// given alignment, and make it the one we allocate into.
+static bool
+next_pinned_hole (bdescr *bd, W_ n, W_ alignment, W_ align_off)
+{
+    PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+    const StgWord lines = hdr->lines;
+    W_ i = 0;
+
+    while (i < PINNED_BLOCK_LINES) {
+        // skip the lines in use, then find the end of the free ones
+        StgWord free_lines = ~lines >> i;
+        if (free_lines == 0) {
+            break;
+        }
+        i += __builtin_ctzll(free_lines);
+        StgWord used_lines = lines >> i;
+        W_ j = used_lines == 0 ? PINNED_BLOCK_LINES
+                               : i + __builtin_ctzll(used_lines);
+
+        StgPtr start = bd->start + i * PINNED_LINE_SIZE_W;
+        StgPtr end   = bd->start + j * PINNED_LINE_SIZE_W;
+        if (start + ALIGN_WITH_OFF_W(start, alignment, align_off) + n <= end) {
+            hdr->hole  = start;
+            hdr->limit = end;
+            bd->free   = start;
+            return true;
+        }
+        i = j;
+    }
+    return false;
+}
+
+// Take a block with a suitable hole from cap->pinned_recycle_list.  We only
+// look at the first few, so that a list of nearly full blocks doesn't slow
+// down allocation.
+static bdescr *
+recycled_pinned_block (Capability *cap, W_ n, W_ alignment, W_ align_off)
+{
+    bdescr **prev = &cap->pinned_recycle_list;
+
+    for (int tries = 0; tries < 4 && *prev != NULL; tries++) {
+        bdescr *bd = *prev;
+        PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+        if (next_pinned_hole(bd, n, alignment, align_off)) {
+            *prev = hdr->recycle_link;
+            hdr->recycle_link = NULL;
+            return bd;
+        }
+        prev = &hdr->recycle_link;
+    }
+    return NULL;
+}
+
+/* -----------------------------------------------------------------------------
+   retirePinnedHoles
+
+   Called at the start of GC, before collect_pinned_object_blocks(), with
+   the oldest generation to be collected.  See Note [Pinned block
+   recycling].
+   -------------------------------------------------------------------------- */
+
+void
+retirePinnedHoles (uint32_t N)
+{
+    for (uint32_t i = 0; i < n_capabilities; i++) {
+        Capability *cap = capabilities[i];
+        bdescr *bd = cap->pinned_object_block;
+
+        if (bd != NULL) {
+            PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+            if (hdr->hole == NULL) {
+                // A fresh block stays attached across the GC; mark what
+                // we've allocated so far, for isAlive().
+                hdr->lines |= pinnedLineBits(bd, bd->start,
+                                             bd->free - bd->start);
+            } else {
+                retire_pinned_hole(cap, bd);
+                cap->pinned_object_block = NULL;
+                if (bd->gen_no > N) {
+                    hdr->recycle_link = cap->pinned_recycle_list;
+                    cap->pinned_recycle_list = bd;
+                }
+            }
+        }
+
+        // Forget the blocks of the generations we're collecting
+        bdescr **prev = &cap->pinned_recycle_list;
+        while (*prev != NULL) {
+            PinnedBlockHeader *hdr = pinnedBlockHeader(*prev);
+            if ((*prev)->gen_no <= N) {
+                *prev = hdr->recycle_link;
+            } else {
+                prev = &hdr->recycle_link;
+            }
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   recyclePinnedBlock
+
+   Called at the end of GC for each BF_LINES block that survived, i.e. is on
+   gen->scavenged_large_objects, before it is counted in gen->n_large_words.
+   Accounts for its free lines, and if there are enough of them, hands the
+   block to a Capability for allocatePinned() to reuse.
+   -------------------------------------------------------------------------- */
+
+void
+recyclePinnedBlock (generation *gen, bdescr *bd)
+{
+    static uint32_t next_cap = 0;
+    PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+    W_ free_lines = PINNED_BLOCK_LINES - __builtin_popcountll(hdr->lines);
+
+    gen->n_pinned_blocks++;
+    gen->n_pinned_free_words += free_lines * PINNED_LINE_SIZE_W;
+
+    if (free_lines < PINNED_BLOCK_LINES / 4 || RtsFlags.GcFlags.useNonmoving) {
+        return;
+    }
+
+#if defined(DEBUG)
+    if (RtsFlags.DebugFlags.zero_on_gc) {
+        for (W_ i = 0; i < PINNED_BLOCK_LINES; i++) {
+            if (!(hdr->lines & ((StgWord)1 << i))) {
+                memset(bd->start + i * PINNED_LINE_SIZE_W, 0xaa,
+                       PINNED_LINE_SIZE_W * sizeof(W_));
+            }
+        }
+    }
+#endif
+
+    bd->free = bd->start + BLOCK_SIZE_W;
+
+    Capability *cap = capabilities[next_cap++ % enabled_capabilities];
+    hdr->recycle_link = cap->pinned_recycle_list;
+    cap->pinned_recycle_list = bd;
+}
+
 /* ---------------------------------------------------------------------------
    Allocate a fixed/pinned object.
 
    We allocate small pinned objects into a single block, allocating a
-   new block when the current one overflows.  The block is chained
-   onto the large_object_list of generation 0.
+   new block when the current one overflows, or into the holes of
+   blocks that the GC found partly free (see Note [Pinned block
+   recycling]).  A new block is chained onto the large_object_list of
+   generation 0.
 
    NOTE: The GC can't in general handle pinned objects.  This
    interface is only safe to use for ByteArrays, which have no
@@ -1199,59 +1459,90 @@ allocatePinned (Capability *cap, W_ n /*words*/, W_ alignment /*bytes*/, W_ alig
         off_w = ALIGN_WITH_OFF_W(bd->free, alignment, align_off);
 
     // If we don't have a block of pinned objects yet, or the current
-    // one isn't large enough to hold the new object, get a new one.
-    if (bd == NULL || (bd->free + off_w + n) > (bd->start + BLOCK_SIZE_W)) {
+    // one (or the current hole in it) isn't large enough to hold the
+    // new object, get a new one.
+    if (bd == NULL || (bd->free + off_w + n) > pinnedBlockHeader(bd)->limit) {
 
-        // stash the old block on cap->pinned_object_blocks.  On the
-        // next GC cycle these objects will be moved to
-        // g0->large_objects.
         if (bd != NULL) {
-            // add it to the allocation stats when the block is full
-            finishedNurseryBlock(cap, bd);
-            dbl_link_onto(bd, &cap->pinned_object_blocks);
+            if (pinnedBlockHeader(bd)->hole == NULL) {
+                // stash the old block on cap->pinned_object_blocks.  On the
+                // next GC cycle these objects will be moved to
+                // g0->large_objects.
+                //
+                // add it to the allocation stats when the block is full
+                finishedNurseryBlock(cap, bd);
+                dbl_link_onto(bd, &cap->pinned_object_blocks);
+                bd = NULL;
+            } else {
+                // A recycled block: move on to another of its holes.
+                // It already belongs to a generation, so it just stays
+                // there.
+                retire_pinned_hole(cap, bd);
+                if (!next_pinned_hole(bd, n, alignment, align_off)) {
+                    if (~pinnedBlockHeader(bd)->lines != 0) {
+                        // holes left, but too small for this object
+                        pinnedBlockHeader(bd)->recycle_link =
+                            cap->pinned_recycle_list;
+                        cap->pinned_recycle_list = bd;
+                    }
+                    bd = NULL;
+                }
+            }
         }
 
-        // We need to find another block.  We could just allocate one,
-        // but that means taking a global lock and we really want to
-        // avoid that (benchmarks that allocate a lot of pinned
-        // objects scale really badly if we do this).
-        //
-        // So first, we try taking the next block from the nursery, in
-        // the same way as allocate().
-        bd = cap->r.rCurrentNursery->link;
+        // Next, try the partly free blocks the GC gave us.
         if (bd == NULL) {
-            // The nursery is empty: allocate a fresh block (we can't fail
-            // here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlockOnNode(cap->node);
-            RELEASE_SM_LOCK;
-            initBdescr(bd, g0, g0);
-        } else {
-            newNurseryBlock(bd);
-            // we have a block in the nursery: steal it
-            cap->r.rCurrentNursery->link = bd->link;
-            if (bd->link != NULL) {
-                bd->link->u.back = cap->r.rCurrentNursery;
+            bd = recycled_pinned_block(cap, n, alignment, align_off);
+        }
+
+        if (bd == NULL) {
+            // We need to find another block.  We could just allocate one,
+            // but that means taking a global lock and we really want to
+            // avoid that (benchmarks that allocate a lot of pinned
+            // objects scale really badly if we do this).
+            //
+            // So first, we try taking the next block from the nursery, in
+            // the same way as allocate().
+            bd = cap->r.rCurrentNursery->link;
+            if (bd == NULL) {
+                // The nursery is empty: allocate a fresh block (we can't fail
+                // here).
+                bd = allocBlockOnNode_lock(cap->node);
+                initBdescr(bd, g0, g0);
+            } else {
+                newNurseryBlock(bd);
+                // we have a block in the nursery: steal it
+                cap->r.rCurrentNursery->link = bd->link;
+                if (bd->link != NULL) {
+                    bd->link->u.back = cap->r.rCurrentNursery;
+                }
+                cap->r.rNursery->n_blocks -= bd->blocks;
             }
-            cap->r.rNursery->n_blocks -= bd->blocks;
+
+            bd->flags  = BF_PINNED | BF_LARGE | BF_EVACUATED | BF_LINES;
+
+            // The pinned_object_block remains attached to the capability
+            // until it is full, even if a GC occurs.  We want this
+            // behaviour because otherwise the unallocated portion of the
+            // block would be forever slop, and under certain workloads
+            // (allocating a few ByteStrings per GC) we accumulate a lot
+            // of slop.
+            //
+            // So, the pinned_object_block is initially marked
+            // BF_EVACUATED so the GC won't touch it.  When it is full,
+            // we place it on the large_objects list, and at the start of
+            // the next GC the BF_EVACUATED flag will be cleared, and the
+            // block will be promoted as usual (if anything in it is
+            // live).
+            PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+            hdr->lines = 1;
+            hdr->limit = bd->start + BLOCK_SIZE_W;
+            hdr->hole = NULL;
+            hdr->recycle_link = NULL;
+            bd->free = bd->start + PINNED_HEADER_W;
         }
 
         cap->pinned_object_block = bd;
-        bd->flags  = BF_PINNED | BF_LARGE | BF_EVACUATED;
-
-        // The pinned_object_block remains attached to the capability
-        // until it is full, even if a GC occurs.  We want this
-        // behaviour because otherwise the unallocated portion of the
-        // block would be forever slop, and under certain workloads
-        // (allocating a few ByteStrings per GC) we accumulate a lot
-        // of slop.
-        //
-        // So, the pinned_object_block is initially marked
-        // BF_EVACUATED so the GC won't touch it.  When it is full,
-        // we place it on the large_objects list, and at the start of
-        // the next GC the BF_EVACUATED flag will be cleared, and the
-        // block will be promoted as usual (if anything in it is
-        // live).
 
         off_w = ALIGN_WITH_OFF_W(bd->free, alignment, align_off);
     }
@@ -61,6 +61,7 @@ extern uint32_t n_nurseries;
 void     resetNurseries       (void);
 void     clearNursery         (Capability *cap);
 void     resizeNurseries      (StgWord blocks);
+void     resizeNursery        (uint32_t i, StgWord blocks);
 void     resizeNurseriesFixed (void);
 StgWord  countNurseryBlocks   (void);
 bool     getNewNursery        (Capability *cap);
@@ -100,6 +101,59 @@ INLINE_HEADER void newNurseryBlock (bdescr *bd) {
 void     updateNurseriesStats (void);
 uint64_t calcTotalAllocated   (void);
 
+/* -----------------------------------------------------------------------------
+   Line maps of small pinned blocks
+
+   See Note [Pinned block recycling] in Storage.c
+   -------------------------------------------------------------------------- */
+
+// One bit of the line map per line, so a line is 8 words on a 64-bit machine
+#define PINNED_BLOCK_LINES  (sizeof(StgWord) * 8)
+#define PINNED_LINE_SIZE_W  (BLOCK_SIZE_W / PINNED_BLOCK_LINES)
+
+typedef struct {
+    StgWord lines;          // bit i set: line i is in use
+    StgPtr  limit;          // end of the hole we are allocating into
+    StgPtr  hole;           // start of that hole, or NULL if block is fresh
+    bdescr *recycle_link;   // next block on cap->pinned_recycle_list
+} PinnedBlockHeader;
+
+#define PINNED_HEADER_W  sizeofW(PinnedBlockHeader)
+
+INLINE_HEADER PinnedBlockHeader *pinnedBlockHeader (bdescr *bd)
+{
+    return (PinnedBlockHeader *)bd->start;
+}
+
+// The bits of the line map covering the n words at p
+INLINE_HEADER StgWord pinnedLineBits (bdescr *bd, StgPtr p, W_ n)
+{
+    W_ first = (p - bd->start) / PINNED_LINE_SIZE_W;
+    W_ last  = (p + n - 1 - bd->start) / PINNED_LINE_SIZE_W;
+    // wraps to the right answer when last is the top bit
+    return ((StgWord)2 << last) - ((StgWord)1 << first);
+}
+
+// Called by the GC, possibly by several threads at once, for each live
+// object in a block with BF_LINES.
+INLINE_HEADER void markPinnedLines (bdescr *bd, StgPtr p, W_ n)
+{
+    PinnedBlockHeader *hdr = pinnedBlockHeader(bd);
+    StgWord bits = pinnedLineBits(bd, p, n);
+    if ((RELAXED_LOAD(&hdr->lines) & bits) != bits) {
+        __atomic_fetch_or(&hdr->lines, bits, __ATOMIC_RELAXED);
+    }
+}
+
+INLINE_HEADER bool pinnedLinesMarked (bdescr *bd, StgPtr p, W_ n)
+{
+    StgWord bits = pinnedLineBits(bd, p, n);
+    return (RELAXED_LOAD(&pinnedBlockHeader(bd)->lines) & bits) == bits;
+}
+
+void retirePinnedHoles  (uint32_t N);
+void recyclePinnedBlock (generation *gen, bdescr *bd);
+
 /* -----------------------------------------------------------------------------
    Stats 'n' DEBUG stuff
    -------------------------------------------------------------------------- */
@@ -15,62 +15,256 @@
 #include "Rts.h"
 
 #include "BlockAlloc.h"
+#include "RtsUtils.h"
+#include "Storage.h"
 #include "Sweep.h"
 #include "Trace.h"
 
-void
-sweep(generation *gen)
+/* -----------------------------------------------------------------------------
+   Note [Parallel sweep]
+   ~~~~~~~~~~~~~~~~~~~~~
+
+   Sweeping the oldest generation means looking at the mark bitmap of each
+   of its blocks, to free the blocks with nothing live in them and to flag
+   the sparsely populated ones (BF_FRAGMENTED), so that the next GC copies
+   their contents rather than marking them again.
+
+   The blocks are independent of each other, so when the other GC threads
+   are free to help (see gcWorkerThread) we split the old_blocks list into
+   chunks (SweepChunk), which the threads take in turn. Each chunk builds
+   its own list of the blocks that survive and of the blocks to free. The
+   leader then joins the survivors up again, in their original order, and
+   frees the rest, so the result is the same as sweeping on one thread.
+
+   Note [Lazy sweeping]
+   ~~~~~~~~~~~~~~~~~~~~
+
+   With +RTS -wl the GC doesn't sweep at all. The marked blocks go onto
+   gen->blocks unswept, with BF_SWEPT set so that the sanity checker
+   doesn't look at the dead objects in them, and we keep the mark bitmap
+   until they have all been swept (startLazySweep). They are swept
+   afterwards, a few at a time, by
+
+     - the block allocator, when it has run out of free blocks and would
+       otherwise take more memory from the OS (allocGroupOnNode);
+     - idle capabilities (doIdleGCWork);
+     - the next major GC, which finishes whatever is left before it starts
+       (pauseLazySweep).
+
+   so the pause no longer includes scanning the bitmaps and freeing the
+   empty blocks.
+
+   Between GCs the only thing that changes gen->blocks is a minor GC
+   pushing promoted blocks onto the front of it, so we remember where we
+   are by the block before the next one to sweep (lazy_prev). If that is
+   NULL the next block was at the front of the list, and we may have to
+   look for it again. Lazy sweeping happens with sm_mutex held, and never
+   during a GC.
+
+   Until the sweep is finished gen->live_estimate is zero, so the heap
+   sizing uses the amount of data in the blocks rather than the amount
+   that was marked.
+   -------------------------------------------------------------------------- */
+
+// The smallest chunk worth sharing out, and the chunks per GC thread
+#define SWEEP_CHUNK_MIN_BLOCKS 256
+#define SWEEP_CHUNKS_PER_THREAD 4
+
+typedef struct {
+    bdescr *first;      // the first block of the chunk
+    W_ n;               // and the number of blocks in it
+    bdescr *kept;       // the blocks that survived, in order,
+    bdescr *kept_last;  // and the last of them
+    bdescr *freed;      // the blocks to be freed
+    W_ n_freed;
+    W_ n_swept;         // the number of marked blocks we looked at
+    W_ n_fragd;         // how many of them were fragmented
+    W_ live;            // estimate of the live words in the chunk
+} SweepChunk;
+
+static SweepChunk *sweep_chunks;
+static StgWord sweep_n_chunks;
+
+// The next chunk for a thread to take
+static volatile StgWord sweep_next;
+
+#if defined(THREADED_RTS)
+// Have the helpers been told to start, and how many have finished?
+static volatile StgWord sweep_started;
+static volatile StgWord sweep_helpers_done;
+#endif
+
+// The state of a lazy sweep. See Note [Lazy sweeping].
+static bdescr *lazy_prev;       // the block before the next one, or NULL
+static bdescr *lazy_next;       // the next block to sweep
+static W_ lazy_left;            // the number of blocks left to sweep
+static bdescr *lazy_bitmap;     // the mark bitmap of the blocks
+static W_ lazy_live;
+static W_ lazy_freed;
+static W_ lazy_fragd;
+static bool lazy_paused;
+
+// Count the live data in a block, and flag it as swept. Returns true if
+// there is nothing live in it.
+static bool
+sweep_block (bdescr *bd, W_ *live, W_ *fragd)
 {
-    bdescr *bd, *prev, *next;
-    uint32_t i;
-    W_ freed, resid, fragd, blocks, live;
-    
-    ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
+    W_ resid = 0;
+    for (uint32_t i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
+    {
+        if (bd->u.bitmap[i] != 0) resid++;
+    }
+    *live += resid * BITS_IN(W_);
 
-    live = 0; // estimate of live data in this gen
-    freed = 0;
-    fragd = 0;
-    blocks = 0;
-    prev = NULL;
-    for (bd = gen->old_blocks; bd != NULL; bd = next)
+    if (resid == 0) {
+        return true;
+    }
+
+    if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
+        (*fragd)++;
+        bd->flags |= BF_FRAGMENTED;
+    }
+
+    bd->flags |= BF_SWEPT;
+    return false;
+}
+
+static void
+sweep_chunk (SweepChunk *c)
+{
+    bdescr *bd, *next;
+    bdescr **link = &c->kept;
+
+    c->kept_last = NULL;
+    c->freed = NULL;
+    c->n_freed = 0;
+    c->n_swept = 0;
+    c->n_fragd = 0;
+    c->live = 0;
+
+    bd = c->first;
+    for (W_ n = c->n; n > 0; n--, bd = next)
     {
         next = bd->link;
 
-        if (!(bd->flags & BF_MARKED)) { 
-            prev = bd;
-            continue;
+        if ((bd->flags & BF_MARKED) &&
+            (c->n_swept++, sweep_block(bd, &c->live, &c->n_fragd))) {
+            bd->link = c->freed;
+            c->freed = bd;
+            c->n_freed++;
+        } else {
+            *link = bd;
+            link = &bd->link;
+            c->kept_last = bd;
         }
+    }
+    *link = NULL;
+}
 
-        blocks++;
-        resid = 0;
-        for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
-        {
-            if (bd->u.bitmap[i] != 0) resid++;
+// Take chunks until there are none left
+static void
+sweep_chunks_loop (void)
+{
+    StgWord i;
+    while ((i = atomic_inc(&sweep_next, 1) - 1) < sweep_n_chunks) {
+        sweep_chunk(&sweep_chunks[i]);
+    }
+}
+
+#if defined(THREADED_RTS)
+// Called by each GC thread other than the leader when it has finished
+// marking, to help sweep the oldest generation. See Note [Parallel sweep].
+void
+sweepWorker (void)
+{
+    while (!ACQUIRE_LOAD(&sweep_started)) {
+        busy_wait_nop();
+    }
+    sweep_chunks_loop();
+    atomic_inc(&sweep_helpers_done, 1);
+}
+#endif
+
+// Split the blocks into chunks for n_threads threads to sweep
+static void
+init_sweep_chunks (generation *gen, uint32_t n_threads)
+{
+    W_ chunk_size = stg_max(SWEEP_CHUNK_MIN_BLOCKS,
+                            gen->n_old_blocks /
+                            (n_threads * SWEEP_CHUNKS_PER_THREAD));
+    if (n_threads == 1) {
+        chunk_size = stg_max(gen->n_old_blocks, 1);
+    }
+
+    sweep_chunks = stgMallocBytes((gen->n_old_blocks / chunk_size + 1) *
+                                  sizeof(SweepChunk), "init_sweep_chunks");
+    sweep_n_chunks = 0;
+
+    for (bdescr *bd = gen->old_blocks; bd != NULL; ) {
+        SweepChunk *c = &sweep_chunks[sweep_n_chunks++];
+        c->first = bd;
+        for (c->n = 0; c->n < chunk_size && bd != NULL; c->n++) {
+            bd = bd->link;
         }
-        live += resid * BITS_IN(W_);
+    }
+    sweep_next = 0;
+}
 
-        if (resid == 0)
-        {
-            freed++;
-            gen->n_old_blocks--;
-            if (prev == NULL) {
-                gen->old_blocks = next;
-            } else {
-                prev->link = next;
+void
+sweep(generation *gen, uint32_t n_helpers USED_IF_THREADS)
+{
+    W_ freed, fragd, blocks, live;
+    
+    ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
+
+    if (RtsFlags.GcFlags.lazySweep) {
+        // Leave it for later, see Note [Lazy sweeping]. The blocks that
+        // weren't marked are freed by the GC.
+        for (bdescr *bd = gen->old_blocks; bd != NULL; bd = bd->link) {
+            if (bd->flags & BF_MARKED) {
+                bd->flags |= BF_SWEPT;
             }
-            freeGroup(bd);
         }
-        else
-        {
-            prev = bd;
-            if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
-                fragd++;
-                bd->flags |= BF_FRAGMENTED;
-            }
+        return;
+    }
+
+#if defined(THREADED_RTS)
+    init_sweep_chunks(gen, n_helpers + 1);
+    sweep_helpers_done = 0;
+    RELEASE_STORE(&sweep_started, true);
+    sweep_chunks_loop();
+    while (ACQUIRE_LOAD(&sweep_helpers_done) != n_helpers) {
+        busy_wait_nop();
+    }
+    RELAXED_STORE(&sweep_started, false);
+#else
+    init_sweep_chunks(gen, 1);
+    sweep_chunks_loop();
+#endif
 
-            bd->flags |= BF_SWEPT;
+    // join up the survivors, and free the rest
+    bdescr **link = &gen->old_blocks;
+    live = 0; // estimate of live data in this gen
+    freed = 0;
+    fragd = 0;
+    blocks = 0;
+    for (StgWord i = 0; i < sweep_n_chunks; i++) {
+        SweepChunk *c = &sweep_chunks[i];
+        if (c->kept != NULL) {
+            *link = c->kept;
+            link = &c->kept_last->link;
+        }
+        if (c->freed != NULL) {
+            freeChain(c->freed);
         }
+        live += c->live;
+        freed += c->n_freed;
+        fragd += c->n_fragd;
+        blocks += c->n_swept;
     }
+    *link = NULL;
+    gen->n_old_blocks -= freed;
+    stgFree(sweep_chunks);
 
     gen->live_estimate = live;
 
@@ -84,3 +278,109 @@ sweep(generation *gen)
 
     ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
 }
+
+/* -----------------------------------------------------------------------------
+   Lazy sweeping
+   -------------------------------------------------------------------------- */
+
+// Called by the GC once it has put the marked blocks of gen, which it
+// didn't sweep, on the front of gen->blocks.
+void
+startLazySweep (generation *gen)
+{
+    ASSERT(lazy_left == 0 && lazy_bitmap == NULL);
+    ASSERT(gen->blocks == gen->old_blocks);
+
+    lazy_prev = NULL;
+    lazy_next = gen->old_blocks;
+    RELAXED_STORE(&lazy_left, gen->n_old_blocks);
+    lazy_bitmap = gen->bitmap;
+    gen->bitmap = NULL;
+    lazy_live = 0;
+    lazy_freed = 0;
+    lazy_fragd = 0;
+}
+
+bool
+lazySweepPending (void)
+{
+    // may be called without sm_mutex, as a hint
+    return !RELAXED_LOAD(&lazy_paused) && RELAXED_LOAD(&lazy_left) > 0;
+}
+
+// Sweep up to max of the blocks left by startLazySweep. The caller must
+// hold sm_mutex. Returns the number of blocks freed.
+W_
+lazySweep (W_ max)
+{
+    generation *gen = oldest_gen;
+    W_ freed = 0;
+    W_ left = lazy_left;
+
+    if (lazy_paused || left == 0) {
+        return 0;
+    }
+
+    if (lazy_prev == NULL && gen->blocks != lazy_next) {
+        // a minor GC has promoted blocks onto the front of the list
+        for (lazy_prev = gen->blocks; lazy_prev->link != lazy_next; ) {
+            lazy_prev = lazy_prev->link;
+        }
+    }
+
+    for (; max > 0 && left > 0; max--, left--) {
+        bdescr *bd = lazy_next;
+        lazy_next = bd->link;
+
+        if (sweep_block(bd, &lazy_live, &lazy_fragd)) {
+            if (lazy_prev == NULL) {
+                gen->blocks = lazy_next;
+            } else {
+                lazy_prev->link = lazy_next;
+            }
+            gen->n_blocks -= bd->blocks;
+            gen->n_words -= bd->free - bd->start;
+            freeGroup(bd);
+            freed++;
+        } else {
+            lazy_prev = bd;
+        }
+    }
+    lazy_freed += freed;
+    RELAXED_STORE(&lazy_left, left);
+
+    if (left == 0) {
+        gen->live_estimate = lazy_live;
+        freeGroup(lazy_bitmap);
+        lazy_bitmap = NULL;
+        debugTrace(DEBUG_gc, "lazy sweep done: %ld blocks freed, %ld are fragmented",
+                   (long)lazy_freed, (long)lazy_fragd);
+    }
+
+    return freed;
+}
+
+// Stop lazy sweeping while we GC, first finishing it off if the GC is
+// going to collect the generation being swept. The caller must hold
+// sm_mutex.
+void
+pauseLazySweep (bool finish)
+{
+    if (finish) {
+        lazySweep(lazy_left);
+    }
+    RELAXED_STORE(&lazy_paused, true);
+}
+
+void
+resumeLazySweep (void)
+{
+    RELAXED_STORE(&lazy_paused, false);
+}
+
+// The blocks held by the lazy sweeper, for memInventory()
+W_
+lazySweepBlocks (void)
+{
+    return lazy_bitmap == NULL ? 0 : lazy_bitmap->blocks;
+}
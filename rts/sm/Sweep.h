@@ -13,4 +13,20 @@
 
 #pragma once
 
-RTS_PRIVATE void sweep(generation *gen);
+RTS_PRIVATE void sweep(generation *gen, uint32_t n_helpers);
+
+#if defined(THREADED_RTS)
+RTS_PRIVATE void sweepWorker(void);
+#endif
+
+// Lazy sweeping, see Note [Lazy sweeping] in Sweep.c
+
+// The number of blocks to sweep at a time
+#define LAZY_SWEEP_BLOCKS 64
+
+RTS_PRIVATE void startLazySweep(generation *gen);
+RTS_PRIVATE bool lazySweepPending(void);
+RTS_PRIVATE W_   lazySweep(W_ max);
+RTS_PRIVATE void pauseLazySweep(bool finish);
+RTS_PRIVATE void resumeLazySweep(void);
+RTS_PRIVATE W_   lazySweepBlocks(void);
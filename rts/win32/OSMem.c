@@ -42,6 +42,12 @@ osMemInit(void)
 {
     allocs = NULL;
     free_blocks = NULL;
+
+    if (RtsFlags.GcFlags.hugePages) {
+        // Large pages need the SeLockMemoryPrivilege, and can't be
+        // committed piecemeal like the rest of the heap
+        errorBelch("warning: --huge-pages is not supported on Windows");
+    }
 }
 
 static
@@ -494,6 +500,16 @@ void osReleaseHeapMemory (void)
 
 #endif
 
+W_ osHugePageSize(void)
+{
+    return 0;
+}
+
+StgWord64 osHugePageBytes(W_ start STG_UNUSED, W_ end STG_UNUSED)
+{
+    return 0;
+}
+
 bool osBuiltWithNumaSupport(void)
 {
     return true;
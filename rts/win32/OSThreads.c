@@ -559,6 +559,12 @@ waitCondition ( Condition* pCond, Mutex* pMut )
   return true;
 }
 
+bool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+  return SleepConditionVariableSRW(pCond, pMut, TimeToMS(timeout), 0);
+}
+
 void
 initMutex (Mutex* pMut)
 {
@@ -0,0 +1,10 @@
+-- Run a few hundred collections, for the EventlogOutput tests that count
+-- GC events.
+
+import Control.Monad
+import System.Mem
+
+main :: IO ()
+main = forM_ [1 .. 200 :: Int] $ \i -> do
+  let xs = [1 .. i * 100]
+  sum xs `seq` performMinorGC
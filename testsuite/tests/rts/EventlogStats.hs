@@ -0,0 +1,192 @@
+{-# LANGUAGE BangPatterns #-}
+-- Check that an eventlog is complete and well formed, and count its
+-- events, for the EventlogOutput tests.  Eventlogs written with
+-- +RTS --eventlog-compress (an LZ4 frame) are decompressed first.
+--
+-- Prints the number of events with each tag, one "<tag> <count>" line
+-- each, then "gc <count>" for the events in the GC class, and finally
+-- "gc-balanced" if every capability posted as many GC_END as GC_START
+-- events, or "gc-unbalanced" if not.  Exits with an error if the eventlog
+-- is truncated or malformed.
+
+module Main (main) where
+
+import Control.Monad
+import Data.Bits
+import qualified Data.ByteString as B
+import qualified Data.ByteString.Unsafe as B
+import qualified Data.Map.Strict as M
+import Data.Word
+import Foreign.Marshal.Alloc
+import Foreign.Ptr
+import Foreign.Storable
+import System.Environment
+import System.Exit
+import System.IO
+
+be :: B.ByteString -> Int -> Int -> Word64
+be bs off n = foldl (\acc i -> acc `shiftL` 8 .|. fromIntegral (B.index bs (off + i)))
+                    0 [0 .. n - 1]
+
+le :: B.ByteString -> Int -> Int -> Word64
+le bs off n = foldr (\i acc -> acc `shiftL` 8 .|. fromIntegral (B.index bs (off + i)))
+                    0 [0 .. n - 1]
+
+bad :: String -> IO a
+bad msg = hPutStrLn stderr ("bad eventlog: " ++ msg) >> exitFailure
+
+-- LZ4 frames
+
+lz4Magic :: Word64
+lz4Magic = 0x184D2204
+
+decompress :: B.ByteString -> IO B.ByteString
+decompress bs = do
+  let flg = B.index bs 4
+      headerLen = 7 + (if testBit flg 3 then 8 else 0)
+      blockSums = testBit flg 4
+  when (flg `shiftR` 6 /= 1) $ bad "unknown LZ4 frame version"
+  B.concat <$> blocks headerLen blockSums
+  where
+    blocks off sums = do
+      when (off + 4 > B.length bs) $ bad "LZ4 frame is truncated"
+      let size = le bs off 4
+          len = fromIntegral (size .&. 0x7fffffff)
+          next = off + 4 + len + (if sums then 4 else 0)
+      if size == 0
+        then return []
+        else do
+          when (off + 4 + len > B.length bs) $ bad "LZ4 block is truncated"
+          let body = B.take len (B.drop (off + 4) bs)
+          blk <- if testBit size 31 then return body else decodeBlock body
+          (blk :) <$> blocks next sums
+
+-- Blocks are at most 4MB
+decodeBlock :: B.ByteString -> IO B.ByteString
+decodeBlock src = do
+  let cap = 4 * 1024 * 1024
+  dst <- mallocBytes cap :: IO (Ptr Word8)
+  n <- go dst cap 0 0
+  r <- B.packCStringLen (castPtr dst, n)
+  free dst
+  return r
+  where
+    srcLen = B.length src
+    byte i | i < srcLen = return (B.unsafeIndex src i)
+           | otherwise = bad "LZ4 sequence is truncated"
+    -- a length of 15 goes on in the following bytes, up to one below 255
+    extend :: Int -> Int -> IO (Int, Int)
+    extend l i
+      | l /= 15 = return (l, i)
+      | otherwise = more l i
+    more !l !i = do
+      b <- fromIntegral <$> byte i
+      if b == 255 then more (l + b) (i + 1) else return (l + b, i + 1)
+    go dst cap !i !o = do
+      tok <- byte i
+      (lits, i1) <- extend (fromIntegral (tok `shiftR` 4)) (i + 1)
+      when (o + lits > cap || i1 + lits > srcLen) $ bad "LZ4 literals overrun"
+      forM_ [0 .. lits - 1] $ \k -> pokeByteOff dst (o + k) (B.unsafeIndex src (i1 + k))
+      let i2 = i1 + lits
+          o2 = o + lits
+      if i2 == srcLen
+        then return o2
+        else do
+          lo <- byte i2
+          hi <- byte (i2 + 1)
+          let off = fromIntegral lo .|. fromIntegral hi `shiftL` 8
+          (ml, i3) <- extend (fromIntegral (tok .&. 15)) (i2 + 2)
+          let len = ml + 4
+          when (off == 0 || off > o2 || o2 + len > cap) $ bad "LZ4 match overrun"
+          forM_ [0 .. len - 1] $ \k ->
+            (peekByteOff dst (o2 - off + k) :: IO Word8) >>= pokeByteOff dst (o2 + k)
+          go dst cap i3 (o2 + len)
+
+-- The eventlog itself
+
+hdrb, hetb, etb, ete, hete, hdre, datb :: Word64
+hdrb = 0x68647262
+hetb = 0x68657462
+etb  = 0x65746200
+ete  = 0x65746500
+hete = 0x68657465
+hdre = 0x68647265
+datb = 0x64617462
+
+gcStart, gcEnd, blockMarker :: Int
+gcStart = 9
+gcEnd = 10
+blockMarker = 18
+
+-- The events that +RTS --eventlog-sample=g<n> samples
+gcTags :: [Int]
+gcTags = [9, 10, 11, 12, 20, 21, 22, 49, 50, 51, 53, 54, 214, 215, 216]
+
+parse :: B.ByteString -> IO (M.Map Int Int, M.Map (Int, Int) Int)
+parse bs = do
+  need 0 8
+  when (be bs 0 4 /= hdrb || be bs 4 4 /= hetb) $ bad "no header"
+  (sizes, off) <- eventTypes M.empty 8
+  need off 8
+  when (be bs off 4 /= hdre || be bs (off + 4) 4 /= datb) $ bad "no data"
+  events sizes (off + 8) 0xffff M.empty M.empty
+  where
+    need off n = when (off + n > B.length bs) $ bad "truncated"
+
+    eventTypes sizes off = do
+      need off 4
+      let marker = be bs off 4
+      if marker == hete
+        then return (sizes, off + 4)
+        else do
+          when (marker /= etb) $ bad "bad event type"
+          need off 12
+          let tag = fromIntegral (be bs (off + 4) 2)
+              size = fromIntegral (be bs (off + 6) 2)
+              dlen = fromIntegral (be bs (off + 8) 4)
+              eoff = off + 12 + dlen
+          need eoff 4
+          let elen = fromIntegral (be bs eoff 4)
+              end = eoff + 4 + elen
+          need end 4
+          when (be bs end 4 /= ete) $ bad "bad event type end"
+          eventTypes (M.insert tag size sizes) (end + 4)
+
+    events sizes !off !capNo !counts !perCap = do
+      need off 2
+      let tag = fromIntegral (be bs off 2)
+      if tag == 0xffff
+        then return (counts, perCap)
+        else do
+          size <- maybe (bad ("unknown event " ++ show tag)) return
+                        (M.lookup tag sizes)
+          need off 10
+          (payload, len) <-
+            if size == 0xffff
+              then need (off + 10) 2 >>
+                   return (off + 12, fromIntegral (be bs (off + 10) 2))
+              else return (off + 10, size)
+          need payload len
+          let capNo' | tag == blockMarker = fromIntegral (be bs (payload + 12) 2)
+                     | otherwise = capNo
+              perCap' | tag == gcStart || tag == gcEnd =
+                          M.insertWith (+) (capNo', tag) 1 perCap
+                      | otherwise = perCap
+          events sizes (payload + len) capNo'
+                 (M.insertWith (+) tag 1 counts) perCap'
+
+main :: IO ()
+main = do
+  [file] <- getArgs
+  raw <- B.readFile file
+  bs <- if B.length raw >= 4 && le raw 0 4 == lz4Magic
+          then decompress raw
+          else return raw
+  (counts, perCap) <- parse bs
+  forM_ (M.toList counts) $ \(tag, n) ->
+    putStrLn (show tag ++ " " ++ show n)
+  putStrLn ("gc " ++ show (sum [ M.findWithDefault 0 t counts | t <- gcTags ]))
+  let caps = M.keys (M.mapKeys fst perCap)
+      balanced = and [ M.lookup (c, gcStart) perCap == M.lookup (c, gcEnd) perCap
+                     | c <- caps ]
+  putStrLn (if balanced then "gc-balanced" else "gc-unbalanced")
@@ -0,0 +1,41 @@
+module Main where
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Stats
+import System.Exit
+import System.Mem
+
+-- With --adaptive-nursery, the nurseries may move about but each should
+-- stay at least -A, and the total no more than 64 times -A per capability.
+-- See Note [Adaptive nursery sizing] in rts/sm/GC.c.
+--
+-- The workload here makes minor GCs cheap but frequent: almost nothing
+-- survives, but each GC has to scan the remembered set, as we keep writing
+-- to 100000 IORefs in the old generation.  (The small Ints we write are
+-- replaced by static closures rather than copied.)  So the nursery should
+-- grow beyond -A.
+
+main :: IO ()
+main = do
+    refs <- mapM newIORef (replicate 100000 (0 :: Int))
+    performMajorGC
+    forM_ [1 .. 200 :: Int] $ \i ->
+        forM_ (zip [i ..] refs) $ \(j, r) -> writeIORef r $! j `mod` 100
+    n <- sum <$> mapM readIORef refs
+    when (n == 0) exitFailure
+
+    caps <- getNumCapabilities
+    s <- getRTSStats
+    let nursery = gcdetails_nursery_bytes (gc s)
+        largest = gcdetails_max_nursery_bytes (gc s)
+        a = 1024 * 1024
+    when (largest < a || largest > nursery ||
+          nursery > fromIntegral caps * 64 * a) $ do
+        putStrLn $ "nursery sizes: " ++ show (nursery, largest)
+        exitFailure
+    when (nursery <= fromIntegral caps * a) $ do
+        putStrLn $ "nursery didn't grow: " ++ show nursery
+        exitFailure
+    putStrLn "ok"
@@ -0,0 +1,26 @@
+module Main where
+
+import Control.Monad
+import GHC.Stats
+import System.Exit
+
+-- With --adaptive-nursery, a program that keeps nearly everything it
+-- allocates should stay at -A: every minor GC sees a survival rate well
+-- over a tenth, so the nursery never grows.  See Note [Adaptive nursery
+-- sizing] in rts/sm/GC.c.
+
+build :: Int -> [Int] -> [Int]
+build 0 acc = acc
+build n acc = let x = n * 1000 in x `seq` build (n - 1) (x : acc)
+
+main :: IO ()
+main = do
+    let xs = build 2000000 []
+    when (null xs) exitFailure
+
+    s <- getRTSStats
+    let nursery = gcdetails_nursery_bytes (gc s)
+    when (nursery /= 1024 * 1024) $ do
+        putStrLn $ "nursery grew: " ++ show nursery
+        exitFailure
+    print (length xs)
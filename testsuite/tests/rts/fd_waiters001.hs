@@ -0,0 +1,79 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- Threads blocked on many file descriptors in the non-threaded RTS.
+--
+-- We block one thread on each of a large number of idle pipes (well
+-- past FD_SETSIZE, which select() could not cope with), plus a few
+-- active pipes, and check that writing to an active pipe wakes exactly
+-- the thread waiting on it.  Run with the argument "bench" to also
+-- print the mean wakeup latency, e.g.
+--
+--   ./fd_waiters001 bench 10000 100 +RTS --io-poller=epoll
+
+import Control.Concurrent
+import Control.Monad
+import Foreign
+import Foreign.C
+import GHC.Clock (getMonotonicTimeNSec)
+import System.Environment
+import System.Posix.Types (Fd(..))
+
+foreign import ccall unsafe "raise_fd_limit"
+    c_raise_fd_limit :: CInt -> IO CInt
+
+foreign import ccall unsafe "make_pipe"
+    c_make_pipe :: Ptr CInt -> IO CInt
+
+foreign import ccall unsafe "poke_pipe"
+    c_poke_pipe :: CInt -> IO ()
+
+foreign import ccall unsafe "drain_pipe"
+    c_drain_pipe :: CInt -> IO ()
+
+newPipe :: IO (CInt, CInt)
+newPipe = allocaArray 2 $ \p -> do
+    throwErrnoIfMinus1_ "make_pipe" (c_make_pipe p)
+    [r, w] <- peekArray 2 p
+    return (r, w)
+
+main :: IO ()
+main = do
+    args <- getArgs
+    let (bench, n_idle0, n_active) = case args of
+          ["bench", i, a] -> (True, read i, read a)
+          _               -> (False, 2000, 100)
+    -- two descriptors per pipe, and some to spare
+    limit <- c_raise_fd_limit (fromIntegral (2 * (n_idle0 + n_active) + 64))
+    let n_idle = min n_idle0 ((fromIntegral limit - 64) `div` 2 - n_active)
+
+    idle <- replicateM n_idle newPipe
+    forM_ idle $ \(r, _) -> forkIO $ threadWaitRead (Fd r)
+
+    woken <- newChan
+    active <- replicateM n_active newPipe
+    forM_ (zip [0 :: Int ..] active) $ \(i, (r, _)) -> forkIO $ forever $ do
+        threadWaitRead (Fd r)
+        c_drain_pipe r
+        writeChan woken i
+
+    -- let everybody block
+    yield
+    threadDelay 10000
+
+    let rounds = if bench then 10 else 1
+    times <- forM [1 .. rounds] $ \_ ->
+      forM (zip [0 ..] active) $ \(i, (_, w)) -> do
+        t0 <- getMonotonicTimeNSec
+        c_poke_pipe w
+        j <- readChan woken
+        t1 <- getMonotonicTimeNSec
+        when (i /= j) $ error ("woke " ++ show j ++ " instead of " ++ show i)
+        return (t1 - t0)
+
+    putStrLn ("woke " ++ show n_active ++ " threads")
+    when bench $ do
+      let ts = concat times
+      putStrLn ("idle descriptors: " ++ show n_idle)
+      putStrLn ("mean wakeup latency: "
+                ++ show (sum ts `div` fromIntegral (length ts) `div` 1000)
+                ++ "us")
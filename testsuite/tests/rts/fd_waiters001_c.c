@@ -0,0 +1,34 @@
+#include <sys/resource.h>
+#include <unistd.h>
+
+int raise_fd_limit(int want)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        return 0;
+    }
+    if (rl.rlim_cur < (rlim_t)want) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)want ? rl.rlim_max : (rlim_t)want;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return rl.rlim_cur > (rlim_t)want ? want : (int)rl.rlim_cur;
+}
+
+int make_pipe(int fds[2])
+{
+    return pipe(fds);
+}
+
+void poke_pipe(int fd)
+{
+    char c = 'x';
+    (void)!write(fd, &c, 1);
+}
+
+void drain_pipe(int fd)
+{
+    char c;
+    (void)!read(fd, &c, 1);
+}
@@ -0,0 +1,33 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- Threads blocked on the same file descriptor in the non-threaded RTS
+-- are woken in the order in which they blocked.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign
+import Foreign.C
+import System.Posix.Types (Fd(..))
+
+foreign import ccall unsafe "make_pipe"
+    c_make_pipe :: Ptr CInt -> IO CInt
+
+foreign import ccall unsafe "poke_pipe"
+    c_poke_pipe :: CInt -> IO ()
+
+main :: IO ()
+main = do
+    (r, w) <- allocaArray 2 $ \p -> do
+        throwErrnoIfMinus1_ "make_pipe" (c_make_pipe p)
+        [r, w] <- peekArray 2 p
+        return (r, w)
+    order <- newMVar []
+    forM_ [0 .. 4 :: Int] $ \i -> do
+        _ <- forkIO $ do
+            threadWaitRead (Fd r)
+            modifyMVar_ order (return . (i :))
+        -- let it block before the next one
+        threadDelay 1000
+    c_poke_pipe w
+    threadDelay 10000
+    readMVar order >>= print . reverse
@@ -0,0 +1,44 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- A descriptor that was the last one with waiters drops out of the active
+-- set when its only waiter is killed.  If it then becomes ready (epoll
+-- still has it armed), that must not take another descriptor, which still
+-- has a waiter, out of the active set: its waiter would stop being a GC
+-- root and would never be woken.
+
+import Control.Concurrent
+import Foreign
+import Foreign.C
+import System.Mem
+import System.Posix.Types (Fd(..))
+
+foreign import ccall unsafe "make_pipe"
+    c_make_pipe :: Ptr CInt -> IO CInt
+
+foreign import ccall unsafe "poke_pipe"
+    c_poke_pipe :: CInt -> IO ()
+
+newPipe :: IO (CInt, CInt)
+newPipe = allocaArray 2 $ \p -> do
+    throwErrnoIfMinus1_ "make_pipe" (c_make_pipe p)
+    [r, w] <- peekArray 2 p
+    return (r, w)
+
+main :: IO ()
+main = do
+    (ra, wa) <- newPipe
+    (rb, wb) <- newPipe
+    done <- newEmptyMVar
+    _ <- forkIO $ threadWaitRead (Fd ra) >> putMVar done ()
+    threadDelay 1000
+    -- b is now the last active descriptor
+    tb <- forkIO $ threadWaitRead (Fd rb)
+    threadDelay 1000
+    killThread tb
+    -- a spurious event for b
+    c_poke_pipe wb
+    threadDelay 10000
+    performMajorGC
+    c_poke_pipe wa
+    takeMVar done
+    putStrLn "woke"
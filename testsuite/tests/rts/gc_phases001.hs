@@ -0,0 +1,27 @@
+module Main where
+
+import Control.Monad
+import Data.IORef
+import GHC.Stats
+import System.Exit
+import System.Mem
+
+-- The phases of a GC are timed on the thread leading it, within the GC, so
+-- they can't add up to more than the whole pause.  See Note [GC phase
+-- timing] in rts/sm/GC.c.
+
+main :: IO ()
+main = do
+    ref <- newIORef [1 .. 100000 :: Int]
+    performMajorGC
+    readIORef ref >>= \xs -> when (sum xs == 0) exitFailure
+    d <- gc <$> getRTSStats
+    let phases = [ gcdetails_roots_elapsed_ns d, gcdetails_cafs_elapsed_ns d
+                 , gcdetails_scav_elapsed_ns d, gcdetails_weak_elapsed_ns d
+                 , gcdetails_sweep_elapsed_ns d, gcdetails_free_elapsed_ns d ]
+    when (any (< 0) phases || gcdetails_par_idle_elapsed_ns d < 0 ||
+          sum phases > gcdetails_elapsed_ns d ||
+          gcdetails_scav_elapsed_ns d == 0) $ do
+        putStrLn $ "phases: " ++ show (phases, gcdetails_elapsed_ns d)
+        exitFailure
+    putStrLn "ok"
@@ -0,0 +1,62 @@
+module Main where
+
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Data.List (isPrefixOf)
+import qualified Data.Map.Strict as M
+import System.Exit
+import System.Mem
+
+-- Builds and rebuilds a map of some tens of megabytes with the heap
+-- advised for huge pages, and a prefaulted nursery, and checks the
+-- contents.  The RTS warns if the kernel has no transparent huge pages,
+-- hence ignore_stderr.
+--
+-- Where the kernel offers transparent huge pages to programs that ask for
+-- them (Linux, with "always" or "madvise" selected), also check that some
+-- of the heap did end up in huge pages: the prefaulted 64MB nursery is
+-- aligned and advised, so it should be backed by them.  Elsewhere this is
+-- just a smoke test of the flags.
+
+readFileMaybe :: FilePath -> IO (Maybe String)
+readFileMaybe f = do
+    r <- try (readFile f >>= evaluate . force')
+    return $ case r of
+      Left e -> const Nothing (e :: IOException)
+      Right s -> Just s
+  where force' s = length s `seq` s
+
+thpEnabled :: IO Bool
+thpEnabled = do
+    s <- readFileMaybe "/sys/kernel/mm/transparent_hugepage/enabled"
+    return $ case s of
+      Just modes -> any (`elem` words modes) ["[always]", "[madvise]"]
+      Nothing -> False
+
+-- Total of the AnonHugePages lines in /proc/self/smaps, in kB
+anonHugePages :: IO Integer
+anonHugePages = do
+    s <- readFileMaybe "/proc/self/smaps"
+    return $ sum [ read n | l <- maybe [] lines s
+                          , "AnonHugePages:" `isPrefixOf` l
+                          , [_, n, _] <- [words l] ]
+
+main :: IO ()
+main = do
+    ref <- newIORef M.empty
+    forM_ [1 .. 4 :: Int] $ \r -> do
+        let m = M.fromList [ (i, i * r) | i <- [1 .. 500000 :: Int] ]
+        writeIORef ref m
+        performMajorGC
+        m' <- readIORef ref
+        unless (M.foldlWithKey' (\ok k v -> ok && v == k * r) True m') $
+            error "huge_pages001: bad map"
+
+    thp <- thpEnabled
+    when thp $ do
+        kb <- anonHugePages
+        when (kb == 0) $ do
+            putStrLn "no part of the heap is in huge pages"
+            exitFailure
+    putStrLn "ok"
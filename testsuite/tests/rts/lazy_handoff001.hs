@@ -0,0 +1,48 @@
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import GHC.Clock (getMonotonicTimeNSec)
+import System.Environment
+import System.Mem
+
+-- Short safe foreign calls with +RTS --lazy-handoff.  Several threads make
+-- calls while another one keeps asking for GCs, which must take the
+-- capabilities back from the calls, and the results must still be right.
+-- Run with the argument "bench" to print the cost of a safe call, e.g.
+--
+--   ./lazy_handoff001 bench 1000000
+--   ./lazy_handoff001 bench 1000000 +RTS --lazy-handoff
+--
+-- to compare it with the usual handoff.
+
+foreign import ccall safe "math.h cos" c_cos :: Double -> IO Double
+
+calls :: Int -> IO Double
+calls n = go n 0
+  where go 0 acc = return acc
+        go k acc = do
+          r <- c_cos (fromIntegral k)
+          go (k - 1) $! acc + r
+
+main :: IO ()
+main = do
+  args <- getArgs
+  case args of
+    ["bench", n] -> do
+      let k = read n
+      t0 <- getMonotonicTimeNSec
+      _ <- calls k >>= evaluate
+      t1 <- getMonotonicTimeNSec
+      putStrLn (show (fromIntegral (t1 - t0) / fromIntegral k :: Double)
+                ++ "ns per safe call")
+    _ -> do
+      let expected = foldl (\acc k -> acc + cos (fromIntegral k)) 0
+                           [100000, 99999 .. 1 :: Int]
+      gcs <- forkIO $ forever $ performMinorGC >> threadDelay 1000
+      vars <- replicateM 4 $ do
+        v <- newEmptyMVar
+        _ <- forkIO $ calls 100000 >>= putMVar v
+        return v
+      rs <- mapM takeMVar vars
+      killThread gcs
+      print (all (\r -> abs (r - expected) < 1e-6) rs)
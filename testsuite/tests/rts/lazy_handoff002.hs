@@ -0,0 +1,15 @@
+import Control.Concurrent
+import Control.Monad
+
+-- With +RTS --lazy-handoff, main returns while other threads are making
+-- short safe foreign calls, some of which will be holding on to their
+-- capabilities.  The RTS must take them back and shut down.
+
+foreign import ccall safe "math.h cos" c_cos :: Double -> IO Double
+
+main :: IO ()
+main = do
+  forM_ [1 .. 4 :: Int] $ \i ->
+    forkIO $ forever $ void $ c_cos (fromIntegral i)
+  threadDelay 50000
+  putStrLn "done"
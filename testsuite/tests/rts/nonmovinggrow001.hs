@@ -0,0 +1,45 @@
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+-- Add capabilities (setNumCapabilities) while a concurrent collection of the
+-- non-moving heap is marking and sweeping, so that the allocators grow while
+-- the sweepers are working through them.  Then allocate into the non-moving
+-- heap on the new capabilities and check that nothing was lost.
+
+data T = T !Int [Int] (IORef [Int])
+
+build :: Int -> IO [T]
+build n = forM [1 .. n] $ \i -> do
+  r <- newIORef [i]
+  evaluate (T i (forceList [i, i + 1]) r)
+
+check :: [T] -> IO Bool
+check ts = and <$> forM ts (\(T i xs r) -> do
+  v <- readIORef r
+  return (v == [i] && xs == [i, i + 1]))
+
+forceList :: [Int] -> [Int]
+forceList xs = sum xs `seq` xs
+
+main :: IO ()
+main = do
+  ts <- build 100000
+  _ <- evaluate (length ts)
+  forM_ [2 .. 6] $ \n -> do
+    performMajorGC
+    setNumCapabilities n
+    dones <- forM [0 .. n - 1] $ \c -> do
+      done <- newEmptyMVar
+      _ <- forkOn c $ do
+        us <- build 20000
+        performMinorGC
+        check us >>= putMVar done
+      return done
+    oks <- mapM takeMVar dones
+    forM_ ts $ \(T i _ r) -> writeIORef r $! forceList [i]
+    unless (and oks) $ putStrLn ("lost data with " ++ show n ++ " capabilities")
+  performMajorGC
+  check ts >>= print
@@ -0,0 +1,33 @@
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+-- Concurrent marking of the non-moving heap with several mark threads
+-- (+RTS --nonmoving-mark-threads).  Build a large old generation, then keep
+-- overwriting references in it while the collections run, so that the mark
+-- threads also work through the update remembered set.
+
+data T = T !Int [Int] (IORef [Int])
+
+build :: Int -> IO [T]
+build n = forM [1 .. n] $ \i -> do
+  r <- newIORef [i]
+  evaluate (T i (forceList [i, i + 1]) r)
+  where forceList xs = sum xs `seq` xs
+
+check :: [T] -> IO Bool
+check ts = and <$> forM ts (\(T i xs r) -> do
+  v <- readIORef r
+  return (v == [i] && xs == [i, i + 1]))
+
+main :: IO ()
+main = do
+  ts <- build 200000
+  _ <- evaluate (length ts)
+  replicateM_ 5 $ do
+    performMajorGC
+    forM_ ts $ \(T i _ r) -> writeIORef r $! forceList [i]
+  performMajorGC
+  check ts >>= print
+  where forceList xs = sum xs `seq` xs
@@ -0,0 +1,21 @@
+import GHC.Conc (par, pseq)
+
+-- Spark stealing with capabilities spread over several (pretend) NUMA
+-- nodes, where thieves try victims on their own node first; see
+-- Note [Choosing a victim to steal sparks from].  Every spark must still
+-- be either stolen or run by its owner, so the result must come out
+-- right.
+
+pfib :: Int -> Integer
+pfib n
+  | n < 15 = sfib n
+  | otherwise = x `par` (y `pseq` (x + y))
+  where
+    x = pfib (n - 1)
+    y = pfib (n - 2)
+
+sfib :: Int -> Integer
+sfib n = if n < 2 then toInteger n else sfib (n - 1) + sfib (n - 2)
+
+main :: IO ()
+main = mapM_ (print . pfib) [25, 27, 29]
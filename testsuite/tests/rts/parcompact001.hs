@@ -0,0 +1,60 @@
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import GHC.Clock (getMonotonicTimeNSec)
+import GHC.Conc
+import System.Environment
+import System.Mem
+
+-- Build a large old generation with a hole after every live object, and
+-- compact it with all the GC threads (the test runs with +RTS -c).  Check
+-- that everything survives being moved.  Run with the argument "bench" to
+-- print the average major GC pause with the compacting collector and the
+-- given number of capabilities, e.g.
+--
+--   ghc -O -threaded -rtsopts parcompact001.hs
+--   for k in 1 2 4 8; do ./parcompact001 bench 2000000 +RTS -c -N$k -RTS; done
+--
+-- Without -c the major GCs copy, and the numbers say nothing about
+-- compaction.
+
+data T = T !Int [Int] (IORef Int)
+
+build :: Int -> IO [T]
+build n = forM [1 .. n] $ \i -> do
+  r <- newIORef i
+  evaluate (T i (forceList [i, i + 1, i + 2]) r)
+  where forceList xs = sum xs `seq` xs
+
+everyOther :: [a] -> [a]
+everyOther (x : _ : xs) = x : everyOther xs
+everyOther xs = xs
+
+check :: [T] -> IO Int
+check ts = fmap sum $ forM ts $ \(T i xs r) -> do
+  v <- readIORef r
+  return (if v == i && xs == [i, i + 1, i + 2] then 1 else 0)
+
+main :: IO ()
+main = do
+  args <- getArgs
+  case args of
+    ["bench", k] -> do
+      ts <- everyOther <$> build (read k)
+      _ <- evaluate (length ts)
+      caps <- getNumCapabilities
+      performMajorGC
+      t0 <- getMonotonicTimeNSec
+      replicateM_ 10 performMajorGC
+      t1 <- getMonotonicTimeNSec
+      let ms = fromIntegral (t1 - t0) / 1e7 :: Double
+      putStrLn (show caps ++ " capabilities: " ++ show ms ++ "ms per GC")
+      _ <- check ts
+      return ()
+    _ -> do
+      ts <- everyOther <$> build 200000
+      _ <- evaluate (length ts)
+      performMajorGC
+      performMajorGC
+      n <- check ts
+      print (n == length ts)
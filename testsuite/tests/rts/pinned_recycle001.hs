@@ -0,0 +1,44 @@
+module Main where
+
+import Control.Monad
+import Data.Word
+import Foreign.ForeignPtr
+import Foreign.Marshal.Array
+import GHC.Stats
+import System.Exit
+import System.Mem
+
+-- Allocates lots of small pinned objects and keeps one in every 64 of them
+-- alive. Without recycling each of the survivors would keep a whole block
+-- alive (well over 100MB in all); with it the free parts of those blocks are
+-- reused. The survivors must be intact afterwards, since their neighbours
+-- have been allocated into the same blocks. See Note [Pinned block
+-- recycling] in rts/sm/Storage.c.
+
+kept :: Int
+kept = 40000
+
+allocate :: Int -> [(Int, ForeignPtr Word64)] -> IO [(Int, ForeignPtr Word64)]
+allocate 0 acc = return acc
+allocate n acc = do
+    fp <- mallocPlainForeignPtrBytes 64
+    withForeignPtr fp $ \p -> pokeArray p (replicate 8 (fromIntegral n))
+    if n `mod` 64 == 0
+        then allocate (n - 1) ((n, fp) : acc)
+        else allocate (n - 1) acc
+
+main :: IO ()
+main = do
+    survivors <- allocate (kept * 64) []
+    performMajorGC
+    forM_ survivors $ \(n, fp) -> do
+        xs <- withForeignPtr fp $ peekArray 8
+        when (xs /= replicate 8 (fromIntegral n)) $ do
+            putStrLn ("survivor " ++ show n ++ " overwritten: " ++ show xs)
+            exitFailure
+    stats <- getRTSStats
+    let mem = max_mem_in_use_bytes stats
+    when (mem > 80 * 1024 * 1024) $ do
+        putStrLn ("too much memory in use: " ++ show mem)
+        exitFailure
+    putStrLn "ok"
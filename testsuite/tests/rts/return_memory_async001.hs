@@ -0,0 +1,38 @@
+module Main where
+
+import Control.Concurrent
+import Control.Monad
+import Data.Array.IO.Safe
+import Data.Word
+import GHC.Stats
+import System.Exit
+import System.Mem
+
+-- With --return-memory-async the GC leaves the freed memory to a background
+-- thread: right after the GC nearly all of it is still in use, and after 20
+-- half-lives nearly all of it should have been returned.
+
+memInUse :: IO Word64
+memInUse = gcdetails_mem_in_use_bytes . gc <$> getRTSStats
+
+main :: IO ()
+main = do
+    -- allocate and touch 256MB
+    hog <- forM [1 .. 64 :: Int] $ \_ ->
+        newArray (0, 1000000) 1 :: IO (IOUArray Word Word32)
+    performMajorGC
+    forM_ hog $ \a -> void $ readArray a 0
+
+    performMajorGC
+    before <- memInUse
+    when (before < 192 * 1024 * 1024) $ do
+        putStrLn $ "memory in use straight after the GC: " ++ show before
+        exitFailure
+
+    threadDelay 1000000
+    performMinorGC
+    final <- memInUse
+    when (final > 64 * 1024 * 1024) $ do
+        putStrLn $ "memory in use: " ++ show final
+        exitFailure
+    putStrLn "ok"
@@ -0,0 +1,24 @@
+module Main where
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Stats
+import System.Exit
+
+-- Every time a thread runs after waiting on a run queue, the wait is added
+-- to the histogram.  See Note [Run queue delays] in rts/Schedule.c.
+
+main :: IO ()
+main = do
+    before <- run_queue_delay_histogram <$> getRTSStats
+    dones <- forM [1 .. 4 :: Int] $ \_ -> do
+        done <- newEmptyMVar
+        _ <- forkIO $ replicateM_ 1000 yield >> putMVar done ()
+        return done
+    mapM_ takeMVar dones
+    after <- run_queue_delay_histogram <$> getRTSStats
+    when (length after /= 24 || or (zipWith (<) after before) ||
+          sum after - sum before < 4000) $ do
+        putStrLn $ "histogram: " ++ show (before, after)
+        exitFailure
+    putStrLn "ok"
@@ -0,0 +1,70 @@
+-- Many threads blocked in threadDelay in the non-threaded RTS.
+--
+-- First we start a few threads with different delays, out of order, and
+-- check that they wake up in order of their deadlines.  Then we put a
+-- large number of threads to sleep with random delays, kill half of them
+-- before they wake up, and check that exactly the other half wake up.
+-- Run with the argument "bench" to also print how long it took to
+-- schedule the delays, e.g.
+--
+--   ./sleeping_threads001 bench 100000
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Clock (getMonotonicTimeNSec)
+import System.Environment
+
+main :: IO ()
+main = do
+    args <- getArgs
+    let (bench, n) = case args of
+          ["bench", k] -> (True, read k)
+          _            -> (False, 20000)
+
+    -- 30ms apart, well above the timer resolution
+    order <- newIORef []
+    finished <- newEmptyMVar
+    let ks = [7, 2, 9, 4, 0, 5, 8, 1, 6, 3 :: Int]
+    forM_ ks $ \k -> forkIO $ do
+        threadDelay (100000 + k * 30000)
+        atomicModifyIORef' order (\o -> (k : o, ()))
+        putMVar finished ()
+    replicateM_ (length ks) (takeMVar finished)
+    readIORef order >>= print . reverse
+
+    done <- newEmptyMVar
+    late <- newIORef (0 :: Int)
+    let delays = [ 100000 + (i * 7919) `mod` 400000 | i <- [1 .. n] ]
+    t0 <- getMonotonicTimeNSec
+    tids <- forM delays $ \d -> forkIO $ do
+        start <- getMonotonicTimeNSec
+        threadDelay d
+        end <- getMonotonicTimeNSec
+        when (end - start < fromIntegral d * 1000) $
+          atomicModifyIORef' late (\x -> (x + 1, ()))
+        putMVar done ()
+    -- let everybody block
+    yield
+    t1 <- getMonotonicTimeNSec
+
+    forM_ (everyOther tids) killThread
+    t2 <- getMonotonicTimeNSec
+
+    replicateM_ (n - length (everyOther tids)) (takeMVar done)
+    -- nobody else should wake up
+    threadDelay 600000
+    extra <- tryTakeMVar done
+    early <- readIORef late
+
+    putStrLn ("woke " ++ show (n - length (everyOther tids)) ++ " threads")
+    when (extra /= Nothing) $ putStrLn "a killed thread woke up"
+    when (early /= 0) $ putStrLn (show early ++ " threads woke up early")
+    when bench $ do
+      putStrLn ("scheduling " ++ show n ++ " delays: "
+                ++ show ((t1 - t0) `div` 1000) ++ "us")
+      putStrLn ("cancelling " ++ show (length (everyOther tids)) ++ " delays: "
+                ++ show ((t2 - t1) `div` 1000) ++ "us")
+  where
+    everyOther (x:_:xs) = x : everyOther xs
+    everyOther xs       = xs
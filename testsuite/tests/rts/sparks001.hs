@@ -0,0 +1,47 @@
+import Control.Exception
+import Control.Monad
+import GHC.Clock (getMonotonicTimeNSec)
+import GHC.Conc
+import System.Environment
+
+-- A very fine-grained parallel program: every call of pfib above the
+-- cutoff sparks one of its recursive calls, so idle capabilities spend
+-- their time stealing sparks.  Check that every spark gets evaluated
+-- correctly whichever capability runs it.  Run with the argument "bench"
+-- to print the time taken and the spark throughput for 1, 2, 4, ...
+-- capabilities up to the number of processors, e.g.
+--
+--   ./sparks001 bench 32
+
+pfib :: Int -> Int
+pfib n
+  | n < 12    = fib n
+  | otherwise = a `par` (b `pseq` a + b + 1)
+  where a = pfib (n - 1)
+        b = pfib (n - 2)
+
+fib :: Int -> Int
+fib n = if n < 2 then 1 else fib (n - 1) + fib (n - 2) + 1
+
+-- The number of sparks pfib n creates
+sparks :: Int -> Int
+sparks n = if n < 12 then 0 else 1 + sparks (n - 1) + sparks (n - 2)
+
+main :: IO ()
+main = do
+  args <- getArgs
+  case args of
+    ["bench", k] -> do
+      procs <- getNumProcessors
+      forM_ (takeWhile (<= procs) (iterate (* 2) 1)) $ \caps -> do
+        setNumCapabilities caps
+        t0 <- getMonotonicTimeNSec
+        _ <- evaluate (pfib (read k))
+        t1 <- getMonotonicTimeNSec
+        let ms = fromIntegral (t1 - t0) / 1e6 :: Double
+        putStrLn (show caps ++ " capabilities: " ++ show ms ++ "ms, "
+                  ++ show (round (fromIntegral (sparks (read k)) / ms)
+                           :: Int) ++ " sparks/ms")
+    _ -> do
+      r <- evaluate (pfib 25)
+      print (r == fib 25)
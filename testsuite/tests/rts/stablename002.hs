@@ -0,0 +1,45 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Clock (getMonotonicTimeNSec)
+import System.Environment
+import System.Mem
+import System.Mem.StableName
+
+-- Make stable names from several capabilities at once, for objects that
+-- are shared between threads and for objects private to each thread,
+-- across minor and major GCs, and check that each object keeps its
+-- stable name.  Run with the argument "bench" to also print how long it
+-- took, e.g.
+--
+--   ./stablename002 bench 1000000 +RTS -N8
+
+main :: IO ()
+main = do
+  args <- getArgs
+  let (bench, n) = case args of
+        ["bench", k] -> (True, read k)
+        _            -> (False, 20000)
+  caps <- getNumCapabilities
+  let threads = max 4 caps
+  shared <- forM [1 .. 1000 :: Int] newIORef
+  sharedNames <- mapM makeStableName shared
+  dones <- replicateM threads newEmptyMVar
+  t0 <- getMonotonicTimeNSec
+  forM_ (zip [0 ..] dones) $ \(i, done) -> forkOn i $ do
+    mine <- forM [1 .. n] newIORef
+    names <- mapM makeStableName mine
+    performMinorGC
+    names' <- mapM makeStableName mine
+    when (names /= names') $ error "private stable names changed"
+    shared' <- mapM makeStableName shared
+    when (shared' /= sharedNames) $ error "shared stable names differ"
+    putMVar done ()
+  mapM_ takeMVar dones
+  t1 <- getMonotonicTimeNSec
+  performMajorGC
+  sharedNames' <- mapM makeStableName shared
+  print (sharedNames == sharedNames')
+  when bench $
+    putStrLn (show (threads * (2 * n + 1000)) ++ " stable names in "
+              ++ show ((t1 - t0) `div` 1000000) ++ "ms")
@@ -0,0 +1,48 @@
+-- Making, dereferencing and freeing stable pointers from several
+-- capabilities at once.
+--
+-- Each capability keeps its own cache of free stable pointer table
+-- entries, and entries move between capabilities via the global free
+-- list, so here every thread frees the stable pointers made by its
+-- neighbour.  Run with the argument "bench" to also print how long it
+-- took, e.g.
+--
+--   ./stableptr001 bench 1000000 +RTS -N8
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.StablePtr
+import GHC.Clock (getMonotonicTimeNSec)
+import System.Environment
+
+main :: IO ()
+main = do
+    args <- getArgs
+    let (bench, n) = case args of
+          ["bench", k] -> (True, read k)
+          _            -> (False, 100000)
+    caps <- getNumCapabilities
+    let threads = max 4 caps
+    chans <- replicateM threads newChan
+    dones <- replicateM threads newEmptyMVar
+    t0 <- getMonotonicTimeNSec
+    forM_ (zip3 [0 ..] chans dones) $ \(i, out, done) -> forkOn i $ do
+        let inp = chans !! ((i + 1) `mod` threads)
+        forM_ [1 .. n] $ \j -> do
+            -- keep a few of our own around to exercise the cache
+            sps <- mapM newStablePtr [j, j + 1, j + 2 :: Int]
+            xs <- mapM deRefStablePtr sps
+            when (xs /= [j, j + 1, j + 2]) $ error "deRefStablePtr"
+            mapM_ freeStablePtr (tail sps)
+            writeChan out (head sps, j)
+            (sp, k) <- readChan inp
+            x <- deRefStablePtr sp
+            when (x /= k) $ error "deRefStablePtr (neighbour)"
+            freeStablePtr sp
+        putMVar done ()
+    mapM_ takeMVar dones
+    t1 <- getMonotonicTimeNSec
+    putStrLn "done"
+    when bench $
+      putStrLn (show (threads * n * 3) ++ " stable pointers in "
+                ++ show ((t1 - t0) `div` 1000000) ++ "ms")
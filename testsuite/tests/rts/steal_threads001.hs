@@ -0,0 +1,51 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Clock (getMonotonicTimeNSec)
+import GHC.Conc
+import System.Environment
+
+-- One thread forks many busy threads at once, so with --steal-threads the
+-- idle capabilities ask it for work rather than waiting for it to share.
+-- Check that every thread runs to completion with the right result.  Run
+-- with the argument "bench" to print, for 1, 2, 4, ... capabilities up to
+-- the number of processors, how long it takes until the last of the forked
+-- threads has started (the fan-out latency), e.g.
+--
+--   ./steal_threads001 bench 1000 +RTS --steal-threads
+
+spin :: Int -> Int
+spin n = go n 0
+  where go 0 acc = acc
+        go k acc = go (k - 1) (acc + k `mod` 7)
+
+fanOut :: Int -> Int -> IO ([Int], Word)
+fanOut k work = do
+  started <- newIORef 0
+  t0 <- getMonotonicTimeNSec
+  vars <- forM [1 .. k] $ \i -> do
+    v <- newEmptyMVar
+    _ <- forkIO $ do
+      t <- getMonotonicTimeNSec
+      atomicModifyIORef' started (\m -> (max m t, ()))
+      putMVar v $! spin (work + i)
+    return v
+  rs <- mapM takeMVar vars
+  t1 <- readIORef started
+  return (rs, fromIntegral (t1 - t0))
+
+main :: IO ()
+main = do
+  args <- getArgs
+  case args of
+    ["bench", k] -> do
+      procs <- getNumProcessors
+      forM_ (takeWhile (<= procs) (iterate (* 2) 1)) $ \caps -> do
+        setNumCapabilities caps
+        (_, ns) <- fanOut (read k) 100000
+        putStrLn (show caps ++ " capabilities: "
+                  ++ show (fromIntegral ns / 1e3 :: Double)
+                  ++ "us until the last thread started")
+    _ -> do
+      (rs, _) <- fanOut 200 20000
+      print (rs == [ spin (20000 + i) | i <- [1 .. 200] ])
@@ -0,0 +1,32 @@
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+-- Mark-region collection of the oldest generation (+RTS -w), swept by all
+-- the GC threads.  Build a large old generation, drop every other object,
+-- and check that what's left survives a few major GCs.
+
+data T = T !Int [Int] (IORef Int)
+
+build :: Int -> IO [T]
+build n = forM [1 .. n] $ \i -> do
+  r <- newIORef i
+  evaluate (T i (forceList [i, i + 1]) r)
+  where forceList xs = sum xs `seq` xs
+
+everyOther :: [a] -> [a]
+everyOther (x : _ : xs) = x : everyOther xs
+everyOther xs = xs
+
+check :: [T] -> IO Bool
+check ts = and <$> forM ts (\(T i xs r) -> do
+  v <- readIORef r
+  return (v == i && xs == [i, i + 1]))
+
+main :: IO ()
+main = do
+  ts <- everyOther <$> build 200000
+  _ <- evaluate (length ts)
+  replicateM_ 3 performMajorGC
+  check ts >>= print
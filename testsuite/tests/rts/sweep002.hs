@@ -0,0 +1,30 @@
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+-- Lazy sweeping of the oldest generation (+RTS -wl): after each major GC
+-- the blocks are swept on demand as we allocate.  Keep replacing most of a
+-- large old generation, so that the allocator has to sweep to find free
+-- blocks, and check that the survivors are intact.
+
+data T = T !Int (IORef Int)
+
+build :: Int -> Int -> IO [T]
+build k n = forM [1 .. n] $ \i -> do
+  r <- newIORef (i * k)
+  evaluate (T i r)
+
+check :: Int -> [T] -> IO Bool
+check k ts = and <$> forM ts (\(T i r) -> (== i * k) <$> readIORef r)
+
+main :: IO ()
+main = do
+  keep <- build 7 1000
+  oks <- forM [1 .. 10] $ \k -> do
+    ts <- build k 100000
+    performMajorGC
+    check k (take 1000 ts)
+  performMajorGC
+  ok <- check 7 keep
+  print (and (ok : oks))
@@ -0,0 +1,163 @@
+#define THREADED_RTS
+
+#include "Rts.h"
+#include "RtsAPI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Allocates and frees small block groups from several threads at once,
+// some of them holding a capability (so using its block cache) and some not
+// (so using the per-node caches, or sm_mutex).  Every group is filled with a
+// pattern belonging to its owner and checked before it is freed, so two
+// threads being handed the same block shows up.  See Note [Block caches] in
+// rts/sm/BlockAlloc.c.
+//
+// Run with the argument "bench" (and +RTS -N<n>) to measure how allocation
+// and freeing of single blocks scales with the number of capabilities.
+
+extern bdescr *allocGroup_lock(W_ n);
+extern bdescr *allocGroupOnNode_lock(uint32_t node, W_ n);
+extern void freeGroup_lock(bdescr *p);
+extern void freeChain_lock(bdescr *bd);
+
+#define THREADS 4
+#define LIVE    64
+#define STEPS   20000
+
+typedef struct {
+    OSThreadId id;
+    int no;
+    bool with_cap;
+    int steps;
+    int max_blocks;
+    double secs;
+} Worker;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(bdescr *bd, StgWord pattern)
+{
+    StgWord *p = (StgWord *)bd->start;
+    for (W_ i = 0; i < bd->blocks * BLOCK_SIZE_W; i += 64) {
+        p[i] = pattern;
+    }
+}
+
+static void check(bdescr *bd, StgWord pattern, W_ blocks)
+{
+    StgWord *p = (StgWord *)bd->start;
+    if (bd->blocks != blocks || bd->free != bd->start) {
+        barf("testblockcache: bad group %p (%" FMT_Word " blocks)",
+             bd, (W_)bd->blocks);
+    }
+    for (W_ i = 0; i < blocks * BLOCK_SIZE_W; i += 64) {
+        if (p[i] != pattern) {
+            barf("testblockcache: group %p was handed out twice", bd);
+        }
+    }
+}
+
+static void *worker(void *arg)
+{
+    Worker *w = arg;
+    bdescr *live[LIVE] = { NULL };
+    W_ sizes[LIVE];
+    Capability *cap = NULL;
+    unsigned int seed = w->no + 1;
+
+    if (w->with_cap) {
+        cap = rts_lock();
+    }
+
+    double start = now();
+    for (int i = 0; i < w->steps; i++) {
+        int j = rand_r(&seed) % LIVE;
+        StgWord pattern = ((StgWord)w->no << 16) | j;
+        if (live[j] != NULL) {
+            check(live[j], pattern, sizes[j]);
+            freeGroup_lock(live[j]);
+        }
+        sizes[j] = rand_r(&seed) % w->max_blocks + 1;
+        // Threads without a capability ask for a node, so that they use
+        // the per-node caches rather than sm_mutex
+        live[j] = w->with_cap ? allocGroup_lock(sizes[j])
+                              : allocGroupOnNode_lock(0, sizes[j]);
+        fill(live[j], pattern);
+    }
+
+    // Give half of them back as a chain
+    bdescr *chain = NULL;
+    for (int j = 0; j < LIVE; j++) {
+        if (live[j] == NULL) continue;
+        check(live[j], ((StgWord)w->no << 16) | j, sizes[j]);
+        if (j % 2) {
+            live[j]->link = chain;
+            chain = live[j];
+        } else {
+            freeGroup_lock(live[j]);
+        }
+    }
+    freeChain_lock(chain);
+    w->secs = now() - start;
+
+    if (w->with_cap) {
+        rts_unlock(cap);
+    }
+    hs_thread_done();
+    return NULL;
+}
+
+static double run(int n, bool with_cap, int steps, int max_blocks)
+{
+    Worker w[n];
+    double secs = 0;
+
+    for (int i = 0; i < n; i++) {
+        w[i].no = i;
+        w[i].with_cap = with_cap || i % 2 == 0;
+        w[i].steps = steps;
+        w[i].max_blocks = max_blocks;
+        if (createOSThread(&w[i].id, "testblockcache", worker, &w[i]) != 0) {
+            barf("testblockcache: can't create thread");
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        joinOSThread(w[i].id);
+        secs = stg_max(secs, w[i].secs);
+    }
+    return secs;
+}
+
+static void bench(void)
+{
+    const int steps = 1000000;
+    for (int n = 1; n <= (int)enabled_capabilities; n *= 2) {
+        double secs = run(n, true, steps, 1);
+        printf("%2d threads: %.1f Mop/s\n", n, 2.0 * n * steps / secs / 1e6);
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    hs_init(&argc, &argv);
+
+    // Half the threads hold a capability, and groups range from a single
+    // block to just over the largest size the caches hold
+    run(THREADS, false, STEPS, 6);
+    printf("ok\n");
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+    }
+
+    hs_exit();
+    return 0;
+}
@@ -0,0 +1,387 @@
+#include "Rts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Tests rts/Hash.c against a simple chained hash table, in the style of the
+// one it replaced: each bucket is a list of entries, newest first, so that a
+// key inserted twice shadows the older entry until the newer is removed.
+//
+// Run with the argument "bench" to compare the speed and the memory use of
+// the two.
+
+// From rts/Hash.h
+typedef struct hashtable HashTable;
+typedef struct strhashtable StrHashTable;
+typedef void (*MapHashFn)(void *data, StgWord key, const void *value);
+extern HashTable *allocHashTable(void);
+extern void insertHashTable(HashTable *table, StgWord key, const void *data);
+extern void *lookupHashTable(const HashTable *table, StgWord key);
+extern void *removeHashTable(HashTable *table, StgWord key, const void *data);
+extern int keyCountHashTable(HashTable *table);
+extern void mapHashTable(HashTable *table, void *data, MapHashFn fn);
+extern void freeHashTable(HashTable *table, void (*freeDataFun)(void *));
+extern void insertStrHashTable(StrHashTable *table, const char *key,
+                               const void *data);
+extern void *lookupStrHashTable(const StrHashTable *table, const char *key);
+extern void *removeStrHashTable(StrHashTable *table, const char *key,
+                                const void *data);
+
+// -----------------------------------------------------------------------------
+// The reference table
+//
+// This follows the chained table from the old rts/Hash.c, so that the
+// benchmark compares against what we had: the same bucket function, an
+// average load of up to 5 entries per bucket, and entries carved out of
+// chunks and recycled through a free list.  The old table grew by
+// splitting one bucket at a time (linear hashing); this one doubles all
+// at once, which ends up with the same buckets.
+
+typedef struct refentry {
+    StgWord key;
+    const void *data;
+    struct refentry *next;
+} RefEntry;
+
+#define REF_LOAD  5
+#define REF_CHUNK (1024 * sizeof(W_) / sizeof(RefEntry))
+
+typedef struct refchunk {
+    struct refchunk *next;
+} RefChunk;
+
+typedef struct {
+    RefEntry **buckets;
+    StgWord mask;
+    int kcount;
+    RefEntry *freeList;
+    RefChunk *chunks;
+} RefTable;
+
+// The old hashWord: strip the boring zero bits
+static StgWord refHash(StgWord key)
+{
+    return key >> sizeof(StgWord);
+}
+
+static RefTable *refAlloc(void)
+{
+    RefTable *t = malloc(sizeof(RefTable));
+    t->mask = 1023;
+    t->buckets = calloc(t->mask + 1, sizeof(RefEntry *));
+    t->kcount = 0;
+    t->freeList = NULL;
+    t->chunks = NULL;
+    return t;
+}
+
+static void refGrow(RefTable *t)
+{
+    StgWord newmask = t->mask * 2 + 1;
+    RefEntry **nb = calloc(newmask + 1, sizeof(RefEntry *));
+
+    // Walk each bucket backwards so the new lists keep newest-first order
+    for (StgWord i = 0; i <= t->mask; i++) {
+        RefEntry *rev = NULL, *e, *next;
+        for (e = t->buckets[i]; e; e = next) {
+            next = e->next; e->next = rev; rev = e;
+        }
+        for (e = rev; e; e = next) {
+            StgWord b = refHash(e->key) & newmask;
+            next = e->next; e->next = nb[b]; nb[b] = e;
+        }
+    }
+    free(t->buckets);
+    t->buckets = nb;
+    t->mask = newmask;
+}
+
+static RefEntry *refAllocEntry(RefTable *t)
+{
+    if (t->freeList == NULL) {
+        RefChunk *c = malloc(sizeof(RefChunk) + REF_CHUNK * sizeof(RefEntry));
+        RefEntry *e = (RefEntry *)&c[1];
+        c->next = t->chunks;
+        t->chunks = c;
+        for (StgWord i = 0; i < REF_CHUNK; i++) {
+            e[i].next = t->freeList;
+            t->freeList = &e[i];
+        }
+    }
+    RefEntry *e = t->freeList;
+    t->freeList = e->next;
+    return e;
+}
+
+static void refInsert(RefTable *t, StgWord key, const void *data)
+{
+    if ((StgWord)++t->kcount >= REF_LOAD * (t->mask + 1)) {
+        refGrow(t);
+    }
+    RefEntry *e = refAllocEntry(t);
+    StgWord b = refHash(key) & t->mask;
+    e->key = key; e->data = data; e->next = t->buckets[b];
+    t->buckets[b] = e;
+}
+
+static void *refLookup(RefTable *t, StgWord key)
+{
+    for (RefEntry *e = t->buckets[refHash(key) & t->mask]; e; e = e->next) {
+        if (e->key == key) return (void *)e->data;
+    }
+    return NULL;
+}
+
+// The data of the oldest entry for the key, or NULL
+static void *refOldest(RefTable *t, StgWord key)
+{
+    void *data = NULL;
+    for (RefEntry *e = t->buckets[refHash(key) & t->mask]; e; e = e->next) {
+        if (e->key == key) data = (void *)e->data;
+    }
+    return data;
+}
+
+static void *refRemove(RefTable *t, StgWord key, const void *data)
+{
+    RefEntry **prev = &t->buckets[refHash(key) & t->mask], *e;
+    for (; (e = *prev) != NULL; prev = &e->next) {
+        if (e->key == key && (data == NULL || e->data == data)) {
+            void *old = (void *)e->data;
+            *prev = e->next;
+            e->next = t->freeList;
+            t->freeList = e;
+            t->kcount--;
+            return old;
+        }
+    }
+    return NULL;
+}
+
+static void refFree(RefTable *t)
+{
+    RefChunk *c, *next;
+    for (c = t->chunks; c; c = next) { next = c->next; free(c); }
+    free(t->buckets);
+    free(t);
+}
+
+// -----------------------------------------------------------------------------
+// Checking HashTable against the reference
+
+static StgWord sum;
+
+static void sumEntry(void *data STG_UNUSED, StgWord key, const void *value)
+{
+    sum += key * 31 + (StgWord)value;
+}
+
+static void check(bool ok, const char *what, int i)
+{
+    if (!ok) {
+        barf("testhashtable: %s failed at step %d", what, i);
+    }
+}
+
+static void test_random(void)
+{
+    const int STEPS = 200000;
+    const StgWord KEYS = 5000;
+    HashTable *h = allocHashTable();
+    RefTable *r = refAlloc();
+
+    for (int i = 0; i < STEPS; i++) {
+        // Keys are word-aligned, like the pointers most tables are keyed on
+        StgWord key = ((StgWord)(rand() % KEYS) + 1) * sizeof(W_);
+        void *data = (void *)(StgWord)(rand() % 4 + 1);
+
+        switch (rand() % 8) {
+        case 0: case 1: case 2:
+            insertHashTable(h, key, data);
+            refInsert(r, key, data);
+            break;
+        case 3:
+            check(removeHashTable(h, key, NULL) == refRemove(r, key, NULL),
+                  "remove", i);
+            break;
+        case 4:
+            // Removing with data that isn't in the table is an error, so
+            // remove the oldest entry, which is often a shadowed one
+            data = refOldest(r, key);
+            if (data != NULL) {
+                check(removeHashTable(h, key, data) == refRemove(r, key, data),
+                      "remove with data", i);
+            }
+            break;
+        default:
+            check(lookupHashTable(h, key) == refLookup(r, key), "lookup", i);
+            break;
+        }
+        check(keyCountHashTable(h) == r->kcount, "keyCount", i);
+
+        // Every so often, empty the table down to nothing
+        if (i % 50000 == 49999) {
+            for (StgWord k = 1; k <= KEYS; k++) {
+                while (lookupHashTable(h, k * sizeof(W_)) != NULL) {
+                    check(removeHashTable(h, k * sizeof(W_), NULL) ==
+                          refRemove(r, k * sizeof(W_), NULL), "drain", i);
+                }
+            }
+            check(keyCountHashTable(h) == 0 && r->kcount == 0, "drain", i);
+        }
+    }
+
+    // Both tables should hold exactly the same entries
+    StgWord hsum, rsum = 0;
+    sum = 0;
+    mapHashTable(h, NULL, sumEntry);
+    hsum = sum;
+    for (StgWord i = 0; i <= r->mask; i++) {
+        for (RefEntry *e = r->buckets[i]; e; e = e->next) {
+            rsum += e->key * 31 + (StgWord)e->data;
+        }
+    }
+    check(hsum == rsum, "mapHashTable", STEPS);
+
+    freeHashTable(h, NULL);
+    refFree(r);
+}
+
+static void test_strings(void)
+{
+    StrHashTable *h = (StrHashTable *)allocHashTable();
+    char keys[1000][16];
+
+    for (int i = 0; i < 1000; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+        insertStrHashTable(h, keys[i], keys[i]);
+    }
+    for (int i = 0; i < 1000; i++) {
+        char k[16];
+        snprintf(k, sizeof(k), "key%d", i);
+        check(lookupStrHashTable(h, k) == keys[i], "lookupStr", i);
+        if (i % 2) {
+            check(removeStrHashTable(h, k, NULL) == keys[i], "removeStr", i);
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        check((lookupStrHashTable(h, keys[i]) == NULL) == (i % 2),
+              "lookupStr after remove", i);
+    }
+    freeHashTable((HashTable *)h, NULL);
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t heapInUse(void)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2,33)
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static void shuffle(StgWord *keys, int n)
+{
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        StgWord tmp = keys[i]; keys[i] = keys[j]; keys[j] = tmp;
+    }
+}
+
+static void report(const char *name, int n, double t[4], size_t m[2])
+{
+    printf("%-10s insert %.1f Mop/s, lookup %.1f Mop/s, "
+           "remove %.1f Mop/s, %.1f bytes/entry\n", name,
+           n / (t[1] - t[0]) / 1e6, 2 * n / (t[2] - t[1]) / 1e6,
+           n / (t[3] - t[2]) / 1e6, (double)(m[1] - m[0]) / n);
+}
+
+static void bench(const int N)
+{
+    StgWord *keys = malloc(N * sizeof(StgWord));
+    StgWord *probes = malloc(N * sizeof(StgWord));
+    double t[4];
+    size_t m[2];
+    StgWord found = 0;
+
+    // Addresses of heap objects, in a random order.  We look them up (and
+    // then look up addresses that aren't keys) in a different order, so
+    // that the chained table doesn't visit its entries in the order it
+    // allocated them.
+    for (int i = 0; i < N; i++) {
+        keys[i] = 0x4200000000ULL + (StgWord)i * 24;
+    }
+    shuffle(keys, N);
+    memcpy(probes, keys, N * sizeof(StgWord));
+    shuffle(probes, N);
+
+    m[0] = heapInUse();
+    t[0] = now();
+    HashTable *h = allocHashTable();
+    for (int i = 0; i < N; i++) insertHashTable(h, keys[i], &keys[i]);
+    t[1] = now();
+    m[1] = heapInUse();
+    for (int i = 0; i < N; i++) found += lookupHashTable(h, probes[i]) != NULL;
+    for (int i = 0; i < N; i++) found += lookupHashTable(h, probes[i] + 8) != NULL;
+    t[2] = now();
+    for (int i = 0; i < N; i++) removeHashTable(h, probes[i], NULL);
+    t[3] = now();
+    freeHashTable(h, NULL);
+    printf("%d keys:\n", N);
+    report("HashTable:", N, t, m);
+
+    m[0] = heapInUse();
+    t[0] = now();
+    RefTable *r = refAlloc();
+    for (int i = 0; i < N; i++) refInsert(r, keys[i], &keys[i]);
+    t[1] = now();
+    m[1] = heapInUse();
+    for (int i = 0; i < N; i++) found += refLookup(r, probes[i]) != NULL;
+    for (int i = 0; i < N; i++) found += refLookup(r, probes[i] + 8) != NULL;
+    t[2] = now();
+    for (int i = 0; i < N; i++) refRemove(r, probes[i], NULL);
+    t[3] = now();
+    refFree(r);
+    report("chained:", N, t, m);
+
+    if (found != 2 * (StgWord)N) {
+        barf("testhashtable: bench lookups found %" FMT_Word, found);
+    }
+    free(keys);
+    free(probes);
+}
+
+int main (int argc, char *argv[])
+{
+    srand(0xf00f00);
+
+    hs_init(&argc, &argv);
+
+    test_random();
+    test_strings();
+    printf("ok\n");
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench(10000);
+        bench(1000000);
+    }
+
+    hs_exit();
+    return 0;
+}
@@ -0,0 +1,40 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Conc
+
+-- Interactive threads that never stop yielding would keep a background
+-- thread off the CPU forever under strict priority.  Check that the
+-- background thread still gets its turns, so the program terminates.
+
+main :: IO ()
+main = do
+  me <- myThreadId
+  setThreadPriority me InteractivePriority
+  threadPriority me >>= print
+  setThreadPriority me NormalPriority
+
+  stop <- newIORef False
+  spinners <- forM [1 .. 4 :: Int] $ \_ -> do
+    done <- newEmptyMVar
+    _ <- forkIO $ do
+      myThreadId >>= \t -> setThreadPriority t InteractivePriority
+      let loop = do
+            s <- readIORef stop
+            unless s (yield >> loop)
+      loop
+      putMVar done ()
+    return done
+
+  finished <- newEmptyMVar
+  _ <- forkIO $ do
+    t <- myThreadId
+    setThreadPriority t BackgroundPriority
+    replicateM_ 100 yield
+    threadPriority t >>= print
+    writeIORef stop True
+    putMVar finished ()
+
+  takeMVar finished
+  mapM_ takeMVar spinners
+  putStrLn "done"
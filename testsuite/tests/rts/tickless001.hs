@@ -0,0 +1,22 @@
+import Control.Concurrent
+import Control.Monad
+
+-- With --tickless the timer is parked while only one thread is running, so
+-- check that it is started again when a second thread becomes runnable:
+-- the busy thread below never blocks, and the main thread only gets to run
+-- again if the busy one is preempted.
+
+spin :: Int -> Int
+spin n = go n 0
+  where go 0 acc = acc
+        go k acc = go (k - 1) (acc + k `mod` 7)
+
+main :: IO ()
+main = do
+  threadDelay 200000
+  done <- newEmptyMVar
+  _ <- forkIO $ forever $ do
+    r <- return $! spin 1000
+    when (r < 0) $ putMVar done ()
+  yield
+  print (spin 100000)
@@ -0,0 +1,31 @@
+import Control.Concurrent
+import Control.Monad
+import System.Exit
+import System.IO
+import System.Posix
+
+-- The child of forkProcess must get a working timer with --tickless:
+-- as in tickless001, the main thread of the child only runs again if the
+-- busy thread is preempted.
+
+spin :: Int -> Int
+spin n = go n 0
+  where go 0 acc = acc
+        go k acc = go (k - 1) (acc + k `mod` 7)
+
+child :: IO ()
+child = do
+  threadDelay 200000
+  _ <- forkIO $ forever $ do
+    r <- return $! spin 1000
+    when (r < 0) $ putStrLn "impossible"
+  yield
+  print (spin 100000)
+  hFlush stdout
+
+main :: IO ()
+main = do
+  hFlush stdout
+  pid <- forkProcess child
+  Just (Exited ExitSuccess) <- getProcessStatus True False pid
+  putStrLn "parent done"